@@ -40,6 +40,7 @@
 G_DEFINE_BOXED_TYPE (EggCounterArena, egg_counter_arena, egg_counter_arena_ref, egg_counter_arena_unref)
 
 #define MAX_COUNTERS       2000
+#define LOCAL_MAX_COUNTERS 512
 #define NAME_FORMAT        "/EggCounters-%u"
 #define MAGIC              0x71167125
 #define COUNTER_MAX_SHM    (1024 * 1024 * 4)
@@ -180,8 +181,18 @@ _egg_counter_arena_init_local (EggCounterArena *arena)
    * We have some very tricky work ahead of us to add unlimited numbers
    * of counters at runtime. We basically need to avoid placing counters
    * that could overlap a page.
+   *
+   * Until then, reserve room for LOCAL_MAX_COUNTERS counters, which grows
+   * with the number of CPUs. Since counters may also be registered at
+   * runtime (such as per-cache counters), a fixed number of pages is not
+   * enough on machines with many CPUs. Pages we never touch are not backed
+   * by memory, so this is cheap.
    */
-  size = page_size * 4;
+  size = DATA_CELL_SIZE *
+         (CELLS_PER_HEADER +
+          (CELLS_PER_GROUP (g_get_num_processors ()) * (LOCAL_MAX_COUNTERS / COUNTERS_PER_GROUP)));
+  size = MAX (size, page_size * 4);
+  size = (size + page_size - 1) / page_size * page_size;
 
   arena->ref_count = 1;
   arena->is_local_arena = TRUE;
@@ -381,9 +392,22 @@ egg_counter_arena_new_for_pid (GPid pid)
       return NULL;
     }
 
+  arena->arena_is_malloced = TRUE;
+
   return arena;
 }
 
+static void
+_egg_counter_free_remote (gpointer data)
+{
+  EggCounter *counter = data;
+
+  g_free ((gchar *)counter->category);
+  g_free ((gchar *)counter->name);
+  g_free ((gchar *)counter->description);
+  g_free (counter);
+}
+
 static void
 _egg_counter_arena_destroy (EggCounterArena *arena)
 {
@@ -394,8 +418,17 @@ _egg_counter_arena_destroy (EggCounterArena *arena)
   else
     g_free (arena->cells);
 
-  g_clear_pointer (&arena->counters, g_list_free);
+  /*
+   * Counters discovered in a remote arena were allocated by us while
+   * walking the shm segment, so we own them. Local counters are owned
+   * by whoever registered them.
+   */
+  if (!arena->is_local_arena)
+    g_list_free_full (arena->counters, _egg_counter_free_remote);
+  else
+    g_list_free (arena->counters);
 
+  arena->counters = NULL;
   arena->cells = NULL;
 
   if (arena->arena_is_malloced)
@@ -460,6 +493,270 @@ egg_counter_arena_foreach (EggCounterArena       *arena,
     func (iter->data, user_data);
 }
 
+/**
+ * egg_counter_new: (skip)
+ * @category: the category of the counter
+ * @name: the name of the counter
+ * @description: the description of the counter
+ *
+ * Creates a new counter at runtime and registers it with the default arena.
+ * This is useful when the counters are not known at compile time, such as
+ * one counter per instance of a named object.
+ *
+ * Since counters cannot be removed once registered, the resulting counter
+ * is never freed. Callers should create at most one counter per name.
+ *
+ * Use egg_counter_add() to modify the counter.
+ *
+ * Returns: (transfer none): An #EggCounter.
+ */
+EggCounter *
+egg_counter_new (const gchar *category,
+                 const gchar *name,
+                 const gchar *description)
+{
+  EggCounter *counter;
+
+  g_return_val_if_fail (category != NULL, NULL);
+  g_return_val_if_fail (name != NULL, NULL);
+
+  counter = g_new0 (EggCounter, 1);
+  counter->category = g_intern_string (category);
+  counter->name = g_strdup (name);
+  counter->description = g_strdup (description ?: "");
+
+  egg_counter_arena_register (egg_counter_arena_get_default (), counter);
+
+  return counter;
+}
+
+/**
+ * egg_histogram_bucket_lower_bound:
+ * @bucket: the index of a bucket, less than %EGG_HISTOGRAM_N_BUCKETS
+ *
+ * Gets the smallest value that is recorded in @bucket.
+ *
+ * Returns: the lower bound of @bucket.
+ */
+gint64
+egg_histogram_bucket_lower_bound (guint bucket)
+{
+  guint shift;
+
+  if (bucket == 0)
+    return 0;
+
+  if (bucket >= EGG_HISTOGRAM_N_BUCKETS - 1)
+    return G_GINT64_CONSTANT (1) << (EGG_HISTOGRAM_MAX_SHIFT + 1);
+
+  shift = EGG_HISTOGRAM_MIN_SHIFT + ((bucket - 1) / 2);
+
+  return (G_GINT64_CONSTANT (1) << shift) +
+         (((bucket - 1) % 2) * (G_GINT64_CONSTANT (1) << (shift - 1)));
+}
+
+/**
+ * egg_histogram_percentile:
+ * @buckets: (array fixed-size=32): bucket counts of a histogram
+ * @percentile: the percentile, between 0 and 100
+ *
+ * Estimates the value below which @percentile percent of the recorded
+ * values fall. Since we only know which bucket a value landed in, this
+ * is the upper bound of that bucket (or the lower bound of the last
+ * bucket, which is unbounded).
+ *
+ * Returns: the estimated value, or 0 if nothing was recorded.
+ */
+gint64
+egg_histogram_percentile (const gint64 *buckets,
+                          gdouble       percentile)
+{
+  gint64 total = 0;
+  gint64 seen = 0;
+  gint64 target;
+  guint i;
+
+  g_return_val_if_fail (buckets != NULL, 0);
+
+  for (i = 0; i < EGG_HISTOGRAM_N_BUCKETS; i++)
+    total += buckets [i];
+
+  if (total <= 0)
+    return 0;
+
+  target = MAX (1, (gint64)(total * CLAMP (percentile, 0.0, 100.0) / 100.0 + 0.5));
+
+  for (i = 0; i < EGG_HISTOGRAM_N_BUCKETS - 1; i++)
+    {
+      seen += buckets [i];
+
+      if (seen >= target)
+        return egg_histogram_bucket_lower_bound (i + 1);
+    }
+
+  return egg_histogram_bucket_lower_bound (EGG_HISTOGRAM_N_BUCKETS - 1);
+}
+
+/**
+ * egg_histogram_register: (skip)
+ * @arena: An #EggCounterArena
+ * @histogram: An #EggHistogram
+ *
+ * Registers the counters backing @histogram in @arena. You usually want
+ * EGG_DEFINE_HISTOGRAM() instead of calling this directly.
+ */
+void
+egg_histogram_register (EggCounterArena *arena,
+                        EggHistogram    *histogram)
+{
+  guint i;
+
+  g_return_if_fail (arena != NULL);
+  g_return_if_fail (histogram != NULL);
+  g_return_if_fail (histogram->name != NULL);
+
+  for (i = 0; i < EGG_HISTOGRAM_N_BUCKETS; i++)
+    {
+      EggCounter *bucket = &histogram->buckets [i];
+
+      bucket->category = histogram->category;
+      bucket->name = g_strdup_printf ("%s@%"G_GINT64_FORMAT,
+                                      histogram->name,
+                                      egg_histogram_bucket_lower_bound (i));
+      bucket->description = histogram->description;
+
+      egg_counter_arena_register (arena, bucket);
+    }
+
+  histogram->sum.category = histogram->category;
+  histogram->sum.name = g_strdup_printf ("%s@sum", histogram->name);
+  histogram->sum.description = histogram->description;
+
+  egg_counter_arena_register (arena, &histogram->sum);
+}
+
+/**
+ * egg_counter_is_histogram:
+ * @counter: An #EggCounter
+ *
+ * Checks if @counter is one of the counters backing an #EggHistogram,
+ * in which case it is more useful to read it with
+ * egg_counter_arena_foreach_histogram().
+ *
+ * Returns: %TRUE if @counter belongs to a histogram.
+ */
+gboolean
+egg_counter_is_histogram (EggCounter *counter)
+{
+  g_return_val_if_fail (counter != NULL, FALSE);
+
+  return counter->name != NULL && strchr (counter->name, '@') != NULL;
+}
+
+typedef struct
+{
+  gchar  *category;
+  gchar  *name;
+  gint64  sum;
+  gint64  buckets [EGG_HISTOGRAM_N_BUCKETS];
+} HistogramSnapshot;
+
+static void
+histogram_snapshot_free (gpointer data)
+{
+  HistogramSnapshot *snapshot = data;
+
+  g_free (snapshot->category);
+  g_free (snapshot->name);
+  g_slice_free (HistogramSnapshot, snapshot);
+}
+
+static gint
+histogram_snapshot_compare (gconstpointer a,
+                            gconstpointer b)
+{
+  const HistogramSnapshot *sa = *(const HistogramSnapshot * const *)a;
+  const HistogramSnapshot *sb = *(const HistogramSnapshot * const *)b;
+  gint ret;
+
+  if (0 == (ret = g_strcmp0 (sa->category, sb->category)))
+    ret = g_strcmp0 (sa->name, sb->name);
+
+  return ret;
+}
+
+/**
+ * egg_counter_arena_foreach_histogram:
+ * @arena: An #EggCounterArena
+ * @func: (scope call): A callback to execute
+ * @user_data: user data for @func
+ *
+ * Calls @func for every histogram found in @arena, after merging the
+ * per-CPU values of each bucket. This works for both local and remote
+ * arenas, and does not block the process owning the arena.
+ */
+void
+egg_counter_arena_foreach_histogram (EggCounterArena         *arena,
+                                     EggHistogramForeachFunc  func,
+                                     gpointer                 user_data)
+{
+  g_autoptr(GHashTable) lookup = NULL;
+  g_autoptr(GPtrArray) snapshots = NULL;
+  GList *iter;
+  guint i;
+
+  g_return_if_fail (arena != NULL);
+  g_return_if_fail (func != NULL);
+
+  lookup = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  snapshots = g_ptr_array_new_with_free_func (histogram_snapshot_free);
+
+  for (iter = arena->counters; iter; iter = iter->next)
+    {
+      EggCounter *counter = iter->data;
+      HistogramSnapshot *snapshot;
+      const gchar *suffix;
+      gchar *key;
+
+      if (!egg_counter_is_histogram (counter))
+        continue;
+
+      suffix = strrchr (counter->name, '@');
+      key = g_strdup_printf ("%s\x1f%.*s",
+                             counter->category,
+                             (gint)(suffix - counter->name),
+                             counter->name);
+
+      if (NULL == (snapshot = g_hash_table_lookup (lookup, key)))
+        {
+          snapshot = g_slice_new0 (HistogramSnapshot);
+          snapshot->category = g_strdup (counter->category);
+          snapshot->name = g_strndup (counter->name, suffix - counter->name);
+          g_ptr_array_add (snapshots, snapshot);
+          g_hash_table_insert (lookup, key, snapshot);
+        }
+      else
+        g_free (key);
+
+      suffix++;
+
+      if (g_str_equal (suffix, "sum"))
+        snapshot->sum = egg_counter_get (counter);
+      else
+        snapshot->buckets [egg_histogram_get_bucket (g_ascii_strtoll (suffix, NULL, 10))] =
+          egg_counter_get (counter);
+    }
+
+  g_ptr_array_sort (snapshots, histogram_snapshot_compare);
+
+  for (i = 0; i < snapshots->len; i++)
+    {
+      HistogramSnapshot *snapshot = g_ptr_array_index (snapshots, i);
+
+      func (snapshot->category, snapshot->name, snapshot->buckets, snapshot->sum, user_data);
+    }
+}
+
 void
 egg_counter_arena_register (EggCounterArena *arena,
                             EggCounter      *counter)
@@ -496,7 +793,29 @@ egg_counter_arena_register (EggCounterArena *arena,
   info = &((CounterInfo *)&arena->cells [group_start_cell])[position];
 
   g_assert (position < COUNTERS_PER_GROUP);
-  g_assert (group_start_cell < arena->n_cells);
+
+  /*
+   * If we have run out of room in the arena, give the counter private
+   * storage so that it still works locally, even though it will not be
+   * visible to external processes.
+   */
+  if (group_start_cell + CELLS_PER_GROUP (ncpu) > arena->n_cells)
+    {
+      static gboolean warned;
+
+      if (!warned)
+        {
+          g_warning ("Counter arena is full, %s:%s will not be shared.",
+                     counter->category, counter->name);
+          warned = TRUE;
+        }
+
+      counter->values = g_new0 (EggCounterValue, ncpu);
+
+      G_UNLOCK (reglock);
+
+      return;
+    }
 
   /*
    * Store information about the counter in the SHM area. Also, update
@@ -77,6 +77,27 @@
  * EggCounterArena provides a helper to walk through the counters in the
  * shared memory zone. egg_counter_arena_foreach().
  *
+ *
+ * Using EggHistogram
+ * ==================
+ *
+ * Counters are great for totals, but not for timing data where the
+ * distribution matters more than the sum. EggHistogram records values
+ * (typically durations in microseconds) into log-linear buckets.
+ *
+ *   EGG_DEFINE_HISTOGRAM (Symbol, "Category", "Name", "Description")
+ *
+ *   gint64 begin = g_get_monotonic_time ();
+ *   ...
+ *   EGG_HISTOGRAM_RECORD_SINCE (Symbol, begin);
+ *
+ * Each bucket is a regular counter in the arena, so recording is a single
+ * lock-free per-CPU increment and external processes can read histograms
+ * without any changes to the shared memory layout. Bucket counters are
+ * named "Name@LowerBound", plus a "Name@sum" counter with the sum of all
+ * recorded values. Use egg_counter_arena_foreach_histogram() to read them
+ * back merged into a single histogram.
+ *
  * You cannot remove a counter once it has been registered.
  *
  *
@@ -244,6 +265,16 @@ G_BEGIN_DECLS
 typedef struct _EggCounter      EggCounter;
 typedef struct _EggCounterArena EggCounterArena;
 typedef struct _EggCounterValue EggCounterValue;
+typedef struct _EggHistogram    EggHistogram;
+
+/*
+ * Buckets are log-linear. Values below 64 go into the first bucket, values
+ * of 2^21 (about 2 seconds when recording usec) and above go into the last
+ * bucket, and each power of two in between is split into two buckets.
+ */
+#define EGG_HISTOGRAM_N_BUCKETS  32
+#define EGG_HISTOGRAM_MIN_SHIFT  6
+#define EGG_HISTOGRAM_MAX_SHIFT  20
 
 /**
  * EggCounterForeachFunc:
@@ -270,6 +301,33 @@ struct _EggCounterValue
   gint64          padding [7];
 } __attribute__ ((aligned(8)));
 
+struct _EggHistogram
+{
+  /*< Private >*/
+  const gchar *category;
+  const gchar *name;
+  const gchar *description;
+  EggCounter   sum;
+  EggCounter   buckets [EGG_HISTOGRAM_N_BUCKETS];
+};
+
+/**
+ * EggHistogramForeachFunc:
+ * @category: the category of the histogram.
+ * @name: the name of the histogram.
+ * @buckets: (array fixed-size=32): the count of values in each bucket.
+ * @sum: the sum of all recorded values.
+ * @user_data: data supplied to egg_counter_arena_foreach_histogram().
+ *
+ * Function prototype for callbacks provided to
+ * egg_counter_arena_foreach_histogram().
+ */
+typedef void (*EggHistogramForeachFunc) (const gchar  *category,
+                                         const gchar  *name,
+                                         const gint64 *buckets,
+                                         gint64        sum,
+                                         gpointer      user_data);
+
 GType            egg_counter_arena_get_type     (void);
 guint            egg_get_current_cpu_call       (void);
 EggCounterArena *egg_counter_arena_get_default  (void);
@@ -281,9 +339,116 @@ void             egg_counter_arena_register     (EggCounterArena       *arena,
 void             egg_counter_arena_foreach      (EggCounterArena       *arena,
                                                  EggCounterForeachFunc  func,
                                                  gpointer               user_data);
+EggCounter      *egg_counter_new                (const gchar           *category,
+                                                 const gchar           *name,
+                                                 const gchar           *description);
+gboolean         egg_counter_is_histogram       (EggCounter            *counter);
+void             egg_counter_arena_foreach_histogram
+                                                (EggCounterArena       *arena,
+                                                 EggHistogramForeachFunc func,
+                                                 gpointer               user_data);
+void             egg_histogram_register         (EggCounterArena       *arena,
+                                                 EggHistogram          *histogram);
+gint64           egg_histogram_bucket_lower_bound
+                                                (guint                  bucket);
+gint64           egg_histogram_percentile       (const gint64          *buckets,
+                                                 gdouble                percentile);
 void             egg_counter_reset              (EggCounter            *counter);
 gint64           egg_counter_get                (EggCounter            *counter);
 
+/**
+ * egg_counter_add:
+ * @counter: An #EggCounter
+ * @count: the amount to add to the counter.
+ *
+ * Like EGG_COUNTER_ADD(), but for counters created at runtime with
+ * egg_counter_new().
+ */
+static inline void
+egg_counter_add (EggCounter *counter,
+                 gint64      count)
+{
+#ifdef EGG_COUNTER_REQUIRES_ATOMIC
+  __sync_add_and_fetch ((gint64 *)&counter->values[0], count);
+#else
+  counter->values[egg_get_current_cpu()].value += count;
+#endif
+}
+
+static inline guint
+egg_histogram_get_bucket (gint64 value)
+{
+  guint shift;
+
+  if (value < (G_GINT64_CONSTANT (1) << EGG_HISTOGRAM_MIN_SHIFT))
+    return 0;
+
+  shift = g_bit_storage ((guint64)value) - 1;
+
+  if (shift > EGG_HISTOGRAM_MAX_SHIFT)
+    return EGG_HISTOGRAM_N_BUCKETS - 1;
+
+  /* The bit after the leading bit selects the upper or lower half. */
+  return 1 + ((shift - EGG_HISTOGRAM_MIN_SHIFT) * 2) + ((value >> (shift - 1)) & 1);
+}
+
+/**
+ * egg_histogram_record:
+ * @histogram: An #EggHistogram
+ * @value: the value to record, such as a duration in microseconds.
+ *
+ * Records @value in the histogram. This is lock-free and as cheap as
+ * incrementing two counters.
+ */
+static inline void
+egg_histogram_record (EggHistogram *histogram,
+                      gint64        value)
+{
+  egg_counter_add (&histogram->buckets [egg_histogram_get_bucket (value)], 1);
+  egg_counter_add (&histogram->sum, value);
+}
+
+/**
+ * EGG_DEFINE_HISTOGRAM:
+ * @Identifier: The symbol name of the histogram
+ * @Category: A string category for the histogram.
+ * @Name: A string name for the histogram, of at most 23 characters.
+ * @Description: A string description for the histogram.
+ *
+ * |[<!-- language="C" -->
+ * EGG_DEFINE_HISTOGRAM (my_histogram, "My", "Latency", "My Latency in usec");
+ * ]|
+ */
+#define EGG_DEFINE_HISTOGRAM(Identifier, Category, Name, Description)                    \
+ static EggHistogram Identifier##_hist = { Category, Name, Description };                \
+ static void Identifier##_hist_init (void) __attribute__((constructor));                 \
+ static void                                                                             \
+ Identifier##_hist_init (void)                                                           \
+ {                                                                                       \
+   egg_histogram_register (egg_counter_arena_get_default(), &Identifier##_hist);         \
+ }
+
+/**
+ * EGG_HISTOGRAM_RECORD_USEC:
+ * @Identifier: The identifier of the histogram.
+ * @Usec: the duration to record, in microseconds.
+ *
+ * Records @Usec in the histogram @Identifier.
+ */
+#define EGG_HISTOGRAM_RECORD_USEC(Identifier, Usec) \
+  egg_histogram_record (&Identifier##_hist, (gint64)(Usec))
+
+/**
+ * EGG_HISTOGRAM_RECORD_SINCE:
+ * @Identifier: The identifier of the histogram.
+ * @BeginTime: a time from g_get_monotonic_time().
+ *
+ * Records the number of microseconds elapsed since @BeginTime in the
+ * histogram @Identifier.
+ */
+#define EGG_HISTOGRAM_RECORD_SINCE(Identifier, BeginTime) \
+  EGG_HISTOGRAM_RECORD_USEC(Identifier, g_get_monotonic_time () - (BeginTime))
+
 G_END_DECLS
 
 #endif /* EGG_COUNTER_H */
@@ -31,6 +31,11 @@
  * array. They allow for efficient O(1) lookup of the highest priority
  * item as it will always be the first item of the array.
  *
+ * #EggHeap is a 4-ary heap, meaning each node has up to four children.
+ * This makes the tree half as deep as a binary heap, and the children of
+ * a node are adjacent in memory, which is friendlier to the CPU cache when
+ * sifting items down the heap.
+ *
  * To create a new heap use egg_heap_new().
  *
  * To add items to the heap, use egg_heap_insert_val() or
@@ -40,6 +45,12 @@
  *
  * To remove an arbitrary item from the heap, use egg_heap_extract_index().
  *
+ * If you need to change the priority of an item after it has been inserted,
+ * insert it with egg_heap_insert_with_handle(). The resulting handle stays
+ * valid while the item moves around within the heap, and can be used with
+ * egg_heap_increase_key(), egg_heap_decrease_key() and egg_heap_remove() in
+ * O(log n).
+ *
  * To remove the highest priority item in the heap, use egg_heap_extract().
  *
  * To free a heap, use egg_heap_unref().
@@ -78,6 +89,11 @@
 /*
  * Based upon Mastering Algorithms in C by Kyle Loudon.
  * Section 10 - Heaps and Priority Queues.
+ *
+ * Extended to a d-ary heap (d = 4) with optional stable handles. When the
+ * first handle is requested, we start tracking the handle of the item at
+ * each position (0 for items without a handle) as well as the position of
+ * each handle, updating both whenever items are moved.
  */
 
 G_DEFINE_BOXED_TYPE (EggHeap, egg_heap, egg_heap_ref, egg_heap_unref)
@@ -92,20 +108,41 @@ struct _EggHeapReal
   guint           element_size;
   gsize           allocated_len;
   GCompareFunc    compare;
+  guint          *handles;
+  GArray         *positions;
+  GArray         *free_handles;
   gchar           tmp[0];
 };
 
-#define heap_parent(npos)   (((npos)-1)/2)
-#define heap_left(npos)     (((npos)*2)+1)
-#define heap_right(npos)    (((npos)*2)+2)
-#define heap_index(h,i)     ((h)->data + (i * (h)->element_size))
+#define HEAP_ARITY          4
+#define heap_parent(npos)   (((npos)-1)/HEAP_ARITY)
+#define heap_child(npos,n)  (((npos)*HEAP_ARITY)+1+(n))
+#define heap_index(h,i)     ((h)->data + ((i) * (h)->element_size))
 #define heap_compare(h,a,b) ((h)->compare(heap_index(h,a), heap_index(h,b)))
-#define heap_swap(h,a,b)                                                \
-  G_STMT_START {                                                        \
-      memcpy ((h)->tmp, heap_index (h, a), (h)->element_size);          \
-      memcpy (heap_index (h, a), heap_index (h, b), (h)->element_size); \
-      memcpy (heap_index (h, b), (h)->tmp, (h)->element_size);          \
- } G_STMT_END
+#define heap_position(h,hd) (g_array_index ((h)->positions, gsize, (hd) - 1))
+
+static inline void
+heap_swap (EggHeapReal *real,
+           gsize        a,
+           gsize        b)
+{
+  memcpy (real->tmp, heap_index (real, a), real->element_size);
+  memcpy (heap_index (real, a), heap_index (real, b), real->element_size);
+  memcpy (heap_index (real, b), real->tmp, real->element_size);
+
+  if (real->handles != NULL)
+    {
+      guint tmp = real->handles [a];
+
+      real->handles [a] = real->handles [b];
+      real->handles [b] = tmp;
+
+      if (real->handles [a])
+        heap_position (real, real->handles [a]) = a;
+      if (real->handles [b])
+        heap_position (real, real->handles [b]) = b;
+    }
+}
 
 /**
  * egg_heap_new:
@@ -135,6 +172,9 @@ egg_heap_new (guint        element_size,
     real->element_size = element_size;
     real->allocated_len = 0;
     real->compare = compare_func;
+    real->handles = NULL;
+    real->positions = NULL;
+    real->free_handles = NULL;
 
     return (EggHeap *)real;
 }
@@ -167,6 +207,9 @@ egg_heap_real_free (EggHeapReal *real)
   g_assert_cmpint (real->ref_count, ==, 0);
 
   g_free (real->data);
+  g_free (real->handles);
+  g_clear_pointer (&real->positions, g_array_unref);
+  g_clear_pointer (&real->free_handles, g_array_unref);
   g_free (real);
 }
 
@@ -199,6 +242,9 @@ egg_heap_real_grow (EggHeapReal *real)
   real->data = g_realloc_n (real->data,
                             real->allocated_len,
                             real->element_size);
+
+  if (real->handles != NULL)
+    real->handles = g_realloc_n (real->handles, real->allocated_len, sizeof (guint));
 }
 
 static void
@@ -211,15 +257,82 @@ egg_heap_real_shrink (EggHeapReal *real)
   real->data = g_realloc_n (real->data,
                             real->allocated_len,
                             real->element_size);
+
+  if (real->handles != NULL)
+    real->handles = g_realloc_n (real->handles, real->allocated_len, sizeof (guint));
+}
+
+static gsize
+egg_heap_real_sift_up (EggHeapReal *real,
+                       gsize        ipos)
+{
+  g_assert (real);
+  g_assert (ipos < real->len);
+
+  while (ipos > 0)
+    {
+      gsize ppos = heap_parent (ipos);
+
+      if (heap_compare (real, ppos, ipos) >= 0)
+        break;
+
+      heap_swap (real, ppos, ipos);
+      ipos = ppos;
+    }
+
+  return ipos;
+}
+
+static gsize
+egg_heap_real_sift_down (EggHeapReal *real,
+                         gsize        ipos)
+{
+  g_assert (real);
+
+  while (TRUE)
+    {
+      gsize first = heap_child (ipos, 0);
+      gsize mpos = ipos;
+      gsize i;
+
+      if (first >= real->len)
+        break;
+
+      for (i = first; i < first + HEAP_ARITY && i < real->len; i++)
+        {
+          if (heap_compare (real, i, mpos) > 0)
+            mpos = i;
+        }
+
+      if (mpos == ipos)
+        break;
+
+      heap_swap (real, mpos, ipos);
+
+      ipos = mpos;
+    }
+
+  return ipos;
 }
 
 static void
-egg_heap_real_insert_val (EggHeapReal   *real,
-                          gconstpointer  data)
+egg_heap_real_release_handle (EggHeapReal *real,
+                              gsize        pos)
 {
-  gint ipos;
-  gint ppos;
+  g_assert (real);
+
+  if (real->handles != NULL && real->handles [pos] != 0)
+    {
+      g_array_append_val (real->free_handles, real->handles [pos]);
+      real->handles [pos] = 0;
+    }
+}
 
+static void
+egg_heap_real_insert_val (EggHeapReal   *real,
+                          gconstpointer  data,
+                          guint          handle)
+{
   g_assert (real);
   g_assert (data);
 
@@ -230,17 +343,57 @@ egg_heap_real_insert_val (EggHeapReal   *real,
           data,
           real->element_size);
 
-  ipos = real->len;
-  ppos = heap_parent (ipos);
-
-  while ((ipos > 0) && (heap_compare (real, ppos, ipos) < 0))
+  if (real->handles != NULL)
     {
-      heap_swap (real, ppos, ipos);
-      ipos = ppos;
-      ppos = heap_parent (ipos);
+      real->handles [real->len] = handle;
+      if (handle != 0)
+        heap_position (real, handle) = real->len;
     }
 
   real->len++;
+
+  egg_heap_real_sift_up (real, real->len - 1);
+}
+
+/*
+ * Removes the item at @index_, moving the last item into its place and
+ * restoring the heap property in whichever direction is necessary.
+ */
+static void
+egg_heap_real_remove_index (EggHeapReal *real,
+                            gsize        index_,
+                            gpointer     result)
+{
+  g_assert (real);
+  g_assert (index_ < real->len);
+
+  if (result)
+    memcpy (result, heap_index (real, index_), real->element_size);
+
+  egg_heap_real_release_handle (real, index_);
+
+  real->len--;
+
+  if (real->len && index_ != real->len)
+    {
+      memcpy (heap_index (real, index_),
+              heap_index (real, real->len),
+              real->element_size);
+
+      if (real->handles != NULL)
+        {
+          real->handles [index_] = real->handles [real->len];
+          real->handles [real->len] = 0;
+          if (real->handles [index_])
+            heap_position (real, real->handles [index_]) = index_;
+        }
+
+      if (egg_heap_real_sift_up (real, index_) == index_)
+        egg_heap_real_sift_down (real, index_);
+    }
+
+  if ((real->len > MIN_HEAP_SIZE) && (real->allocated_len / 2) >= real->len)
+    egg_heap_real_shrink (real);
 }
 
 void
@@ -257,7 +410,7 @@ egg_heap_insert_vals (EggHeap       *heap,
   g_return_if_fail (len);
 
   for (i = 0; i < len; i++, ptr += real->element_size)
-    egg_heap_real_insert_val (real, ptr);
+    egg_heap_real_insert_val (real, ptr, 0);
 }
 
 gboolean
@@ -265,120 +418,208 @@ egg_heap_extract (EggHeap  *heap,
                   gpointer  result)
 {
   EggHeapReal *real = (EggHeapReal *)heap;
-  gint ipos;
-  gint lpos;
-  gint rpos;
-  gint mpos;
 
   g_return_val_if_fail (heap, FALSE);
 
   if (real->len == 0)
     return FALSE;
 
-  if (result)
-    memcpy (result, heap_index (real, 0), real->element_size);
+  egg_heap_real_remove_index (real, 0, result);
 
-  if (--real->len > 0)
-    {
-      memmove (real->data,
-               heap_index (real, real->len),
-               real->element_size);
+  return TRUE;
+}
 
-      ipos = 0;
+gboolean
+egg_heap_extract_index (EggHeap  *heap,
+                        guint     index_,
+                        gpointer  result)
+{
+  EggHeapReal *real = (EggHeapReal *)heap;
 
-      while (TRUE)
-        {
-          lpos = heap_left (ipos);
-          rpos = heap_right (ipos);
+  g_return_val_if_fail (heap, FALSE);
 
-          if ((lpos < real->len) && (heap_compare (real, lpos, ipos) > 0))
-            mpos = lpos;
-          else
-            mpos = ipos;
+  if (index_ >= real->len)
+    return FALSE;
 
-          if ((rpos < real->len) && (heap_compare (real, rpos, mpos) > 0))
-            mpos = rpos;
+  egg_heap_real_remove_index (real, index_, result);
 
-          if (mpos == ipos)
-            break;
+  return TRUE;
+}
 
-          heap_swap (real, mpos, ipos);
+/**
+ * egg_heap_insert_with_handle:
+ * @heap: An #EggHeap
+ * @data: the item to insert
+ *
+ * Inserts @data into the heap like egg_heap_insert_val(), but returns a
+ * handle that may be used to find, re-prioritize or remove the item later
+ * on, regardless of where the item has moved within the heap.
+ *
+ * The handle is valid until the item is removed from the heap, after which
+ * it may be reused for another item.
+ *
+ * Returns: a handle for the item, which is never zero.
+ */
+guint
+egg_heap_insert_with_handle (EggHeap       *heap,
+                             gconstpointer  data)
+{
+  EggHeapReal *real = (EggHeapReal *)heap;
+  guint handle;
 
-          ipos = mpos;
-        }
+  g_return_val_if_fail (heap, 0);
+  g_return_val_if_fail (data, 0);
+
+  if (real->handles == NULL)
+    {
+      real->handles = g_new0 (guint, MAX (real->allocated_len, 1));
+      real->positions = g_array_new (FALSE, FALSE, sizeof (gsize));
+      real->free_handles = g_array_new (FALSE, FALSE, sizeof (guint));
     }
 
-  if ((real->len > MIN_HEAP_SIZE) && (real->allocated_len / 2) >= real->len)
-    egg_heap_real_shrink (real);
+  if (real->free_handles->len > 0)
+    {
+      handle = g_array_index (real->free_handles, guint, real->free_handles->len - 1);
+      g_array_set_size (real->free_handles, real->free_handles->len - 1);
+    }
+  else
+    {
+      gsize unused = 0;
 
-  return TRUE;
+      g_array_append_val (real->positions, unused);
+      handle = real->positions->len;
+    }
+
+  egg_heap_real_insert_val (real, data, handle);
+
+  return handle;
+}
+
+static gboolean
+egg_heap_real_check_handle (EggHeapReal *real,
+                            guint        handle)
+{
+  gsize pos;
+
+  if (real->positions == NULL || handle == 0 || handle > real->positions->len)
+    return FALSE;
+
+  pos = heap_position (real, handle);
+
+  return pos < real->len && real->handles [pos] == handle;
 }
 
+/**
+ * egg_heap_lookup:
+ * @heap: An #EggHeap
+ * @handle: a handle from egg_heap_insert_with_handle()
+ *
+ * Gets a pointer to the item for @handle within the heap. The pointer is
+ * only valid until the heap is modified.
+ *
+ * Returns: (nullable): a pointer to the item, or %NULL if @handle is invalid.
+ */
+gpointer
+egg_heap_lookup (EggHeap *heap,
+                 guint    handle)
+{
+  EggHeapReal *real = (EggHeapReal *)heap;
+
+  g_return_val_if_fail (heap, NULL);
+
+  if (!egg_heap_real_check_handle (real, handle))
+    return NULL;
+
+  return heap_index (real, heap_position (real, handle));
+}
+
+/**
+ * egg_heap_remove:
+ * @heap: An #EggHeap
+ * @handle: a handle from egg_heap_insert_with_handle()
+ * @result: (out caller-allocates) (optional): a location for the item
+ *
+ * Removes the item for @handle from the heap in O(log n).
+ *
+ * Returns: %TRUE if the item was removed.
+ */
 gboolean
-egg_heap_extract_index (EggHeap  *heap,
-                        guint     index_,
-                        gpointer  result)
+egg_heap_remove (EggHeap  *heap,
+                 guint     handle,
+                 gpointer  result)
 {
   EggHeapReal *real = (EggHeapReal *)heap;
-  gint ipos;
-  gint lpos;
-  gint mpos;
-  gint ppos;
-  gint rpos;
 
   g_return_val_if_fail (heap, FALSE);
 
-  if (real->len == 0)
+  if (!egg_heap_real_check_handle (real, handle))
     return FALSE;
 
-  if (result)
-    memcpy (result, heap_index (real, index_), real->element_size);
-
-  real->len--;
+  egg_heap_real_remove_index (real, heap_position (real, handle), result);
 
-  if (real->len && index_ != real->len)
-    {
-      memcpy (heap_index (real, index_),
-              heap_index (real, real->len),
-              real->element_size);
+  return TRUE;
+}
 
-      ipos = index_;
-      ppos = heap_parent (ipos);
+/**
+ * egg_heap_increase_key:
+ * @heap: An #EggHeap
+ * @handle: a handle from egg_heap_insert_with_handle()
+ * @data: (nullable): the new value for the item, or %NULL
+ *
+ * Replaces the item for @handle with @data, which must compare greater
+ * than or equal to the previous value, moving it towards the head of the
+ * heap as necessary.
+ *
+ * If @data is %NULL, the item is expected to have been modified in place,
+ * such as when the heap contains pointers to structures.
+ */
+void
+egg_heap_increase_key (EggHeap       *heap,
+                       guint          handle,
+                       gconstpointer  data)
+{
+  EggHeapReal *real = (EggHeapReal *)heap;
+  gsize pos;
 
-      while (heap_compare (real, ipos, ppos) > 0)
-        {
-          heap_swap (real, ipos, ppos);
-          ipos = ppos;
-          ppos = heap_parent (ppos);
-        }
+  g_return_if_fail (heap);
+  g_return_if_fail (egg_heap_real_check_handle (real, handle));
 
-      if (ipos == index_)
-        {
-          while (TRUE)
-            {
-              lpos = heap_left (ipos);
-              rpos = heap_right (ipos);
+  pos = heap_position (real, handle);
 
-              if ((lpos < real->len) && (heap_compare (real, lpos, ipos) > 0))
-                mpos = lpos;
-              else
-                mpos = ipos;
+  if (data != NULL)
+    memcpy (heap_index (real, pos), data, real->element_size);
 
-              if ((rpos < real->len) && (heap_compare (real, rpos, mpos) > 0))
-                mpos = rpos;
+  egg_heap_real_sift_up (real, pos);
+}
 
-              if (mpos == ipos)
-                break;
+/**
+ * egg_heap_decrease_key:
+ * @heap: An #EggHeap
+ * @handle: a handle from egg_heap_insert_with_handle()
+ * @data: (nullable): the new value for the item, or %NULL
+ *
+ * Replaces the item for @handle with @data, which must compare less than
+ * or equal to the previous value, moving it away from the head of the heap
+ * as necessary.
+ *
+ * If @data is %NULL, the item is expected to have been modified in place,
+ * such as when the heap contains pointers to structures.
+ */
+void
+egg_heap_decrease_key (EggHeap       *heap,
+                       guint          handle,
+                       gconstpointer  data)
+{
+  EggHeapReal *real = (EggHeapReal *)heap;
+  gsize pos;
 
-              heap_swap (real, mpos, ipos);
+  g_return_if_fail (heap);
+  g_return_if_fail (egg_heap_real_check_handle (real, handle));
 
-              ipos = mpos;
-            }
-        }
-    }
+  pos = heap_position (real, handle);
 
-  if ((real->len > MIN_HEAP_SIZE) && (real->allocated_len / 2) >= real->len)
-    egg_heap_real_shrink (real);
+  if (data != NULL)
+    memcpy (heap_index (real, pos), data, real->element_size);
 
-  return TRUE;
+  egg_heap_real_sift_down (real, pos);
 }
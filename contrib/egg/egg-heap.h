@@ -49,6 +49,20 @@ gboolean   egg_heap_extract       (EggHeap        *heap,
 gboolean   egg_heap_extract_index (EggHeap        *heap,
                                    guint           index_,
                                    gpointer        result);
+guint      egg_heap_insert_with_handle
+                                  (EggHeap        *heap,
+                                   gconstpointer   data);
+gpointer   egg_heap_lookup        (EggHeap        *heap,
+                                   guint           handle);
+gboolean   egg_heap_remove        (EggHeap        *heap,
+                                   guint           handle,
+                                   gpointer        result);
+void       egg_heap_increase_key  (EggHeap        *heap,
+                                   guint           handle,
+                                   gconstpointer   data);
+void       egg_heap_decrease_key  (EggHeap        *heap,
+                                   guint           handle,
+                                   gconstpointer   data);
 
 G_END_DECLS
 
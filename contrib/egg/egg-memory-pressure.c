@@ -0,0 +1,356 @@
+/* egg-memory-pressure.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "egg-memory-pressure"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "egg-counter.h"
+#include "egg-memory-pressure.h"
+
+/*
+ * EggMemoryPressure watches the kernel for signs that the system is running
+ * low on memory and emits the "pressure" signal so that caches may release
+ * whatever they can rebuild later.
+ *
+ * On Linux we prefer a pressure stall information (PSI) trigger on
+ * /proc/pressure/memory, which wakes us up when tasks spent more than
+ * PSI_STALL_USEC stalled on memory within a PSI_WINDOW_USEC window. When PSI
+ * is not available, we fall back to watching the "high" and "max" counters
+ * of the cgroup v2 memory.events file for our cgroup.
+ *
+ * Notifications are rate limited to one per MIN_INTERVAL_USEC, since
+ * trimming caches again right away is unlikely to help.
+ */
+
+#define PSI_PATH          "/proc/pressure/memory"
+#define PSI_STALL_USEC    150000
+#define PSI_WINDOW_USEC   2000000
+#define MIN_INTERVAL_USEC (5 * G_USEC_PER_SEC)
+
+struct _EggMemoryPressure
+{
+  GObject       parent_instance;
+
+  GFileMonitor *events_monitor;
+  GFile        *events_file;
+  guint64       last_high;
+  guint64       last_max;
+
+  gint64        last_notify;
+
+  guint         psi_source;
+  gint          psi_fd;
+};
+
+G_DEFINE_TYPE (EggMemoryPressure, egg_memory_pressure, G_TYPE_OBJECT)
+
+EGG_DEFINE_COUNTER (pressure_events, "EggMemoryPressure", "Pressure Events", "Number of times memory pressure was signaled")
+
+enum {
+  PRESSURE,
+  N_SIGNALS
+};
+
+static guint signals [N_SIGNALS];
+
+#ifdef __linux__
+static gboolean
+egg_memory_pressure_psi_cb (gint         fd,
+                            GIOCondition condition,
+                            gpointer     user_data)
+{
+  EggMemoryPressure *self = user_data;
+
+  g_assert (EGG_IS_MEMORY_PRESSURE (self));
+
+  if ((condition & G_IO_ERR) != 0)
+    {
+      /* The monitor was destroyed, such as when our cgroup went away. */
+      self->psi_source = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  egg_memory_pressure_notify (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+egg_memory_pressure_init_psi (EggMemoryPressure *self)
+{
+  g_autofree gchar *trigger = NULL;
+  gint fd;
+
+  g_assert (EGG_IS_MEMORY_PRESSURE (self));
+
+  if (-1 == (fd = open (PSI_PATH, O_RDWR | O_NONBLOCK | O_CLOEXEC)))
+    return FALSE;
+
+  /* The trigger must include the trailing \0. */
+  trigger = g_strdup_printf ("some %u %u", PSI_STALL_USEC, PSI_WINDOW_USEC);
+
+  if (write (fd, trigger, strlen (trigger) + 1) < 0)
+    {
+      g_debug ("Failed to register PSI trigger: %s", g_strerror (errno));
+      close (fd);
+      return FALSE;
+    }
+
+  self->psi_fd = fd;
+  self->psi_source = g_unix_fd_add (fd, G_IO_PRI | G_IO_ERR, egg_memory_pressure_psi_cb, self);
+
+  return TRUE;
+}
+
+static gboolean
+egg_memory_pressure_read_events (EggMemoryPressure *self,
+                                 guint64           *high,
+                                 guint64           *max)
+{
+  g_autofree gchar *contents = NULL;
+  g_auto(GStrv) lines = NULL;
+
+  g_assert (EGG_IS_MEMORY_PRESSURE (self));
+
+  *high = 0;
+  *max = 0;
+
+  if (!g_file_load_contents (self->events_file, NULL, &contents, NULL, NULL, NULL))
+    return FALSE;
+
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (guint i = 0; lines [i] != NULL; i++)
+    {
+      if (g_str_has_prefix (lines [i], "high "))
+        *high = g_ascii_strtoull (lines [i] + 5, NULL, 10);
+      else if (g_str_has_prefix (lines [i], "max "))
+        *max = g_ascii_strtoull (lines [i] + 4, NULL, 10);
+    }
+
+  return TRUE;
+}
+
+static void
+egg_memory_pressure_events_changed (EggMemoryPressure *self,
+                                    GFile             *file,
+                                    GFile             *other_file,
+                                    GFileMonitorEvent  event,
+                                    GFileMonitor      *monitor)
+{
+  guint64 high;
+  guint64 max;
+
+  g_assert (EGG_IS_MEMORY_PRESSURE (self));
+
+  if (event != G_FILE_MONITOR_EVENT_CHANGED &&
+      event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+    return;
+
+  if (!egg_memory_pressure_read_events (self, &high, &max))
+    return;
+
+  /*
+   * "high" increments each time we were throttled for going over our
+   * soft limit, "max" each time we were about to hit the hard limit.
+   */
+  if (high > self->last_high || max > self->last_max)
+    egg_memory_pressure_notify (self);
+
+  self->last_high = high;
+  self->last_max = max;
+}
+
+static gboolean
+egg_memory_pressure_init_cgroup (EggMemoryPressure *self)
+{
+  g_autofree gchar *contents = NULL;
+  g_autofree gchar *path = NULL;
+  g_auto(GStrv) lines = NULL;
+
+  g_assert (EGG_IS_MEMORY_PRESSURE (self));
+
+  if (!g_file_get_contents ("/proc/self/cgroup", &contents, NULL, NULL))
+    return FALSE;
+
+  /* The unified (v2) hierarchy is the entry with an id of 0. */
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (guint i = 0; lines [i] != NULL; i++)
+    {
+      if (g_str_has_prefix (lines [i], "0::"))
+        {
+          path = g_build_filename ("/sys/fs/cgroup", lines [i] + 3, "memory.events", NULL);
+          break;
+        }
+    }
+
+  if (path == NULL || !g_file_test (path, G_FILE_TEST_EXISTS))
+    return FALSE;
+
+  self->events_file = g_file_new_for_path (path);
+  self->events_monitor = g_file_monitor_file (self->events_file, G_FILE_MONITOR_NONE, NULL, NULL);
+
+  if (self->events_monitor == NULL)
+    {
+      g_clear_object (&self->events_file);
+      return FALSE;
+    }
+
+  egg_memory_pressure_read_events (self, &self->last_high, &self->last_max);
+
+  g_signal_connect_object (self->events_monitor,
+                           "changed",
+                           G_CALLBACK (egg_memory_pressure_events_changed),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  return TRUE;
+}
+#endif
+
+static void
+egg_memory_pressure_finalize (GObject *object)
+{
+  EggMemoryPressure *self = (EggMemoryPressure *)object;
+
+  if (self->psi_source != 0)
+    {
+      g_source_remove (self->psi_source);
+      self->psi_source = 0;
+    }
+
+  if (self->psi_fd != -1)
+    {
+      close (self->psi_fd);
+      self->psi_fd = -1;
+    }
+
+  if (self->events_monitor != NULL)
+    g_file_monitor_cancel (self->events_monitor);
+
+  g_clear_object (&self->events_monitor);
+  g_clear_object (&self->events_file);
+
+  G_OBJECT_CLASS (egg_memory_pressure_parent_class)->finalize (object);
+}
+
+static void
+egg_memory_pressure_class_init (EggMemoryPressureClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = egg_memory_pressure_finalize;
+
+  /**
+   * EggMemoryPressure::pressure:
+   *
+   * This signal is emitted when the system is under memory pressure.
+   * Handlers should release any memory that can be recreated later.
+   */
+  signals [PRESSURE] =
+    g_signal_new ("pressure",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 0);
+}
+
+static void
+egg_memory_pressure_init (EggMemoryPressure *self)
+{
+  self->psi_fd = -1;
+
+#ifdef __linux__
+  if (!egg_memory_pressure_init_psi (self) &&
+      !egg_memory_pressure_init_cgroup (self))
+    g_debug ("No memory pressure notifications available");
+#endif
+}
+
+/**
+ * egg_memory_pressure_get_default:
+ *
+ * Gets the shared #EggMemoryPressure instance. This must be called from
+ * the main thread, as notifications are dispatched from the default main
+ * context.
+ *
+ * Returns: (transfer none): An #EggMemoryPressure.
+ */
+EggMemoryPressure *
+egg_memory_pressure_get_default (void)
+{
+  static EggMemoryPressure *instance;
+
+  if (g_once_init_enter (&instance))
+    g_once_init_leave (&instance, g_object_new (EGG_TYPE_MEMORY_PRESSURE, NULL));
+
+  return instance;
+}
+
+/**
+ * egg_memory_pressure_is_enabled:
+ * @self: An #EggMemoryPressure
+ *
+ * Checks if the system provides memory pressure notifications.
+ *
+ * Returns: %TRUE if the "pressure" signal may be emitted by the system.
+ */
+gboolean
+egg_memory_pressure_is_enabled (EggMemoryPressure *self)
+{
+  g_return_val_if_fail (EGG_IS_MEMORY_PRESSURE (self), FALSE);
+
+  return self->psi_source != 0 || self->events_monitor != NULL;
+}
+
+/**
+ * egg_memory_pressure_notify:
+ * @self: An #EggMemoryPressure
+ *
+ * Emits the "pressure" signal, unless it was emitted very recently.
+ *
+ * This is used when the system notifies us of memory pressure, but may
+ * also be called by the application, such as when it knows it is about
+ * to allocate a large amount of memory.
+ */
+void
+egg_memory_pressure_notify (EggMemoryPressure *self)
+{
+  gint64 now;
+
+  g_return_if_fail (EGG_IS_MEMORY_PRESSURE (self));
+
+  now = g_get_monotonic_time ();
+
+  if (self->last_notify != 0 && (now - self->last_notify) < MIN_INTERVAL_USEC)
+    return;
+
+  self->last_notify = now;
+
+  EGG_COUNTER_INC (pressure_events);
+
+  g_debug ("Memory pressure detected, asking caches to trim");
+
+  g_signal_emit (self, signals [PRESSURE], 0);
+}
@@ -0,0 +1,36 @@
+/* egg-memory-pressure.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EGG_MEMORY_PRESSURE_H
+#define EGG_MEMORY_PRESSURE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define EGG_TYPE_MEMORY_PRESSURE (egg_memory_pressure_get_type())
+
+G_DECLARE_FINAL_TYPE (EggMemoryPressure, egg_memory_pressure, EGG, MEMORY_PRESSURE, GObject)
+
+EggMemoryPressure *egg_memory_pressure_get_default (void);
+gboolean           egg_memory_pressure_is_enabled  (EggMemoryPressure *self);
+void               egg_memory_pressure_notify      (EggMemoryPressure *self);
+
+G_END_DECLS
+
+#endif /* EGG_MEMORY_PRESSURE_H */
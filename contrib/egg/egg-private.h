@@ -26,6 +26,7 @@ G_BEGIN_DECLS
 #include "egg-counter.h"
 #include "egg-frame-source.h"
 #include "egg-heap.h"
+#include "egg-memory-pressure.h"
 #include "egg-search-bar.h"
 #include "egg-settings-sandwich.h"
 #include "egg-signal-group.h"
@@ -22,6 +22,7 @@
 
 #include "egg-counter.h"
 #include "egg-heap.h"
+#include "egg-memory-pressure.h"
 #include "egg-task-cache.h"
 
 typedef struct
@@ -30,6 +31,10 @@ typedef struct
   gpointer      key;
   gpointer      value;
   gint64        evict_at;
+  gint64        last_access;
+  gsize         cost;
+  guint         n_accesses;
+  guint         heap_handle;
 } CacheItem;
 
 typedef struct
@@ -38,6 +43,23 @@ typedef struct
   EggHeap *heap;
 } EvictSource;
 
+/*
+ * Counters registered for each named cache. Instances sharing a name share
+ * the same counters, since counters cannot be unregistered. The category is
+ * "TaskCache/<Metric>" and the counter name is the name of the cache, which
+ * allows tools/ide-list-counters to group them per cache. Categories are
+ * truncated to 19 characters in the counter arena, so keep metrics short.
+ */
+typedef struct
+{
+  EggCounter *hits;
+  EggCounter *misses;
+  EggCounter *coalesced;
+  EggCounter *populate_usec;
+  EggCounter *evictions;
+  EggCounter *bytes;
+} CacheCounters;
+
 struct _EggTaskCache
 {
   GObject               parent_instance;
@@ -56,8 +78,18 @@ struct _EggTaskCache
   GHashTable           *cache;
   GHashTable           *in_flight;
   GHashTable           *queued;
+  GHashTable           *pinned;
+
+  EggTaskCacheCostFunc  cost_func;
+  gpointer              cost_func_data;
+  GDestroyNotify        cost_func_data_destroy;
+  gsize                 cost;
+  gsize                 max_cost;
+
+  EggTaskCacheEvictPolicy evict_policy;
 
   gchar                *name;
+  CacheCounters        *counters;
 
   EggHeap              *evict_heap;
   GSource              *evict_source;
@@ -74,6 +106,18 @@ EGG_DEFINE_COUNTER (queued,     "EggTaskCache", "Queued",     "Number of queued
 EGG_DEFINE_COUNTER (cached,     "EggTaskCache", "Cache Size", "Number of cached items")
 EGG_DEFINE_COUNTER (hits,       "EggTaskCache", "Cache Hits", "Number of cache hits")
 EGG_DEFINE_COUNTER (misses,     "EggTaskCache", "Cache Miss", "Number of cache misses")
+EGG_DEFINE_COUNTER (cost,       "EggTaskCache", "Cache Cost", "Combined cost of cached items, usually in bytes")
+EGG_DEFINE_COUNTER (evictions,  "EggTaskCache", "Evictions",  "Number of items evicted due to age or cost")
+
+#define CACHE_COUNTER_ADD(self, Counter, Count)             \
+  G_STMT_START {                                            \
+    if ((self)->counters != NULL)                           \
+      egg_counter_add ((self)->counters->Counter, (Count)); \
+  } G_STMT_END
+#define CACHE_COUNTER_INC(self, Counter) CACHE_COUNTER_ADD(self, Counter, 1)
+
+G_LOCK_DEFINE_STATIC (cache_counters);
+static GHashTable *cache_counters;
 
 enum {
   PROP_0,
@@ -173,10 +217,46 @@ cache_item_free (gpointer data)
   item->self->value_destroy_func (item->value);
   item->self = NULL;
   item->evict_at = 0;
+  item->cost = 0;
 
   g_slice_free (CacheItem, item);
 }
 
+static CacheCounters *
+cache_counters_get (const gchar *name)
+{
+  CacheCounters *counters;
+
+  g_assert (name != NULL);
+
+  G_LOCK (cache_counters);
+
+  if (cache_counters == NULL)
+    cache_counters = g_hash_table_new (g_str_hash, g_str_equal);
+
+  if (NULL == (counters = g_hash_table_lookup (cache_counters, name)))
+    {
+      counters = g_new0 (CacheCounters, 1);
+      counters->hits = egg_counter_new ("TaskCache/Hits", name,
+                                        "Number of cache hits");
+      counters->misses = egg_counter_new ("TaskCache/Misses", name,
+                                          "Number of cache misses");
+      counters->coalesced = egg_counter_new ("TaskCache/Coalesced", name,
+                                             "Misses that waited on an in-flight populate");
+      counters->populate_usec = egg_counter_new ("TaskCache/Populate", name,
+                                                 "Total time spent populating the cache, in usec");
+      counters->evictions = egg_counter_new ("TaskCache/Evictions", name,
+                                             "Number of items evicted due to age, cost or pressure");
+      counters->bytes = egg_counter_new ("TaskCache/Bytes", name,
+                                         "Combined cost of cached items, usually in bytes");
+      g_hash_table_insert (cache_counters, g_strdup (name), counters);
+    }
+
+  G_UNLOCK (cache_counters);
+
+  return counters;
+}
+
 static gint
 cache_item_compare_evict_at (gconstpointer a,
                              gconstpointer b)
@@ -214,12 +294,66 @@ cache_item_new (EggTaskCache  *self,
   ret->self = self;
   ret->key = self->key_copy_func ((gpointer)key);
   ret->value = self->value_copy_func ((gpointer)value);
+  ret->last_access = g_get_monotonic_time ();
   if (self->time_to_live_usec > 0)
-    ret->evict_at = g_get_monotonic_time () + self->time_to_live_usec;
+    ret->evict_at = ret->last_access + self->time_to_live_usec;
+  if (self->cost_func != NULL)
+    ret->cost = self->cost_func (ret->value, self->cost_func_data);
 
   return ret;
 }
 
+static inline gboolean
+egg_task_cache_is_pinned (EggTaskCache  *self,
+                          gconstpointer  key)
+{
+  return g_hash_table_size (self->pinned) > 0 &&
+         g_hash_table_contains (self->pinned, key);
+}
+
+static void
+egg_task_cache_reschedule (EggTaskCache *self,
+                           CacheItem    *item,
+                           gint64        evict_at)
+{
+  gint64 old_evict_at;
+
+  g_assert (EGG_IS_TASK_CACHE (self));
+  g_assert (item != NULL);
+  g_assert (item->heap_handle != 0);
+
+  old_evict_at = item->evict_at;
+  item->evict_at = evict_at;
+
+  /* The heap is ordered so that the soonest eviction is at the head. */
+  if (evict_at >= old_evict_at)
+    egg_heap_decrease_key (self->evict_heap, item->heap_handle, NULL);
+  else
+    egg_heap_increase_key (self->evict_heap, item->heap_handle, NULL);
+
+  if (self->evict_source != NULL)
+    evict_source_rearm (self->evict_source);
+}
+
+static void
+egg_task_cache_touch (EggTaskCache *self,
+                      CacheItem    *item)
+{
+  g_assert (EGG_IS_TASK_CACHE (self));
+  g_assert (item != NULL);
+
+  item->last_access = g_get_monotonic_time ();
+  item->n_accesses++;
+
+  /*
+   * When we are tracking the cost of items, the time to live slides
+   * forward with each access. Otherwise an expensive item that is in
+   * active use would be thrown away just to be rebuilt immediately.
+   */
+  if (self->cost_func != NULL && self->time_to_live_usec > 0)
+    egg_task_cache_reschedule (self, item, item->last_access + self->time_to_live_usec);
+}
+
 static gboolean
 egg_task_cache_evict_full (EggTaskCache  *self,
                            gconstpointer  key,
@@ -231,19 +365,13 @@ egg_task_cache_evict_full (EggTaskCache  *self,
 
   if ((item = g_hash_table_lookup (self->cache, key)))
     {
-      if (check_heap)
-        {
-          gsize i;
+      if (check_heap && item->heap_handle != 0)
+        egg_heap_remove (self->evict_heap, item->heap_handle, NULL);
+      item->heap_handle = 0;
 
-          for (i = 0; i < self->evict_heap->len; i++)
-            {
-              if (item == egg_heap_index (self->evict_heap, gpointer, i))
-                {
-                  egg_heap_extract_index (self->evict_heap, i, NULL);
-                  break;
-                }
-            }
-        }
+      self->cost -= item->cost;
+      EGG_COUNTER_SUB (cost, item->cost);
+      CACHE_COUNTER_ADD (self, bytes, -(gint64)item->cost);
 
       g_hash_table_remove (self->cache, key);
 
@@ -282,11 +410,16 @@ egg_task_cache_evict_all (EggTaskCache *self)
 
       /* The cache item is owned by the hashtable, so safe to "leak" here */
       egg_heap_extract_index (self->evict_heap, self->evict_heap->len - 1, &item);
+      item->heap_handle = 0;
     }
 
   g_hash_table_remove_all (self->cache);
 
   EGG_COUNTER_SUB (cached, size);
+  EGG_COUNTER_SUB (cost, self->cost);
+  CACHE_COUNTER_ADD (self, bytes, -(gint64)self->cost);
+
+  self->cost = 0;
 
   if (self->evict_source != NULL)
     evict_source_rearm (self->evict_source);
@@ -318,6 +451,8 @@ egg_task_cache_peek (EggTaskCache  *self,
   if ((item = g_hash_table_lookup (self->cache, key)))
     {
       EGG_COUNTER_INC (hits);
+      CACHE_COUNTER_INC (self, hits);
+      egg_task_cache_touch (self, item);
       return item->value;
     }
 
@@ -357,6 +492,121 @@ egg_task_cache_propagate_error (EggTaskCache  *self,
     }
 }
 
+/*
+ * Chooses the next item to evict according to the eviction policy.
+ *
+ * Pinned items and @keep are never chosen.
+ */
+static CacheItem *
+egg_task_cache_find_victim (EggTaskCache *self,
+                            CacheItem    *keep,
+                            gint64        now)
+{
+  GHashTableIter iter;
+  CacheItem *victim = NULL;
+  gdouble victim_score = 0.0;
+  gpointer value;
+
+  g_assert (EGG_IS_TASK_CACHE (self));
+
+  g_hash_table_iter_init (&iter, self->cache);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      CacheItem *item = value;
+
+      if (item == keep || egg_task_cache_is_pinned (self, item->key))
+        continue;
+
+      if (victim == NULL)
+        {
+          victim = item;
+          victim_score = (gdouble)MAX (item->cost, 1) * (gdouble)(now - item->last_access + 1);
+          continue;
+        }
+
+      switch (self->evict_policy)
+        {
+        case EGG_TASK_CACHE_EVICT_LRU:
+          if (item->last_access < victim->last_access)
+            victim = item;
+          break;
+
+        case EGG_TASK_CACHE_EVICT_LFU:
+          if (item->n_accesses < victim->n_accesses ||
+              (item->n_accesses == victim->n_accesses &&
+               item->last_access < victim->last_access))
+            victim = item;
+          break;
+
+        case EGG_TASK_CACHE_EVICT_DEFAULT:
+        default:
+          {
+            gdouble score;
+
+            score = (gdouble)MAX (item->cost, 1) * (gdouble)(now - item->last_access + 1);
+
+            if (score > victim_score)
+              {
+                victim = item;
+                victim_score = score;
+              }
+          }
+          break;
+        }
+    }
+
+  return victim;
+}
+
+/*
+ * Evicts items until the combined cost of the cache is within @max_cost
+ * and there are no more than @max_items items.
+ *
+ * Items are chosen by egg_task_cache_find_victim(). Pinned items and @keep
+ * are never evicted, even if that means the cache stays above its budget.
+ */
+static void
+egg_task_cache_trim_full (EggTaskCache *self,
+                          CacheItem    *keep,
+                          gsize         max_cost,
+                          guint         max_items)
+{
+  gint64 now;
+
+  g_assert (EGG_IS_TASK_CACHE (self));
+
+  now = g_get_monotonic_time ();
+
+  while (self->cost > max_cost || g_hash_table_size (self->cache) > max_items)
+    {
+      CacheItem *victim;
+
+      if (NULL == (victim = egg_task_cache_find_victim (self, keep, now)))
+        break;
+
+      g_debug ("Evicting item of cost %"G_GSIZE_FORMAT" from %s to stay within budget",
+               victim->cost, self->name ?: "unnamed cache");
+
+      egg_task_cache_evict_full (self, victim->key, TRUE);
+
+      EGG_COUNTER_INC (evictions);
+      CACHE_COUNTER_INC (self, evictions);
+    }
+}
+
+static void
+egg_task_cache_trim (EggTaskCache *self,
+                     CacheItem    *keep)
+{
+  g_assert (EGG_IS_TASK_CACHE (self));
+
+  if (self->max_cost == 0)
+    return;
+
+  egg_task_cache_trim_full (self, keep, self->max_cost, G_MAXUINT);
+}
+
 static void
 egg_task_cache_populate (EggTaskCache  *self,
                          gconstpointer  key,
@@ -371,12 +621,18 @@ egg_task_cache_populate (EggTaskCache  *self,
   if (g_hash_table_contains (self->cache, key))
     egg_task_cache_evict (self, key);
   g_hash_table_insert (self->cache, item->key, item);
-  egg_heap_insert_val (self->evict_heap, item);
+  item->heap_handle = egg_heap_insert_with_handle (self->evict_heap, &item);
+
+  self->cost += item->cost;
 
   EGG_COUNTER_INC (cached);
+  EGG_COUNTER_ADD (cost, item->cost);
+  CACHE_COUNTER_ADD (self, bytes, item->cost);
 
   if (self->evict_source != NULL)
     evict_source_rearm (self->evict_source);
+
+  egg_task_cache_trim (self, item);
 }
 
 static void
@@ -422,10 +678,14 @@ egg_task_cache_fetch_cb (GObject      *object,
   GError *error = NULL;
   gpointer key = user_data;
   gpointer ret;
+  gint64 *begin_time;
 
   g_assert (EGG_IS_TASK_CACHE (self));
   g_assert (G_IS_TASK (task));
 
+  if ((begin_time = g_hash_table_lookup (self->in_flight, key)))
+    CACHE_COUNTER_ADD (self, populate_usec, g_get_monotonic_time () - *begin_time);
+
   g_hash_table_remove (self->in_flight, key);
 
   ret = g_task_propagate_pointer (task, &error);
@@ -477,6 +737,7 @@ egg_task_cache_get_async (EggTaskCache        *self,
     }
 
   EGG_COUNTER_INC (misses);
+  CACHE_COUNTER_INC (self, misses);
 
   /*
    * Always queue the request. If we need to dispatch the worker to
@@ -500,6 +761,10 @@ egg_task_cache_get_async (EggTaskCache        *self,
   if (!g_hash_table_contains (self->in_flight, key))
     {
       g_autoptr(GTask) fetch_task = NULL;
+      gint64 *begin_time;
+
+      begin_time = g_new (gint64, 1);
+      *begin_time = g_get_monotonic_time ();
 
       fetch_task = g_task_new (self,
                                cancellable,
@@ -507,7 +772,7 @@ egg_task_cache_get_async (EggTaskCache        *self,
                                self->key_copy_func ((gpointer)key));
       g_hash_table_insert (self->in_flight,
                            self->key_copy_func ((gpointer)key),
-                           GINT_TO_POINTER (TRUE));
+                           begin_time);
       self->populate_callback (self,
                                key,
                                g_object_ref (fetch_task),
@@ -515,6 +780,10 @@ egg_task_cache_get_async (EggTaskCache        *self,
 
       EGG_COUNTER_INC (in_flight);
     }
+  else
+    {
+      CACHE_COUNTER_INC (self, coalesced);
+    }
 }
 
 /**
@@ -552,8 +821,22 @@ egg_task_cache_do_eviction (gpointer user_data)
 
       if (item->evict_at <= now)
         {
+          /* Pinned items get another lease instead of being evicted. */
+          if (egg_task_cache_is_pinned (self, item->key))
+            {
+              item->evict_at = now + self->time_to_live_usec;
+              egg_heap_decrease_key (self->evict_heap, item->heap_handle, NULL);
+              continue;
+            }
+
           egg_heap_extract (self->evict_heap, NULL);
+          item->heap_handle = 0;
+
           egg_task_cache_evict_full (self, item->key, FALSE);
+
+          EGG_COUNTER_INC (evictions);
+          CACHE_COUNTER_INC (self, evictions);
+
           continue;
         }
 
@@ -613,13 +896,13 @@ egg_task_cache_constructed (GObject *object)
                                        cache_item_free);
 
   /*
-   * This is where we store a bit to know if we have an inflight
-   * request for this cache key.
+   * This is where we store the time an inflight request for this
+   * cache key was started.
    */
   self->in_flight = g_hash_table_new_full (self->key_hash_func,
                                            self->key_equal_func,
                                            self->key_destroy_func,
-                                           NULL);
+                                           g_free);
 
   /*
    * This is where tasks queue waiting for an in_flight callback.
@@ -629,11 +912,29 @@ egg_task_cache_constructed (GObject *object)
                                         self->key_destroy_func,
                                         (GDestroyNotify)g_ptr_array_unref);
 
+  /*
+   * This is where we store the pin count of keys that must not be
+   * evicted, such as those backing a visible document.
+   */
+  self->pinned = g_hash_table_new_full (self->key_hash_func,
+                                        self->key_equal_func,
+                                        self->key_destroy_func,
+                                        NULL);
+
   /*
    * Register our eviction source if we have a time_to_live.
    */
   if (self->time_to_live_usec > 0)
     egg_task_cache_install_evict_source (self);
+
+  /*
+   * Release half of what we can when the system runs low on memory.
+   */
+  g_signal_connect_object (egg_memory_pressure_get_default (),
+                           "pressure",
+                           G_CALLBACK (egg_task_cache_shrink),
+                           self,
+                           G_CONNECT_SWAPPED);
 }
 
 static void
@@ -672,8 +973,14 @@ egg_task_cache_dispose (GObject *object)
                count, self->name ?: "unnamed cache");
 
       EGG_COUNTER_SUB (cached, count);
+      EGG_COUNTER_SUB (cost, self->cost);
+      CACHE_COUNTER_ADD (self, bytes, -(gint64)self->cost);
+
+      self->cost = 0;
     }
 
+  g_clear_pointer (&self->pinned, g_hash_table_unref);
+
   if (self->queued != NULL)
     {
       gint64 count = 0;
@@ -698,6 +1005,14 @@ egg_task_cache_dispose (GObject *object)
     {
       if (self->populate_callback_data_destroy)
         self->populate_callback_data_destroy (self->populate_callback_data);
+      self->populate_callback_data = NULL;
+    }
+
+  if (self->cost_func_data)
+    {
+      if (self->cost_func_data_destroy)
+        self->cost_func_data_destroy (self->cost_func_data);
+      self->cost_func_data = NULL;
     }
 
   G_OBJECT_CLASS (egg_task_cache_parent_class)->dispose (object);
@@ -939,6 +1254,11 @@ egg_task_cache_set_name (EggTaskCache *self,
   g_free (self->name);
   self->name = g_strdup (name);
 
+  /* Move our cost over to the counters for the new name. */
+  CACHE_COUNTER_ADD (self, bytes, -(gint64)self->cost);
+  self->counters = name ? cache_counters_get (name) : NULL;
+  CACHE_COUNTER_ADD (self, bytes, self->cost);
+
   if (name && self->evict_source)
     {
       g_autofree gchar *full_name = NULL;
@@ -947,3 +1267,233 @@ egg_task_cache_set_name (EggTaskCache *self,
       g_source_set_name (self->evict_source, full_name);
     }
 }
+
+/**
+ * egg_task_cache_set_cost_func: (skip)
+ * @self: An #EggTaskCache
+ * @cost_func: (nullable): An #EggTaskCacheCostFunc or %NULL
+ * @cost_func_data: user data for @cost_func
+ * @cost_func_data_destroy: (nullable): destroy notify for @cost_func_data
+ *
+ * Sets the function used to determine the cost of each item in the cache.
+ *
+ * Combined with egg_task_cache_set_max_cost(), this allows the cache to
+ * keep its footprint within a budget. When a cost function is set, accessing
+ * an item also extends its time to live.
+ */
+void
+egg_task_cache_set_cost_func (EggTaskCache         *self,
+                              EggTaskCacheCostFunc  cost_func,
+                              gpointer              cost_func_data,
+                              GDestroyNotify        cost_func_data_destroy)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_return_if_fail (EGG_IS_TASK_CACHE (self));
+
+  if (self->cost_func_data && self->cost_func_data_destroy)
+    self->cost_func_data_destroy (self->cost_func_data);
+
+  self->cost_func = cost_func;
+  self->cost_func_data = cost_func_data;
+  self->cost_func_data_destroy = cost_func_data_destroy;
+
+  EGG_COUNTER_SUB (cost, self->cost);
+  CACHE_COUNTER_ADD (self, bytes, -(gint64)self->cost);
+  self->cost = 0;
+
+  g_hash_table_iter_init (&iter, self->cache);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      CacheItem *item = value;
+
+      item->cost = cost_func ? cost_func (item->value, cost_func_data) : 0;
+      self->cost += item->cost;
+    }
+
+  EGG_COUNTER_ADD (cost, self->cost);
+  CACHE_COUNTER_ADD (self, bytes, self->cost);
+
+  egg_task_cache_trim (self, NULL);
+}
+
+/**
+ * egg_task_cache_get_cost:
+ * @self: An #EggTaskCache
+ *
+ * Gets the combined cost of all items in the cache, as determined by
+ * the cost function set with egg_task_cache_set_cost_func().
+ *
+ * Returns: the current cost of the cache.
+ */
+gsize
+egg_task_cache_get_cost (EggTaskCache *self)
+{
+  g_return_val_if_fail (EGG_IS_TASK_CACHE (self), 0);
+
+  return self->cost;
+}
+
+gsize
+egg_task_cache_get_max_cost (EggTaskCache *self)
+{
+  g_return_val_if_fail (EGG_IS_TASK_CACHE (self), 0);
+
+  return self->max_cost;
+}
+
+/**
+ * egg_task_cache_set_max_cost:
+ * @self: An #EggTaskCache
+ * @max_cost: the maximum cost, or 0 for unlimited
+ *
+ * Sets the budget for the combined cost of items in the cache. When the
+ * budget is exceeded, the least recently used items are evicted with
+ * preference given to the most expensive ones.
+ *
+ * Pinned items are never evicted to satisfy the budget.
+ */
+void
+egg_task_cache_set_max_cost (EggTaskCache *self,
+                             gsize         max_cost)
+{
+  g_return_if_fail (EGG_IS_TASK_CACHE (self));
+
+  self->max_cost = max_cost;
+
+  egg_task_cache_trim (self, NULL);
+}
+
+EggTaskCacheEvictPolicy
+egg_task_cache_get_evict_policy (EggTaskCache *self)
+{
+  g_return_val_if_fail (EGG_IS_TASK_CACHE (self), EGG_TASK_CACHE_EVICT_DEFAULT);
+
+  return self->evict_policy;
+}
+
+/**
+ * egg_task_cache_set_evict_policy:
+ * @self: An #EggTaskCache
+ * @policy: An #EggTaskCacheEvictPolicy
+ *
+ * Sets the policy used to choose which items are evicted when the cache
+ * is over its budget or the system is under memory pressure. Items are
+ * still evicted when their time to live expires, regardless of @policy.
+ */
+void
+egg_task_cache_set_evict_policy (EggTaskCache            *self,
+                                 EggTaskCacheEvictPolicy  policy)
+{
+  g_return_if_fail (EGG_IS_TASK_CACHE (self));
+  g_return_if_fail (policy <= EGG_TASK_CACHE_EVICT_LFU);
+
+  self->evict_policy = policy;
+}
+
+/**
+ * egg_task_cache_shrink:
+ * @self: An #EggTaskCache
+ *
+ * Evicts items until the cache is using at most half of its current cost,
+ * or when no cost function has been set, half of its current items. Items
+ * are chosen according to the eviction policy, and pinned items are never
+ * evicted.
+ *
+ * This is called automatically when #EggMemoryPressure signals that the
+ * system is running low on memory.
+ */
+void
+egg_task_cache_shrink (EggTaskCache *self)
+{
+  g_return_if_fail (EGG_IS_TASK_CACHE (self));
+
+  if (self->cache == NULL)
+    return;
+
+  g_debug ("Shrinking %s", self->name ?: "unnamed cache");
+
+  if (self->cost_func != NULL)
+    egg_task_cache_trim_full (self, NULL, self->cost / 2, G_MAXUINT);
+  else
+    egg_task_cache_trim_full (self, NULL, G_MAXSIZE, g_hash_table_size (self->cache) / 2);
+}
+
+/**
+ * egg_task_cache_pin:
+ * @self: An #EggTaskCache
+ * @key: The key for the cache
+ *
+ * Prevents the item for @key from being evicted, either due to its age or
+ * to stay within the budget set with egg_task_cache_set_max_cost().
+ *
+ * @key does not need to be in the cache yet. Calls may be nested, and each
+ * call must be balanced with a call to egg_task_cache_unpin().
+ */
+void
+egg_task_cache_pin (EggTaskCache  *self,
+                    gconstpointer  key)
+{
+  guint count;
+
+  g_return_if_fail (EGG_IS_TASK_CACHE (self));
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->pinned, key));
+
+  if (count == 0)
+    g_hash_table_insert (self->pinned,
+                         self->key_copy_func ((gpointer)key),
+                         GUINT_TO_POINTER (1));
+  else
+    g_hash_table_replace (self->pinned,
+                          self->key_copy_func ((gpointer)key),
+                          GUINT_TO_POINTER (count + 1));
+}
+
+/**
+ * egg_task_cache_unpin:
+ * @self: An #EggTaskCache
+ * @key: The key for the cache
+ *
+ * Releases a pin previously acquired with egg_task_cache_pin().
+ */
+void
+egg_task_cache_unpin (EggTaskCache  *self,
+                      gconstpointer  key)
+{
+  guint count;
+
+  g_return_if_fail (EGG_IS_TASK_CACHE (self));
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->pinned, key));
+
+  if (count == 0)
+    {
+      g_warning ("Attempt to unpin a key that is not pinned in %s",
+                 self->name ?: "unnamed cache");
+      return;
+    }
+
+  if (count == 1)
+    {
+      CacheItem *item;
+
+      g_hash_table_remove (self->pinned, key);
+
+      /*
+       * The item may have been kept around past its budget or time to live
+       * while it was pinned, so give it a fresh lease before we consider
+       * trimming the cache again.
+       */
+      if ((item = g_hash_table_lookup (self->cache, key)))
+        egg_task_cache_touch (self, item);
+
+      egg_task_cache_trim (self, NULL);
+    }
+  else
+    g_hash_table_replace (self->pinned,
+                          self->key_copy_func ((gpointer)key),
+                          GUINT_TO_POINTER (count - 1));
+}
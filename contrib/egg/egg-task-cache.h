@@ -49,6 +49,37 @@ typedef void (*EggTaskCacheCallback) (EggTaskCache  *self,
                                       GTask         *task,
                                       gpointer       user_data);
 
+/**
+ * EggTaskCacheCostFunc:
+ * @value: the cached value
+ * @user_data: user_data registered with egg_task_cache_set_cost_func().
+ *
+ * #EggTaskCacheCostFunc is used to determine the approximate cost of an
+ * item in the cache, typically in bytes. The cost of an item is calculated
+ * once, when the item is inserted into the cache.
+ *
+ * Returns: the cost of @value.
+ */
+typedef gsize (*EggTaskCacheCostFunc) (gconstpointer value,
+                                       gpointer      user_data);
+
+/**
+ * EggTaskCacheEvictPolicy:
+ * @EGG_TASK_CACHE_EVICT_DEFAULT: weigh the cost of items against the time
+ *   since they were last accessed.
+ * @EGG_TASK_CACHE_EVICT_LRU: evict the least recently used items first.
+ * @EGG_TASK_CACHE_EVICT_LFU: evict the least frequently used items first.
+ *
+ * The policy used to choose which items to evict when the cache is over
+ * its budget or the system is under memory pressure.
+ */
+typedef enum
+{
+  EGG_TASK_CACHE_EVICT_DEFAULT,
+  EGG_TASK_CACHE_EVICT_LRU,
+  EGG_TASK_CACHE_EVICT_LFU,
+} EggTaskCacheEvictPolicy;
+
 EggTaskCache *egg_task_cache_new        (GHashFunc              key_hash_func,
                                          GEqualFunc             key_equal_func,
                                          GBoxedCopyFunc         key_copy_func,
@@ -76,6 +107,28 @@ void          egg_task_cache_evict_all  (EggTaskCache          *self);
 gpointer      egg_task_cache_peek       (EggTaskCache          *self,
                                          gconstpointer          key);
 GPtrArray    *egg_task_cache_get_values (EggTaskCache          *self);
+void          egg_task_cache_set_cost_func
+                                        (EggTaskCache          *self,
+                                         EggTaskCacheCostFunc   cost_func,
+                                         gpointer               cost_func_data,
+                                         GDestroyNotify         cost_func_data_destroy);
+gsize         egg_task_cache_get_cost   (EggTaskCache          *self);
+gsize         egg_task_cache_get_max_cost
+                                        (EggTaskCache          *self);
+void          egg_task_cache_set_max_cost
+                                        (EggTaskCache          *self,
+                                         gsize                  max_cost);
+EggTaskCacheEvictPolicy
+              egg_task_cache_get_evict_policy
+                                        (EggTaskCache          *self);
+void          egg_task_cache_set_evict_policy
+                                        (EggTaskCache          *self,
+                                         EggTaskCacheEvictPolicy policy);
+void          egg_task_cache_shrink     (EggTaskCache          *self);
+void          egg_task_cache_pin        (EggTaskCache          *self,
+                                         gconstpointer          key);
+void          egg_task_cache_unpin      (EggTaskCache          *self,
+                                         gconstpointer          key);
 
 G_END_DECLS
 
@@ -21,6 +21,11 @@
 #include <egg-counter.h>
 #include <gtksourceview/gtksource.h>
 #include <glib/gi18n.h>
+#include <stdio.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+# include <malloc.h>
+#endif
 
 #include "ide-context.h"
 #include "ide-debug.h"
@@ -47,6 +52,8 @@
 
 #define AUTO_SAVE_TIMEOUT_DEFAULT    60
 #define MAX_FILE_SIZE_BYTES_DEFAULT  (1024UL * 1024UL * 10UL)
+#define RESUME_DEFERRED_DELAY_MSEC   500
+#define TRIM_CHECK_INTERVAL_SEC      60
 
 struct _IdeBufferManager
 {
@@ -54,6 +61,7 @@ struct _IdeBufferManager
 
   GPtrArray                *buffers;
   GHashTable               *timeouts;
+  GHashTable               *idle_states;
   IdeBuffer                *focus_buffer;
   GtkSourceCompletionWords *word_completion;
   GSettings                *settings;
@@ -61,9 +69,17 @@ struct _IdeBufferManager
   gsize                     max_file_size;
 
   guint                     auto_save_timeout;
+  guint                     resume_deferred_source;
+  guint                     trim_source;
   guint                     auto_save : 1;
 };
 
+typedef struct
+{
+  gint64 last_focus_time;
+  guint  trimmed : 1;
+} IdleState;
+
 typedef struct
 {
   IdeBufferManager *self;
@@ -103,6 +119,12 @@ G_DEFINE_TYPE_EXTENDED (IdeBufferManager, ide_buffer_manager, IDE_TYPE_OBJECT, 0
 
 EGG_DEFINE_COUNTER (registered, "IdeBufferManager", "Registered Buffers",
                     "The number of buffers registered with the buffer manager.")
+EGG_DEFINE_COUNTER (trimmed, "IdeBufferManager", "Trimmed Buffers",
+                    "The number of idle buffers whose derived state has been released.")
+EGG_DEFINE_COUNTER (trim_rss_before, "IdeBufferManager", "RSS Before Trim",
+                    "The resident set size in KiB before the last idle buffer trim.")
+EGG_DEFINE_COUNTER (trim_rss_after, "IdeBufferManager", "RSS After Trim",
+                    "The resident set size in KiB after the last idle buffer trim.")
 
 enum {
   PROP_0,
@@ -125,6 +147,8 @@ enum {
   BUFFER_FOCUS_ENTER,
   BUFFER_FOCUS_LEAVE,
 
+  BUFFER_TRIMMED,
+
   LAST_SIGNAL
 };
 
@@ -132,6 +156,8 @@ static void register_auto_save   (IdeBufferManager *self,
                                   IdeBuffer        *buffer);
 static void unregister_auto_save (IdeBufferManager *self,
                                   IdeBuffer        *buffer);
+static void touch_idle_state     (IdeBufferManager *self,
+                                  IdeBuffer        *buffer);
 
 static GParamSpec *properties [LAST_PROP];
 static guint signals [LAST_SIGNAL];
@@ -316,6 +342,17 @@ ide_buffer_manager_set_focus_buffer (IdeBufferManager *self,
 
   previous = self->focus_buffer;
 
+  /* Idle time is counted from when the buffer last lost focus */
+  if (previous != NULL)
+    touch_idle_state (self, previous);
+
+  if (buffer != NULL)
+    touch_idle_state (self, buffer);
+
+  /* Catch up on work that was skipped while restoring in the background */
+  if (buffer != NULL && _ide_buffer_get_deferred (buffer))
+    _ide_buffer_set_deferred (buffer, FALSE);
+
   if (ide_set_weak_pointer (&self->focus_buffer, buffer))
     {
       /* notify that we left the previous buffer */
@@ -374,6 +411,142 @@ ide_buffer_manager_buffer_changed (IdeBufferManager *self,
     }
 }
 
+static void
+idle_state_free (gpointer data)
+{
+  IdleState *state = data;
+
+  g_slice_free (IdleState, state);
+}
+
+static gint64
+get_rss_kib (void)
+{
+#ifdef __linux__
+  g_autofree gchar *contents = NULL;
+  gint64 pages;
+
+  /* The second field is the number of resident pages */
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return -1;
+
+  if (sscanf (contents, "%*s %"G_GINT64_FORMAT, &pages) != 1)
+    return -1;
+
+  return pages * (sysconf (_SC_PAGESIZE) / 1024);
+#else
+  return -1;
+#endif
+}
+
+static void
+touch_idle_state (IdeBufferManager *self,
+                  IdeBuffer        *buffer)
+{
+  IdleState *state;
+
+  g_assert (IDE_IS_BUFFER_MANAGER (self));
+  g_assert (IDE_IS_BUFFER (buffer));
+
+  if (NULL == (state = g_hash_table_lookup (self->idle_states, buffer)))
+    return;
+
+  state->last_focus_time = g_get_monotonic_time ();
+
+  /* Deferred work is resumed by the caller, but the word index is ours */
+  if (state->trimmed)
+    {
+      state->trimmed = FALSE;
+      if (_ide_buffer_get_large_file (buffer) == NULL)
+        gtk_source_completion_words_register (self->word_completion, GTK_TEXT_BUFFER (buffer));
+    }
+}
+
+static gboolean
+ide_buffer_manager_trim_cb (gpointer data)
+{
+  IdeBufferManager *self = data;
+  g_autoptr(GPtrArray) to_trim = NULL;
+  gint64 idle_usec;
+  gint64 now;
+  gint64 rss;
+  gint64 rss_after;
+  guint i;
+
+  g_assert (IDE_IS_BUFFER_MANAGER (self));
+
+  idle_usec = (gint64)g_settings_get_uint (self->settings, "idle-buffer-timeout") * 60 * G_USEC_PER_SEC;
+
+  /* Disabled, or still catching up on the buffers restored from the session */
+  if (idle_usec == 0 || self->resume_deferred_source != 0)
+    return G_SOURCE_CONTINUE;
+
+  now = g_get_monotonic_time ();
+  to_trim = g_ptr_array_new ();
+
+  for (i = 0; i < self->buffers->len; i++)
+    {
+      IdeBuffer *buffer = g_ptr_array_index (self->buffers, i);
+      IdleState *state = g_hash_table_lookup (self->idle_states, buffer);
+
+      if (state == NULL)
+        continue;
+
+      /* Visible in an unfocused split, so it is still in use */
+      if (_ide_buffer_get_mapped (buffer))
+        {
+          touch_idle_state (self, buffer);
+          continue;
+        }
+
+      if (state->trimmed || buffer == self->focus_buffer)
+        continue;
+
+      if (now - state->last_focus_time >= idle_usec)
+        g_ptr_array_add (to_trim, buffer);
+    }
+
+  if (to_trim->len == 0)
+    return G_SOURCE_CONTINUE;
+
+  rss = get_rss_kib ();
+
+  for (i = 0; i < to_trim->len; i++)
+    {
+      IdeBuffer *buffer = g_ptr_array_index (to_trim, i);
+      IdleState *state = g_hash_table_lookup (self->idle_states, buffer);
+
+      state->trimmed = TRUE;
+
+      gtk_source_completion_words_unregister (self->word_completion, GTK_TEXT_BUFFER (buffer));
+      _ide_buffer_trim (buffer);
+
+      /* Let plugins drop their caches too, such as translation units */
+      g_signal_emit (self, signals [BUFFER_TRIMMED], 0, buffer);
+
+      EGG_COUNTER_INC (trimmed);
+    }
+
+#ifdef __GLIBC__
+  /* Give the freed memory back to the system so that it shows up in RSS */
+  malloc_trim (0);
+#endif
+
+  if (rss >= 0 && (rss_after = get_rss_kib ()) >= 0)
+    {
+      egg_counter_reset (&trim_rss_before_ctr);
+      EGG_COUNTER_ADD (trim_rss_before, rss);
+
+      egg_counter_reset (&trim_rss_after_ctr);
+      EGG_COUNTER_ADD (trim_rss_after, rss_after);
+
+      IDE_TRACE_MSG ("Trimmed %u idle buffers, RSS %"G_GINT64_FORMAT" KiB to %"G_GINT64_FORMAT" KiB",
+                     to_trim->len, rss, rss_after);
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
 static void
 ide_buffer_manager_add_buffer (IdeBufferManager *self,
                                IdeBuffer        *buffer)
@@ -388,7 +561,23 @@ ide_buffer_manager_add_buffer (IdeBufferManager *self,
   if (self->auto_save)
     register_auto_save (self, buffer);
 
-  gtk_source_completion_words_register (self->word_completion, GTK_TEXT_BUFFER (buffer));
+  /*
+   * Large files only contain a window of the file, and scanning every
+   * window the user scrolls through for words would defeat the point of
+   * not loading the whole file. Leave them out of word completion.
+   */
+  if (_ide_buffer_get_large_file (buffer) == NULL)
+    gtk_source_completion_words_register (self->word_completion, GTK_TEXT_BUFFER (buffer));
+
+  g_hash_table_insert (self->idle_states, buffer, g_slice_new0 (IdleState));
+  touch_idle_state (self, buffer);
+
+  if (self->trim_source == 0)
+    self->trim_source = g_timeout_add_seconds_full (G_PRIORITY_LOW,
+                                                    TRIM_CHECK_INTERVAL_SEC,
+                                                    ide_buffer_manager_trim_cb,
+                                                    self,
+                                                    NULL);
 
   g_signal_connect_object (buffer,
                            "changed",
@@ -442,6 +631,8 @@ ide_buffer_manager_remove_buffer (IdeBufferManager *self,
 
   gtk_source_completion_words_unregister (self->word_completion, GTK_TEXT_BUFFER (buffer));
 
+  g_hash_table_remove (self->idle_states, buffer);
+
   unregister_auto_save (self, buffer);
 
   g_signal_handlers_disconnect_by_func (buffer,
@@ -623,6 +814,69 @@ emit_signal:
   g_task_return_pointer (task, g_object_ref (state->buffer), g_object_unref);
 }
 
+static void
+ide_buffer_manager_load_file__large_file_cb (GObject      *object,
+                                             GAsyncResult *result,
+                                             gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(IdeLargeFile) large_file = NULL;
+  IdeBufferManager *self;
+  IdeContext *context;
+  LoadState *state;
+  GError *error = NULL;
+  gboolean create_new_view;
+  gsize i;
+
+  IDE_ENTRY;
+
+  g_assert (G_IS_TASK (task));
+
+  self = g_task_get_source_object (task);
+  state = g_task_get_task_data (task);
+
+  g_assert (IDE_IS_BUFFER_MANAGER (self));
+  g_assert (IDE_IS_BUFFER (state->buffer));
+
+  if (NULL == (large_file = _ide_large_file_load_finish (result, &error)))
+    {
+      _ide_buffer_set_loading (state->buffer, FALSE);
+      g_task_return_error (task, error);
+      IDE_EXIT;
+    }
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+
+  /*
+   * Switch the buffer into large file mode before any views are created
+   * so they can disable the features that would need the whole file.
+   */
+  _ide_buffer_set_large_file (state->buffer, large_file);
+
+  create_new_view = (state->flags & IDE_WORKBENCH_OPEN_FLAGS_BACKGROUND) ? FALSE : state->is_new;
+  g_signal_emit (self, signals [LOAD_BUFFER], 0, state->buffer, create_new_view);
+
+  for (i = 0; i < self->buffers->len; i++)
+    {
+      if (g_ptr_array_index (self->buffers, i) == (gpointer)state->buffer)
+        break;
+    }
+
+  if (i == self->buffers->len && state->is_new)
+    ide_buffer_manager_add_buffer (self, state->buffer);
+
+  _ide_buffer_set_loading (state->buffer, FALSE);
+
+  if (!_ide_context_is_restoring (context))
+    ide_buffer_manager_set_focus_buffer (self, state->buffer);
+
+  g_signal_emit (self, signals [BUFFER_LOADED], 0, state->buffer);
+
+  g_task_return_pointer (task, g_object_ref (state->buffer), g_object_unref);
+
+  IDE_EXIT;
+}
+
 static void
 ide_buffer_manager__load_file_query_info_cb (GObject      *object,
                                              GAsyncResult *result,
@@ -667,6 +921,29 @@ ide_buffer_manager__load_file_query_info_cb (GObject      *object,
 
   if ((self->max_file_size > 0) && (size > self->max_file_size))
     {
+      /*
+       * Files that are too large for a GtkTextBuffer can still be viewed
+       * if they are local, by mapping them and only showing a window of
+       * the file at a time.
+       */
+      if (g_file_is_native (file))
+        {
+          if (file_info && g_file_info_has_attribute (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+            {
+              GTimeVal tv;
+
+              g_file_info_get_modification_time (file_info, &tv);
+              _ide_buffer_set_mtime (state->buffer, &tv);
+            }
+
+          _ide_large_file_load_async (file,
+                                      g_task_get_cancellable (task),
+                                      ide_buffer_manager_load_file__large_file_cb,
+                                      g_object_ref (task));
+          IDE_EXIT;
+        }
+
+      _ide_buffer_set_loading (state->buffer, FALSE);
       g_task_return_new_error (task,
                                G_IO_ERROR,
                                G_IO_ERROR_INVALID_DATA,
@@ -762,6 +1039,9 @@ ide_buffer_manager__load_file_read_cb (GObject      *object,
  * from the user accidentally loading very large files. You can change the maximum size of file
  * that will be loaded with the #IdeBufferManager:max-file-size property.
  *
+ * Local files larger than that are opened read-only, with only a window of the file loaded
+ * into the buffer at a time. Other files larger than that will fail to load.
+ *
  * See ide_buffer_manager_load_file_finish() for how to complete this asynchronous request.
  */
 void
@@ -840,6 +1120,13 @@ ide_buffer_manager_load_file_async (IdeBufferManager       *self,
                                       "context", context,
                                       "file", file,
                                       NULL);
+
+      /*
+       * Buffers restored without a view don't need highlighting or
+       * diagnostics until the user looks at them.
+       */
+      if ((flags & IDE_WORKBENCH_OPEN_FLAGS_BACKGROUND) && _ide_context_is_restoring (context))
+        _ide_buffer_set_deferred (state->buffer, TRUE);
     }
 
   _ide_buffer_set_mtime (state->buffer, NULL);
@@ -1126,6 +1413,15 @@ ide_buffer_manager_save_file_async (IdeBufferManager     *self,
 
   task = g_task_new (self, cancellable, callback, user_data);
 
+  if (_ide_buffer_get_large_file (buffer) != NULL)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_READ_ONLY,
+                               _("Large files are opened read-only and cannot be saved."));
+      return;
+    }
+
   context = ide_object_get_context (IDE_OBJECT (self));
   ide_context_hold_for_object (context, task);
 
@@ -1261,11 +1557,66 @@ list_model_iface_init (GListModelInterface *iface)
   iface->get_item = ide_buffer_manager_get_item;
 }
 
+static gboolean
+ide_buffer_manager_resume_deferred_cb (gpointer data)
+{
+  IdeBufferManager *self = data;
+  IdeDiagnosticsManager *diagnostics_manager;
+  IdeContext *context;
+  gsize i;
+
+  g_assert (IDE_IS_BUFFER_MANAGER (self));
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  diagnostics_manager = ide_context_get_diagnostics_manager (context);
+
+  /* Wait for the previous buffer to be diagnosed before starting another */
+  if (ide_diagnostics_manager_get_busy (diagnostics_manager))
+    return G_SOURCE_CONTINUE;
+
+  for (i = 0; i < self->buffers->len; i++)
+    {
+      IdeBuffer *buffer = g_ptr_array_index (self->buffers, i);
+
+      if (_ide_buffer_get_deferred (buffer))
+        {
+          _ide_buffer_set_deferred (buffer, FALSE);
+          return G_SOURCE_CONTINUE;
+        }
+    }
+
+  self->resume_deferred_source = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * _ide_buffer_manager_resume_deferred:
+ *
+ * Resumes buffers that were deferred while restoring the session, one at a
+ * time at low priority so that they don't compete with the focused buffer.
+ */
+void
+_ide_buffer_manager_resume_deferred (IdeBufferManager *self)
+{
+  g_return_if_fail (IDE_IS_BUFFER_MANAGER (self));
+
+  if (self->resume_deferred_source == 0)
+    self->resume_deferred_source =
+      g_timeout_add_full (G_PRIORITY_LOW,
+                          RESUME_DEFERRED_DELAY_MSEC,
+                          ide_buffer_manager_resume_deferred_cb,
+                          self,
+                          NULL);
+}
+
 static void
 ide_buffer_manager_dispose (GObject *object)
 {
   IdeBufferManager *self = (IdeBufferManager *)object;
 
+  ide_clear_source (&self->resume_deferred_source);
+  ide_clear_source (&self->trim_source);
   ide_clear_weak_pointer (&self->focus_buffer);
 
   while (self->buffers->len)
@@ -1294,6 +1645,7 @@ ide_buffer_manager_finalize (GObject *object)
 
   g_clear_pointer (&self->buffers, g_ptr_array_unref);
   g_clear_pointer (&self->timeouts, g_hash_table_unref);
+  g_clear_pointer (&self->idle_states, g_hash_table_unref);
   g_clear_object (&self->settings);
 
   G_OBJECT_CLASS (ide_buffer_manager_parent_class)->finalize (object);
@@ -1537,6 +1889,22 @@ ide_buffer_manager_class_init (IdeBufferManagerClass *klass)
                                             G_SIGNAL_RUN_LAST,
                                             0, NULL, NULL, NULL,
                                             G_TYPE_NONE, 1, IDE_TYPE_BUFFER);
+
+  /**
+   * IdeBufferManager::buffer-trimmed:
+   * @self: An #IdeBufferManager
+   * @buffer: An #IdeBuffer
+   *
+   * This signal is emitted when @buffer has not been focused for some time and the state
+   * derived from it has been released to save memory. Consumers that cache state for the
+   * buffer, such as parsed translation units or symbol trees, may drop it too. The buffer
+   * will be rebuilt when it is focused again, see #IdeBufferManager::buffer-focus-enter.
+   */
+  signals [BUFFER_TRIMMED] = g_signal_new ("buffer-trimmed",
+                                           G_TYPE_FROM_CLASS (klass),
+                                           G_SIGNAL_RUN_LAST,
+                                           0, NULL, NULL, NULL,
+                                           G_TYPE_NONE, 1, IDE_TYPE_BUFFER);
 }
 
 static void
@@ -1547,6 +1915,7 @@ ide_buffer_manager_init (IdeBufferManager *self)
   self->buffers = g_ptr_array_new ();
   self->max_file_size = MAX_FILE_SIZE_BYTES_DEFAULT;
   self->timeouts = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->idle_states = g_hash_table_new_full (NULL, NULL, NULL, idle_state_free);
   self->word_completion = g_object_new (IDE_TYPE_COMPLETION_WORDS, NULL);
   self->settings = g_settings_new ("org.gnome.builder.editor");
 }
@@ -0,0 +1,701 @@
+/* ide-buffer-snapshot.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-buffer-snapshot"
+
+#include <string.h>
+
+#include "buffers/ide-buffer-snapshot.h"
+
+/*
+ * IdeBufferSnapshot is a copy of the text of an IdeBuffer, kept in sync
+ * from the insert-text and delete-range vfuncs so that we never have to
+ * walk the GtkTextBuffer to get at the contents.
+ *
+ * The text is stored as an array of immutable chunks (each a GBytes of a
+ * few kilobytes, split at character boundaries) along with the number of
+ * characters in each chunk, so that GtkTextIter offsets can be mapped to a
+ * chunk without looking at the text of the other chunks.
+ *
+ * Snapshots are copy-on-write. As long as the buffer holds the only
+ * reference, edits are applied in place. Once a reference has been handed
+ * out (such as to IdeUnsavedFiles), the next edit creates a new snapshot
+ * that shares every chunk except those touched by the edit. That makes
+ * handing out a snapshot O(1), and an edit proportional to the number of
+ * chunks rather than the size of the text.
+ *
+ * The contiguous GBytes is only created when a consumer asks for it with
+ * _ide_buffer_snapshot_get_bytes(), which may happen on any thread, and is
+ * cached until the next edit.
+ *
+ * Snapshots may also be backed by a file which is not read until the
+ * contents are needed, such as drafts restored by IdeUnsavedFiles. If the
+ * file cannot be read the snapshot is empty, and the failure is reported by
+ * _ide_buffer_snapshot_load_bytes() so that callers persisting the snapshot
+ * do not replace the file with nothing.
+ */
+
+#define CHUNK_SIZE     4096
+#define MAX_CHUNK_SIZE (CHUNK_SIZE * 2)
+#define MIN_CHUNK_SIZE (CHUNK_SIZE / 4)
+
+typedef struct
+{
+  GBytes *bytes;
+  gsize   n_chars;
+} Chunk;
+
+struct _IdeBufferSnapshot
+{
+  volatile gint  ref_count;
+  GArray        *chunks;
+  gsize          length;
+  GMutex         mutex;
+  GBytes        *flattened;
+  gchar         *path;
+  GError        *load_error;
+  guint          trailing_newline : 1;
+};
+
+static void
+chunk_clear (gpointer data)
+{
+  Chunk *chunk = data;
+
+  g_clear_pointer (&chunk->bytes, g_bytes_unref);
+}
+
+static IdeBufferSnapshot *
+ide_buffer_snapshot_alloc (void)
+{
+  IdeBufferSnapshot *self;
+
+  self = g_slice_new0 (IdeBufferSnapshot);
+  self->ref_count = 1;
+  self->chunks = g_array_new (FALSE, FALSE, sizeof (Chunk));
+  g_array_set_clear_func (self->chunks, chunk_clear);
+  g_mutex_init (&self->mutex);
+
+  return self;
+}
+
+/*
+ * Inserts @bytes into @chunks at @index, slicing it (without copying) into
+ * pieces of CHUNK_SIZE if it is too large. Returns the number of chunks
+ * that were inserted.
+ */
+static guint
+chunks_insert_bytes (GArray *chunks,
+                     guint   index,
+                     GBytes *bytes)
+{
+  const gchar *data;
+  gsize len;
+  gsize pos = 0;
+  guint n_chunks = 0;
+
+  data = g_bytes_get_data (bytes, &len);
+
+  while (pos < len)
+    {
+      gsize n = len - pos;
+      Chunk chunk;
+
+      if (n > MAX_CHUNK_SIZE)
+        {
+          n = CHUNK_SIZE;
+
+          /* Never split a multi-byte character across chunks */
+          while (n > 1 && (data [pos + n] & 0xC0) == 0x80)
+            n--;
+        }
+
+      if (pos == 0 && n == len)
+        chunk.bytes = g_bytes_ref (bytes);
+      else
+        chunk.bytes = g_bytes_new_from_bytes (bytes, pos, n);
+
+      chunk.n_chars = g_utf8_strlen (data + pos, n);
+
+      g_array_insert_val (chunks, index + n_chunks, chunk);
+
+      pos += n;
+      n_chunks++;
+    }
+
+  return n_chunks;
+}
+
+/*
+ * Replaces the chunk at @index with the concatenation of @prefix, @text
+ * and @suffix, which may point into the chunk being replaced.
+ */
+static guint
+replace_chunk (IdeBufferSnapshot *self,
+               guint              index,
+               const gchar       *prefix,
+               gsize              prefix_len,
+               const gchar       *text,
+               gsize              text_len,
+               const gchar       *suffix,
+               gsize              suffix_len)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  gsize len = prefix_len + text_len + suffix_len;
+  gchar *buf;
+
+  buf = g_malloc (len);
+  memcpy (buf, prefix, prefix_len);
+  memcpy (buf + prefix_len, text, text_len);
+  memcpy (buf + prefix_len + text_len, suffix, suffix_len);
+
+  /* Only release the old chunk now that we are done reading from it */
+  g_array_remove_index (self->chunks, index);
+
+  if (len == 0)
+    {
+      g_free (buf);
+      return 0;
+    }
+
+  bytes = g_bytes_new_take (buf, len);
+
+  return chunks_insert_bytes (self->chunks, index, bytes);
+}
+
+/*
+ * Merges the chunk at @index with the following one if either is small,
+ * so that lots of deletions do not leave behind tiny chunks.
+ */
+static void
+maybe_merge (IdeBufferSnapshot *self,
+             guint              index)
+{
+  const gchar *a_data;
+  const gchar *b_data;
+  Chunk *a;
+  Chunk *b;
+  Chunk merged;
+  gsize a_len;
+  gsize b_len;
+  gchar *buf;
+
+  if (index + 1 >= self->chunks->len)
+    return;
+
+  a = &g_array_index (self->chunks, Chunk, index);
+  b = &g_array_index (self->chunks, Chunk, index + 1);
+
+  a_data = g_bytes_get_data (a->bytes, &a_len);
+  b_data = g_bytes_get_data (b->bytes, &b_len);
+
+  if ((a_len >= MIN_CHUNK_SIZE && b_len >= MIN_CHUNK_SIZE) || (a_len + b_len) > MAX_CHUNK_SIZE)
+    return;
+
+  buf = g_malloc (a_len + b_len);
+  memcpy (buf, a_data, a_len);
+  memcpy (buf + a_len, b_data, b_len);
+
+  merged.bytes = g_bytes_new_take (buf, a_len + b_len);
+  merged.n_chars = a->n_chars + b->n_chars;
+
+  g_array_remove_range (self->chunks, index, 2);
+  g_array_insert_val (self->chunks, index, merged);
+}
+
+/*
+ * Loads the contents of snapshots created with
+ * _ide_buffer_snapshot_new_for_path(). Must be called with the mutex held.
+ */
+static void
+ide_buffer_snapshot_load_locked (IdeBufferSnapshot *self)
+{
+  gchar *contents = NULL;
+  gsize len = 0;
+
+  if (self->path == NULL)
+    return;
+
+  g_assert (self->flattened == NULL);
+  g_assert (self->chunks->len == 0);
+
+  if (!g_file_get_contents (self->path, &contents, &len, &self->load_error))
+    {
+      g_warning ("Failed to load \"%s\": %s", self->path, self->load_error->message);
+      contents = g_strdup ("");
+      len = 0;
+    }
+
+  self->flattened = g_bytes_new_take (contents, len);
+  self->length = len;
+
+  g_clear_pointer (&self->path, g_free);
+}
+
+static void
+ide_buffer_snapshot_load (IdeBufferSnapshot *self)
+{
+  g_mutex_lock (&self->mutex);
+  ide_buffer_snapshot_load_locked (self);
+  g_mutex_unlock (&self->mutex);
+}
+
+static void
+ide_buffer_snapshot_copy_chunks (IdeBufferSnapshot *self,
+                                 IdeBufferSnapshot *dest)
+{
+  guint i;
+
+  /* Snapshots created from GBytes only get chunks once they are edited */
+  if (self->chunks->len == 0 && self->length > 0)
+    {
+      g_assert (self->flattened != NULL);
+      g_assert (!self->trailing_newline);
+
+      chunks_insert_bytes (dest->chunks, 0, self->flattened);
+      return;
+    }
+
+  for (i = 0; i < self->chunks->len; i++)
+    {
+      Chunk chunk = g_array_index (self->chunks, Chunk, i);
+
+      chunk.bytes = g_bytes_ref (chunk.bytes);
+      g_array_append_val (dest->chunks, chunk);
+    }
+}
+
+/*
+ * Gets a snapshot that may be modified, consuming the reference to @self.
+ * If nobody else holds a reference to @self, it is returned. Otherwise a
+ * new snapshot sharing the chunks of @self is created.
+ */
+static IdeBufferSnapshot *
+ide_buffer_snapshot_make_writable (IdeBufferSnapshot *self)
+{
+  IdeBufferSnapshot *copy;
+
+  ide_buffer_snapshot_load (self);
+
+  if (g_atomic_int_get (&self->ref_count) == 1)
+    {
+      if (self->chunks->len == 0 && self->length > 0)
+        {
+          g_assert (!self->trailing_newline);
+
+          chunks_insert_bytes (self->chunks, 0, self->flattened);
+        }
+
+      g_clear_pointer (&self->flattened, g_bytes_unref);
+
+      return self;
+    }
+
+  copy = ide_buffer_snapshot_alloc ();
+  copy->length = self->length;
+  copy->trailing_newline = self->trailing_newline;
+  ide_buffer_snapshot_copy_chunks (self, copy);
+
+  _ide_buffer_snapshot_unref (self);
+
+  return copy;
+}
+
+IdeBufferSnapshot *
+_ide_buffer_snapshot_new (void)
+{
+  return ide_buffer_snapshot_alloc ();
+}
+
+/**
+ * _ide_buffer_snapshot_new_for_bytes:
+ * @bytes: a #GBytes
+ *
+ * Creates a snapshot whose contents are @bytes. No copy of @bytes is made,
+ * and it will be returned from _ide_buffer_snapshot_get_bytes().
+ */
+IdeBufferSnapshot *
+_ide_buffer_snapshot_new_for_bytes (GBytes *bytes)
+{
+  IdeBufferSnapshot *self;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  self = ide_buffer_snapshot_alloc ();
+  self->flattened = g_bytes_ref (bytes);
+  self->length = g_bytes_get_size (bytes);
+
+  return self;
+}
+
+/**
+ * _ide_buffer_snapshot_new_for_path:
+ * @path: the path to a file
+ *
+ * Creates a snapshot whose contents are those of the file at @path. The
+ * file is not read until the snapshot is modified or its contents are
+ * requested, so the file must not change in the mean time.
+ */
+IdeBufferSnapshot *
+_ide_buffer_snapshot_new_for_path (const gchar *path)
+{
+  IdeBufferSnapshot *self;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  self = ide_buffer_snapshot_alloc ();
+  self->path = g_strdup (path);
+
+  return self;
+}
+
+IdeBufferSnapshot *
+_ide_buffer_snapshot_ref (IdeBufferSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+_ide_buffer_snapshot_unref (IdeBufferSnapshot *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_clear_pointer (&self->chunks, g_array_unref);
+      g_clear_pointer (&self->flattened, g_bytes_unref);
+      g_clear_pointer (&self->path, g_free);
+      g_clear_error (&self->load_error);
+      g_mutex_clear (&self->mutex);
+      g_slice_free (IdeBufferSnapshot, self);
+    }
+}
+
+static guint
+find_chunk (IdeBufferSnapshot *self,
+            gsize              char_offset,
+            gsize             *chunk_char_offset)
+{
+  gsize begin = 0;
+  guint i;
+
+  for (i = 0; i < self->chunks->len; i++)
+    {
+      const Chunk *chunk = &g_array_index (self->chunks, Chunk, i);
+
+      if (char_offset <= begin + chunk->n_chars)
+        {
+          *chunk_char_offset = char_offset - begin;
+          return i;
+        }
+
+      begin += chunk->n_chars;
+    }
+
+  *chunk_char_offset = 0;
+
+  return self->chunks->len;
+}
+
+/**
+ * _ide_buffer_snapshot_insert:
+ * @self: (transfer full): an #IdeBufferSnapshot
+ * @char_offset: the character offset to insert at
+ * @text: the UTF-8 text to insert
+ * @len: the length of @text in bytes
+ *
+ * Inserts @text at @char_offset. @self is consumed, use the result in
+ * place of @self afterwards.
+ *
+ * Returns: (transfer full): the modified snapshot.
+ */
+IdeBufferSnapshot *
+_ide_buffer_snapshot_insert (IdeBufferSnapshot *self,
+                             gsize              char_offset,
+                             const gchar       *text,
+                             gsize              len)
+{
+  gsize rel;
+  guint index;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (text != NULL || len == 0, self);
+
+  if (len == 0)
+    return self;
+
+  self = ide_buffer_snapshot_make_writable (self);
+
+  index = find_chunk (self, char_offset, &rel);
+
+  if (index == self->chunks->len)
+    {
+      g_autoptr(GBytes) bytes = g_bytes_new (text, len);
+
+      chunks_insert_bytes (self->chunks, index, bytes);
+    }
+  else
+    {
+      const Chunk *chunk = &g_array_index (self->chunks, Chunk, index);
+      const gchar *data;
+      const gchar *split;
+      gsize chunk_len;
+
+      data = g_bytes_get_data (chunk->bytes, &chunk_len);
+      split = g_utf8_offset_to_pointer (data, rel);
+
+      replace_chunk (self,
+                     index,
+                     data, split - data,
+                     text, len,
+                     split, chunk_len - (split - data));
+    }
+
+  self->length += len;
+
+  return self;
+}
+
+/**
+ * _ide_buffer_snapshot_delete:
+ * @self: (transfer full): an #IdeBufferSnapshot
+ * @begin_char_offset: the first character to delete
+ * @end_char_offset: the character after the last to delete
+ *
+ * Deletes the characters between @begin_char_offset and @end_char_offset.
+ * @self is consumed, use the result in place of @self afterwards.
+ *
+ * Returns: (transfer full): the modified snapshot.
+ */
+IdeBufferSnapshot *
+_ide_buffer_snapshot_delete (IdeBufferSnapshot *self,
+                             gsize              begin_char_offset,
+                             gsize              end_char_offset)
+{
+  gsize chunk_begin = 0;
+  guint first = G_MAXUINT;
+  guint i = 0;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  if (begin_char_offset >= end_char_offset)
+    return self;
+
+  self = ide_buffer_snapshot_make_writable (self);
+
+  while (i < self->chunks->len && chunk_begin < end_char_offset)
+    {
+      const Chunk *chunk = &g_array_index (self->chunks, Chunk, i);
+      gsize chunk_end = chunk_begin + chunk->n_chars;
+      const gchar *data;
+      gsize chunk_len;
+      gsize rel_begin;
+      gsize rel_end;
+      gsize b;
+      gsize e;
+
+      if (chunk_end <= begin_char_offset)
+        {
+          chunk_begin = chunk_end;
+          i++;
+          continue;
+        }
+
+      if (first == G_MAXUINT)
+        first = i;
+
+      rel_begin = MAX (begin_char_offset, chunk_begin) - chunk_begin;
+      rel_end = MIN (end_char_offset, chunk_end) - chunk_begin;
+      chunk_begin = chunk_end;
+
+      data = g_bytes_get_data (chunk->bytes, &chunk_len);
+      b = g_utf8_offset_to_pointer (data, rel_begin) - data;
+      e = g_utf8_offset_to_pointer (data + b, rel_end - rel_begin) - data;
+
+      self->length -= e - b;
+
+      i += replace_chunk (self, i, data, b, NULL, 0, data + e, chunk_len - e);
+    }
+
+  if (first != G_MAXUINT)
+    {
+      if (first > 0)
+        maybe_merge (self, first - 1);
+      maybe_merge (self, MIN (first, self->chunks->len));
+    }
+
+  return self;
+}
+
+/**
+ * _ide_buffer_snapshot_set_trailing_newline:
+ * @self: (transfer full): an #IdeBufferSnapshot
+ * @trailing_newline: if a "\n" should be appended to the contents
+ *
+ * Sets if the contents returned from _ide_buffer_snapshot_get_bytes()
+ * should have a "\n" appended, to match the implicit trailing newline of
+ * #GtkSourceBuffer.
+ *
+ * Returns: (transfer full): the modified snapshot.
+ */
+IdeBufferSnapshot *
+_ide_buffer_snapshot_set_trailing_newline (IdeBufferSnapshot *self,
+                                           gboolean           trailing_newline)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  trailing_newline = !!trailing_newline;
+
+  if (self->trailing_newline != trailing_newline)
+    {
+      self = ide_buffer_snapshot_make_writable (self);
+      self->trailing_newline = trailing_newline;
+    }
+
+  return self;
+}
+
+/**
+ * _ide_buffer_snapshot_get_length:
+ *
+ * Gets the length of the contents in bytes, including the trailing
+ * newline if any.
+ */
+gsize
+_ide_buffer_snapshot_get_length (IdeBufferSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  ide_buffer_snapshot_load (self);
+
+  return self->length + self->trailing_newline;
+}
+
+/**
+ * _ide_buffer_snapshot_peek_bytes:
+ *
+ * Gets the contiguous contents if they have already been created.
+ *
+ * Returns: (transfer none) (nullable): a #GBytes or %NULL.
+ */
+GBytes *
+_ide_buffer_snapshot_peek_bytes (IdeBufferSnapshot *self)
+{
+  GBytes *ret;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->mutex);
+  ret = self->flattened;
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
+
+/**
+ * _ide_buffer_snapshot_get_bytes:
+ *
+ * Gets the contents of the snapshot as a contiguous #GBytes, creating it
+ * if necessary. This is safe to call from any thread holding a reference.
+ *
+ * As with ide_buffer_get_content(), the data is followed by a \0 byte
+ * that is not included in the size of the #GBytes.
+ *
+ * Returns: (transfer none): a #GBytes that is valid for the lifetime of
+ *   the snapshot.
+ */
+GBytes *
+_ide_buffer_snapshot_get_bytes (IdeBufferSnapshot *self)
+{
+  GBytes *ret;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->mutex);
+
+  ide_buffer_snapshot_load_locked (self);
+
+  if (self->flattened == NULL)
+    {
+      gchar *buf;
+      gchar *pos;
+      guint i;
+
+      pos = buf = g_malloc (self->length + 2);
+
+      for (i = 0; i < self->chunks->len; i++)
+        {
+          const Chunk *chunk = &g_array_index (self->chunks, Chunk, i);
+          gconstpointer data;
+          gsize len;
+
+          data = g_bytes_get_data (chunk->bytes, &len);
+          memcpy (pos, data, len);
+          pos += len;
+        }
+
+      if (self->trailing_newline)
+        *pos++ = '\n';
+      *pos = '\0';
+
+      self->flattened = g_bytes_new_take (buf, pos - buf);
+    }
+
+  ret = self->flattened;
+
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
+
+/**
+ * _ide_buffer_snapshot_load_bytes:
+ *
+ * Like _ide_buffer_snapshot_get_bytes(), but fails if the snapshot is
+ * backed by a file that could not be read rather than returning empty
+ * contents.
+ *
+ * Returns: (transfer none) (nullable): a #GBytes that is valid for the
+ *   lifetime of the snapshot, or %NULL and @error is set.
+ */
+GBytes *
+_ide_buffer_snapshot_load_bytes (IdeBufferSnapshot  *self,
+                                 GError            **error)
+{
+  GBytes *ret;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  ret = _ide_buffer_snapshot_get_bytes (self);
+
+  g_mutex_lock (&self->mutex);
+  if (self->load_error != NULL)
+    {
+      g_propagate_error (error, g_error_copy (self->load_error));
+      ret = NULL;
+    }
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
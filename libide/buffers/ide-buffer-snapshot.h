@@ -0,0 +1,52 @@
+/* ide-buffer-snapshot.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_BUFFER_SNAPSHOT_H
+#define IDE_BUFFER_SNAPSHOT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IdeBufferSnapshot IdeBufferSnapshot;
+
+IdeBufferSnapshot *_ide_buffer_snapshot_new                  (void);
+IdeBufferSnapshot *_ide_buffer_snapshot_new_for_bytes        (GBytes            *bytes);
+IdeBufferSnapshot *_ide_buffer_snapshot_new_for_path         (const gchar       *path);
+IdeBufferSnapshot *_ide_buffer_snapshot_ref                  (IdeBufferSnapshot *self);
+void               _ide_buffer_snapshot_unref                (IdeBufferSnapshot *self);
+IdeBufferSnapshot *_ide_buffer_snapshot_insert               (IdeBufferSnapshot *self,
+                                                              gsize              char_offset,
+                                                              const gchar       *text,
+                                                              gsize              len);
+IdeBufferSnapshot *_ide_buffer_snapshot_delete               (IdeBufferSnapshot *self,
+                                                              gsize              begin_char_offset,
+                                                              gsize              end_char_offset);
+IdeBufferSnapshot *_ide_buffer_snapshot_set_trailing_newline (IdeBufferSnapshot *self,
+                                                              gboolean           trailing_newline);
+gsize              _ide_buffer_snapshot_get_length           (IdeBufferSnapshot *self);
+GBytes            *_ide_buffer_snapshot_peek_bytes           (IdeBufferSnapshot *self);
+GBytes            *_ide_buffer_snapshot_get_bytes            (IdeBufferSnapshot *self);
+GBytes            *_ide_buffer_snapshot_load_bytes           (IdeBufferSnapshot  *self,
+                                                              GError            **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeBufferSnapshot, _ide_buffer_snapshot_unref)
+
+G_END_DECLS
+
+#endif /* IDE_BUFFER_SNAPSHOT_H */
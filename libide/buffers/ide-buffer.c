@@ -29,6 +29,7 @@
 
 #include "buffers/ide-buffer-change-monitor.h"
 #include "buffers/ide-buffer.h"
+#include "buffers/ide-line-intervals.h"
 #include "buffers/ide-unsaved-files.h"
 #include "diagnostics/ide-diagnostic.h"
 #include "diagnostics/ide-diagnostics.h"
@@ -49,10 +50,10 @@
 #include "util/ide-gtk.h"
 #include "vcs/ide-vcs.h"
 
-#define DEFAULT_DIAGNOSE_TIMEOUT_MSEC          333
 #define DEFAULT_DIAGNOSE_CONSERVE_TIMEOUT_MSEC 5000
 #define RECLAIMATION_TIMEOUT_SECS              1
 #define MODIFICATION_TIMEOUT_SECS              1
+#define LARGE_FILE_WINDOW_LINES                10000
 
 #define TAG_ERROR            "diagnostician::error"
 #define TAG_WARNING          "diagnostician::warning"
@@ -70,15 +71,17 @@ typedef struct
 {
   IdeContext             *context;
   IdeDiagnostics         *diagnostics;
-  GHashTable             *diagnostics_line_cache;
+  IdeLineIntervals       *diagnostics_line_cache;
   EggSignalGroup         *diagnostics_manager_signals;
   IdeFile                *file;
   GBytes                 *content;
+  IdeBufferSnapshot      *snapshot;
   IdeBufferChangeMonitor *change_monitor;
   IdeHighlightEngine     *highlight_engine;
   IdeExtensionAdapter    *rename_provider_adapter;
   IdeExtensionAdapter    *symbol_resolver_adapter;
   GspellChecker          *spellchecker;
+  IdeLargeFile           *large_file;
   gchar                  *title;
 
   EggSignalGroup         *file_signals;
@@ -96,13 +99,21 @@ typedef struct
   gint                    hold_count;
   guint                   reclamation_handler;
 
+  guint                   n_mapped_views;
+
   gsize                   change_count;
 
+  guint                   large_file_first_line;
+  guint                   large_file_window_serial;
+
   guint                   changed_on_volume : 1;
+  guint                   deferred : 1;
+  guint                   has_embedded_objects : 1;
   guint                   highlight_diagnostics : 1;
   guint                   loading : 1;
   guint                   mtime_set : 1;
   guint                   read_only : 1;
+  guint                   snapshot_synced : 1;
 } IdeBufferPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (IdeBuffer, ide_buffer, GTK_SOURCE_TYPE_BUFFER)
@@ -144,6 +155,10 @@ ide_buffer_set_spell_checking (IdeBuffer *self,
 
   g_return_if_fail (IDE_IS_BUFFER (self));
 
+  /* Spellchecking would have to walk the entire window of a large file */
+  if (priv->large_file != NULL)
+    enable = FALSE;
+
   if (enable)
     {
       if (!GSPELL_IS_CHECKER (priv->spellchecker))
@@ -296,15 +311,70 @@ ide_buffer_set_context (IdeBuffer  *self,
   egg_signal_group_set_target (priv->diagnostics_manager_signals, diagnostics_manager);
 }
 
+/*
+ * The snapshot is released when an unmodified buffer is trimmed, since the
+ * same text is in the GtkTextBuffer. Rebuild it from there when it is needed
+ * again. The slice includes U+FFFC for embedded objects, which is what the
+ * snapshot would contain had it been tracking the buffer all along.
+ */
+static IdeBufferSnapshot *
+ide_buffer_ensure_snapshot (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_assert (IDE_IS_BUFFER (self));
+
+  if (priv->snapshot == NULL)
+    {
+      g_autoptr(GBytes) bytes = NULL;
+      GtkTextIter begin;
+      GtkTextIter end;
+      gchar *text;
+
+      gtk_text_buffer_get_bounds (GTK_TEXT_BUFFER (self), &begin, &end);
+      text = gtk_text_buffer_get_slice (GTK_TEXT_BUFFER (self), &begin, &end, TRUE);
+      bytes = g_bytes_new_take (text, strlen (text));
+
+      priv->snapshot = _ide_buffer_snapshot_new_for_bytes (bytes);
+    }
+
+  return priv->snapshot;
+}
+
 void
 ide_buffer_sync_to_unsaved_files (IdeBuffer *self)
 {
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+  IdeUnsavedFiles *unsaved_files;
+  GFile *gfile;
   GBytes *content;
 
   g_assert (IDE_IS_BUFFER (self));
 
-  if ((content = ide_buffer_get_content (self)))
-    g_bytes_unref (content);
+  if (priv->snapshot_synced || priv->large_file != NULL)
+    return;
+
+  if (priv->has_embedded_objects ||
+      priv->context == NULL ||
+      priv->file == NULL ||
+      NULL == (gfile = ide_file_get_file (priv->file)))
+    {
+      if ((content = ide_buffer_get_content (self)))
+        g_bytes_unref (content);
+      return;
+    }
+
+  /*
+   * Hand the snapshot to the unsaved files without flattening it. Whoever
+   * needs the contents as contiguous bytes will do that from their own
+   * thread with ide_unsaved_file_get_content().
+   */
+  priv->snapshot =
+    _ide_buffer_snapshot_set_trailing_newline (ide_buffer_ensure_snapshot (self),
+                                               gtk_source_buffer_get_implicit_trailing_newline (GTK_SOURCE_BUFFER (self)));
+  unsaved_files = ide_context_get_unsaved_files (priv->context);
+  _ide_unsaved_files_update_snapshot (unsaved_files, gfile, priv->snapshot);
+  priv->snapshot_synced = TRUE;
 }
 
 static void
@@ -320,7 +390,7 @@ ide_buffer_clear_diagnostics (IdeBuffer *self)
   g_assert (IDE_IS_BUFFER (self));
 
   if (priv->diagnostics_line_cache != NULL)
-    g_hash_table_remove_all (priv->diagnostics_line_cache);
+    _ide_line_intervals_clear (priv->diagnostics_line_cache);
 
   gtk_text_buffer_get_bounds (buffer, &begin, &end);
 
@@ -346,10 +416,6 @@ ide_buffer_cache_diagnostic_line (IdeBuffer             *self,
                                   IdeDiagnosticSeverity  severity)
 {
   IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
-  gpointer new_value = GINT_TO_POINTER (severity);
-  gsize line_begin;
-  gsize line_end;
-  gsize i;
 
   g_assert (IDE_IS_BUFFER (self));
   g_assert (begin);
@@ -358,21 +424,11 @@ ide_buffer_cache_diagnostic_line (IdeBuffer             *self,
   if (!priv->diagnostics_line_cache)
     return;
 
-  line_begin = MIN (ide_source_location_get_line (begin),
-                    ide_source_location_get_line (end));
-  line_end = MAX (ide_source_location_get_line (begin),
-                  ide_source_location_get_line (end));
-
-  for (i = line_begin; i <= line_end; i++)
-    {
-      gpointer old_value;
-      gpointer key = GINT_TO_POINTER (i);
-
-      old_value = g_hash_table_lookup (priv->diagnostics_line_cache, key);
-
-      if (new_value > old_value)
-        g_hash_table_replace (priv->diagnostics_line_cache, key, new_value);
-    }
+  /* Overlapping diagnostics resolve to the highest severity for the line */
+  _ide_line_intervals_add (priv->diagnostics_line_cache,
+                           ide_source_location_get_line (begin),
+                           ide_source_location_get_line (end),
+                           severity);
 }
 
 static void
@@ -613,6 +669,10 @@ ide_buffer_reload_change_monitor (IdeBuffer *self)
       g_clear_object (&priv->change_monitor);
     }
 
+  /* The window of a large file does not match what the VCS has */
+  if (priv->large_file != NULL)
+    return;
+
   if (priv->context && priv->file)
     {
       IdeVcs *vcs;
@@ -681,6 +741,7 @@ ide_buffer_changed (GtkTextBuffer *buffer)
   GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->changed (buffer);
 
   priv->change_count++;
+  priv->snapshot_synced = FALSE;
 
   g_clear_pointer (&priv->content, g_bytes_unref);
 }
@@ -690,8 +751,28 @@ ide_buffer_delete_range (GtkTextBuffer *buffer,
                          GtkTextIter   *start,
                          GtkTextIter   *end)
 {
+  IdeBuffer *self = (IdeBuffer *)buffer;
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
   IDE_ENTRY;
 
+  gtk_text_iter_order (start, end);
+
+  /*
+   * Joining lines moves the diagnostics below the deleted range up, so the
+   * gutter stays accurate until the next diagnosis completes.
+   */
+  if (priv->diagnostics_line_cache != NULL)
+    {
+      guint begin_line = gtk_text_iter_get_line (start);
+      guint end_line = gtk_text_iter_get_line (end);
+
+      if (end_line > begin_line)
+        _ide_line_intervals_remove_lines (priv->diagnostics_line_cache,
+                                          begin_line + 1,
+                                          end_line - begin_line);
+    }
+
 #ifdef IDE_ENABLE_TRACE
   {
     gint begin_line, begin_offset;
@@ -708,6 +789,11 @@ ide_buffer_delete_range (GtkTextBuffer *buffer,
   }
 #endif
 
+  if (priv->snapshot != NULL)
+    priv->snapshot = _ide_buffer_snapshot_delete (priv->snapshot,
+                                                  gtk_text_iter_get_offset (start),
+                                                  gtk_text_iter_get_offset (end));
+
   GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->delete_range (buffer, start, end);
 
   ide_buffer_emit_cursor_moved (IDE_BUFFER (buffer));
@@ -721,6 +807,8 @@ ide_buffer_insert_text (GtkTextBuffer *buffer,
                         const gchar   *text,
                         gint           len)
 {
+  IdeBuffer *self = (IdeBuffer *)buffer;
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
   gboolean check_modeline = FALSE;
 
   g_assert (IDE_IS_BUFFER (buffer));
@@ -737,6 +825,35 @@ ide_buffer_insert_text (GtkTextBuffer *buffer,
       ((text [0] == '\n') || ((len > 1) && (strchr (text, '\n') != NULL))))
     check_modeline = TRUE;
 
+  if (len < 0)
+    len = strlen (text);
+
+  if (priv->snapshot != NULL)
+    priv->snapshot = _ide_buffer_snapshot_insert (priv->snapshot,
+                                                  gtk_text_iter_get_offset (location),
+                                                  text,
+                                                  len);
+
+  /* Move diagnostics below the insertion down with the text they belong to */
+  if (priv->diagnostics_line_cache != NULL)
+    {
+      const gchar *pos = text;
+      const gchar *end = text + len;
+      guint n_lines = 0;
+
+      while (NULL != (pos = memchr (pos, '\n', end - pos)))
+        {
+          n_lines++;
+          pos++;
+        }
+
+      if (n_lines > 0)
+        _ide_line_intervals_insert_lines (priv->diagnostics_line_cache,
+                                          gtk_text_iter_get_line (location) +
+                                          !gtk_text_iter_starts_line (location),
+                                          n_lines);
+    }
+
   GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->insert_text (buffer, location, text, len);
 
   ide_buffer_emit_cursor_moved (IDE_BUFFER (buffer));
@@ -745,6 +862,56 @@ ide_buffer_insert_text (GtkTextBuffer *buffer,
     ide_buffer_do_modeline (IDE_BUFFER (buffer));
 }
 
+/*
+ * Embedded objects take up a single character in the buffer. Track them as
+ * U+FFFC in the snapshot so that character offsets stay in sync, but since
+ * gtk_text_buffer_get_text() skips them, fall back to copying the text out
+ * of the buffer in ide_buffer_get_content() once we have seen one.
+ */
+#define OBJECT_REPLACEMENT_CHAR "\xEF\xBF\xBC"
+
+static void
+ide_buffer_insert_pixbuf (GtkTextBuffer *buffer,
+                          GtkTextIter   *location,
+                          GdkPixbuf     *pixbuf)
+{
+  IdeBuffer *self = (IdeBuffer *)buffer;
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_assert (IDE_IS_BUFFER (self));
+
+  priv->has_embedded_objects = TRUE;
+
+  if (priv->snapshot != NULL)
+    priv->snapshot = _ide_buffer_snapshot_insert (priv->snapshot,
+                                                  gtk_text_iter_get_offset (location),
+                                                  OBJECT_REPLACEMENT_CHAR,
+                                                  strlen (OBJECT_REPLACEMENT_CHAR));
+
+  GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->insert_pixbuf (buffer, location, pixbuf);
+}
+
+static void
+ide_buffer_insert_child_anchor (GtkTextBuffer      *buffer,
+                                GtkTextIter        *location,
+                                GtkTextChildAnchor *anchor)
+{
+  IdeBuffer *self = (IdeBuffer *)buffer;
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_assert (IDE_IS_BUFFER (self));
+
+  priv->has_embedded_objects = TRUE;
+
+  if (priv->snapshot != NULL)
+    priv->snapshot = _ide_buffer_snapshot_insert (priv->snapshot,
+                                                  gtk_text_iter_get_offset (location),
+                                                  OBJECT_REPLACEMENT_CHAR,
+                                                  strlen (OBJECT_REPLACEMENT_CHAR));
+
+  GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->insert_child_anchor (buffer, location, anchor);
+}
+
 static void
 ide_buffer_mark_set (GtkTextBuffer     *buffer,
                      const GtkTextIter *iter,
@@ -1263,9 +1430,11 @@ ide_buffer_dispose (GObject *object)
 
   egg_signal_group_set_target (priv->diagnostics_manager_signals, NULL);
 
-  g_clear_pointer (&priv->diagnostics_line_cache, g_hash_table_unref);
+  g_clear_pointer (&priv->diagnostics_line_cache, _ide_line_intervals_free);
   g_clear_pointer (&priv->diagnostics, ide_diagnostics_unref);
   g_clear_pointer (&priv->content, g_bytes_unref);
+  g_clear_pointer (&priv->snapshot, _ide_buffer_snapshot_unref);
+  g_clear_pointer (&priv->large_file, _ide_large_file_unref);
   g_clear_pointer (&priv->title, g_free);
   g_clear_object (&priv->file);
   g_clear_object (&priv->highlight_engine);
@@ -1406,6 +1575,8 @@ ide_buffer_class_init (IdeBufferClass *klass)
   text_buffer_class->changed = ide_buffer_changed;
   text_buffer_class->delete_range = ide_buffer_delete_range;
   text_buffer_class->insert_text = ide_buffer_insert_text;
+  text_buffer_class->insert_pixbuf = ide_buffer_insert_pixbuf;
+  text_buffer_class->insert_child_anchor = ide_buffer_insert_child_anchor;
   text_buffer_class->mark_set = ide_buffer_mark_set;
 
   properties [PROP_BUSY] =
@@ -1558,6 +1729,7 @@ ide_buffer_init (IdeBuffer *self)
   IDE_ENTRY;
 
   priv->highlight_diagnostics = TRUE;
+  priv->snapshot = _ide_buffer_snapshot_new ();
 
   priv->file_signals = egg_signal_group_new (IDE_TYPE_FILE);
   egg_signal_group_connect_object (priv->file_signals,
@@ -1571,7 +1743,7 @@ ide_buffer_init (IdeBuffer *self)
                                    self,
                                    G_CONNECT_SWAPPED);
 
-  priv->diagnostics_line_cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->diagnostics_line_cache = _ide_line_intervals_new ();
 
   priv->diagnostics_manager_signals = egg_signal_group_new (IDE_TYPE_DIAGNOSTICS_MANAGER);
   egg_signal_group_connect_object (priv->diagnostics_manager_signals,
@@ -1685,6 +1857,87 @@ ide_buffer_get_context (IdeBuffer *self)
   return priv->context;
 }
 
+static inline IdeBufferLineFlags
+severity_to_line_flags (IdeDiagnosticSeverity severity)
+{
+  switch (severity)
+    {
+    case IDE_DIAGNOSTIC_FATAL:
+    case IDE_DIAGNOSTIC_ERROR:
+      return IDE_BUFFER_LINE_FLAGS_ERROR;
+
+    case IDE_DIAGNOSTIC_DEPRECATED:
+    case IDE_DIAGNOSTIC_WARNING:
+      return IDE_BUFFER_LINE_FLAGS_WARNING;
+
+    case IDE_DIAGNOSTIC_NOTE:
+      return IDE_BUFFER_LINE_FLAGS_NOTE;
+
+    case IDE_DIAGNOSTIC_IGNORED:
+    default:
+      return 0;
+    }
+}
+
+typedef struct
+{
+  IdeBufferLineFlags *flags;
+  guint               begin_line;
+} DiagnosticLineFlags;
+
+static void
+collect_diagnostic_line_flags (guint    begin_line,
+                               guint    end_line,
+                               guint    value,
+                               gpointer user_data)
+{
+  DiagnosticLineFlags *state = user_data;
+  IdeBufferLineFlags flags = severity_to_line_flags (value);
+  guint i;
+
+  for (i = begin_line; i <= end_line; i++)
+    state->flags [i - state->begin_line] |= flags;
+}
+
+/**
+ * _ide_buffer_get_diagnostic_line_flags:
+ * @self: An #IdeBuffer.
+ * @begin_line: the first line.
+ * @end_line: the last line, inclusive.
+ * @flags: (array): an array of (@end_line - @begin_line + 1) flags.
+ *
+ * Fills @flags with the diagnostic flags of a range of lines, such as the
+ * visible area of a view. This only requires a single lookup for the whole
+ * range rather than one per line.
+ */
+void
+_ide_buffer_get_diagnostic_line_flags (IdeBuffer          *self,
+                                       guint               begin_line,
+                                       guint               end_line,
+                                       IdeBufferLineFlags *flags)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+  DiagnosticLineFlags state;
+
+  g_return_if_fail (IDE_IS_BUFFER (self));
+  g_return_if_fail (begin_line <= end_line);
+  g_return_if_fail (flags != NULL);
+
+  memset (flags, 0, sizeof *flags * (end_line - begin_line + 1));
+
+  if (priv->diagnostics_line_cache == NULL)
+    return;
+
+  state.flags = flags;
+  state.begin_line = begin_line;
+
+  _ide_line_intervals_foreach (priv->diagnostics_line_cache,
+                               begin_line,
+                               end_line,
+                               collect_diagnostic_line_flags,
+                               &state);
+}
+
 /**
  * ide_buffer_get_line_flags:
  * @self: A #IdeBuffer.
@@ -1704,32 +1957,7 @@ ide_buffer_get_line_flags (IdeBuffer *self,
   IdeBufferLineChange change = 0;
 
   if (priv->diagnostics_line_cache)
-    {
-      gpointer key = GINT_TO_POINTER (line);
-      gpointer value;
-
-      value = g_hash_table_lookup (priv->diagnostics_line_cache, key);
-
-      switch (GPOINTER_TO_INT (value))
-        {
-        case IDE_DIAGNOSTIC_FATAL:
-        case IDE_DIAGNOSTIC_ERROR:
-          flags |= IDE_BUFFER_LINE_FLAGS_ERROR;
-          break;
-
-        case IDE_DIAGNOSTIC_DEPRECATED:
-        case IDE_DIAGNOSTIC_WARNING:
-          flags |= IDE_BUFFER_LINE_FLAGS_WARNING;
-          break;
-
-        case IDE_DIAGNOSTIC_NOTE:
-          flags |= IDE_BUFFER_LINE_FLAGS_NOTE;
-          break;
-
-        default:
-          break;
-        }
-    }
+    flags |= severity_to_line_flags (_ide_line_intervals_lookup (priv->diagnostics_line_cache, line));
 
   if (priv->change_monitor)
     {
@@ -1829,7 +2057,8 @@ ide_buffer_get_diagnostic_at_iter (IdeBuffer         *self,
       IdeDiagnostic *diagnostic = NULL;
       IdeBufferLineFlags flags;
       guint distance = G_MAXUINT;
-      gsize size;
+      gsize begin = 0;
+      gsize end;
       gsize i;
       guint line;
 
@@ -1839,9 +2068,15 @@ ide_buffer_get_diagnostic_at_iter (IdeBuffer         *self,
       if ((flags & IDE_BUFFER_LINE_FLAGS_DIAGNOSTICS_MASK) == 0)
         return NULL;
 
-      size = ide_diagnostics_get_size (priv->diagnostics);
+      end = ide_diagnostics_get_size (priv->diagnostics);
+
+      /*
+       * Diagnostics from the diagnostics manager are sorted by location,
+       * so we only need to look at those on this line.
+       */
+      _ide_diagnostics_lookup_line (priv->diagnostics, line, &begin, &end);
 
-      for (i = 0; i < size; i++)
+      for (i = begin; i < end; i++)
         {
           IdeDiagnostic *diag;
           IdeSourceLocation *location;
@@ -1928,7 +2163,33 @@ ide_buffer_get_content (IdeBuffer *self)
 
   g_return_val_if_fail (IDE_IS_BUFFER (self), NULL);
 
-  if (!priv->content)
+  if (!priv->content && !priv->has_embedded_objects)
+    {
+      IdeUnsavedFiles *unsaved_files;
+      GFile *gfile = NULL;
+
+      /*
+       * The snapshot already mirrors the buffer text, so all we need to do is
+       * flatten it (which reuses the cached bytes if a consumer of the unsaved
+       * files already did so).
+       */
+      priv->snapshot =
+        _ide_buffer_snapshot_set_trailing_newline (ide_buffer_ensure_snapshot (self),
+                                                   gtk_source_buffer_get_implicit_trailing_newline (GTK_SOURCE_BUFFER (self)));
+      priv->content = g_bytes_ref (_ide_buffer_snapshot_get_bytes (priv->snapshot));
+
+      if (!priv->snapshot_synced &&
+          (priv->large_file == NULL) &&
+          (priv->context != NULL) &&
+          (priv->file != NULL) &&
+          (gfile = ide_file_get_file (priv->file)))
+        {
+          unsaved_files = ide_context_get_unsaved_files (priv->context);
+          _ide_unsaved_files_update_snapshot (unsaved_files, gfile, priv->snapshot);
+          priv->snapshot_synced = TRUE;
+        }
+    }
+  else if (!priv->content)
     {
       IdeUnsavedFiles *unsaved_files;
       gchar *text;
@@ -2198,6 +2459,351 @@ _ide_buffer_set_read_only (IdeBuffer *self,
     }
 }
 
+gboolean
+_ide_buffer_get_deferred (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_return_val_if_fail (IDE_IS_BUFFER (self), FALSE);
+
+  return priv->deferred;
+}
+
+/**
+ * _ide_buffer_set_deferred:
+ * @self: An #IdeBuffer.
+ * @deferred: if background work should be deferred.
+ *
+ * Buffers that are restored in the background are marked as deferred so
+ * that semantic highlighting and diagnostics are not performed until the
+ * buffer is first focused, or the buffer manager decides the system is
+ * idle enough to catch up.
+ */
+void
+_ide_buffer_set_deferred (IdeBuffer *self,
+                          gboolean   deferred)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_BUFFER (self));
+
+  deferred = !!deferred;
+
+  if (deferred != priv->deferred)
+    {
+      priv->deferred = deferred;
+
+      if (!deferred)
+        {
+          IdeDiagnosticsManager *diagnostics_manager;
+
+          IDE_TRACE_MSG ("Resuming deferred buffer \"%s\"", ide_buffer_get_title (self));
+
+          ide_buffer_rehighlight (self);
+
+          if (priv->context != NULL)
+            {
+              diagnostics_manager = ide_context_get_diagnostics_manager (priv->context);
+              _ide_diagnostics_manager_queue_diagnose (diagnostics_manager, self);
+            }
+        }
+    }
+
+  IDE_EXIT;
+}
+
+/**
+ * _ide_buffer_trim:
+ * @self: An #IdeBuffer.
+ *
+ * Releases state derived from the buffer contents, for buffers that have not
+ * been focused in a long time. Semantic highlighting is removed and the buffer
+ * is deferred so that it is not rebuilt (nor diagnosed) until the buffer is
+ * focused again. Unmodified buffers also release their snapshot of the text,
+ * which is rebuilt from the buffer when it is next needed.
+ */
+void
+_ide_buffer_trim (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_BUFFER (self));
+
+  /* Large files only hold a small window of the file already */
+  if (priv->large_file != NULL)
+    IDE_EXIT;
+
+  /* Still visible, such as in a split that does not have focus */
+  if (priv->n_mapped_views > 0)
+    IDE_EXIT;
+
+  IDE_TRACE_MSG ("Trimming idle buffer \"%s\"", ide_buffer_get_title (self));
+
+  _ide_buffer_set_deferred (self, TRUE);
+
+  if (priv->highlight_engine != NULL)
+    ide_highlight_engine_clear (priv->highlight_engine);
+
+  g_clear_pointer (&priv->content, g_bytes_unref);
+
+  if (!gtk_text_buffer_get_modified (GTK_TEXT_BUFFER (self)))
+    g_clear_pointer (&priv->snapshot, _ide_buffer_snapshot_unref);
+
+  IDE_EXIT;
+}
+
+/**
+ * _ide_buffer_add_mapped_view:
+ * @self: An #IdeBuffer.
+ *
+ * Called by #IdeSourceView when a view of @self is mapped. Buffers with a
+ * mapped view are visible even when they are not focused, so they are not
+ * trimmed, and if they were trimmed (or deferred) before, their highlighting
+ * and diagnostics are restored right away.
+ */
+void
+_ide_buffer_add_mapped_view (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_return_if_fail (IDE_IS_BUFFER (self));
+
+  priv->n_mapped_views++;
+
+  if (priv->deferred)
+    _ide_buffer_set_deferred (self, FALSE);
+}
+
+void
+_ide_buffer_remove_mapped_view (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_return_if_fail (IDE_IS_BUFFER (self));
+  g_return_if_fail (priv->n_mapped_views > 0);
+
+  priv->n_mapped_views--;
+}
+
+gboolean
+_ide_buffer_get_mapped (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_return_val_if_fail (IDE_IS_BUFFER (self), FALSE);
+
+  return priv->n_mapped_views > 0;
+}
+
+IdeLargeFile *
+_ide_buffer_get_large_file (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_return_val_if_fail (IDE_IS_BUFFER (self), NULL);
+
+  return priv->large_file;
+}
+
+guint
+_ide_buffer_get_large_file_first_line (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_return_val_if_fail (IDE_IS_BUFFER (self), 0);
+
+  return priv->large_file_first_line;
+}
+
+static void
+ide_buffer_set_large_file_window_cb (GObject      *object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autofree gchar *text = NULL;
+  IdeBufferPrivate *priv;
+  IdeBuffer *self;
+  GError *error = NULL;
+  GtkTextIter iter;
+  guint first_line;
+  guint n_lines;
+  gsize len;
+
+  IDE_ENTRY;
+
+  g_assert (G_IS_TASK (task));
+
+  self = g_task_get_source_object (task);
+  priv = ide_buffer_get_instance_private (self);
+
+  if (NULL == (text = _ide_large_file_get_window_finish (result, &first_line, &n_lines, &len, &error)))
+    {
+      g_task_return_error (task, error);
+      IDE_EXIT;
+    }
+
+  /* A newer window was requested while this one was being read */
+  if (priv->large_file == NULL ||
+      GPOINTER_TO_UINT (g_task_get_task_data (task)) != priv->large_file_window_serial)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_CANCELLED,
+                               "The window was replaced");
+      IDE_EXIT;
+    }
+
+  IDE_TRACE_MSG ("Showing lines %u-%u of %u",
+                 first_line, first_line + n_lines,
+                 _ide_large_file_get_n_lines (priv->large_file));
+
+  priv->large_file_first_line = first_line;
+
+  gtk_source_buffer_begin_not_undoable_action (GTK_SOURCE_BUFFER (self));
+  gtk_text_buffer_set_text (GTK_TEXT_BUFFER (self), text, len);
+  gtk_source_buffer_end_not_undoable_action (GTK_SOURCE_BUFFER (self));
+
+  gtk_text_buffer_get_start_iter (GTK_TEXT_BUFFER (self), &iter);
+  gtk_text_buffer_select_range (GTK_TEXT_BUFFER (self), &iter, &iter);
+  gtk_text_buffer_set_modified (GTK_TEXT_BUFFER (self), FALSE);
+
+  g_task_return_boolean (task, TRUE);
+
+  IDE_EXIT;
+}
+
+/**
+ * _ide_buffer_set_large_file_window_async:
+ * @self: An #IdeBuffer in large file mode.
+ * @line: A line within the large file.
+ *
+ * Replaces the contents of the buffer with a window of the large file that
+ * contains @line, (roughly) centered around it. The window may hold fewer
+ * lines than requested when they are long. Use
+ * _ide_buffer_get_large_file_first_line() to translate between lines in the
+ * buffer and lines in the file once the request completes.
+ *
+ * The window is read in a worker thread and applied from the main loop. If
+ * another window is requested in the mean time, this request fails with
+ * %G_IO_ERROR_CANCELLED and leaves the buffer alone.
+ */
+void
+_ide_buffer_set_large_file_window_async (IdeBuffer           *self,
+                                         guint                line,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+  GTask *task;
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_BUFFER (self));
+  g_return_if_fail (priv->large_file != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, _ide_buffer_set_large_file_window_async);
+  g_task_set_task_data (task, GUINT_TO_POINTER (++priv->large_file_window_serial), NULL);
+
+  _ide_large_file_get_window_async (priv->large_file,
+                                    line,
+                                    LARGE_FILE_WINDOW_LINES,
+                                    cancellable,
+                                    ide_buffer_set_large_file_window_cb,
+                                    task);
+
+  IDE_EXIT;
+}
+
+gboolean
+_ide_buffer_set_large_file_window_finish (IdeBuffer     *self,
+                                          GAsyncResult  *result,
+                                          GError       **error)
+{
+  g_return_val_if_fail (IDE_IS_BUFFER (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+ide_buffer_index_large_file_cb (GObject      *object,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+  g_autoptr(IdeBuffer) self = user_data;
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+  g_autoptr(GError) error = NULL;
+
+  g_assert (IDE_IS_BUFFER (self));
+
+  if (!_ide_large_file_index_finish (result, &error))
+    {
+      g_warning ("Failed to index large file: %s", error->message);
+      return;
+    }
+
+  /* Stop once the buffer has been closed or the file fully indexed */
+  if (priv->large_file != NULL && !_ide_large_file_get_indexed (priv->large_file))
+    _ide_large_file_index_async (priv->large_file,
+                                 NULL,
+                                 ide_buffer_index_large_file_cb,
+                                 g_steal_pointer (&self));
+}
+
+/**
+ * _ide_buffer_set_large_file:
+ * @self: An #IdeBuffer.
+ * @large_file: An #IdeLargeFile.
+ *
+ * Switches the buffer into large file mode. Only a window of @large_file is
+ * kept in the buffer at a time, the buffer is read-only, and features that
+ * would need to process the entire file (highlighting, diagnostics, change
+ * monitors, spellchecking) are disabled.
+ *
+ * The first window is read in a worker and shown once it is ready, and the
+ * rest of @large_file is indexed in the background for as long as the
+ * buffer uses it.
+ */
+void
+_ide_buffer_set_large_file (IdeBuffer    *self,
+                            IdeLargeFile *large_file)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_BUFFER (self));
+  g_return_if_fail (large_file != NULL);
+
+  g_clear_pointer (&priv->large_file, _ide_large_file_unref);
+  priv->large_file = _ide_large_file_ref (large_file);
+
+  _ide_buffer_set_read_only (self, TRUE);
+  ide_buffer_set_highlight_diagnostics (self, FALSE);
+  ide_buffer_set_spell_checking (self, FALSE);
+  gtk_source_buffer_set_highlight_syntax (GTK_SOURCE_BUFFER (self), FALSE);
+  gtk_source_buffer_set_highlight_matching_brackets (GTK_SOURCE_BUFFER (self), FALSE);
+  ide_buffer_reload_change_monitor (self);
+
+  _ide_buffer_set_large_file_window_async (self, 0, NULL, NULL, NULL);
+
+  if (!_ide_large_file_get_indexed (large_file))
+    _ide_large_file_index_async (large_file,
+                                 NULL,
+                                 ide_buffer_index_large_file_cb,
+                                 g_object_ref (self));
+
+  IDE_EXIT;
+}
+
 /**
  * ide_buffer_get_changed_on_volume:
  * @self: A #IdeBuffer.
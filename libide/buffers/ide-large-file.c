@@ -0,0 +1,804 @@
+/* ide-large-file.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-large-file"
+
+#include <egg-counter.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ide-debug.h"
+
+#include "buffers/ide-large-file.h"
+#include "threading/ide-thread-pool.h"
+
+/*
+ * IdeLargeFile provides read-only access to files that are too large to be
+ * loaded into a GtkTextBuffer, such as logs, generated sources or database
+ * dumps. Only the window being looked at is read from the file, using
+ * pread() so that a file truncated underneath us (as happens with rotated
+ * logs) results in a short read rather than a SIGBUS as with a mapping.
+ *
+ * To find lines quickly we keep the offset of every LINE_INDEX_STRIDE'th
+ * line. That keeps the index small (a few hundred kilobytes for a gigabyte
+ * of text) while only requiring a short scan from the nearest index entry
+ * to locate any given line.
+ *
+ * The index is built incrementally in worker threads. Loading only indexes
+ * enough of the file to cover the first window, so it can be shown right
+ * away, and the rest is indexed with _ide_large_file_index_async() in
+ * chunks of INDEX_CHUNK_LENGTH bytes. Lines that have not been indexed yet
+ * cannot be requested.
+ */
+
+#define LINE_INDEX_STRIDE  1024
+#define MAX_TEXT_LENGTH    (4 * 1024 * 1024)
+#define READ_BLOCK_LENGTH  (1024 * 1024)
+#define INDEX_CHUNK_LENGTH (64 * 1024 * 1024)
+
+struct _IdeLargeFile
+{
+  volatile gint  ref_count;
+  gint           fd;
+  gsize          length;
+
+  /* Held by a worker for the duration of indexing a chunk */
+  GMutex         index_mutex;
+
+  /* Protects the fields below, which are read from the main thread */
+  GMutex         mutex;
+  GArray        *line_index;
+  guint64        n_indexed;
+  guint          n_lines;
+  guint          at_line_start : 1;
+  guint          indexed : 1;
+};
+
+EGG_DEFINE_COUNTER (instances, "IdeLargeFile", "Instances", "Number of large files open.")
+
+IdeLargeFile *
+_ide_large_file_ref (IdeLargeFile *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+_ide_large_file_unref (IdeLargeFile *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_clear_pointer (&self->line_index, g_array_unref);
+      g_mutex_clear (&self->index_mutex);
+      g_mutex_clear (&self->mutex);
+
+      if (self->fd != -1)
+        close (self->fd);
+
+      g_slice_free (IdeLargeFile, self);
+
+      EGG_COUNTER_DEC (instances);
+    }
+}
+
+/*
+ * Reads up to @len bytes at @offset, stopping early only at the end of the
+ * file. Returns the number of bytes read, or -1 on error.
+ */
+static gssize
+read_fully (gint      fd,
+            guint64   offset,
+            gchar    *data,
+            gsize     len,
+            GError  **error)
+{
+  gsize total = 0;
+
+  while (total < len)
+    {
+      gssize n = pread (fd, data + total, len - total, offset + total);
+
+      if (n < 0)
+        {
+          gint errsv = errno;
+
+          if (errsv == EINTR)
+            continue;
+
+          g_set_error_literal (error,
+                               G_IO_ERROR,
+                               g_io_error_from_errno (errsv),
+                               g_strerror (errsv));
+          return -1;
+        }
+
+      if (n == 0)
+        break;
+
+      total += n;
+    }
+
+  return total;
+}
+
+/*
+ * Scans up to @max_length more bytes of the file, adding to the line index.
+ * Reaching the end of the file (which may be before the length we saw when
+ * opening it) marks the index as complete.
+ */
+static gboolean
+ide_large_file_index (IdeLargeFile  *self,
+                      guint64        max_length,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  g_autofree gchar *block = NULL;
+  guint64 scanned = 0;
+  gboolean ret = TRUE;
+
+  g_assert (self != NULL);
+
+  g_mutex_lock (&self->index_mutex);
+
+  block = g_malloc (READ_BLOCK_LENGTH);
+
+  while (!self->indexed && scanned < max_length)
+    {
+      g_autoptr(GArray) offsets = NULL;
+      const gchar *pos = block;
+      const gchar *end;
+      guint64 n_indexed;
+      guint n_lines;
+      gboolean at_line_start;
+      gssize n_read;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        {
+          ret = FALSE;
+          break;
+        }
+
+      /* Only this worker modifies these, so they may be read unlocked */
+      n_indexed = self->n_indexed;
+      n_lines = self->n_lines;
+      at_line_start = self->at_line_start;
+
+      if (-1 == (n_read = read_fully (self->fd, n_indexed, block, READ_BLOCK_LENGTH, error)))
+        {
+          ret = FALSE;
+          break;
+        }
+
+      offsets = g_array_new (FALSE, FALSE, sizeof (guint64));
+      end = block + n_read;
+
+      while (pos < end)
+        {
+          const gchar *nl;
+
+          if (at_line_start)
+            {
+              if ((n_lines % LINE_INDEX_STRIDE) == 0)
+                {
+                  guint64 offset = n_indexed + (pos - block);
+                  g_array_append_val (offsets, offset);
+                }
+
+              n_lines++;
+              at_line_start = FALSE;
+            }
+
+          if (NULL == (nl = memchr (pos, '\n', end - pos)))
+            break;
+
+          pos = nl + 1;
+          at_line_start = TRUE;
+        }
+
+      g_mutex_lock (&self->mutex);
+      g_array_append_vals (self->line_index, offsets->data, offsets->len);
+      self->n_indexed = n_indexed + n_read;
+      self->n_lines = n_lines;
+      self->at_line_start = at_line_start;
+      self->indexed = (n_read < READ_BLOCK_LENGTH);
+      g_mutex_unlock (&self->mutex);
+
+      scanned += n_read;
+    }
+
+  g_mutex_unlock (&self->index_mutex);
+
+  return ret;
+}
+
+static void
+ide_large_file_load_worker (GTask        *task,
+                            gpointer      source_object,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+  GFile *file = task_data;
+  g_autofree gchar *path = NULL;
+  g_autoptr(IdeLargeFile) self = NULL;
+  struct stat stbuf;
+  GError *error = NULL;
+  gint fd;
+
+  IDE_ENTRY;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (G_IS_FILE (file));
+
+  if (NULL == (path = g_file_get_path (file)))
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_NOT_SUPPORTED,
+                               "Large files must be on a local filesystem");
+      IDE_EXIT;
+    }
+
+  fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+
+  if (fd == -1 || fstat (fd, &stbuf) != 0)
+    {
+      gint errsv = errno;
+
+      if (fd != -1)
+        close (fd);
+
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               g_io_error_from_errno (errsv),
+                               "Failed to open \"%s\": %s",
+                               path, g_strerror (errsv));
+      IDE_EXIT;
+    }
+
+  self = g_slice_new0 (IdeLargeFile);
+  self->ref_count = 1;
+  self->fd = fd;
+  self->length = stbuf.st_size;
+  self->line_index = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+                                        (self->length / 64 / LINE_INDEX_STRIDE) + 1);
+  self->at_line_start = TRUE;
+  g_mutex_init (&self->index_mutex);
+  g_mutex_init (&self->mutex);
+
+  EGG_COUNTER_INC (instances);
+
+  /* A window is never longer than MAX_TEXT_LENGTH, so this covers the first */
+  if (!ide_large_file_index (self, MAX_TEXT_LENGTH, cancellable, &error))
+    {
+      g_task_return_error (task, error);
+      IDE_EXIT;
+    }
+
+  IDE_TRACE_MSG ("Indexed %u lines of \"%s\" before loading", self->n_lines, path);
+
+  g_task_return_pointer (task, g_steal_pointer (&self), (GDestroyNotify)_ide_large_file_unref);
+
+  IDE_EXIT;
+}
+
+/**
+ * _ide_large_file_load_async:
+ * @file: a #GFile on a local filesystem
+ *
+ * Opens @file and indexes enough of it to show the first window in a
+ * worker thread. Use _ide_large_file_index_async() to index the rest.
+ */
+void
+_ide_large_file_load_async (GFile               *file,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, _ide_large_file_load_async);
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+  g_task_run_in_thread (task, ide_large_file_load_worker);
+}
+
+IdeLargeFile *
+_ide_large_file_load_finish (GAsyncResult  *result,
+                             GError       **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+ide_large_file_index_worker (GTask        *task,
+                             gpointer      source_object,
+                             gpointer      task_data,
+                             GCancellable *cancellable)
+{
+  IdeLargeFile *self = task_data;
+  GError *error = NULL;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (self != NULL);
+
+  if (!ide_large_file_index (self, INDEX_CHUNK_LENGTH, cancellable, &error))
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * _ide_large_file_index_async:
+ * @self: an #IdeLargeFile
+ *
+ * Indexes the next chunk of @self in a worker thread. Call this again
+ * until _ide_large_file_get_indexed() returns %TRUE. Splitting the work up
+ * this way lets the caller stop indexing once it no longer needs the file.
+ */
+void
+_ide_large_file_index_async (IdeLargeFile        *self,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, _ide_large_file_index_async);
+  g_task_set_task_data (task, _ide_large_file_ref (self), (GDestroyNotify)_ide_large_file_unref);
+  g_task_run_in_thread (task, ide_large_file_index_worker);
+}
+
+gboolean
+_ide_large_file_index_finish (GAsyncResult  *result,
+                              GError       **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * _ide_large_file_get_indexed:
+ * @self: an #IdeLargeFile
+ *
+ * Returns: %TRUE if the whole file has been indexed.
+ */
+gboolean
+_ide_large_file_get_indexed (IdeLargeFile *self)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  g_mutex_lock (&self->mutex);
+  ret = self->indexed;
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
+
+/**
+ * _ide_large_file_get_n_lines:
+ * @self: an #IdeLargeFile
+ *
+ * Gets the number of lines indexed so far, which is the number of lines in
+ * the file once _ide_large_file_get_indexed() returns %TRUE.
+ */
+guint
+_ide_large_file_get_n_lines (IdeLargeFile *self)
+{
+  guint ret;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->mutex);
+  ret = self->n_lines;
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
+
+gsize
+_ide_large_file_get_size (IdeLargeFile *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->length;
+}
+
+/*
+ * Finds the offset of the line @n_lines after the one starting at @offset.
+ * If the file ends first, the end of the file is returned.
+ */
+static guint64
+ide_large_file_skip_lines (IdeLargeFile *self,
+                           guint64       offset,
+                           guint         n_lines)
+{
+  g_autofree gchar *block = NULL;
+
+  if (n_lines == 0)
+    return offset;
+
+  block = g_malloc (READ_BLOCK_LENGTH);
+
+  for (;;)
+    {
+      const gchar *pos = block;
+      const gchar *end;
+      gssize n_read;
+
+      n_read = read_fully (self->fd, offset, block, READ_BLOCK_LENGTH, NULL);
+      if (n_read <= 0)
+        return offset;
+
+      end = block + n_read;
+
+      while (n_lines > 0)
+        {
+          const gchar *nl;
+
+          if (NULL == (nl = memchr (pos, '\n', end - pos)))
+            break;
+
+          pos = nl + 1;
+          n_lines--;
+        }
+
+      if (n_lines == 0 || n_read < READ_BLOCK_LENGTH)
+        return offset + (pos - block);
+
+      offset += n_read;
+    }
+}
+
+/*
+ * Moves @pos forward by up to @n_lines lines without passing @end. A line
+ * that is not terminated before @end only counts if @at_end is set, as it
+ * may otherwise continue past what was read.
+ */
+static guint
+forward_lines (const gchar **pos,
+               const gchar  *end,
+               guint         n_lines,
+               gboolean      at_end)
+{
+  guint count = 0;
+
+  while (count < n_lines && *pos < end)
+    {
+      const gchar *nl;
+
+      if (NULL != (nl = memchr (*pos, '\n', end - *pos)))
+        *pos = nl + 1;
+      else if (at_end)
+        *pos = end;
+      else
+        break;
+
+      count++;
+    }
+
+  return count;
+}
+
+/*
+ * Moves @pos, which must be at the start of a line, back by up to @n_lines
+ * lines without passing @begin. A line starting before @begin (unless
+ * @at_start is set) does not count, as only part of it was read.
+ */
+static guint
+backward_lines (const gchar **pos,
+                const gchar  *begin,
+                guint         n_lines,
+                gboolean      at_start)
+{
+  guint count = 0;
+
+  while (count < n_lines && *pos > begin)
+    {
+      const gchar *line = *pos - 1;
+
+      /* line[0] is the newline terminating the previous line */
+      while (line > begin && line [-1] != '\n')
+        line--;
+
+      if (line == begin && !at_start)
+        break;
+
+      *pos = line;
+      count++;
+    }
+
+  return count;
+}
+
+/*
+ * Copies @len bytes of @str into @gstr, replacing invalid UTF-8 (and
+ * embedded NUL bytes) with U+FFFD so that it may be inserted into a
+ * GtkTextBuffer.
+ */
+static void
+append_valid_utf8 (GString     *gstr,
+                   const gchar *str,
+                   gsize        len)
+{
+  while (len > 0)
+    {
+      const gchar *invalid;
+      gsize valid;
+
+      if (g_utf8_validate (str, len, &invalid))
+        {
+          g_string_append_len (gstr, str, len);
+          break;
+        }
+
+      valid = invalid - str;
+      g_string_append_len (gstr, str, valid);
+      g_string_append (gstr, "\xEF\xBF\xBD");
+
+      str += valid + 1;
+      len -= valid + 1;
+    }
+}
+
+/**
+ * _ide_large_file_get_window:
+ * @self: an #IdeLargeFile
+ * @line: the line the window should contain
+ * @max_lines: the maximum number of lines in the window
+ * @first_line: (out): the first line of the window
+ * @n_lines: (out): the number of lines in the window
+ * @length: (out): the length of the result in bytes
+ *
+ * Reads a window of up to @max_lines lines around @line, as valid UTF-8
+ * suitable for a GtkTextBuffer. The window is positioned by byte offset so
+ * that @line is always part of it, even when the lines around it are too
+ * long to fit @max_lines of them in the few megabytes that are read. A
+ * single line longer than that is truncated.
+ *
+ * @line is clamped to the lines indexed so far.
+ *
+ * Returns: (transfer full): a newly allocated string.
+ */
+gchar *
+_ide_large_file_get_window (IdeLargeFile *self,
+                            guint         line,
+                            guint         max_lines,
+                            guint        *first_line,
+                            guint        *n_lines,
+                            gsize        *length)
+{
+  g_autofree gchar *data = NULL;
+  const gchar *begin;
+  const gchar *last;
+  const gchar *end;
+  GString *str;
+  guint64 target;
+  guint64 offset;
+  gssize n_read;
+  gboolean at_end;
+  guint before;
+  guint after;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (max_lines > 0, NULL);
+  g_return_val_if_fail (first_line != NULL, NULL);
+  g_return_val_if_fail (n_lines != NULL, NULL);
+  g_return_val_if_fail (length != NULL, NULL);
+
+  *first_line = 0;
+  *n_lines = 0;
+  *length = 0;
+
+  g_mutex_lock (&self->mutex);
+  if (self->n_lines == 0)
+    {
+      g_mutex_unlock (&self->mutex);
+      return g_strdup ("");
+    }
+  line = MIN (line, self->n_lines - 1);
+  target = g_array_index (self->line_index, guint64, line / LINE_INDEX_STRIDE);
+  g_mutex_unlock (&self->mutex);
+
+  target = ide_large_file_skip_lines (self, target, line % LINE_INDEX_STRIDE);
+
+  /*
+   * Read MAX_TEXT_LENGTH bytes centered on the target line, or shifted
+   * towards the middle of the file when it is near either end.
+   */
+  offset = target - MIN (target, MAX_TEXT_LENGTH / 2);
+  if (self->length > MAX_TEXT_LENGTH)
+    offset = MIN (offset, self->length - MAX_TEXT_LENGTH);
+  else
+    offset = 0;
+  offset = MIN (offset, target);
+
+  data = g_malloc (MAX_TEXT_LENGTH);
+
+  if (-1 == (n_read = read_fully (self->fd, offset, data, MAX_TEXT_LENGTH, NULL)))
+    n_read = 0;
+
+  /* The file may have been truncated since the index was built */
+  end = data + n_read;
+  at_end = (n_read < MAX_TEXT_LENGTH || offset + n_read >= self->length);
+  begin = last = data + MIN (target - offset, (guint64)n_read);
+
+  /* Take half of the lines after the target, then fill in before it */
+  after = forward_lines (&last, end, (max_lines + 1) / 2, at_end);
+  if (after == 0 && last < end)
+    {
+      last = end;
+      after = 1;
+    }
+  before = backward_lines (&begin, data, max_lines - after, offset == 0);
+  after += forward_lines (&last, end, max_lines - after - before, at_end);
+
+  /* Don't leave a trailing newline, GtkTextBuffer will show an empty line */
+  if (last > begin && last [-1] == '\n')
+    last--;
+
+  str = g_string_sized_new (last - begin + 1);
+  append_valid_utf8 (str, begin, last - begin);
+
+  *first_line = line - MIN (line, before);
+  *n_lines = before + after;
+  *length = str->len;
+
+  return g_string_free (str, FALSE);
+}
+
+typedef struct
+{
+  IdeLargeFile *large_file;
+  guint         line;
+  guint         max_lines;
+  guint         first_line;
+  guint         n_lines;
+  gsize         length;
+} WindowRequest;
+
+static void
+window_request_free (gpointer data)
+{
+  WindowRequest *request = data;
+
+  g_clear_pointer (&request->large_file, _ide_large_file_unref);
+  g_slice_free (WindowRequest, request);
+}
+
+static void
+ide_large_file_get_window_worker (GTask        *task,
+                                  gpointer      source_object,
+                                  gpointer      task_data,
+                                  GCancellable *cancellable)
+{
+  WindowRequest *request = task_data;
+  gchar *text;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (request != NULL);
+
+  text = _ide_large_file_get_window (request->large_file,
+                                     request->line,
+                                     request->max_lines,
+                                     &request->first_line,
+                                     &request->n_lines,
+                                     &request->length);
+
+  g_task_return_pointer (task, text, g_free);
+}
+
+/**
+ * _ide_large_file_get_window_async:
+ * @self: an #IdeLargeFile
+ * @line: the line the window should contain
+ * @max_lines: the maximum number of lines in the window
+ *
+ * Like _ide_large_file_get_window(), but reads the window on the compiler
+ * lane of the #IdeThreadPool so that the main loop does not wait on the
+ * disk. The request is queued as interactive work since the user is
+ * waiting to see those lines.
+ */
+void
+_ide_large_file_get_window_async (IdeLargeFile        *self,
+                                  guint                line,
+                                  guint                max_lines,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  WindowRequest *request;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (max_lines > 0);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  request = g_slice_new0 (WindowRequest);
+  request->large_file = _ide_large_file_ref (self);
+  request->line = line;
+  request->max_lines = max_lines;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, _ide_large_file_get_window_async);
+  g_task_set_task_data (task, request, window_request_free);
+  ide_thread_pool_push_task_with_priority (IDE_THREAD_POOL_COMPILER,
+                                           IDE_THREAD_POOL_PRIORITY_INTERACTIVE,
+                                           task,
+                                           ide_large_file_get_window_worker);
+}
+
+/**
+ * _ide_large_file_get_window_finish:
+ * @first_line: (out): the first line of the window
+ * @n_lines: (out): the number of lines in the window
+ * @length: (out): the length of the result in bytes
+ *
+ * Completes a request to _ide_large_file_get_window_async().
+ *
+ * Returns: (transfer full): a newly allocated string, or %NULL and @error
+ *   is set.
+ */
+gchar *
+_ide_large_file_get_window_finish (GAsyncResult  *result,
+                                   guint         *first_line,
+                                   guint         *n_lines,
+                                   gsize         *length,
+                                   GError       **error)
+{
+  WindowRequest *request;
+  gchar *ret;
+
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+  g_return_val_if_fail (first_line != NULL, NULL);
+  g_return_val_if_fail (n_lines != NULL, NULL);
+  g_return_val_if_fail (length != NULL, NULL);
+
+  request = g_task_get_task_data (G_TASK (result));
+
+  if (NULL != (ret = g_task_propagate_pointer (G_TASK (result), error)))
+    {
+      *first_line = request->first_line;
+      *n_lines = request->n_lines;
+      *length = request->length;
+    }
+
+  return ret;
+}
@@ -0,0 +1,67 @@
+/* ide-large-file.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_LARGE_FILE_H
+#define IDE_LARGE_FILE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IdeLargeFile IdeLargeFile;
+
+void          _ide_large_file_load_async        (GFile                *file,
+                                                 GCancellable         *cancellable,
+                                                 GAsyncReadyCallback   callback,
+                                                 gpointer              user_data);
+IdeLargeFile *_ide_large_file_load_finish       (GAsyncResult         *result,
+                                                 GError              **error);
+void          _ide_large_file_index_async       (IdeLargeFile         *self,
+                                                 GCancellable         *cancellable,
+                                                 GAsyncReadyCallback   callback,
+                                                 gpointer              user_data);
+gboolean      _ide_large_file_index_finish      (GAsyncResult         *result,
+                                                 GError              **error);
+IdeLargeFile *_ide_large_file_ref               (IdeLargeFile         *self);
+void          _ide_large_file_unref             (IdeLargeFile         *self);
+gboolean      _ide_large_file_get_indexed       (IdeLargeFile         *self);
+guint         _ide_large_file_get_n_lines       (IdeLargeFile         *self);
+gsize         _ide_large_file_get_size          (IdeLargeFile         *self);
+gchar        *_ide_large_file_get_window        (IdeLargeFile         *self,
+                                                 guint                 line,
+                                                 guint                 max_lines,
+                                                 guint                *first_line,
+                                                 guint                *n_lines,
+                                                 gsize                *length);
+void          _ide_large_file_get_window_async  (IdeLargeFile         *self,
+                                                 guint                 line,
+                                                 guint                 max_lines,
+                                                 GCancellable         *cancellable,
+                                                 GAsyncReadyCallback   callback,
+                                                 gpointer              user_data);
+gchar        *_ide_large_file_get_window_finish (GAsyncResult         *result,
+                                                 guint                *first_line,
+                                                 guint                *n_lines,
+                                                 gsize                *length,
+                                                 GError              **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeLargeFile, _ide_large_file_unref)
+
+G_END_DECLS
+
+#endif /* IDE_LARGE_FILE_H */
@@ -0,0 +1,469 @@
+/* ide-line-intervals.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-line-intervals"
+
+#include "buffers/ide-line-intervals.h"
+
+/*
+ * IdeLineIntervals maps ranges of lines to a value, such as the highest
+ * severity of the diagnostics found on those lines. Where ranges overlap,
+ * the larger value wins.
+ *
+ * The ranges are kept in an array sorted by line. Ranges added with
+ * _ide_line_intervals_add() are collected and then merged into runs that
+ * do not overlap the next time the intervals are queried. Because both the
+ * beginning and the end of the runs are sorted, we can binary search for
+ * the first run touching a line and walk forward from there, making lookups
+ * O(log n + k).
+ *
+ * When lines are inserted or removed from the buffer, the runs are shifted
+ * (or shrunk) so that they continue to point at the same text without
+ * needing to wait for the next diagnosis. Removing lines may cause two runs
+ * to share their boundary line, which lookups account for.
+ */
+
+struct _IdeLineIntervals
+{
+  GArray *runs;
+  GArray *pending;
+};
+
+typedef struct
+{
+  guint begin;
+  guint end;
+  guint value;
+} Interval;
+
+typedef struct
+{
+  guint pos;
+  guint value;
+  gint  delta;
+} Event;
+
+typedef struct
+{
+  guint value;
+  guint count;
+} Active;
+
+IdeLineIntervals *
+_ide_line_intervals_new (void)
+{
+  IdeLineIntervals *self;
+
+  self = g_slice_new0 (IdeLineIntervals);
+  self->runs = g_array_new (FALSE, FALSE, sizeof (Interval));
+  self->pending = g_array_new (FALSE, FALSE, sizeof (Interval));
+
+  return self;
+}
+
+void
+_ide_line_intervals_free (IdeLineIntervals *self)
+{
+  if (self != NULL)
+    {
+      g_clear_pointer (&self->runs, g_array_unref);
+      g_clear_pointer (&self->pending, g_array_unref);
+      g_slice_free (IdeLineIntervals, self);
+    }
+}
+
+void
+_ide_line_intervals_clear (IdeLineIntervals *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_array_set_size (self->runs, 0);
+  g_array_set_size (self->pending, 0);
+}
+
+/**
+ * _ide_line_intervals_add:
+ * @self: An #IdeLineIntervals
+ * @begin_line: the first line of the range
+ * @end_line: the last line of the range, inclusive
+ * @value: a value greater than zero
+ *
+ * Adds @value to the lines from @begin_line to @end_line.
+ */
+void
+_ide_line_intervals_add (IdeLineIntervals *self,
+                         guint             begin_line,
+                         guint             end_line,
+                         guint             value)
+{
+  Interval interval;
+
+  g_return_if_fail (self != NULL);
+
+  if (value == 0)
+    return;
+
+  interval.begin = MIN (begin_line, end_line);
+  interval.end = MIN (MAX (begin_line, end_line), G_MAXUINT - 1);
+  interval.value = value;
+
+  g_array_append_val (self->pending, interval);
+}
+
+static gint
+compare_event (gconstpointer a,
+               gconstpointer b)
+{
+  const Event *event_a = a;
+  const Event *event_b = b;
+
+  if (event_a->pos < event_b->pos)
+    return -1;
+  else if (event_a->pos > event_b->pos)
+    return 1;
+  else
+    return 0;
+}
+
+static void
+add_events (GArray *events,
+            GArray *intervals)
+{
+  guint i;
+
+  for (i = 0; i < intervals->len; i++)
+    {
+      const Interval *interval = &g_array_index (intervals, Interval, i);
+      Event event;
+
+      event.pos = interval->begin;
+      event.value = interval->value;
+      event.delta = 1;
+      g_array_append_val (events, event);
+
+      event.pos = interval->end + 1;
+      event.delta = -1;
+      g_array_append_val (events, event);
+    }
+}
+
+static void
+append_run (GArray *runs,
+            guint   begin,
+            guint   end,
+            guint   value)
+{
+  Interval run;
+
+  if (runs->len > 0)
+    {
+      Interval *last = &g_array_index (runs, Interval, runs->len - 1);
+
+      if (last->value == value && last->end + 1 >= begin)
+        {
+          last->end = MAX (last->end, end);
+          return;
+        }
+    }
+
+  run.begin = begin;
+  run.end = end;
+  run.value = value;
+
+  g_array_append_val (runs, run);
+}
+
+/*
+ * Merges the pending intervals into the runs by sweeping over the begin
+ * and end of each interval, tracking how many intervals of each value are
+ * active at any given line. There are only a handful of distinct values in
+ * practice (diagnostic severities), so a linear scan of them is fine.
+ */
+static void
+ide_line_intervals_normalize (IdeLineIntervals *self)
+{
+  g_autoptr(GArray) events = NULL;
+  g_autoptr(GArray) active = NULL;
+  GArray *runs;
+  guint i;
+
+  g_assert (self != NULL);
+
+  if (self->pending->len == 0)
+    return;
+
+  events = g_array_sized_new (FALSE, FALSE, sizeof (Event),
+                              (self->runs->len + self->pending->len) * 2);
+  active = g_array_new (FALSE, FALSE, sizeof (Active));
+
+  add_events (events, self->runs);
+  add_events (events, self->pending);
+  g_array_sort (events, compare_event);
+
+  runs = g_array_sized_new (FALSE, FALSE, sizeof (Interval), self->runs->len + self->pending->len);
+
+  for (i = 0; i < events->len;)
+    {
+      guint pos = g_array_index (events, Event, i).pos;
+      guint max_value = 0;
+      guint j;
+
+      /* Apply every event at this line before looking at the next segment */
+      for (; i < events->len && g_array_index (events, Event, i).pos == pos; i++)
+        {
+          const Event *event = &g_array_index (events, Event, i);
+          Active *item = NULL;
+
+          for (j = 0; j < active->len; j++)
+            {
+              if (g_array_index (active, Active, j).value == event->value)
+                {
+                  item = &g_array_index (active, Active, j);
+                  break;
+                }
+            }
+
+          if (item == NULL)
+            {
+              Active new_item = { event->value, 0 };
+
+              g_array_append_val (active, new_item);
+              item = &g_array_index (active, Active, active->len - 1);
+            }
+
+          item->count += event->delta;
+        }
+
+      if (i == events->len)
+        break;
+
+      for (j = 0; j < active->len; j++)
+        {
+          const Active *item = &g_array_index (active, Active, j);
+
+          if (item->count > 0 && item->value > max_value)
+            max_value = item->value;
+        }
+
+      if (max_value > 0)
+        append_run (runs, pos, g_array_index (events, Event, i).pos - 1, max_value);
+    }
+
+  g_array_unref (self->runs);
+  self->runs = runs;
+
+  g_array_set_size (self->pending, 0);
+}
+
+guint
+_ide_line_intervals_get_size (IdeLineIntervals *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  ide_line_intervals_normalize (self);
+
+  return self->runs->len;
+}
+
+/*
+ * Locates the index of the first run that ends at or after @line.
+ */
+static guint
+ide_line_intervals_bsearch (IdeLineIntervals *self,
+                            guint             line)
+{
+  guint lo = 0;
+  guint hi = self->runs->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (g_array_index (self->runs, Interval, mid).end < line)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/**
+ * _ide_line_intervals_lookup:
+ *
+ * Returns: the largest value for @line, or zero if there is none.
+ */
+guint
+_ide_line_intervals_lookup (IdeLineIntervals *self,
+                            guint             line)
+{
+  guint value = 0;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  ide_line_intervals_normalize (self);
+
+  for (i = ide_line_intervals_bsearch (self, line); i < self->runs->len; i++)
+    {
+      const Interval *run = &g_array_index (self->runs, Interval, i);
+
+      if (run->begin > line)
+        break;
+
+      value = MAX (value, run->value);
+    }
+
+  return value;
+}
+
+/**
+ * _ide_line_intervals_foreach:
+ * @self: An #IdeLineIntervals
+ * @begin_line: the first line to visit
+ * @end_line: the last line to visit, inclusive
+ * @foreach_func: (scope call): a function to call
+ * @user_data: closure data for @foreach_func
+ *
+ * Calls @foreach_func for every run overlapping @begin_line to @end_line,
+ * clamped to that range. Runs are visited in order, and two runs may share
+ * their boundary line.
+ */
+void
+_ide_line_intervals_foreach (IdeLineIntervals        *self,
+                             guint                    begin_line,
+                             guint                    end_line,
+                             IdeLineIntervalsForeach  foreach_func,
+                             gpointer                 user_data)
+{
+  guint i;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (foreach_func != NULL);
+
+  ide_line_intervals_normalize (self);
+
+  for (i = ide_line_intervals_bsearch (self, begin_line); i < self->runs->len; i++)
+    {
+      const Interval *run = &g_array_index (self->runs, Interval, i);
+
+      if (run->begin > end_line)
+        break;
+
+      foreach_func (MAX (run->begin, begin_line), MIN (run->end, end_line), run->value, user_data);
+    }
+}
+
+/**
+ * _ide_line_intervals_insert_lines:
+ * @self: An #IdeLineIntervals
+ * @line: the line that new lines were inserted before
+ * @n_lines: the number of new lines
+ *
+ * Shifts every run at or after @line down by @n_lines. Runs spanning @line
+ * grow to cover the new lines.
+ */
+void
+_ide_line_intervals_insert_lines (IdeLineIntervals *self,
+                                  guint             line,
+                                  guint             n_lines)
+{
+  guint i;
+
+  g_return_if_fail (self != NULL);
+
+  if (n_lines == 0)
+    return;
+
+  ide_line_intervals_normalize (self);
+
+  for (i = ide_line_intervals_bsearch (self, line); i < self->runs->len; i++)
+    {
+      Interval *run = &g_array_index (self->runs, Interval, i);
+
+      if (run->begin >= line)
+        run->begin += n_lines;
+
+      run->end += n_lines;
+    }
+}
+
+static inline guint
+remove_lines_map (guint line,
+                  guint removed_begin,
+                  guint n_lines)
+{
+  if (line < removed_begin)
+    return line;
+  else if (line - removed_begin < n_lines)
+    return removed_begin > 0 ? removed_begin - 1 : 0;
+  else
+    return line - n_lines;
+}
+
+/**
+ * _ide_line_intervals_remove_lines:
+ * @self: An #IdeLineIntervals
+ * @line: the first line that was removed
+ * @n_lines: the number of lines removed
+ *
+ * Removes @n_lines lines starting from @line, such as when a newline is
+ * deleted and the following line is joined with the previous one. Runs on
+ * the removed lines collapse onto the line before them.
+ */
+void
+_ide_line_intervals_remove_lines (IdeLineIntervals *self,
+                                  guint             line,
+                                  guint             n_lines)
+{
+  guint first;
+  guint i;
+
+  g_return_if_fail (self != NULL);
+
+  if (n_lines == 0)
+    return;
+
+  ide_line_intervals_normalize (self);
+
+  first = ide_line_intervals_bsearch (self, line > 0 ? line - 1 : 0);
+
+  for (i = first; i < self->runs->len; i++)
+    {
+      Interval *run = &g_array_index (self->runs, Interval, i);
+
+      run->begin = remove_lines_map (run->begin, line, n_lines);
+      run->end = remove_lines_map (run->end, line, n_lines);
+    }
+
+  /* Coalesce runs of the same value that were brought together */
+  for (i = first + 1; i < self->runs->len;)
+    {
+      Interval *prev = &g_array_index (self->runs, Interval, i - 1);
+      Interval *run = &g_array_index (self->runs, Interval, i);
+
+      if (prev->value == run->value && prev->end + 1 >= run->begin)
+        {
+          prev->end = MAX (prev->end, run->end);
+          g_array_remove_index (self->runs, i);
+          continue;
+        }
+
+      i++;
+    }
+}
@@ -0,0 +1,59 @@
+/* ide-line-intervals.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_LINE_INTERVALS_H
+#define IDE_LINE_INTERVALS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IdeLineIntervals IdeLineIntervals;
+
+typedef void (*IdeLineIntervalsForeach) (guint    begin_line,
+                                         guint    end_line,
+                                         guint    value,
+                                         gpointer user_data);
+
+IdeLineIntervals *_ide_line_intervals_new          (void);
+void              _ide_line_intervals_free         (IdeLineIntervals        *self);
+void              _ide_line_intervals_clear        (IdeLineIntervals        *self);
+guint             _ide_line_intervals_get_size     (IdeLineIntervals        *self);
+void              _ide_line_intervals_add          (IdeLineIntervals        *self,
+                                                    guint                    begin_line,
+                                                    guint                    end_line,
+                                                    guint                    value);
+guint             _ide_line_intervals_lookup       (IdeLineIntervals        *self,
+                                                    guint                    line);
+void              _ide_line_intervals_foreach      (IdeLineIntervals        *self,
+                                                    guint                    begin_line,
+                                                    guint                    end_line,
+                                                    IdeLineIntervalsForeach  foreach_func,
+                                                    gpointer                 user_data);
+void              _ide_line_intervals_insert_lines (IdeLineIntervals        *self,
+                                                    guint                    line,
+                                                    guint                    n_lines);
+void              _ide_line_intervals_remove_lines (IdeLineIntervals        *self,
+                                                    guint                    line,
+                                                    guint                    n_lines);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeLineIntervals, _ide_line_intervals_free)
+
+G_END_DECLS
+
+#endif /* IDE_LINE_INTERVALS_H */
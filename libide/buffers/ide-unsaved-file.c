@@ -18,7 +18,22 @@
 
 #define G_LOG_DOMAIN "ide-unsaved-file"
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "config.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_MEMFD_CREATE
+# include <sys/mman.h>
+#endif
+
 #include "ide-debug.h"
+#include "ide-internal.h"
 
 #include "buffers/ide-unsaved-file.h"
 
@@ -26,41 +41,242 @@ G_DEFINE_BOXED_TYPE (IdeUnsavedFile, ide_unsaved_file,
                      ide_unsaved_file_ref, ide_unsaved_file_unref)
 
 struct _IdeUnsavedFile
+{
+  volatile gint       ref_count;
+  IdeBufferSnapshot  *snapshot;
+  GFile              *file;
+  IdeUnsavedTempFile *temp_file;
+  gint64              sequence;
+};
+
+/*
+ * IdeUnsavedTempFile is the on-disk copy of an unsaved file, for tools
+ * that can only read from a path. It is shared by every IdeUnsavedFile
+ * created for the same file, and nothing is created until a consumer
+ * asks for the path.
+ *
+ * When possible, the contents live in a memfd which is exposed to other
+ * processes through /proc/<pid>/fd/<fd>. That avoids writing every
+ * modified buffer to disk. The path is only valid while we are running,
+ * which is all that consumers of unsaved files need.
+ */
+struct _IdeUnsavedTempFile
 {
   volatile gint  ref_count;
-  GBytes        *content;
-  GFile         *file;
-  gchar         *temp_path;
-  gint64         sequence;
+  GMutex         mutex;
+  gchar         *basename;
+  gchar         *path;
+  gint64         written_sequence;
+  gint           fd;
+  guint          is_memfd : 1;
 };
 
+IdeUnsavedTempFile *
+_ide_unsaved_temp_file_new (GFile *file)
+{
+  IdeUnsavedTempFile *self;
+
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+  self = g_slice_new0 (IdeUnsavedTempFile);
+  self->ref_count = 1;
+  self->basename = g_file_get_basename (file);
+  self->written_sequence = -1;
+  self->fd = -1;
+  g_mutex_init (&self->mutex);
+
+  return self;
+}
+
+IdeUnsavedTempFile *
+_ide_unsaved_temp_file_ref (IdeUnsavedTempFile *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+_ide_unsaved_temp_file_unref (IdeUnsavedTempFile *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      if (self->path != NULL && !self->is_memfd)
+        g_unlink (self->path);
+
+      if (self->fd != -1)
+        g_close (self->fd, NULL);
+
+      g_clear_pointer (&self->path, g_free);
+      g_clear_pointer (&self->basename, g_free);
+      g_mutex_clear (&self->mutex);
+      g_slice_free (IdeUnsavedTempFile, self);
+    }
+}
+
+/* Must be called with the mutex held. */
+static gboolean
+ide_unsaved_temp_file_ensure (IdeUnsavedTempFile  *self,
+                              GError             **error)
+{
+  g_autofree gchar *template = NULL;
+  const gchar *suffix;
+
+  if (self->fd != -1)
+    return TRUE;
+
+#ifdef HAVE_MEMFD_CREATE
+  self->fd = memfd_create (self->basename, MFD_CLOEXEC);
+
+  if (self->fd != -1)
+    {
+      self->is_memfd = TRUE;
+      self->path = g_strdup_printf ("/proc/%d/fd/%d", (gint)getpid (), self->fd);
+      return TRUE;
+    }
+#endif
+
+  /* Fallback to a real file in the temporary directory. */
+  suffix = strrchr (self->basename, '.') ?: "";
+  template = g_strdup_printf ("builder_codeassistant_XXXXXX%s", suffix);
+  self->fd = g_file_open_tmp (template, &self->path, error);
+
+  return self->fd != -1;
+}
+
+static const gchar *
+ide_unsaved_temp_file_get_path (IdeUnsavedTempFile *self)
+{
+  g_autoptr(GError) error = NULL;
+  const gchar *ret;
+
+  g_assert (self != NULL);
+
+  g_mutex_lock (&self->mutex);
+  if (!ide_unsaved_temp_file_ensure (self, &error))
+    g_warning ("Failed to create temporary file: %s", error->message);
+  ret = self->path;
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
+
+static gboolean
+ide_unsaved_temp_file_write (IdeUnsavedTempFile  *self,
+                             GBytes              *content,
+                             gint64               sequence,
+                             GError             **error)
+{
+  const gchar *data;
+  gboolean ret = FALSE;
+  gsize len;
+  gsize pos = 0;
+
+  g_assert (self != NULL);
+  g_assert (content != NULL);
+
+  data = g_bytes_get_data (content, &len);
+
+  g_mutex_lock (&self->mutex);
+
+  if (!ide_unsaved_temp_file_ensure (self, error))
+    goto unlock;
+
+  /* Nothing to do if this version was already written by another consumer */
+  if (sequence != -1 && sequence == self->written_sequence)
+    {
+      ret = TRUE;
+      goto unlock;
+    }
+
+  if (ftruncate (self->fd, 0) != 0)
+    goto failure;
+
+  while (pos < len)
+    {
+      gssize n = pwrite (self->fd, data + pos, len - pos, pos);
+
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          goto failure;
+        }
+
+      pos += n;
+    }
+
+  self->written_sequence = sequence;
+  ret = TRUE;
+
+  goto unlock;
+
+failure:
+  {
+    gint errsv = errno;
+
+    self->written_sequence = -1;
+    g_set_error (error,
+                 G_IO_ERROR,
+                 g_io_error_from_errno (errsv),
+                 "Failed to write \"%s\": %s",
+                 self->path, g_strerror (errsv));
+  }
+
+unlock:
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
+
 IdeUnsavedFile *
-_ide_unsaved_file_new (GFile       *file,
-                       GBytes      *content,
-                       const gchar *temp_path,
-                       gint64       sequence)
+_ide_unsaved_file_new (GFile              *file,
+                       IdeBufferSnapshot  *snapshot,
+                       IdeUnsavedTempFile *temp_file,
+                       gint64              sequence)
 {
   IdeUnsavedFile *ret;
 
   g_return_val_if_fail (G_IS_FILE (file), NULL);
-  g_return_val_if_fail (content, NULL);
+  g_return_val_if_fail (snapshot, NULL);
 
   ret = g_slice_new0 (IdeUnsavedFile);
   ret->ref_count = 1;
   ret->file = g_object_ref (file);
-  ret->content = g_bytes_ref (content);
+  ret->snapshot = _ide_buffer_snapshot_ref (snapshot);
   ret->sequence = sequence;
-  ret->temp_path = g_strdup (temp_path);
+
+  if (temp_file != NULL)
+    ret->temp_file = _ide_unsaved_temp_file_ref (temp_file);
+  else
+    ret->temp_file = _ide_unsaved_temp_file_new (file);
 
   return ret;
 }
 
+/**
+ * ide_unsaved_file_get_temp_path:
+ *
+ * Gets a path that can be used to read the contents of the unsaved file
+ * from another process. The temporary file is created the first time this
+ * is called, and may be a link into /proc rather than a real file.
+ *
+ * The contents are only written when ide_unsaved_file_persist() is called.
+ *
+ * Returns: (nullable): A path, or %NULL if the file could not be created.
+ */
 const gchar *
 ide_unsaved_file_get_temp_path (IdeUnsavedFile *self)
 {
   g_return_val_if_fail (self, NULL);
 
-  return self->temp_path;
+  return ide_unsaved_temp_file_get_path (self->temp_file);
 }
 
 gboolean
@@ -68,7 +284,6 @@ ide_unsaved_file_persist (IdeUnsavedFile  *self,
                           GCancellable    *cancellable,
                           GError         **error)
 {
-  g_autoptr(GFile) file = NULL;
   gboolean ret;
 
   IDE_ENTRY;
@@ -76,18 +291,15 @@ ide_unsaved_file_persist (IdeUnsavedFile  *self,
   g_return_val_if_fail (self, FALSE);
   g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
 
-  IDE_TRACE_MSG ("Saving draft to \"%s\"", self->temp_path);
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    IDE_RETURN (FALSE);
+
+  IDE_TRACE_MSG ("Saving draft to \"%s\"", ide_unsaved_file_get_temp_path (self));
 
-  file = g_file_new_for_path (self->temp_path);
-  ret = g_file_replace_contents (file,
-                                 g_bytes_get_data (self->content, NULL),
-                                 g_bytes_get_size (self->content),
-                                 NULL,
-                                 FALSE,
-                                 G_FILE_CREATE_REPLACE_DESTINATION,
-                                 NULL,
-                                 cancellable,
-                                 error);
+  ret = ide_unsaved_temp_file_write (self->temp_file,
+                                     _ide_buffer_snapshot_get_bytes (self->snapshot),
+                                     self->sequence,
+                                     error);
 
   IDE_RETURN (ret);
 }
@@ -119,8 +331,8 @@ ide_unsaved_file_unref (IdeUnsavedFile *self)
 
   if (g_atomic_int_dec_and_test (&self->ref_count))
     {
-      g_clear_pointer (&self->temp_path, g_free);
-      g_clear_pointer (&self->content, g_bytes_unref);
+      g_clear_pointer (&self->temp_file, _ide_unsaved_temp_file_unref);
+      g_clear_pointer (&self->snapshot, _ide_buffer_snapshot_unref);
       g_clear_object (&self->file);
       g_slice_free (IdeUnsavedFile, self);
     }
@@ -139,7 +351,7 @@ ide_unsaved_file_get_content (IdeUnsavedFile *self)
 {
   g_return_val_if_fail (self, NULL);
 
-  return self->content;
+  return _ide_buffer_snapshot_get_bytes (self->snapshot);
 }
 
 /**
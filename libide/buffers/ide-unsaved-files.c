@@ -18,9 +18,15 @@
 
 #define G_LOG_DOMAIN "ide-unsaved-files"
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 #include <errno.h>
+#include <fcntl.h>
 #include <glib/gstdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "ide-context.h"
 #include "ide-debug.h"
@@ -30,29 +36,42 @@
 #include "buffers/ide-unsaved-file.h"
 #include "buffers/ide-unsaved-files.h"
 #include "projects/ide-project.h"
+#include "util/ide-line-reader.h"
 
 typedef struct
 {
-  gint64           sequence;
-  GFile           *file;
-  GBytes          *content;
-  gchar           *temp_path;
-  gint             temp_fd;
-  IdeUnsavedFiles *backptr;
+  gint64              sequence;
+  gint64              saved_sequence;
+  GFile              *file;
+  IdeBufferSnapshot  *snapshot;
+  IdeUnsavedTempFile *temp_file;
 } UnsavedFile;
 
 typedef struct
 {
-  GPtrArray *unsaved_files;
-  gint64     sequence;
+  /* GFile -> UnsavedFile, the key is owned by the value */
+  GHashTable *unsaved_files;
+  gint64      sequence;
+
+  /* Serializes saves, along with the generation of the last one written */
+  GMutex      save_mutex;
+  guint       save_generation;
+  guint       saved_generation;
 } IdeUnsavedFilesPrivate;
 
 typedef struct
 {
   GPtrArray *unsaved_files;
   gchar     *drafts_directory;
+  guint      generation;
 } AsyncState;
 
+typedef struct
+{
+  gchar *checksum;
+  guint  position;
+} JournalEntry;
+
 G_DEFINE_TYPE_WITH_PRIVATE (IdeUnsavedFiles, ide_unsaved_files, IDE_TYPE_OBJECT)
 
 gchar *
@@ -92,20 +111,8 @@ unsaved_file_free (gpointer data)
   if (uf)
     {
       g_clear_object (&uf->file);
-      g_clear_pointer (&uf->content, g_bytes_unref);
-
-      if (uf->temp_path != NULL)
-        {
-           g_unlink (uf->temp_path);
-           g_clear_pointer (&uf->temp_path, g_free);
-        }
-
-      if (uf->temp_fd != -1)
-        {
-          g_close (uf->temp_fd, NULL);
-          uf->temp_fd = -1;
-        }
-
+      g_clear_pointer (&uf->snapshot, _ide_buffer_snapshot_unref);
+      g_clear_pointer (&uf->temp_file, _ide_unsaved_temp_file_unref);
       g_slice_free (UnsavedFile, uf);
     }
 }
@@ -116,28 +123,124 @@ unsaved_file_copy (const UnsavedFile *uf)
   UnsavedFile *copy;
 
   copy = g_slice_new0 (UnsavedFile);
+  copy->sequence = uf->sequence;
+  copy->saved_sequence = uf->saved_sequence;
   copy->file = g_object_ref (uf->file);
-  copy->content = g_bytes_ref (uf->content);
+  copy->snapshot = _ide_buffer_snapshot_ref (uf->snapshot);
 
   return copy;
 }
 
+/*
+ * Drafts are stored in a content-addressed layout:
+ *
+ *   drafts/<project>/objects/<sha1 of contents>
+ *   drafts/<project>/journal
+ *
+ * The journal is append-only, with one record per line:
+ *
+ *   + <sha1> <uri>    the draft for <uri> has the contents <sha1>
+ *   - <uri>           there is no longer a draft for <uri>
+ *
+ * Replaying the journal gives the current set of drafts. Saving only
+ * writes the objects that do not exist yet and appends records for the
+ * drafts that changed, so buffers that were not modified since the last
+ * save cost nothing. Once the journal has collected enough stale records
+ * it is rewritten, and objects that are no longer referenced are removed.
+ *
+ * Drafts that changed are appended in the order they were modified, and
+ * compaction keeps that order, so the position of the last record for each
+ * uri tells which drafts were modified most recently.
+ *
+ * Older versions wrote a "manifest" listing the uris, with the contents
+ * stored in a file named by the sha1 of the uri. Those are still restored,
+ * and cleaned up by the next compaction.
+ */
+
+#define JOURNAL_COMPACT_MIN_RECORDS 64
+#define JOURNAL_COMPACT_RATIO       4
+#define OBJECTS_PER_SYNC            64
+
+typedef struct
+{
+  gchar *tmp_path;
+  gchar *path;
+  gint   fd;
+} PendingObject;
+
+static void
+pending_object_free (gpointer data)
+{
+  PendingObject *pending = data;
+
+  if (pending->fd != -1)
+    {
+      g_close (pending->fd, NULL);
+      g_unlink (pending->tmp_path);
+    }
+
+  g_free (pending->tmp_path);
+  g_free (pending->path);
+  g_slice_free (PendingObject, pending);
+}
+
 static gboolean
-unsaved_file_save (UnsavedFile  *uf,
-                   const gchar  *path,
-                   GError      **error)
+write_fully (gint           fd,
+             const gchar   *data,
+             gsize          len,
+             GError       **error)
 {
-  gboolean ret;
+  while (len > 0)
+    {
+      gssize n = write (fd, data, len);
 
-  g_assert (uf);
-  g_assert (uf->content);
-  g_assert (path);
+      if (n < 0)
+        {
+          gint errsv = errno;
 
-  ret = g_file_set_contents (path,
-                             g_bytes_get_data (uf->content, NULL),
-                             g_bytes_get_size (uf->content),
-                             error);
-  return ret;
+          if (errsv == EINTR)
+            continue;
+
+          g_set_error_literal (error,
+                               G_IO_ERROR,
+                               g_io_error_from_errno (errsv),
+                               g_strerror (errsv));
+          return FALSE;
+        }
+
+      data += n;
+      len -= n;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+sync_directory (const gchar  *path,
+                GError      **error)
+{
+  gint fd;
+
+  fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (fd == -1 || fsync (fd) != 0)
+    {
+      gint errsv = errno;
+
+      if (fd != -1)
+        close (fd);
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to sync \"%s\": %s",
+                   path, g_strerror (errsv));
+      return FALSE;
+    }
+
+  close (fd);
+
+  return TRUE;
 }
 
 static gchar *
@@ -154,72 +257,590 @@ hash_uri (const gchar *uri)
   return ret;
 }
 
+static JournalEntry *
+journal_entry_new (const gchar *checksum,
+                   guint        position)
+{
+  JournalEntry *entry;
+
+  entry = g_slice_new0 (JournalEntry);
+  entry->checksum = g_strdup (checksum);
+  entry->position = position;
+
+  return entry;
+}
+
 static void
-ide_unsaved_files_save_worker (GTask        *task,
-                               gpointer      source_object,
-                               gpointer      task_data,
-                               GCancellable *cancellable)
+journal_entry_free (gpointer data)
 {
-  GString *manifest;
-  AsyncState *state = task_data;
+  JournalEntry *entry = data;
+
+  g_free (entry->checksum);
+  g_slice_free (JournalEntry, entry);
+}
+
+static gint
+compare_by_position (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      user_data)
+{
+  GHashTable *entries = user_data;
+  const JournalEntry *entry_a = g_hash_table_lookup (entries, *(const gchar **)a);
+  const JournalEntry *entry_b = g_hash_table_lookup (entries, *(const gchar **)b);
+
+  if (entry_a->position < entry_b->position)
+    return -1;
+  else if (entry_a->position > entry_b->position)
+    return 1;
+  else
+    return 0;
+}
+
+/*
+ * Gets the uris of @entries, in the order they were last recorded in the
+ * journal, so the most recently modified draft is last.
+ */
+static GPtrArray *
+journal_get_ordered_uris (GHashTable *entries)
+{
+  GHashTableIter iter;
+  GPtrArray *ar;
+  gpointer key;
+
+  ar = g_ptr_array_sized_new (g_hash_table_size (entries));
+
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (ar, key);
+
+  g_ptr_array_sort_with_data (ar, compare_by_position, entries);
+
+  return ar;
+}
+
+static gboolean
+is_checksum (const gchar *str,
+             gsize        len)
+{
+  gsize i;
+
+  if (len != 40)
+    return FALSE;
+
+  for (i = 0; i < len; i++)
+    {
+      if (!g_ascii_isxdigit (str [i]))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Replays the journal at @path, returning a hashtable of uri to
+ * JournalEntry. A partially written record at the end of the journal (such
+ * as after a crash during an append) is ignored.
+ */
+static GHashTable *
+journal_load (const gchar *path,
+              guint       *n_records)
+{
+  g_autofree gchar *contents = NULL;
+  IdeLineReader reader;
+  GHashTable *entries;
+  const gchar *end;
+  gchar *line;
+  gsize len = 0;
+  gsize line_len;
+
+  g_assert (path != NULL);
+  g_assert (n_records != NULL);
+
+  *n_records = 0;
+
+  entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, journal_entry_free);
+
+  if (!g_file_get_contents (path, &contents, &len, NULL))
+    return entries;
+
+  if (NULL == (end = memrchr (contents, '\n', len)))
+    return entries;
+
+  ide_line_reader_init (&reader, contents, end - contents);
+
+  while (NULL != (line = ide_line_reader_next (&reader, &line_len)))
+    {
+      if (line_len > 2 && line [0] == '-' && line [1] == ' ')
+        {
+          g_autofree gchar *uri = g_strndup (line + 2, line_len - 2);
+
+          g_hash_table_remove (entries, uri);
+          (*n_records)++;
+        }
+      else if (line_len >= 44 &&
+               line [0] == '+' &&
+               line [1] == ' ' &&
+               is_checksum (line + 2, 40) &&
+               line [42] == ' ')
+        {
+          g_autofree gchar *checksum = g_strndup (line + 2, 40);
+
+          g_hash_table_insert (entries,
+                               g_strndup (line + 43, line_len - 43),
+                               journal_entry_new (checksum, *n_records));
+          (*n_records)++;
+        }
+    }
+
+  return entries;
+}
+
+static gboolean
+journal_append (const gchar  *path,
+                GString      *records,
+                GError      **error)
+{
+  gint fd;
+
+  g_assert (path != NULL);
+  g_assert (records != NULL);
+
+  fd = open (path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+  if (fd == -1)
+    {
+      gint errsv = errno;
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to open \"%s\": %s",
+                   path, g_strerror (errsv));
+      return FALSE;
+    }
+
+  if (!write_fully (fd, records->str, records->len, error))
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  if (fdatasync (fd) != 0)
+    {
+      gint errsv = errno;
+
+      close (fd);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to sync \"%s\": %s",
+                   path, g_strerror (errsv));
+      return FALSE;
+    }
+
+  close (fd);
+
+  return TRUE;
+}
+
+/*
+ * Rewrites the journal to contain only the live entries, in the order they
+ * were recorded, then removes the objects (and drafts from the legacy
+ * layout) that are no longer needed.
+ */
+static gboolean
+journal_compact (const gchar  *drafts_directory,
+                 GHashTable   *entries,
+                 GError      **error)
+{
+  g_autoptr(GHashTable) referenced = NULL;
+  g_autoptr(GPtrArray) uris = NULL;
+  g_autofree gchar *journal_path = NULL;
+  g_autofree gchar *objects_dir = NULL;
   g_autofree gchar *manifest_path = NULL;
-  GError *error = NULL;
+  g_autofree gchar *manifest = NULL;
+  g_autoptr(GString) str = NULL;
+  const gchar *name;
+  GDir *dir;
+  guint i;
+
+  IDE_ENTRY;
+
+  journal_path = g_build_filename (drafts_directory, "journal", NULL);
+  objects_dir = g_build_filename (drafts_directory, "objects", NULL);
+  manifest_path = g_build_filename (drafts_directory, "manifest", NULL);
+
+  str = g_string_new (NULL);
+  referenced = g_hash_table_new (g_str_hash, g_str_equal);
+
+  uris = journal_get_ordered_uris (entries);
+
+  for (i = 0; i < uris->len; i++)
+    {
+      const gchar *uri = g_ptr_array_index (uris, i);
+      JournalEntry *entry = g_hash_table_lookup (entries, uri);
+
+      g_string_append_printf (str, "+ %s %s\n", entry->checksum, uri);
+      g_hash_table_add (referenced, entry->checksum);
+    }
+
+  if (!g_file_set_contents (journal_path, str->str, str->len, error) ||
+      !sync_directory (drafts_directory, error))
+    IDE_RETURN (FALSE);
+
+  if (NULL != (dir = g_dir_open (objects_dir, 0, NULL)))
+    {
+      while (NULL != (name = g_dir_read_name (dir)))
+        {
+          if (!g_hash_table_contains (referenced, name))
+            {
+              g_autofree gchar *path = g_build_filename (objects_dir, name, NULL);
+
+              g_unlink (path);
+            }
+        }
+
+      g_dir_close (dir);
+    }
+
+  if (g_file_get_contents (manifest_path, &manifest, NULL, NULL))
+    {
+      g_auto(GStrv) lines = g_strsplit (manifest, "\n", 0);
+
+      for (i = 0; lines [i]; i++)
+        {
+          g_autofree gchar *hash = NULL;
+          g_autofree gchar *path = NULL;
+
+          if (!*lines [i])
+            continue;
+
+          hash = hash_uri (lines [i]);
+          path = g_build_filename (drafts_directory, hash, NULL);
+          g_unlink (path);
+        }
+
+      g_unlink (manifest_path);
+    }
+
+  IDE_RETURN (TRUE);
+}
+
+/*
+ * Writes @content to a temporary file next to its object path. The file
+ * is not synced or renamed into place until objects_commit() so that the
+ * cost of syncing is shared by a batch of objects.
+ */
+static gboolean
+objects_stage (const gchar  *objects_dir,
+               const gchar  *checksum,
+               GBytes       *content,
+               GPtrArray    *pending,
+               GError      **error)
+{
+  PendingObject *object;
+  const gchar *data;
+  gsize len;
+  guint i;
+
+  g_assert (objects_dir != NULL);
+  g_assert (checksum != NULL);
+  g_assert (content != NULL);
+  g_assert (pending != NULL);
+
+  object = g_slice_new0 (PendingObject);
+  object->path = g_build_filename (objects_dir, checksum, NULL);
+  object->tmp_path = g_strdup_printf ("%s.tmp", object->path);
+  object->fd = -1;
+
+  /* Objects are immutable, so there is nothing to do if it exists already */
+  if (g_file_test (object->path, G_FILE_TEST_IS_REGULAR))
+    goto skip;
+
+  for (i = 0; i < pending->len; i++)
+    {
+      PendingObject *other = g_ptr_array_index (pending, i);
+
+      if (g_str_equal (other->path, object->path))
+        goto skip;
+    }
+
+  object->fd = open (object->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+  if (object->fd == -1)
+    {
+      gint errsv = errno;
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to create \"%s\": %s",
+                   object->tmp_path, g_strerror (errsv));
+      pending_object_free (object);
+      return FALSE;
+    }
+
+  g_ptr_array_add (pending, object);
+
+  data = g_bytes_get_data (content, &len);
+
+  return write_fully (object->fd, data, len, error);
+
+skip:
+  pending_object_free (object);
+
+  return TRUE;
+}
+
+static gboolean
+objects_commit (const gchar  *objects_dir,
+                GPtrArray    *pending,
+                GError      **error)
+{
+  guint i;
+
+  g_assert (objects_dir != NULL);
+  g_assert (pending != NULL);
+
+  if (pending->len == 0)
+    return TRUE;
+
+  /*
+   * All of the objects have been written before we sync any of them, which
+   * lets the kernel write them out together rather than stalling on each.
+   */
+  for (i = 0; i < pending->len; i++)
+    {
+      PendingObject *object = g_ptr_array_index (pending, i);
+
+      if (fsync (object->fd) != 0)
+        {
+          gint errsv = errno;
+
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errsv),
+                       "Failed to sync \"%s\": %s",
+                       object->tmp_path, g_strerror (errsv));
+          return FALSE;
+        }
+    }
+
+  for (i = 0; i < pending->len; i++)
+    {
+      PendingObject *object = g_ptr_array_index (pending, i);
+
+      g_close (object->fd, NULL);
+      object->fd = -1;
+
+      if (g_rename (object->tmp_path, object->path) != 0)
+        {
+          gint errsv = errno;
+
+          g_unlink (object->tmp_path);
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errsv),
+                       "Failed to rename \"%s\": %s",
+                       object->tmp_path, g_strerror (errsv));
+          return FALSE;
+        }
+    }
+
+  g_ptr_array_set_size (pending, 0);
+
+  return sync_directory (objects_dir, error);
+}
+
+/*
+ * Writes the drafts in @state. Must be called with the save mutex held, as
+ * each save replays (and may rewrite) the journal.
+ */
+static gint
+compare_by_sequence (gconstpointer a,
+                     gconstpointer b)
+{
+  const UnsavedFile *uf_a = *(const UnsavedFile **)a;
+  const UnsavedFile *uf_b = *(const UnsavedFile **)b;
+
+  if (uf_a->sequence < uf_b->sequence)
+    return -1;
+  else if (uf_a->sequence > uf_b->sequence)
+    return 1;
+  else
+    return 0;
+}
+
+static gboolean
+ide_unsaved_files_save_locked (AsyncState  *state,
+                               GError     **error)
+{
+  g_autoptr(GHashTable) entries = NULL;
+  g_autoptr(GHashTable) live = NULL;
+  g_autoptr(GPtrArray) pending = NULL;
+  g_autoptr(GPtrArray) uris = NULL;
+  g_autoptr(GString) records = NULL;
+  g_autofree gchar *objects_dir = NULL;
+  g_autofree gchar *journal_path = NULL;
+  g_autofree gchar *manifest_path = NULL;
+  GHashTableIter iter;
+  const gchar *uri;
+  gboolean incomplete = FALSE;
+  guint n_records = 0;
+  guint n_written = 0;
   gsize i;
 
-  g_assert (G_IS_TASK (task));
-  g_assert (IDE_IS_UNSAVED_FILES (source_object));
+  IDE_ENTRY;
+
   g_assert (state);
 
+  objects_dir = g_build_filename (state->drafts_directory, "objects", NULL);
+  journal_path = g_build_filename (state->drafts_directory, "journal", NULL);
+  manifest_path = g_build_filename (state->drafts_directory, "manifest", NULL);
+
   /* ensure that the directory exists */
-  if (g_mkdir_with_parents (state->drafts_directory, 0700) != 0)
+  if (g_mkdir_with_parents (objects_dir, 0700) != 0)
     {
-      error = g_error_new_literal (G_IO_ERROR,
-                                   g_io_error_from_errno (errno),
-                                   "Failed to create drafts directory");
-      g_task_return_error (task, error);
-      return;
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           "Failed to create drafts directory");
+      IDE_RETURN (FALSE);
     }
 
-  manifest = g_string_new (NULL);
-  manifest_path = g_build_filename (state->drafts_directory,
-                                    "manifest",
-                                    NULL);
+  entries = journal_load (journal_path, &n_records);
+  live = g_hash_table_new (g_str_hash, g_str_equal);
+  uris = g_ptr_array_new_with_free_func (g_free);
+  pending = g_ptr_array_new_with_free_func (pending_object_free);
+  records = g_string_new (NULL);
+
+  /* Records are appended in the order the drafts were modified */
+  g_ptr_array_sort (state->unsaved_files, compare_by_sequence);
 
   for (i = 0; i < state->unsaved_files->len; i++)
     {
-      g_autofree gchar *path = NULL;
-      g_autofree gchar *uri = NULL;
-      g_autofree gchar *hash = NULL;
-      UnsavedFile *uf;
-
-      uf = g_ptr_array_index (state->unsaved_files, i);
+      UnsavedFile *uf = g_ptr_array_index (state->unsaved_files, i);
+      g_autoptr(GError) load_error = NULL;
+      JournalEntry *existing;
+      gchar *checksum;
+      GBytes *content;
 
       uri = g_file_get_uri (uf->file);
+      g_ptr_array_add (uris, (gchar *)uri);
+      g_hash_table_add (live, (gchar *)uri);
+
+      existing = g_hash_table_lookup (entries, uri);
+
+      /* Not modified since the last save, so don't even look at the contents */
+      if (existing != NULL && uf->saved_sequence == uf->sequence)
+        continue;
+
+      /*
+       * Runs in a worker, so flattening the snapshot happens off the main loop.
+       * A restored draft we failed to read keeps its record, rather than being
+       * replaced with an empty draft.
+       */
+      if (NULL == (content = _ide_buffer_snapshot_load_bytes (uf->snapshot, &load_error)))
+        {
+          g_warning ("Not saving draft for \"%s\": %s", uri, load_error->message);
+          incomplete = TRUE;
+          continue;
+        }
 
-      g_string_append_printf (manifest, "%s\n", uri);
+      checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, content);
 
-      hash = hash_uri (uri);
-      path = g_build_filename (state->drafts_directory, hash, NULL);
+      if (existing != NULL && g_strcmp0 (existing->checksum, checksum) == 0)
+        {
+          g_free (checksum);
+          continue;
+        }
 
-      if (!unsaved_file_save (uf, path, &error))
+      if (!objects_stage (objects_dir, checksum, content, pending, error) ||
+          (pending->len >= OBJECTS_PER_SYNC && !objects_commit (objects_dir, pending, error)))
         {
-          g_task_return_error (task, error);
-          goto cleanup;
+          g_free (checksum);
+          IDE_RETURN (FALSE);
         }
+
+      g_string_append_printf (records, "+ %s %s\n", checksum, uri);
+      g_hash_table_insert (entries, g_strdup (uri), journal_entry_new (checksum, n_records + n_written));
+      g_free (checksum);
+      n_written++;
     }
 
-  if (!g_file_set_contents (manifest_path,
-                            manifest->str, manifest->len,
-                            &error))
+  /* Drafts that were dropped since the last save */
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&uri, NULL))
     {
-      g_task_return_error (task, error);
-      goto cleanup;
+      if (!g_hash_table_contains (live, uri))
+        {
+          g_string_append_printf (records, "- %s\n", uri);
+          g_hash_table_iter_remove (&iter);
+          n_written++;
+        }
     }
 
-  g_task_return_boolean (task, TRUE);
+  /* Objects must be durable before the journal refers to them */
+  if (!objects_commit (objects_dir, pending, error) ||
+      (records->len > 0 && !journal_append (journal_path, records, error)))
+    IDE_RETURN (FALSE);
+
+  n_records += n_written;
+
+  IDE_TRACE_MSG ("Wrote %u journal records, %u total for %u drafts",
+                 n_written, n_records, g_hash_table_size (entries));
+
+  /* Compacting would drop the files of drafts we failed to read */
+  if (!incomplete &&
+      (g_file_test (manifest_path, G_FILE_TEST_EXISTS) ||
+       (n_records > JOURNAL_COMPACT_MIN_RECORDS &&
+        n_records > JOURNAL_COMPACT_RATIO * g_hash_table_size (entries))))
+    {
+      if (!journal_compact (state->drafts_directory, entries, error))
+        IDE_RETURN (FALSE);
+    }
 
-cleanup:
-  g_string_free (manifest, TRUE);
+  IDE_RETURN (TRUE);
+}
+
+static void
+ide_unsaved_files_save_worker (GTask        *task,
+                               gpointer      source_object,
+                               gpointer      task_data,
+                               GCancellable *cancellable)
+{
+  IdeUnsavedFiles *self = source_object;
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+  AsyncState *state = task_data;
+  GError *error = NULL;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_UNSAVED_FILES (self));
+  g_assert (state);
+
+  g_mutex_lock (&priv->save_mutex);
+
+  /*
+   * Saves are run one at a time, but may be picked up by workers out of
+   * order. A newer save has already written everything this one would.
+   */
+  if (state->generation <= priv->saved_generation)
+    {
+      IDE_TRACE_MSG ("Skipping save %u, %u was already saved",
+                     state->generation, priv->saved_generation);
+      g_task_return_boolean (task, TRUE);
+    }
+  else if (!ide_unsaved_files_save_locked (state, &error))
+    {
+      g_task_return_error (task, error);
+    }
+  else
+    {
+      priv->saved_generation = state->generation;
+      g_task_return_boolean (task, TRUE);
+    }
+
+  g_mutex_unlock (&priv->save_mutex);
 }
 
 static AsyncState *
@@ -232,7 +853,7 @@ async_state_new (IdeUnsavedFiles *files)
 
   context = ide_object_get_context (IDE_OBJECT (files));
 
-  state = g_slice_new (AsyncState);
+  state = g_slice_new0 (AsyncState);
   state->unsaved_files = g_ptr_array_new_with_free_func (unsaved_file_free);
   state->drafts_directory = get_drafts_directory (context);
 
@@ -247,8 +868,9 @@ ide_unsaved_files_save_async (IdeUnsavedFiles     *files,
 {
   IdeUnsavedFilesPrivate *priv;
   g_autoptr(GTask) task = NULL;
+  GHashTableIter iter;
   AsyncState *state;
-  gsize i;
+  UnsavedFile *uf;
 
   g_return_if_fail (IDE_IS_UNSAVED_FILES (files));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
@@ -257,15 +879,11 @@ ide_unsaved_files_save_async (IdeUnsavedFiles     *files,
 
   state = async_state_new (files);
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
-    {
-      UnsavedFile *uf;
-      UnsavedFile *uf_copy;
+  state->generation = ++priv->save_generation;
 
-      uf = g_ptr_array_index (priv->unsaved_files, i);
-      uf_copy = unsaved_file_copy (uf);
-      g_ptr_array_add (state->unsaved_files, uf_copy);
-    }
+  g_hash_table_iter_init (&iter, priv->unsaved_files);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&uf))
+    g_ptr_array_add (state->unsaved_files, unsaved_file_copy (uf));
 
   task = g_task_new (files, cancellable, callback, user_data);
   g_task_set_task_data (task, state, async_state_free);
@@ -277,10 +895,48 @@ ide_unsaved_files_save_finish (IdeUnsavedFiles  *files,
                                GAsyncResult     *result,
                                GError          **error)
 {
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (files);
+  AsyncState *state;
+  gsize i;
+
   g_return_val_if_fail (IDE_IS_UNSAVED_FILES (files), FALSE);
   g_return_val_if_fail (G_IS_TASK (result), FALSE);
 
-  return g_task_propagate_boolean (G_TASK (result), error);
+  if (!g_task_propagate_boolean (G_TASK (result), error))
+    return FALSE;
+
+  state = g_task_get_task_data (G_TASK (result));
+
+  /* Remember what was saved so the next save can skip unmodified drafts */
+  for (i = 0; i < state->unsaved_files->len; i++)
+    {
+      UnsavedFile *saved = g_ptr_array_index (state->unsaved_files, i);
+      UnsavedFile *uf = g_hash_table_lookup (priv->unsaved_files, saved->file);
+
+      if (uf != NULL && uf->sequence == saved->sequence)
+        uf->saved_sequence = uf->sequence;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Drafts are read lazily, so make sure we will be able to read them before
+ * they are restored. Otherwise the draft would be restored as an empty file.
+ */
+static gboolean
+draft_is_readable (const gchar *path)
+{
+  if (!g_file_test (path, G_FILE_TEST_IS_REGULAR))
+    return FALSE;
+
+  if (g_access (path, R_OK) != 0)
+    {
+      g_warning ("Ignoring unreadable draft \"%s\": %s", path, g_strerror (errno));
+      return FALSE;
+    }
+
+  return TRUE;
 }
 
 static void
@@ -290,12 +946,13 @@ ide_unsaved_files_restore_worker (GTask        *task,
                                   GCancellable *cancellable)
 {
   AsyncState *state = task_data;
-  g_autofree gchar *manifest_contents = NULL;
+  g_autoptr(GHashTable) entries = NULL;
+  g_autoptr(GPtrArray) uris = NULL;
+  g_autofree gchar *journal_path = NULL;
   g_autofree gchar *manifest_path = NULL;
-  gchar **lines;
-  GError *error = NULL;
-  gsize len;
-  gsize i;
+  g_autofree gchar *manifest_contents = NULL;
+  guint n_records;
+  guint i;
 
   IDE_ENTRY;
 
@@ -303,64 +960,87 @@ ide_unsaved_files_restore_worker (GTask        *task,
   g_assert (IDE_IS_UNSAVED_FILES (source_object));
   g_assert (state);
 
-  manifest_path = g_build_filename (state->drafts_directory,
-                                    "manifest",
-                                    NULL);
+  journal_path = g_build_filename (state->drafts_directory, "journal", NULL);
+  manifest_path = g_build_filename (state->drafts_directory, "manifest", NULL);
 
-  g_debug ("Loading drafts manifest %s", manifest_path);
+  g_debug ("Loading drafts journal %s", journal_path);
 
-  if (!g_file_test (manifest_path, G_FILE_TEST_IS_REGULAR))
-    {
-      g_task_return_boolean (task, TRUE);
-      return;
-    }
+  /*
+   * Only the journal is read here. The contents of each draft are loaded
+   * when they are first needed, which for most drafts is when the buffer
+   * is restored.
+   */
+  entries = journal_load (journal_path, &n_records);
 
-  if (!g_file_get_contents (manifest_path, &manifest_contents, &len, &error))
+  /*
+   * Drafts are handed over oldest first, so that the sequence of the most
+   * recently modified one is the highest. We don't know when drafts from
+   * the previous layout were modified, so they go first.
+   */
+  if (g_file_get_contents (manifest_path, &manifest_contents, NULL, NULL))
     {
-      g_task_return_error (task, error);
-      return;
+      g_auto(GStrv) lines = g_strsplit (manifest_contents, "\n", 0);
+
+      for (i = 0; lines [i]; i++)
+        {
+          g_autoptr(GFile) file = NULL;
+          g_autofree gchar *hash = NULL;
+          g_autofree gchar *path = NULL;
+          UnsavedFile *unsaved;
+
+          if (!*lines [i] || g_hash_table_contains (entries, lines [i]))
+            continue;
+
+          file = g_file_new_for_uri (lines [i]);
+          if (!file || !g_file_query_exists (file, NULL))
+            continue;
+
+          hash = hash_uri (lines [i]);
+          path = g_build_filename (state->drafts_directory, hash, NULL);
+          if (!draft_is_readable (path))
+            continue;
+
+          g_debug ("Found draft for \"%s\" at \"%s\"", lines [i], path);
+
+          unsaved = g_slice_new0 (UnsavedFile);
+          unsaved->file = g_steal_pointer (&file);
+          unsaved->snapshot = _ide_buffer_snapshot_new_for_path (path);
+
+          g_ptr_array_add (state->unsaved_files, unsaved);
+        }
     }
 
-  lines = g_strsplit (manifest_contents, "\n", 0);
+  uris = journal_get_ordered_uris (entries);
 
-  for (i = 0; lines [i]; i++)
+  for (i = 0; i < uris->len; i++)
     {
+      const gchar *uri = g_ptr_array_index (uris, i);
+      JournalEntry *entry = g_hash_table_lookup (entries, uri);
       g_autoptr(GFile) file = NULL;
-      gchar *contents = NULL;
-      g_autofree gchar *hash = NULL;
       g_autofree gchar *path = NULL;
       UnsavedFile *unsaved;
-      gsize data_len;
 
-      if (!*lines [i])
+      file = g_file_new_for_uri (uri);
+      if (!g_file_query_exists (file, NULL))
         continue;
 
-      file = g_file_new_for_uri (lines [i]);
-      if (!file || !g_file_query_exists (file, NULL))
+      path = g_build_filename (state->drafts_directory, "objects", entry->checksum, NULL);
+      if (!draft_is_readable (path))
         continue;
 
-      hash = hash_uri (lines [i]);
-      path = g_build_filename (state->drafts_directory, hash, NULL);
-
-      g_debug ("Loading draft for \"%s\" from \"%s\"", lines [i], path);
-
-      if (!g_file_get_contents (path, &contents, &data_len, &error))
-        {
-          g_warning ("%s", error->message);
-          g_clear_error (&error);
-          continue;
-        }
+      g_debug ("Found draft for \"%s\" at \"%s\"", uri, path);
 
       unsaved = g_slice_new0 (UnsavedFile);
-      unsaved->file = g_object_ref (file);
-      unsaved->content = g_bytes_new_take (contents, data_len);
+      unsaved->file = g_steal_pointer (&file);
+      unsaved->snapshot = _ide_buffer_snapshot_new_for_path (path);
+      unsaved->saved_sequence = 1;
 
       g_ptr_array_add (state->unsaved_files, unsaved);
     }
 
-  g_strfreev (lines);
-
   g_task_return_boolean (task, TRUE);
+
+  IDE_EXIT;
 }
 
 void
@@ -388,6 +1068,7 @@ ide_unsaved_files_restore_finish (IdeUnsavedFiles  *files,
                                   GAsyncResult     *result,
                                   GError          **error)
 {
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (files);
   AsyncState *state;
   gsize i;
 
@@ -396,48 +1077,33 @@ ide_unsaved_files_restore_finish (IdeUnsavedFiles  *files,
 
   state = g_task_get_task_data (G_TASK (result));
 
+  /* In the order they were modified, see ide_unsaved_files_restore_worker() */
   for (i = 0; i < state->unsaved_files->len; i++)
     {
+      UnsavedFile *restored = g_ptr_array_index (state->unsaved_files, i);
       UnsavedFile *uf;
 
-      uf = g_ptr_array_index (state->unsaved_files, i);
-      ide_unsaved_files_update (files, uf->file, uf->content);
+      _ide_unsaved_files_update_snapshot (files, restored->file, restored->snapshot);
+
+      /* Drafts restored from the journal do not need to be written again */
+      if (restored->saved_sequence != 0 &&
+          NULL != (uf = g_hash_table_lookup (priv->unsaved_files, restored->file)))
+        uf->saved_sequence = uf->sequence;
     }
 
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
-static void
-ide_unsaved_files_move_to_front (IdeUnsavedFiles *self,
-                                 guint            index)
-{
-  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
-  UnsavedFile *new_front;
-  UnsavedFile *old_front;
-
-  g_return_if_fail (IDE_IS_UNSAVED_FILES (self));
-
-  new_front = g_ptr_array_index (priv->unsaved_files, index);
-  old_front = g_ptr_array_index (priv->unsaved_files, 0);
-
-  /*
-   * TODO: We could shift all these items down, but it probably isnt' worth
-   *       the effort. We will just move-to-front after a miss and ping
-   *       pong the old item back to the front.
-   */
-  priv->unsaved_files->pdata[0] = new_front;
-  priv->unsaved_files->pdata[index] = old_front;
-}
-
 static void
 ide_unsaved_files_remove_draft (IdeUnsavedFiles *self,
                                 GFile           *file)
 {
   IdeContext *context;
   g_autofree gchar *drafts_directory = NULL;
+  g_autofree gchar *journal_path = NULL;
   g_autofree gchar *uri = NULL;
-  g_autofree gchar *hash = NULL;
-  g_autofree gchar *path = NULL;
+  g_autofree gchar *record = NULL;
+  gint fd;
 
   IDE_ENTRY;
 
@@ -446,13 +1112,24 @@ ide_unsaved_files_remove_draft (IdeUnsavedFiles *self,
 
   context = ide_object_get_context (IDE_OBJECT (self));
   drafts_directory = get_drafts_directory (context);
+  journal_path = g_build_filename (drafts_directory, "journal", NULL);
   uri = g_file_get_uri (file);
-  hash = hash_uri (uri);
-  path = g_build_filename (drafts_directory, hash, NULL);
 
   g_debug ("Removing draft for \"%s\"", uri);
 
-  g_unlink (path);
+  /*
+   * Record the removal right away so a crash does not bring back a draft
+   * that was saved. This is not synced, the next save of the drafts will
+   * record it again if it was lost. The object is cleaned up during the
+   * next compaction.
+   */
+  if (-1 != (fd = open (journal_path, O_WRONLY | O_APPEND | O_CLOEXEC)))
+    {
+      record = g_strdup_printf ("- %s\n", uri);
+      if (!write_fully (fd, record, strlen (record), NULL))
+        g_warning ("Failed to remove draft for \"%s\"", uri);
+      close (fd);
+    }
 
   IDE_EXIT;
 }
@@ -462,101 +1139,95 @@ ide_unsaved_files_remove (IdeUnsavedFiles *self,
                           GFile           *file)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
-  guint i;
 
   g_return_if_fail (IDE_IS_UNSAVED_FILES (self));
   g_return_if_fail (G_IS_FILE (file));
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
+  if (g_hash_table_contains (priv->unsaved_files, file))
     {
-      UnsavedFile *unsaved;
-
-      unsaved = g_ptr_array_index (priv->unsaved_files, i);
-
-      if (g_file_equal (file, unsaved->file))
-        {
-          ide_unsaved_files_remove_draft (self, file);
-          g_ptr_array_remove_index_fast (priv->unsaved_files, i);
-          break;
-        }
+      ide_unsaved_files_remove_draft (self, file);
+      g_hash_table_remove (priv->unsaved_files, file);
     }
 }
 
-static void
-setup_tempfile (GFile  *file,
-                gint   *temp_fd,
-                gchar **temp_path)
-{
-  g_autofree gchar *name = NULL;
-  const gchar *suffix;
-  gchar *template;
-
-  g_assert (G_IS_FILE (file));
-  g_assert (temp_fd);
-  g_assert (temp_path);
-
-  *temp_fd = -1;
-  *temp_path = NULL;
-
-  name = g_file_get_basename (file);
-  suffix = strrchr (name, '.') ?: "";
-  template = g_strdup_printf ("builder_codeassistant_XXXXXX%s", suffix);
-  *temp_fd = g_file_open_tmp (template, temp_path, NULL);
-}
-
+/*
+ * _ide_unsaved_files_update_snapshot:
+ *
+ * Like ide_unsaved_files_update() but takes a reference to @snapshot
+ * instead of contiguous bytes. #IdeBuffer uses this so that syncing the
+ * buffer does not require flattening the text; consumers will flatten
+ * lazily from ide_unsaved_file_get_content() when they need it.
+ */
 void
-ide_unsaved_files_update (IdeUnsavedFiles *self,
-                          GFile           *file,
-                          GBytes          *content)
+_ide_unsaved_files_update_snapshot (IdeUnsavedFiles   *self,
+                                    GFile             *file,
+                                    IdeBufferSnapshot *snapshot)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
   UnsavedFile *unsaved;
-  guint i;
 
   g_return_if_fail (IDE_IS_UNSAVED_FILES (self));
   g_return_if_fail (G_IS_FILE (file));
 
   priv->sequence++;
 
-  if (!content)
+  if (!snapshot)
     {
       ide_unsaved_files_remove (self, file);
       return;
     }
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
+  if (NULL != (unsaved = g_hash_table_lookup (priv->unsaved_files, file)))
     {
-      unsaved = g_ptr_array_index (priv->unsaved_files, i);
-
-      if (g_file_equal (file, unsaved->file))
+      if (snapshot != unsaved->snapshot)
         {
-          if (content != unsaved->content)
-            {
-              g_clear_pointer (&unsaved->content, g_bytes_unref);
-              unsaved->content = g_bytes_ref (content);
-              unsaved->sequence = priv->sequence;
-            }
-
-          /*
-           * A file that get's updated is the most likely to get updated on
-           * the next attempt. Therefore, we will simply move this entry to
-           * the beginning of the array to increase its chances of being the
-           * first entry we check.
-           */
-          if (i != 0)
-            ide_unsaved_files_move_to_front (self, i);
-
-          return;
+          g_clear_pointer (&unsaved->snapshot, _ide_buffer_snapshot_unref);
+          unsaved->snapshot = _ide_buffer_snapshot_ref (snapshot);
+          unsaved->sequence = priv->sequence;
         }
+
+      return;
     }
 
+  /*
+   * The temporary file is not created until a consumer asks for its path,
+   * most unsaved files are only ever read from memory.
+   */
   unsaved = g_slice_new0 (UnsavedFile);
   unsaved->file = g_object_ref (file);
-  unsaved->content = g_bytes_ref (content);
+  unsaved->snapshot = _ide_buffer_snapshot_ref (snapshot);
   unsaved->sequence = priv->sequence;
-  setup_tempfile (file, &unsaved->temp_fd, &unsaved->temp_path);
+  unsaved->temp_file = _ide_unsaved_temp_file_new (file);
 
-  g_ptr_array_insert (priv->unsaved_files, 0, unsaved);
+  g_hash_table_insert (priv->unsaved_files, unsaved->file, unsaved);
+}
+
+void
+ide_unsaved_files_update (IdeUnsavedFiles *self,
+                          GFile           *file,
+                          GBytes          *content)
+{
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+  g_autoptr(IdeBufferSnapshot) snapshot = NULL;
+
+  g_return_if_fail (IDE_IS_UNSAVED_FILES (self));
+  g_return_if_fail (G_IS_FILE (file));
+
+  if (content != NULL)
+    {
+      UnsavedFile *unsaved = g_hash_table_lookup (priv->unsaved_files, file);
+
+      /*
+       * Avoid replacing the snapshot if we are handed back the very bytes
+       * we already wrapped, such as from ide_unsaved_file_get_content().
+       */
+      if (unsaved != NULL && _ide_buffer_snapshot_peek_bytes (unsaved->snapshot) == content)
+        snapshot = _ide_buffer_snapshot_ref (unsaved->snapshot);
+      else
+        snapshot = _ide_buffer_snapshot_new_for_bytes (content);
+    }
+
+  _ide_unsaved_files_update_snapshot (self, file, snapshot);
 }
 
 /**
@@ -578,26 +1249,20 @@ GPtrArray *
 ide_unsaved_files_to_array (IdeUnsavedFiles *self)
 {
   IdeUnsavedFilesPrivate *priv;
+  GHashTableIter iter;
+  UnsavedFile *uf;
   GPtrArray *ar;
-  gsize i;
 
   g_return_val_if_fail (IDE_IS_UNSAVED_FILES (self), NULL);
 
   priv = ide_unsaved_files_get_instance_private (self);
 
-  ar = g_ptr_array_new ();
+  ar = g_ptr_array_sized_new (g_hash_table_size (priv->unsaved_files));
   g_ptr_array_set_free_func (ar, (GDestroyNotify)ide_unsaved_file_unref);
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
-    {
-      IdeUnsavedFile *item;
-      UnsavedFile *uf;
-
-      uf = g_ptr_array_index (priv->unsaved_files, i);
-      item = _ide_unsaved_file_new (uf->file, uf->content, uf->temp_path, uf->sequence);
-
-      g_ptr_array_add (ar, item);
-    }
+  g_hash_table_iter_init (&iter, priv->unsaved_files);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&uf))
+    g_ptr_array_add (ar, _ide_unsaved_file_new (uf->file, uf->snapshot, uf->temp_file, uf->sequence));
 
   return ar;
 }
@@ -607,22 +1272,11 @@ ide_unsaved_files_contains (IdeUnsavedFiles *self,
                             GFile           *file)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
-  guint i;
 
   g_return_val_if_fail (IDE_IS_UNSAVED_FILES (self), FALSE);
   g_return_val_if_fail (G_IS_FILE (file), FALSE);
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
-    {
-      UnsavedFile *uf;
-
-      uf = g_ptr_array_index (priv->unsaved_files, i);
-
-      if (g_file_equal (uf->file, file))
-        return TRUE;
-    }
-
-  return FALSE;
+  return g_hash_table_contains (priv->unsaved_files, file);
 }
 
 /**
@@ -639,11 +1293,12 @@ ide_unsaved_files_get_unsaved_file (IdeUnsavedFiles *self,
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
   IdeUnsavedFile *ret = NULL;
-  gsize i;
+  UnsavedFile *uf;
 
   IDE_ENTRY;
 
   g_return_val_if_fail (IDE_IS_UNSAVED_FILES (self), NULL);
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
 
 #ifdef IDE_ENABLE_TRACE
   {
@@ -655,23 +1310,15 @@ ide_unsaved_files_get_unsaved_file (IdeUnsavedFiles *self,
   }
 #endif
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
+  if (NULL != (uf = g_hash_table_lookup (priv->unsaved_files, file)))
     {
-      UnsavedFile *uf;
-
-      uf = g_ptr_array_index (priv->unsaved_files, i);
-
-      if (g_file_equal (uf->file, file))
-        {
-          IDE_TRACE_MSG ("Hit");
-          ret = _ide_unsaved_file_new (uf->file, uf->content, uf->temp_path, uf->sequence);
-          goto complete;
-        }
+      IDE_TRACE_MSG ("Hit");
+      ret = _ide_unsaved_file_new (uf->file, uf->snapshot, uf->temp_file, uf->sequence);
+      IDE_RETURN (ret);
     }
 
   IDE_TRACE_MSG ("Miss");
 
-complete:
   IDE_RETURN (ret);
 }
 
@@ -691,7 +1338,8 @@ ide_unsaved_files_finalize (GObject *object)
   IdeUnsavedFiles *self = (IdeUnsavedFiles *)object;
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
 
-  g_clear_pointer (&priv->unsaved_files, g_ptr_array_unref);
+  g_clear_pointer (&priv->unsaved_files, g_hash_table_unref);
+  g_mutex_clear (&priv->save_mutex);
 
   G_OBJECT_CLASS (ide_unsaved_files_parent_class)->finalize (object);
 }
@@ -709,7 +1357,11 @@ ide_unsaved_files_init (IdeUnsavedFiles *self)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
 
-  priv->unsaved_files = g_ptr_array_new_with_free_func (unsaved_file_free);
+  priv->unsaved_files = g_hash_table_new_full ((GHashFunc)g_file_hash,
+                                               (GEqualFunc)g_file_equal,
+                                               NULL,
+                                               unsaved_file_free);
+  g_mutex_init (&priv->save_mutex);
 }
 
 void
@@ -22,15 +22,73 @@
 
 #include "ide-context.h"
 #include "ide-debug.h"
+#include "ide-global.h"
+#include "ide-internal.h"
 #include "ide-macros.h"
 
 #include "buffers/ide-buffer.h"
 #include "buffers/ide-buffer-manager.h"
+#include "buildsystem/ide-build-manager.h"
+#include "buildsystem/ide-build-result.h"
 #include "diagnostics/ide-diagnostic.h"
 #include "diagnostics/ide-diagnostic-provider.h"
 #include "diagnostics/ide-diagnostics.h"
 #include "diagnostics/ide-diagnostics-manager.h"
+#include "diagnostics/ide-diagnostics-store.h"
+#include "files/ide-file.h"
 #include "plugins/ide-extension-set-adapter.h"
+#include "vcs/ide-vcs.h"
+
+/*
+ * Providers are not started as soon as the buffer changes. Instead, each
+ * provider waits for the buffer to settle for a period based on how long it
+ * has taken to run in the past, so that expensive providers are not started
+ * on every pause in typing. Providers that have not completed a diagnosis
+ * yet use the default.
+ */
+#define DEFAULT_DEBOUNCE_MSEC 333
+#define MIN_DEBOUNCE_MSEC     100
+#define MAX_DEBOUNCE_MSEC     1500
+
+/*
+ * Diagnostics restored from the store only depend on the content of the
+ * file, while the providers also depend on the build configuration and on
+ * other files such as headers. So the providers still run once to confirm
+ * them, but only after this delay so they do not compete with loading.
+ */
+#define RESTORED_VERIFY_DELAY_USEC (5 * G_USEC_PER_SEC)
+
+typedef struct
+{
+  /*
+   * The cancellable for the request in flight, or %NULL if the provider
+   * is idle. It is cancelled when the buffer changes again, since the
+   * result would be out of date anyway.
+   */
+  GCancellable *cancellable;
+
+  /*
+   * When the request was started, so that we can measure how long the
+   * provider takes to diagnose a file.
+   */
+  gint64 begin_time;
+
+  /*
+   * The change serial of the group when the request was started. If this
+   * matches the group's change serial, the provider is up to date.
+   */
+  guint serial;
+} DiagnoseRequest;
+
+typedef struct
+{
+  /*
+   * A moving average of how long the provider takes to complete, in
+   * microseconds. This is tracked per provider type, since each group has
+   * its own instance of the provider.
+   */
+  gint64 latency;
+} ProviderStats;
 
 typedef struct
 {
@@ -75,12 +133,53 @@ typedef struct
    */
   IdeExtensionSetAdapter *adapter;
 
+  /*
+   * This contains a DiagnoseRequest for each provider, keyed by the
+   * provider, used to track which providers are out of date.
+   */
+  GHashTable *requests_by_provider;
+
+  /*
+   * Diagnostics that were restored from the store when the buffer was
+   * loaded, in place of running the providers. They are dropped once the
+   * providers have diagnosed a newer version of the buffer.
+   */
+  IdeDiagnostics *restored;
+
+  /*
+   * The checksum of the buffer content that was last provided to the
+   * diagnostic providers, so that we can record the results in the store.
+   */
+  gchar *checksum;
+
+  /*
+   * The merged and sorted diagnostics of every provider, which is handed
+   * out to callers of ide_diagnostics_manager_get_diagnostics_for_file().
+   * It is immutable and only rebuilt once @sequence has changed since
+   * @snapshot_sequence.
+   */
+  IdeDiagnostics *snapshot;
+  guint snapshot_sequence;
+
   /*
    * This is our sequence number for diagnostics. It is monotonically
    * increasing with every diagnostic discovered.
    */
   guint sequence;
 
+  /*
+   * This is incremented every time the buffer changes (or a provider is
+   * invalidated). Providers whose last request was for an older serial
+   * need to be run again.
+   */
+  guint change_serial;
+
+  /*
+   * The time of the last change, which providers wait to settle before
+   * starting a new request.
+   */
+  gint64 changed_at;
+
   /*
    * If we are currently diagnosing, then this will be set to a
    * number greater than zero.
@@ -94,6 +193,13 @@ typedef struct
    */
   guint needs_diagnose : 1;
 
+  /*
+   * This bit is set when the diagnostics were restored from the store and
+   * the providers have yet to confirm them, in which case they are started
+   * after RESTORED_VERIFY_DELAY_USEC instead of right away.
+   */
+  guint verify_restored : 1;
+
   /*
    * This bit is set if we know the file or buffer has diagnostics. This
    * is useful when we've cleaned up our extensions and no longer have
@@ -123,11 +229,54 @@ struct _IdeDiagnosticsManager
    */
   GHashTable *groups_by_file;
 
+  /*
+   * This contains the ProviderStats for each type of provider, keyed by
+   * the GType of the provider.
+   */
+  GHashTable *stats_by_type;
+
+  /*
+   * This contains the last known diagnostics for files in the project,
+   * including those that are not open. It is saved to the cache directory
+   * when the context is unloaded.
+   */
+  IdeDiagnosticsStore *store;
+
+  /*
+   * Diagnostics found in the output of the current build, as a GPtrArray
+   * of IdeDiagnostic keyed by GFile. They are added to the store once the
+   * build has completed.
+   */
+  GHashTable *build_diagnostics;
+
+  /*
+   * The uris of files that are being checked against the store in a
+   * thread, so that we only check each of them once at a time. The value
+   * is set if the file changed again while it was being checked.
+   */
+  GHashTable *validating;
+
+  /*
+   * A GFileMonitor, keyed by uri, for the files that are not open and
+   * whose diagnostics were asked for. The store entry is validated again
+   * when the file changes, rather than checking the file on every call to
+   * ide_diagnostics_manager_get_diagnostics_for_file().
+   */
+  GHashTable *monitors;
+
+  /*
+   * If the last build failed, not every file that changed was compiled,
+   * so the files it did not report on may still have diagnostics.
+   */
+  gboolean build_failed;
+
   /*
    * If any group has a queued diagnose in process, this will be set so
-   * we can coalesce the dispatch of everything at the same time.
+   * we can coalesce the dispatch of everything at the same time. This is
+   * either an idle or a timeout for when the next provider is due.
    */
   guint queued_diagnose_source;
+  gint64 queued_diagnose_at;
 };
 
 enum {
@@ -150,6 +299,10 @@ static void     ide_diagnostics_manager_add_diagnostic    (IdeDiagnosticsManager
                                                            IdeDiagnostic         *diagnostic);
 static void     ide_diagnostics_group_queue_diagnose      (IdeDiagnosticsGroup   *group,
                                                            IdeDiagnosticsManager *self);
+static void     ide_diagnostics_manager_schedule          (IdeDiagnosticsManager *self,
+                                                           gint64                 delay_usec);
+static void     ide_diagnostics_manager_validate          (IdeDiagnosticsManager *self,
+                                                           const gchar * const   *uris);
 
 
 static GParamSpec *properties [N_PROPS];
@@ -169,6 +322,61 @@ free_diagnostics (gpointer data)
     ide_diagnostics_unref (diagnostics);
 }
 
+static void
+free_variant (gpointer data)
+{
+  GVariant *variant = data;
+
+  if (variant != NULL)
+    g_variant_unref (variant);
+}
+
+static void
+free_monitor (gpointer data)
+{
+  GFileMonitor *monitor = data;
+
+  g_file_monitor_cancel (monitor);
+  g_object_unref (monitor);
+}
+
+typedef struct
+{
+  gchar  *checksum;
+  gint64  mtime;
+} FileChecksum;
+
+static void
+file_checksum_free (gpointer data)
+{
+  FileChecksum *fc = data;
+
+  g_free (fc->checksum);
+  g_slice_free (FileChecksum, fc);
+}
+
+static gint64
+get_mtime (GFileInfo *file_info)
+{
+  GTimeVal tv;
+
+  g_file_info_get_modification_time (file_info, &tv);
+
+  return ((gint64)tv.tv_sec * G_USEC_PER_SEC) + tv.tv_usec;
+}
+
+static void
+diagnose_request_free (gpointer data)
+{
+  DiagnoseRequest *request = data;
+
+  if (request->cancellable != NULL)
+    g_cancellable_cancel (request->cancellable);
+
+  g_clear_object (&request->cancellable);
+  g_slice_free (DiagnoseRequest, request);
+}
+
 static void
 ide_diagnostics_group_free (gpointer data)
 {
@@ -178,6 +386,10 @@ ide_diagnostics_group_free (gpointer data)
   g_assert (group->ref_count == 0);
 
   g_clear_pointer (&group->diagnostics_by_provider, g_hash_table_unref);
+  g_clear_pointer (&group->requests_by_provider, g_hash_table_unref);
+  g_clear_pointer (&group->restored, ide_diagnostics_unref);
+  g_clear_pointer (&group->checksum, g_free);
+  g_clear_pointer (&group->snapshot, ide_diagnostics_unref);
   g_weak_ref_clear (&group->buffer_wr);
   g_clear_object (&group->adapter);
   g_clear_object (&group->file);
@@ -194,6 +406,7 @@ ide_diagnostics_group_new (GFile *file)
   group = g_slice_new0 (IdeDiagnosticsGroup);
   group->ref_count = 1;
   group->file = g_object_ref (file);
+  group->requests_by_provider = g_hash_table_new_full (NULL, NULL, NULL, diagnose_request_free);
 
   g_weak_ref_init (&group->buffer_wr, NULL);
 
@@ -223,11 +436,64 @@ ide_diagnostics_group_unref (IdeDiagnosticsGroup *group)
     ide_diagnostics_group_free (group);
 }
 
+/*
+ * Creates a sorted #IdeDiagnostics containing the diagnostics from every
+ * provider of @group, along with those restored from the store.
+ */
+static IdeDiagnostics *
+ide_diagnostics_group_merge (IdeDiagnosticsGroup *group)
+{
+  GPtrArray *ar;
+  IdeDiagnostics *ret;
+
+  g_assert (group != NULL);
+
+  ar = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_diagnostic_unref);
+
+  if (group->restored != NULL)
+    {
+      gsize length = ide_diagnostics_get_size (group->restored);
+
+      for (gsize i = 0; i < length; i++)
+        g_ptr_array_add (ar, ide_diagnostic_ref (ide_diagnostics_index (group->restored, i)));
+    }
+
+  if (group->diagnostics_by_provider != NULL)
+    {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init (&iter, group->diagnostics_by_provider);
+
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          IdeDiagnostics *diagnostics = value;
+          gsize length;
+
+          if (diagnostics == NULL)
+            continue;
+
+          length = ide_diagnostics_get_size (diagnostics);
+
+          for (gsize i = 0; i < length; i++)
+            g_ptr_array_add (ar, ide_diagnostic_ref (ide_diagnostics_index (diagnostics, i)));
+        }
+    }
+
+  ret = ide_diagnostics_new (ar);
+  _ide_diagnostics_sort (ret);
+
+  return ret;
+}
+
 static guint
 ide_diagnostics_group_has_diagnostics (IdeDiagnosticsGroup *group)
 {
   g_assert (group != NULL);
 
+  if (group->restored != NULL && ide_diagnostics_get_size (group->restored) > 0)
+    return TRUE;
+
   if (group->diagnostics_by_provider != NULL)
     {
       GHashTableIter iter;
@@ -295,6 +561,163 @@ ide_diagnostics_group_add (IdeDiagnosticsGroup   *group,
   group->sequence++;
 }
 
+static DiagnoseRequest *
+ide_diagnostics_group_get_request (IdeDiagnosticsGroup   *group,
+                                   IdeDiagnosticProvider *provider)
+{
+  DiagnoseRequest *request;
+
+  g_assert (group != NULL);
+  g_assert (IDE_IS_DIAGNOSTIC_PROVIDER (provider));
+
+  if (NULL == (request = g_hash_table_lookup (group->requests_by_provider, provider)))
+    {
+      request = g_slice_new0 (DiagnoseRequest);
+      g_hash_table_insert (group->requests_by_provider, provider, request);
+    }
+
+  return request;
+}
+
+static gboolean
+ide_diagnostics_group_is_up_to_date (IdeDiagnosticsGroup *group)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_assert (group != NULL);
+
+  g_hash_table_iter_init (&iter, group->requests_by_provider);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      DiagnoseRequest *request = value;
+
+      if (request->serial != group->change_serial || request->cancellable != NULL)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Saves the diagnostics of @group in the store, once every provider has
+ * reported on the current content of the buffer.
+ */
+static void
+ide_diagnostics_manager_record_group (IdeDiagnosticsManager *self,
+                                      IdeDiagnosticsGroup   *group)
+{
+  g_autoptr(IdeBuffer) buffer = NULL;
+  g_autoptr(GPtrArray) ar = NULL;
+  g_autofree gchar *uri = NULL;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (group != NULL);
+
+  if (group->checksum == NULL || group->diagnostics_by_provider == NULL)
+    return;
+
+  if (NULL == (buffer = g_weak_ref_get (&group->buffer_wr)))
+    return;
+
+  ar = g_ptr_array_new ();
+
+  g_hash_table_iter_init (&iter, group->diagnostics_by_provider);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      IdeDiagnostics *diagnostics = value;
+      gsize length;
+
+      if (diagnostics == NULL)
+        continue;
+
+      length = ide_diagnostics_get_size (diagnostics);
+
+      for (gsize i = 0; i < length; i++)
+        g_ptr_array_add (ar, ide_diagnostics_index (diagnostics, i));
+    }
+
+  uri = g_file_get_uri (group->file);
+
+  /*
+   * The content may not match the file on disk, so the entry is checked
+   * against the file before it is shown once the buffer is closed.
+   */
+  _ide_diagnostics_store_insert (self->store,
+                                 uri,
+                                 group->checksum,
+                                 0,
+                                 FALSE,
+                                 _ide_diagnostics_store_encode ((IdeDiagnostic **)ar->pdata, ar->len));
+}
+
+static gint64
+ide_diagnostics_manager_get_latency (IdeDiagnosticsManager *self,
+                                     IdeDiagnosticProvider *provider)
+{
+  ProviderStats *stats;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (IDE_IS_DIAGNOSTIC_PROVIDER (provider));
+
+  stats = g_hash_table_lookup (self->stats_by_type, GSIZE_TO_POINTER (G_OBJECT_TYPE (provider)));
+
+  return stats != NULL ? stats->latency : DEFAULT_DEBOUNCE_MSEC * 1000;
+}
+
+static gint64
+ide_diagnostics_manager_get_debounce (IdeDiagnosticsManager *self,
+                                      IdeDiagnosticProvider *provider)
+{
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (IDE_IS_DIAGNOSTIC_PROVIDER (provider));
+
+  return CLAMP (ide_diagnostics_manager_get_latency (self, provider),
+                MIN_DEBOUNCE_MSEC * 1000,
+                MAX_DEBOUNCE_MSEC * 1000);
+}
+
+static void
+ide_diagnostics_manager_record_latency (IdeDiagnosticsManager *self,
+                                        IdeDiagnosticProvider *provider,
+                                        gint64                 latency)
+{
+  ProviderStats *stats;
+  gpointer key;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (IDE_IS_DIAGNOSTIC_PROVIDER (provider));
+
+  key = GSIZE_TO_POINTER (G_OBJECT_TYPE (provider));
+
+  if (NULL == (stats = g_hash_table_lookup (self->stats_by_type, key)))
+    {
+      stats = g_slice_new0 (ProviderStats);
+      stats->latency = latency;
+      g_hash_table_insert (self->stats_by_type, key, stats);
+    }
+  else
+    {
+      /* Weigh recent runs heavier, the file may have grown */
+      stats->latency = (stats->latency * 3 + latency) / 4;
+    }
+
+  IDE_TRACE_MSG ("%s took %"G_GINT64_FORMAT" msec, average is now %"G_GINT64_FORMAT" msec",
+                 G_OBJECT_TYPE_NAME (provider), latency / 1000, stats->latency / 1000);
+}
+
+static void
+provider_stats_free (gpointer data)
+{
+  ProviderStats *stats = data;
+
+  g_slice_free (ProviderStats, stats);
+}
+
 static void
 ide_diagnostics_group_diagnose_cb (GObject      *object,
                                    GAsyncResult *result,
@@ -305,7 +728,9 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
   g_autoptr(IdeDiagnostics) diagnostics = NULL;
   g_autoptr(GError) error = NULL;
   IdeDiagnosticsGroup *group;
-  gboolean changed;
+  DiagnoseRequest *request;
+  gboolean changed = FALSE;
+  gboolean cancelled;
 
   IDE_ENTRY;
 
@@ -317,7 +742,9 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
 
   diagnostics = ide_diagnostic_provider_diagnose_finish (provider, result, &error);
 
-  if (error != NULL)
+  cancelled = g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+  if (error != NULL && !cancelled)
     g_warning ("%s", error->message);
 
   /*
@@ -328,6 +755,26 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
   group = g_object_get_data (G_OBJECT (provider), "IDE_DIAGNOSTICS_GROUP");
   g_assert (group != NULL);
 
+  /*
+   * The request is gone if the provider was unloaded while we were
+   * diagnosing. Otherwise, mark the provider idle and learn how long it
+   * took so that we can tune how long it waits for the buffer to settle.
+   */
+  if (NULL != (request = g_hash_table_lookup (group->requests_by_provider, provider)))
+    {
+      if (error == NULL)
+        ide_diagnostics_manager_record_latency (self, provider,
+                                                g_get_monotonic_time () - request->begin_time);
+      g_clear_object (&request->cancellable);
+    }
+
+  /*
+   * If the request was superseded, keep the previous diagnostics until the
+   * next request completes rather than flashing an empty gutter.
+   */
+  if (cancelled)
+    IDE_GOTO (finish);
+
   /*
    * Clear all of our old diagnostics no matter where they ended up.
    */
@@ -361,15 +808,28 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
         changed = TRUE;
     }
 
+  group->has_diagnostics = ide_diagnostics_group_has_diagnostics (group);
+
+finish:
   group->in_diagnose--;
 
   /*
-   * Ensure we increment our sequence number even when no diagnostics were
-   * reported. This ensures that the gutter gets cleared and line-flags
-   * cache updated.
+   * Once every provider has reported on the current content, the restored
+   * diagnostics are no longer needed and we can remember the results in
+   * case we see this content again.
    */
-  if (group->in_diagnose == 0)
-    group->sequence++;
+  if (!cancelled && ide_diagnostics_group_is_up_to_date (group))
+    {
+      if (group->restored != NULL)
+        {
+          g_clear_pointer (&group->restored, ide_diagnostics_unref);
+          group->has_diagnostics = ide_diagnostics_group_has_diagnostics (group);
+          group->sequence++;
+          changed = TRUE;
+        }
+
+      ide_diagnostics_manager_record_group (self, group);
+    }
 
   /*
    * Since the individual groups have sequence numbers associated with changes,
@@ -380,19 +840,22 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
   if (changed)
     g_signal_emit (self, signals [CHANGED], 0);
 
+  if (group->in_diagnose == 0)
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_BUSY]);
+
   /*
-   * If there are no more diagnostics providers active and the group needs
-   * another diagnosis, then we can start the next one now.
+   * If the group needs another diagnosis, this provider may now be able to
+   * start on it. Other providers for the group do not need to be finished.
    *
    * If we are completing this diagnosis and the buffer was already released
    * (and other diagnose providers have unloaded), we might be able to clean
    * up the group and be done with things.
    */
-  if (group->was_removed == FALSE && group->in_diagnose == 0 && group->needs_diagnose)
+  if (group->was_removed == FALSE && group->needs_diagnose)
     {
-      ide_diagnostics_group_queue_diagnose (group, self);
+      ide_diagnostics_manager_schedule (self, 0);
     }
-  else if (ide_diagnostics_group_can_dispose (group))
+  else if (group->in_diagnose == 0 && ide_diagnostics_group_can_dispose (group))
     {
       group->was_removed = TRUE;
       g_hash_table_remove (self->groups_by_file, group->file);
@@ -403,27 +866,28 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
 }
 
 static void
-ide_diagnostics_group_diagnose_foreach (IdeExtensionSetAdapter *adapter,
-                                        PeasPluginInfo         *plugin_info,
-                                        PeasExtension          *exten,
-                                        gpointer                user_data)
+ide_diagnostics_group_start (IdeDiagnosticsGroup   *group,
+                             IdeDiagnosticsManager *self,
+                             IdeDiagnosticProvider *provider,
+                             DiagnoseRequest       *request)
 {
-  IdeDiagnosticProvider *provider = (IdeDiagnosticProvider *)exten;
-  IdeDiagnosticsManager *self = user_data;
-  IdeDiagnosticsGroup *group;
-  IdeContext *context;
   g_autoptr(IdeFile) file = NULL;
+  IdeContext *context;
 
   IDE_ENTRY;
 
   g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
-  g_assert (IDE_IS_EXTENSION_SET_ADAPTER (adapter));
-  g_assert (plugin_info != NULL);
+  g_assert (group != NULL);
   g_assert (IDE_IS_DIAGNOSTIC_PROVIDER (provider));
+  g_assert (request != NULL);
+  g_assert (request->cancellable == NULL);
 
-  group = g_object_get_data (G_OBJECT (provider), "IDE_DIAGNOSTICS_GROUP");
   group->in_diagnose++;
 
+  request->cancellable = g_cancellable_new ();
+  request->begin_time = g_get_monotonic_time ();
+  request->serial = group->change_serial;
+
   context = ide_object_get_context (IDE_OBJECT (self));
 
   file = g_object_new (IDE_TYPE_FILE,
@@ -441,42 +905,125 @@ ide_diagnostics_group_diagnose_foreach (IdeExtensionSetAdapter *adapter,
 
   ide_diagnostic_provider_diagnose_async (provider,
                                           file,
-                                          NULL,
+                                          request->cancellable,
                                           ide_diagnostics_group_diagnose_cb,
                                           g_object_ref (self));
+
+  IDE_EXIT;
 }
 
 static void
-ide_diagnostics_group_diagnose (IdeDiagnosticsGroup   *group,
-                                IdeDiagnosticsManager *self)
+collect_providers (IdeExtensionSetAdapter *adapter,
+                   PeasPluginInfo         *plugin_info,
+                   PeasExtension          *exten,
+                   gpointer                user_data)
 {
-  g_autoptr(IdeBuffer) buffer = NULL;
+  GPtrArray *providers = user_data;
 
-  IDE_ENTRY;
+  g_ptr_array_add (providers, exten);
+}
+
+static gint
+compare_by_latency (gconstpointer a,
+                    gconstpointer b,
+                    gpointer      user_data)
+{
+  IdeDiagnosticsManager *self = user_data;
+  gint64 latency_a = ide_diagnostics_manager_get_latency (self, *(IdeDiagnosticProvider **)a);
+  gint64 latency_b = ide_diagnostics_manager_get_latency (self, *(IdeDiagnosticProvider **)b);
+
+  if (latency_a < latency_b)
+    return -1;
+  else if (latency_a > latency_b)
+    return 1;
+  else
+    return 0;
+}
+
+/*
+ * Starts every provider of @group that is out of date and whose debounce
+ * period has elapsed, cheapest first.
+ *
+ * Returns: the time at which the next provider is due, or %G_MAXINT64.
+ */
+static gint64
+ide_diagnostics_group_dispatch (IdeDiagnosticsGroup   *group,
+                                IdeDiagnosticsManager *self,
+                                gint64                 now)
+{
+  g_autoptr(GPtrArray) providers = NULL;
+  g_autoptr(IdeBuffer) buffer = NULL;
+  gint64 next_deadline = G_MAXINT64;
+  gboolean up_to_date = TRUE;
+  gboolean synced = FALSE;
+  guint i;
 
   g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
   g_assert (group != NULL);
-  g_assert (group->in_diagnose == FALSE);
   g_assert (IDE_IS_EXTENSION_SET_ADAPTER (group->adapter));
 
-  group->needs_diagnose = FALSE;
-  group->has_diagnostics = FALSE;
+  providers = g_ptr_array_new ();
+  ide_extension_set_adapter_foreach (group->adapter, collect_providers, providers);
+  g_ptr_array_sort_with_data (providers, compare_by_latency, self);
 
-  /*
-   * We need to ensure that all the diagnostic providers have access to the
-   * proper data within the unsaved files. So sync the content once to avoid
-   * all providers from having to do this manually.
-   */
-  if (NULL != (buffer = g_weak_ref_get (&group->buffer_wr)))
-    ide_buffer_sync_to_unsaved_files (buffer);
+  buffer = g_weak_ref_get (&group->buffer_wr);
 
-  ide_extension_set_adapter_foreach (group->adapter,
-                                     ide_diagnostics_group_diagnose_foreach,
-                                     self);
+  for (i = 0; i < providers->len; i++)
+    {
+      IdeDiagnosticProvider *provider = g_ptr_array_index (providers, i);
+      DiagnoseRequest *request;
+      gint64 deadline;
 
-  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_BUSY]);
+      request = ide_diagnostics_group_get_request (group, provider);
 
-  IDE_EXIT;
+      if (request->serial == group->change_serial)
+        continue;
+
+      up_to_date = FALSE;
+
+      /* Wait for the superseded request to bail before starting another */
+      if (request->cancellable != NULL)
+        continue;
+
+      /* Providers that have never run start right away, unless restored */
+      if (request->serial == 0 && group->verify_restored)
+        deadline = group->changed_at + RESTORED_VERIFY_DELAY_USEC;
+      else if (request->serial == 0)
+        deadline = now;
+      else
+        deadline = group->changed_at + ide_diagnostics_manager_get_debounce (self, provider);
+
+      if (deadline > now)
+        {
+          next_deadline = MIN (next_deadline, deadline);
+          continue;
+        }
+
+      /*
+       * We need to ensure that all the diagnostic providers have access to the
+       * proper data within the unsaved files. So sync the content once to avoid
+       * all providers from having to do this manually.
+       */
+      if (!synced && buffer != NULL)
+        {
+          g_autoptr(GBytes) content = NULL;
+
+          ide_buffer_sync_to_unsaved_files (buffer);
+
+          content = ide_buffer_get_content (buffer);
+          g_free (group->checksum);
+          group->checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, content);
+
+          synced = TRUE;
+        }
+
+      ide_diagnostics_group_start (group, self, provider, request);
+    }
+
+  if (up_to_date)
+    group->needs_diagnose = FALSE;
+
+  return next_deadline;
 }
 
 static gboolean
@@ -485,6 +1032,9 @@ ide_diagnostics_manager_begin_diagnose (gpointer data)
   IdeDiagnosticsManager *self = data;
   GHashTableIter iter;
   gpointer value;
+  gint64 next_deadline = G_MAXINT64;
+  gint64 now;
+  gboolean was_busy;
 
   IDE_ENTRY;
 
@@ -492,40 +1042,111 @@ ide_diagnostics_manager_begin_diagnose (gpointer data)
 
   self->queued_diagnose_source = 0;
 
+  was_busy = ide_diagnostics_manager_get_busy (self);
+  now = g_get_monotonic_time ();
+
   g_hash_table_iter_init (&iter, self->groups_by_file);
 
   while (g_hash_table_iter_next (&iter, NULL, &value))
     {
       IdeDiagnosticsGroup *group = value;
+      g_autoptr(IdeBuffer) buffer = NULL;
+      gint64 deadline;
 
-      if (group->needs_diagnose && group->adapter != NULL)
-        ide_diagnostics_group_diagnose (group, self);
+      if (!group->needs_diagnose || group->adapter == NULL)
+        continue;
+
+      /*
+       * Buffers restored in the background are not diagnosed until they are
+       * resumed. We leave needs_diagnose set so they are picked up then.
+       */
+      buffer = g_weak_ref_get (&group->buffer_wr);
+      if (buffer != NULL && _ide_buffer_get_deferred (buffer))
+        continue;
+
+      deadline = ide_diagnostics_group_dispatch (group, self, now);
+      next_deadline = MIN (next_deadline, deadline);
     }
 
+  if (next_deadline != G_MAXINT64)
+    ide_diagnostics_manager_schedule (self, next_deadline - now);
+
+  if (was_busy != ide_diagnostics_manager_get_busy (self))
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_BUSY]);
+
   IDE_RETURN (G_SOURCE_REMOVE);
 }
 
+/*
+ * Queues the dispatcher to run after @delay_usec, unless it is already
+ * queued to run sooner than that.
+ */
+static void
+ide_diagnostics_manager_schedule (IdeDiagnosticsManager *self,
+                                  gint64                 delay_usec)
+{
+  gint64 at;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+
+  at = g_get_monotonic_time () + MAX (0, delay_usec);
+
+  if (self->queued_diagnose_source != 0)
+    {
+      if (self->queued_diagnose_at <= at)
+        return;
+      ide_clear_source (&self->queued_diagnose_source);
+    }
+
+  self->queued_diagnose_at = at;
+
+  if (delay_usec <= 0)
+    self->queued_diagnose_source =
+      gdk_threads_add_idle_full (G_PRIORITY_DEFAULT,
+                                 ide_diagnostics_manager_begin_diagnose,
+                                 g_object_ref (self),
+                                 g_object_unref);
+  else
+    self->queued_diagnose_source =
+      gdk_threads_add_timeout_full (G_PRIORITY_DEFAULT,
+                                    MAX (1, delay_usec / 1000),
+                                    ide_diagnostics_manager_begin_diagnose,
+                                    g_object_ref (self),
+                                    g_object_unref);
+}
+
 static void
 ide_diagnostics_group_queue_diagnose (IdeDiagnosticsGroup   *group,
                                       IdeDiagnosticsManager *self)
 {
+  GHashTableIter iter;
+  gpointer value;
+
   g_assert (group != NULL);
 
   /*
-   * This checks to see if we are diagnosing and if not queues a diagnose.
-   * If a diagnosis is already running, we don't need to do anything now
-   * because the completion of the diagnose will tick off the next diagnose
-   * upon seening group->needs_diagnose==TRUE.
+   * Everything diagnosed before now is out of date. Providers that are
+   * still working on an older version are cancelled, and will be started
+   * again by the dispatcher once they have bailed and the buffer has
+   * settled.
    */
 
+  group->change_serial++;
+  group->changed_at = g_get_monotonic_time ();
   group->needs_diagnose = TRUE;
+  group->verify_restored = FALSE;
 
-  if (group->in_diagnose == 0 && self->queued_diagnose_source == 0)
-    self->queued_diagnose_source =
-      gdk_threads_add_idle_full (G_PRIORITY_DEFAULT,
-                                 ide_diagnostics_manager_begin_diagnose,
-                                 g_object_ref (self),
-                                 g_object_unref);
+  g_hash_table_iter_init (&iter, group->requests_by_provider);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      DiagnoseRequest *request = value;
+
+      if (request->cancellable != NULL)
+        g_cancellable_cancel (request->cancellable);
+    }
+
+  ide_diagnostics_manager_schedule (self, 0);
 }
 
 static void
@@ -535,6 +1156,11 @@ ide_diagnostics_manager_finalize (GObject *object)
 
   ide_clear_source (&self->queued_diagnose_source);
   g_clear_pointer (&self->groups_by_file, g_hash_table_unref);
+  g_clear_pointer (&self->stats_by_type, g_hash_table_unref);
+  g_clear_pointer (&self->store, _ide_diagnostics_store_free);
+  g_clear_pointer (&self->build_diagnostics, g_hash_table_unref);
+  g_clear_pointer (&self->validating, g_hash_table_unref);
+  g_clear_pointer (&self->monitors, g_hash_table_unref);
 
   G_OBJECT_CLASS (ide_diagnostics_manager_parent_class)->finalize (object);
 }
@@ -596,6 +1222,14 @@ ide_diagnostics_manager_init (IdeDiagnosticsManager *self)
                                                 (GEqualFunc)g_file_equal,
                                                 NULL,
                                                 (GDestroyNotify)ide_diagnostics_group_unref);
+  self->stats_by_type = g_hash_table_new_full (NULL, NULL, NULL, provider_stats_free);
+  self->store = _ide_diagnostics_store_new ();
+  self->build_diagnostics = g_hash_table_new_full (g_file_hash,
+                                                   (GEqualFunc)g_file_equal,
+                                                   g_object_unref,
+                                                   (GDestroyNotify)g_ptr_array_unref);
+  self->validating = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->monitors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, free_monitor);
 }
 
 static void
@@ -771,7 +1405,8 @@ ide_diagnostics_manager_clear_by_provider (IdeDiagnosticsManager *self,
 
       if (group->diagnostics_by_provider != NULL)
         {
-          g_hash_table_remove (group->diagnostics_by_provider, provider);
+          if (g_hash_table_remove (group->diagnostics_by_provider, provider))
+            group->sequence++;
 
           /*
            * If we caused this hashtable to become empty, we can release the
@@ -801,6 +1436,7 @@ ide_diagnostics_manager_extension_removed (IdeExtensionSetAdapter *adapter,
 {
   IdeDiagnosticProvider *provider = (IdeDiagnosticProvider *)exten;
   IdeDiagnosticsManager *self = user_data;
+  IdeDiagnosticsGroup *group;
 
   IDE_ENTRY;
 
@@ -813,6 +1449,11 @@ ide_diagnostics_manager_extension_removed (IdeExtensionSetAdapter *adapter,
                                         G_CALLBACK (ide_diagnostics_manager_provider_invalidated),
                                         self);
 
+  /* This cancels the request in flight, if any */
+  group = g_object_get_data (G_OBJECT (provider), "IDE_DIAGNOSTICS_GROUP");
+  if (group != NULL)
+    g_hash_table_remove (group->requests_by_provider, provider);
+
   /*
    * The goal of the following is to reomve our diagnostics from any file
    * that has been loaded. It is possible for diagnostic providers to effect
@@ -841,6 +1482,28 @@ ide_diagnostics_manager_buffer_changed (IdeDiagnosticsManager *self,
   IDE_EXIT;
 }
 
+/*
+ * Called when a deferred buffer is resumed. Changes made while it was
+ * deferred have already been noted, so we only need to dispatch them.
+ * If nothing changed, the previous diagnostics are still valid.
+ */
+void
+_ide_diagnostics_manager_queue_diagnose (IdeDiagnosticsManager *self,
+                                         IdeBuffer             *buffer)
+{
+  IdeDiagnosticsGroup *group;
+  GFile *gfile;
+
+  g_return_if_fail (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_return_if_fail (IDE_IS_BUFFER (buffer));
+
+  gfile = ide_file_get_file (ide_buffer_get_file (buffer));
+
+  if (NULL != (group = g_hash_table_lookup (self->groups_by_file, gfile)) &&
+      group->needs_diagnose)
+    ide_diagnostics_manager_schedule (self, 0);
+}
+
 static void
 ide_diagnostics_manager_buffer_notify_language (IdeDiagnosticsManager *self,
                                                 GParamSpec            *pspec,
@@ -940,6 +1603,63 @@ ide_diagnostics_manager_buffer_notify_file (IdeDiagnosticsManager *self,
   ide_diagnostics_manager_update_group_by_file (self, buffer, gfile);
 }
 
+/*
+ * If the store has diagnostics for the exact content of @buffer, from a
+ * previous session or the last time the file was open, show them until
+ * the providers have run. The providers are delayed, since the restored
+ * diagnostics are most likely still correct.
+ */
+static void
+ide_diagnostics_manager_restore_group (IdeDiagnosticsManager *self,
+                                       IdeDiagnosticsGroup   *group,
+                                       IdeBuffer             *buffer)
+{
+  g_autoptr(GPtrArray) providers = NULL;
+  g_autoptr(GVariant) diagnostics = NULL;
+  g_autoptr(GBytes) content = NULL;
+  g_autofree gchar *checksum = NULL;
+  g_autofree gchar *uri = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (group != NULL);
+  g_assert (IDE_IS_BUFFER (buffer));
+
+  /*
+   * Without any providers, nothing would ever replace the restored
+   * diagnostics once the buffer changes.
+   */
+  providers = g_ptr_array_new ();
+  ide_extension_set_adapter_foreach (group->adapter, collect_providers, providers);
+  if (providers->len == 0)
+    IDE_EXIT;
+
+  content = ide_buffer_get_content (buffer);
+  checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, content);
+  uri = g_file_get_uri (group->file);
+
+  if (NULL == (diagnostics = _ide_diagnostics_store_lookup (self->store, uri, checksum)))
+    IDE_EXIT;
+
+  IDE_TRACE_MSG ("Restoring diagnostics for %s", uri);
+
+  g_clear_pointer (&group->restored, ide_diagnostics_unref);
+  group->restored = _ide_diagnostics_store_decode (diagnostics, ide_buffer_get_file (buffer));
+
+  g_free (group->checksum);
+  group->checksum = g_steal_pointer (&checksum);
+
+  /* Have the providers confirm them once things have settled */
+  group->verify_restored = TRUE;
+  group->has_diagnostics = ide_diagnostics_group_has_diagnostics (group);
+  group->sequence++;
+
+  g_signal_emit (self, signals [CHANGED], 0);
+
+  IDE_EXIT;
+}
+
 static void
 ide_diagnostics_manager_buffer_loaded (IdeDiagnosticsManager *self,
                                        IdeBuffer             *buffer,
@@ -958,6 +1678,13 @@ ide_diagnostics_manager_buffer_loaded (IdeDiagnosticsManager *self,
   g_assert (IDE_IS_BUFFER (buffer));
   g_assert (IDE_IS_BUFFER_MANAGER (buffer_manager));
 
+  /*
+   * Large files only contain a window of the file, so diagnostics would
+   * neither be accurate nor cheap to generate. Don't track them at all.
+   */
+  if (_ide_buffer_get_large_file (buffer) != NULL)
+    IDE_EXIT;
+
   /*
    * The goal below is to setup all of our state needed for tracking
    * diagnostics during the lifetime of the buffer. That includes tracking
@@ -1033,6 +1760,8 @@ ide_diagnostics_manager_buffer_loaded (IdeDiagnosticsManager *self,
 
   ide_diagnostics_group_queue_diagnose (group, self);
 
+  ide_diagnostics_manager_restore_group (self, group, buffer);
+
   IDE_EXIT;
 }
 
@@ -1074,6 +1803,17 @@ ide_diagnostics_manager_buffer_unloaded (IdeDiagnosticsManager *self,
    */
   g_clear_object (&group->adapter);
 
+  /*
+   * The restored diagnostics are still in the store if anyone needs them.
+   */
+  if (group->restored != NULL)
+    {
+      g_clear_pointer (&group->restored, ide_diagnostics_unref);
+      group->sequence++;
+    }
+
+  g_clear_pointer (&group->checksum, g_free);
+
   /*
    * Even after unloading the diagnostic providers, we might still have
    * diagnostics that were created from other files (this could happen when
@@ -1104,6 +1844,408 @@ ide_diagnostics_manager_buffer_unloaded (IdeDiagnosticsManager *self,
   IDE_EXIT;
 }
 
+/*
+ * The store is keyed by the project directory rather than the project name,
+ * since two checkouts of the same project would otherwise share it.
+ */
+static GFile *
+get_store_file (IdeDiagnosticsManager *self)
+{
+  IdeContext *context;
+  GFile *workdir;
+  g_autofree gchar *uri = NULL;
+  g_autofree gchar *checksum = NULL;
+  g_autofree gchar *name = NULL;
+  g_autofree gchar *path = NULL;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  workdir = ide_vcs_get_working_directory (ide_context_get_vcs (context));
+
+  uri = g_file_get_uri (workdir);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+  name = g_strconcat (checksum, ".diagnostics", NULL);
+  path = g_build_filename (g_get_user_cache_dir (),
+                           ide_get_program_name (),
+                           "diagnostics",
+                           name,
+                           NULL);
+
+  return g_file_new_for_path (path);
+}
+
+/*
+ * Computes the checksum of each file whose uri is a key of the hashtable
+ * found in @task_data, as a FileChecksum. Files that no longer exist have a
+ * %NULL checksum, and files that could not be read are left out.
+ *
+ * The modification time is queried before the contents are read, so that
+ * a file changing in the mean time is checked again the next time.
+ */
+static void
+ide_diagnostics_manager_checksum_worker (GTask        *task,
+                                         gpointer      source_object,
+                                         gpointer      task_data,
+                                         GCancellable *cancellable)
+{
+  GHashTable *uris = task_data;
+  GHashTable *checksums;
+  GHashTableIter iter;
+  gpointer key;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (source_object));
+  g_assert (uris != NULL);
+
+  checksums = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, file_checksum_free);
+
+  g_hash_table_iter_init (&iter, uris);
+
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      const gchar *uri = key;
+      g_autoptr(GFile) file = g_file_new_for_uri (uri);
+      g_autoptr(GFileInfo) file_info = NULL;
+      g_autoptr(GError) error = NULL;
+      g_autofree gchar *contents = NULL;
+      FileChecksum *fc;
+      gsize len = 0;
+
+      file_info = g_file_query_info (file,
+                                     G_FILE_ATTRIBUTE_TIME_MODIFIED","
+                                     G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                     G_FILE_QUERY_INFO_NONE,
+                                     cancellable,
+                                     &error);
+
+      if (file_info != NULL)
+        g_file_load_contents (file, cancellable, &contents, &len, NULL, &error);
+
+      if (contents != NULL)
+        {
+          fc = g_slice_new0 (FileChecksum);
+          fc->checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1, (guchar *)contents, len);
+          fc->mtime = get_mtime (file_info);
+          g_hash_table_insert (checksums, g_strdup (uri), fc);
+        }
+      else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          fc = g_slice_new0 (FileChecksum);
+          g_hash_table_insert (checksums, g_strdup (uri), fc);
+        }
+    }
+
+  g_task_return_pointer (task, checksums, (GDestroyNotify)g_hash_table_unref);
+}
+
+static void
+ide_diagnostics_manager_validate_cb (GObject      *object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data)
+{
+  IdeDiagnosticsManager *self = (IdeDiagnosticsManager *)object;
+  g_autoptr(GHashTable) checksums = NULL;
+  g_autoptr(GPtrArray) again = NULL;
+  GHashTable *uris;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (G_IS_TASK (result));
+
+  uris = g_task_get_task_data (G_TASK (result));
+  again = g_ptr_array_new_with_free_func (g_free);
+
+  g_hash_table_iter_init (&iter, uris);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (g_hash_table_lookup (self->validating, key))
+        g_ptr_array_add (again, g_strdup (key));
+      g_hash_table_remove (self->validating, key);
+    }
+
+  checksums = g_task_propagate_pointer (G_TASK (result), NULL);
+
+  if (checksums != NULL && g_hash_table_size (checksums) > 0)
+    {
+      g_hash_table_iter_init (&iter, checksums);
+
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          FileChecksum *fc = value;
+
+          _ide_diagnostics_store_validate (self->store, key, fc->checksum, fc->mtime);
+
+          /* The entry is gone along with the file */
+          if (fc->checksum == NULL)
+            g_hash_table_remove (self->monitors, key);
+        }
+
+      g_signal_emit (self, signals [CHANGED], 0);
+    }
+
+  /* Files that changed while they were being checked */
+  if (again->len > 0)
+    {
+      g_ptr_array_add (again, NULL);
+      ide_diagnostics_manager_validate (self, (const gchar * const *)again->pdata);
+    }
+}
+
+/*
+ * Checks the entries of the store for @uris against the files on disk in a
+ * thread. Files that are already being checked are checked again once that
+ * has completed, since they may have changed after their checksum was taken.
+ */
+static void
+ide_diagnostics_manager_validate (IdeDiagnosticsManager *self,
+                                  const gchar * const   *uris)
+{
+  g_autoptr(GHashTable) set = NULL;
+  g_autoptr(GTask) task = NULL;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (uris != NULL);
+
+  set = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (guint i = 0; uris [i] != NULL; i++)
+    {
+      if (g_hash_table_contains (self->validating, uris [i]))
+        {
+          g_hash_table_insert (self->validating, g_strdup (uris [i]), GINT_TO_POINTER (TRUE));
+          continue;
+        }
+
+      g_hash_table_insert (self->validating, g_strdup (uris [i]), NULL);
+      g_hash_table_add (set, g_strdup (uris [i]));
+    }
+
+  if (g_hash_table_size (set) == 0)
+    return;
+
+  task = g_task_new (self, NULL, ide_diagnostics_manager_validate_cb, NULL);
+  g_task_set_task_data (task, g_steal_pointer (&set), (GDestroyNotify)g_hash_table_unref);
+  g_task_run_in_thread (task, ide_diagnostics_manager_checksum_worker);
+}
+
+static void
+ide_diagnostics_manager_load_store (IdeDiagnosticsManager *self)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree gchar *path = NULL;
+  g_auto(GStrv) strv = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+
+  file = get_store_file (self);
+  path = g_file_get_path (file);
+
+  if (NULL == (mapped = g_mapped_file_new (path, FALSE, &error)))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("%s", error->message);
+      IDE_EXIT;
+    }
+
+  bytes = g_mapped_file_get_bytes (mapped);
+
+  if (!_ide_diagnostics_store_load (self->store, bytes, &error))
+    {
+      g_warning ("Failed to load diagnostics from %s: %s", path, error->message);
+      IDE_EXIT;
+    }
+
+  IDE_TRACE_MSG ("Loaded diagnostics for %u files",
+                 _ide_diagnostics_store_get_size (self->store));
+
+  /*
+   * Files may have changed since the store was saved, so check them
+   * against their checksum before showing the diagnostics for files
+   * that are not open.
+   */
+  strv = _ide_diagnostics_store_get_uris (self->store);
+  ide_diagnostics_manager_validate (self, (const gchar * const *)strv);
+
+  IDE_EXIT;
+}
+
+static void
+ide_diagnostics_manager_flush_build_cb (GObject      *object,
+                                        GAsyncResult *result,
+                                        gpointer      user_data)
+{
+  IdeDiagnosticsManager *self = (IdeDiagnosticsManager *)object;
+  g_autoptr(GHashTable) checksums = NULL;
+  GHashTable *encoded;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (G_IS_TASK (result));
+
+  if (NULL == (checksums = g_task_propagate_pointer (G_TASK (result), NULL)))
+    return;
+
+  encoded = g_task_get_task_data (G_TASK (result));
+
+  g_hash_table_iter_init (&iter, checksums);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      FileChecksum *fc = value;
+      GVariant *diagnostics = g_hash_table_lookup (encoded, key);
+
+      if (diagnostics == NULL)
+        _ide_diagnostics_store_drop_build (self->store, key, fc->checksum);
+      else if (fc->checksum != NULL)
+        _ide_diagnostics_store_insert (self->store, key, fc->checksum, fc->mtime, TRUE, diagnostics);
+    }
+
+  g_signal_emit (self, signals [CHANGED], 0);
+}
+
+/*
+ * Moves the diagnostics from the last build into the store. This runs at a
+ * low priority so that the diagnostics still queued by the build result are
+ * delivered first.
+ *
+ * Files that a previous build reported on, but this one did not, map to
+ * %NULL so that their entry is dropped if the build compiled them again.
+ */
+static gboolean
+ide_diagnostics_manager_flush_build (gpointer data)
+{
+  IdeDiagnosticsManager *self = data;
+  g_autoptr(GHashTable) encoded = NULL;
+  g_autoptr(GTask) task = NULL;
+  g_auto(GStrv) build_uris = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+
+  encoded = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, free_variant);
+
+  g_hash_table_iter_init (&iter, self->build_diagnostics);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      GFile *file = key;
+      GPtrArray *ar = value;
+      IdeDiagnosticsGroup *group;
+
+      /*
+       * Open buffers are diagnosed by the providers, which know about
+       * unsaved changes, so they have the final say for those.
+       */
+      group = g_hash_table_lookup (self->groups_by_file, file);
+      if (group != NULL && group->adapter != NULL)
+        continue;
+
+      g_hash_table_insert (encoded,
+                           g_file_get_uri (file),
+                           g_variant_ref_sink (_ide_diagnostics_store_encode ((IdeDiagnostic **)ar->pdata, ar->len)));
+    }
+
+  g_hash_table_remove_all (self->build_diagnostics);
+
+  /*
+   * A failed build may have stopped before compiling everything that
+   * changed, so silence only means something when it succeeded.
+   */
+  if (!self->build_failed)
+    {
+      build_uris = _ide_diagnostics_store_get_build_uris (self->store);
+
+      for (guint i = 0; build_uris [i] != NULL; i++)
+        {
+          if (!g_hash_table_contains (encoded, build_uris [i]))
+            g_hash_table_insert (encoded, g_strdup (build_uris [i]), NULL);
+        }
+    }
+
+  if (g_hash_table_size (encoded) == 0)
+    IDE_RETURN (G_SOURCE_REMOVE);
+
+  /* Build output refers to the files on disk */
+  task = g_task_new (self, NULL, ide_diagnostics_manager_flush_build_cb, NULL);
+  g_task_set_task_data (task, g_steal_pointer (&encoded), (GDestroyNotify)g_hash_table_unref);
+  g_task_run_in_thread (task, ide_diagnostics_manager_checksum_worker);
+
+  IDE_RETURN (G_SOURCE_REMOVE);
+}
+
+static void
+ide_diagnostics_manager_build_diagnostic (IdeDiagnosticsManager *self,
+                                          IdeDiagnostic         *diagnostic,
+                                          IdeBuildResult        *build_result)
+{
+  GPtrArray *ar;
+  GFile *file;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (diagnostic != NULL);
+  g_assert (IDE_IS_BUILD_RESULT (build_result));
+
+  if (NULL == (file = ide_diagnostic_get_file (diagnostic)))
+    return;
+
+  if (NULL == (ar = g_hash_table_lookup (self->build_diagnostics, file)))
+    {
+      ar = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_diagnostic_unref);
+      g_hash_table_insert (self->build_diagnostics, g_object_ref (file), ar);
+    }
+
+  g_ptr_array_add (ar, ide_diagnostic_ref (diagnostic));
+}
+
+static void
+ide_diagnostics_manager_build_started (IdeDiagnosticsManager *self,
+                                       IdeBuildResult        *build_result,
+                                       IdeBuildManager       *build_manager)
+{
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (IDE_IS_BUILD_RESULT (build_result));
+  g_assert (IDE_IS_BUILD_MANAGER (build_manager));
+
+  g_hash_table_remove_all (self->build_diagnostics);
+
+  g_signal_connect_object (build_result,
+                           "diagnostic",
+                           G_CALLBACK (ide_diagnostics_manager_build_diagnostic),
+                           self,
+                           G_CONNECT_SWAPPED);
+}
+
+static void
+ide_diagnostics_manager_build_completed (IdeDiagnosticsManager *self,
+                                         IdeBuildResult        *build_result,
+                                         IdeBuildManager       *build_manager)
+{
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (IDE_IS_BUILD_RESULT (build_result));
+  g_assert (IDE_IS_BUILD_MANAGER (build_manager));
+
+  self->build_failed = ide_build_result_get_failed (build_result);
+
+  g_idle_add_full (G_PRIORITY_LOW,
+                   ide_diagnostics_manager_flush_build,
+                   g_object_ref (self),
+                   g_object_unref);
+}
+
 static gboolean
 ide_diagnostics_manager_initable_init (GInitable     *initable,
                                        GCancellable  *cancellable,
@@ -1111,6 +2253,7 @@ ide_diagnostics_manager_initable_init (GInitable     *initable,
 {
   IdeDiagnosticsManager *self = (IdeDiagnosticsManager *)initable;
   IdeBufferManager *buffer_manager;
+  IdeBuildManager *build_manager;
   IdeContext *context;
   guint n_items;
 
@@ -1120,6 +2263,31 @@ ide_diagnostics_manager_initable_init (GInitable     *initable,
 
   context = ide_object_get_context (IDE_OBJECT (self));
   buffer_manager = ide_context_get_buffer_manager (context);
+  build_manager = ide_context_get_build_manager (context);
+
+  /*
+   * Load the store before tracking buffers so that the buffers which are
+   * already open can reuse their diagnostics.
+   */
+  ide_diagnostics_manager_load_store (self);
+
+  g_signal_connect_object (build_manager,
+                           "build-started",
+                           G_CALLBACK (ide_diagnostics_manager_build_started),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (build_manager,
+                           "build-finished",
+                           G_CALLBACK (ide_diagnostics_manager_build_completed),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (build_manager,
+                           "build-failed",
+                           G_CALLBACK (ide_diagnostics_manager_build_completed),
+                           self,
+                           G_CONNECT_SWAPPED);
 
   g_signal_connect_object (buffer_manager,
                            "buffer-loaded",
@@ -1180,61 +2348,159 @@ ide_diagnostics_manager_get_busy (IdeDiagnosticsManager *self)
   return FALSE;
 }
 
+static void
+ide_diagnostics_manager_monitor_changed (IdeDiagnosticsManager *self,
+                                         GFile                 *file,
+                                         GFile                 *other_file,
+                                         GFileMonitorEvent      event,
+                                         GFileMonitor          *monitor)
+{
+  g_autofree gchar *uri = NULL;
+  const gchar *uris[] = { NULL, NULL };
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (G_IS_FILE (file));
+  g_assert (G_IS_FILE_MONITOR (monitor));
+
+  switch (event)
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED:
+    case G_FILE_MONITOR_EVENT_RENAMED:
+      uri = g_file_get_uri (file);
+      IDE_TRACE_MSG ("%s changed on disk, checking diagnostics", uri);
+      uris [0] = uri;
+      ide_diagnostics_manager_validate (self, uris);
+      break;
+
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+    case G_FILE_MONITOR_EVENT_PRE_UNMOUNT:
+    case G_FILE_MONITOR_EVENT_UNMOUNTED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+    default:
+      break;
+    }
+}
+
+/*
+ * Starts watching @file, which is not open, so that its entry in the store
+ * is validated again whenever it changes on disk.
+ *
+ * Returns: %TRUE if @file was not watched yet.
+ */
+static gboolean
+ide_diagnostics_manager_watch (IdeDiagnosticsManager *self,
+                               GFile                 *file,
+                               const gchar           *uri)
+{
+  g_autoptr(GError) error = NULL;
+  GFileMonitor *monitor;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (G_IS_FILE (file));
+  g_assert (uri != NULL);
+
+  if (g_hash_table_contains (self->monitors, uri))
+    return FALSE;
+
+  if (NULL == (monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error)))
+    {
+      g_debug ("Failed to create GFileMonitor: %s", error->message);
+      return FALSE;
+    }
+
+  g_signal_connect_object (monitor,
+                           "changed",
+                           G_CALLBACK (ide_diagnostics_manager_monitor_changed),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  g_hash_table_insert (self->monitors, g_strdup (uri), monitor);
+
+  return TRUE;
+}
+
 /**
  * ide_diagnostics_manager_get_diagnostics_for_file:
  * @self: An #IdeDiagnosticsManager
  * @file: A #GFile to retrieve diagnostics for
  *
- * This function collects all of the diagnostics that have been collected
- * for @file and returns them as a new #IdeDiagnostics to the caller.
+ * This function returns all of the diagnostics that have been collected
+ * for @file, sorted by their location.
+ *
+ * The result is shared with other callers until the diagnostics for @file
+ * change (see ide_diagnostics_manager_get_sequence_for_file()), so it must
+ * not be modified.
  *
  * The #IdeDiagnostics structure will contain zero items if there are
  * no diagnostics discovered. Therefore, this function will never return
  * a %NULL value.
  *
- * Returns: (transfer full): A new #IdeDiagnostics.
+ * Returns: (transfer full): An #IdeDiagnostics.
  */
 IdeDiagnostics *
 ide_diagnostics_manager_get_diagnostics_for_file (IdeDiagnosticsManager *self,
                                                   GFile                 *file)
 {
-  g_autoptr(IdeDiagnostics) ret = NULL;
+  g_autofree gchar *uri = NULL;
   IdeDiagnosticsGroup *group;
+  IdeDiagnostics *ret;
+  gboolean needs_validate = FALSE;
 
   g_return_val_if_fail (IDE_IS_DIAGNOSTICS_MANAGER (self), NULL);
   g_return_val_if_fail (G_IS_FILE (file), NULL);
 
-  ret = ide_diagnostics_new (NULL);
-
   group = g_hash_table_lookup (self->groups_by_file, file);
 
-  if (group != NULL && group->diagnostics_by_provider != NULL)
+  if (group != NULL && (group->adapter != NULL || group->diagnostics_by_provider != NULL))
     {
-      GHashTableIter iter;
-      gpointer value;
+      /*
+       * Every change to the diagnostics of the group bumps the sequence, so
+       * we only need to merge them again when it has moved on.
+       */
+      if (group->snapshot == NULL || group->snapshot_sequence != group->sequence)
+        {
+          g_clear_pointer (&group->snapshot, ide_diagnostics_unref);
+          group->snapshot = ide_diagnostics_group_merge (group);
+          group->snapshot_sequence = group->sequence;
+        }
 
-      g_hash_table_iter_init (&iter, group->diagnostics_by_provider);
+      return ide_diagnostics_ref (group->snapshot);
+    }
 
-      while (g_hash_table_iter_next (&iter, NULL, &value))
-        {
-          IdeDiagnostics *diagnostics = value;
-          guint length;
+  /*
+   * If the file is not open, we might still know about its diagnostics
+   * from a previous session or the last build. They are only used once
+   * they were checked against the file, which happens in a thread, and
+   * ::changed is emitted when done. The file is watched from then on so
+   * that it is checked again when it changes, and once more when we start
+   * watching in case it changed since it was last checked.
+   */
+  uri = g_file_get_uri (file);
 
-          if (diagnostics == NULL)
-            continue;
+  if (!_ide_diagnostics_store_contains (self->store, uri))
+    return ide_diagnostics_new (NULL);
 
-          length = ide_diagnostics_get_size (diagnostics);
+  ret = _ide_diagnostics_store_lookup_on_disk (self->store,
+                                               uri,
+                                               ide_object_get_context (IDE_OBJECT (self)),
+                                               &needs_validate);
 
-          for (guint i = 0; i < length; i++)
-            {
-              IdeDiagnostic *diagnostic = ide_diagnostics_index (diagnostics, i);
+  if (ide_diagnostics_manager_watch (self, file, uri) || needs_validate)
+    {
+      const gchar *uris[] = { uri, NULL };
 
-              ide_diagnostics_add (ret, diagnostic);
-            }
-        }
+      ide_diagnostics_manager_validate (self, uris);
     }
 
-  return g_steal_pointer (&ret);
+  if (ret == NULL)
+    ret = ide_diagnostics_new (NULL);
+
+  return ret;
 }
 
 guint
@@ -1253,3 +2519,111 @@ ide_diagnostics_manager_get_sequence_for_file (IdeDiagnosticsManager *self,
 
   return 0;
 }
+
+typedef struct
+{
+  GFile  *file;
+  GBytes *bytes;
+} SaveState;
+
+static void
+save_state_free (gpointer data)
+{
+  SaveState *state = data;
+
+  g_clear_object (&state->file);
+  g_clear_pointer (&state->bytes, g_bytes_unref);
+  g_slice_free (SaveState, state);
+}
+
+static void
+ide_diagnostics_manager_save_worker (GTask        *task,
+                                     gpointer      source_object,
+                                     gpointer      task_data,
+                                     GCancellable *cancellable)
+{
+  SaveState *state = task_data;
+  g_autoptr(GFile) parent = NULL;
+  GError *error = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (source_object));
+  g_assert (state != NULL);
+  g_assert (G_IS_FILE (state->file));
+  g_assert (state->bytes != NULL);
+
+  parent = g_file_get_parent (state->file);
+
+  if (!g_file_query_exists (parent, cancellable) &&
+      !g_file_make_directory_with_parents (parent, cancellable, &error))
+    {
+      g_task_return_error (task, error);
+      IDE_EXIT;
+    }
+
+  if (!g_file_replace_contents (state->file,
+                                g_bytes_get_data (state->bytes, NULL),
+                                g_bytes_get_size (state->bytes),
+                                NULL,
+                                FALSE,
+                                G_FILE_CREATE_NONE,
+                                NULL,
+                                cancellable,
+                                &error))
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+
+  IDE_EXIT;
+}
+
+/**
+ * _ide_diagnostics_manager_save_async:
+ *
+ * Saves the known diagnostics for the project to the cache directory, so
+ * they are available the next time the project is opened.
+ */
+void
+_ide_diagnostics_manager_save_async (IdeDiagnosticsManager *self,
+                                     GCancellable          *cancellable,
+                                     GAsyncReadyCallback    callback,
+                                     gpointer               user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  SaveState *state;
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+
+  if (!_ide_diagnostics_store_get_dirty (self->store))
+    {
+      g_task_return_boolean (task, TRUE);
+      IDE_EXIT;
+    }
+
+  state = g_slice_new0 (SaveState);
+  state->file = get_store_file (self);
+  state->bytes = _ide_diagnostics_store_serialize (self->store);
+
+  g_task_set_task_data (task, state, save_state_free);
+  g_task_run_in_thread (task, ide_diagnostics_manager_save_worker);
+
+  IDE_EXIT;
+}
+
+gboolean
+_ide_diagnostics_manager_save_finish (IdeDiagnosticsManager  *self,
+                                      GAsyncResult           *result,
+                                      GError                **error)
+{
+  g_return_val_if_fail (IDE_IS_DIAGNOSTICS_MANAGER (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
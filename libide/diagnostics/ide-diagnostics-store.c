@@ -0,0 +1,626 @@
+/* ide-diagnostics-store.c
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-diagnostics-store"
+
+#include <gio/gio.h>
+
+#include "ide-context.h"
+#include "ide-internal.h"
+
+#include "diagnostics/ide-diagnostic.h"
+#include "diagnostics/ide-diagnostics.h"
+#include "diagnostics/ide-diagnostics-store.h"
+#include "diagnostics/ide-source-location.h"
+#include "diagnostics/ide-source-range.h"
+#include "files/ide-file.h"
+
+/*
+ * IdeDiagnosticsStore keeps the last known diagnostics for every file in
+ * the project, along with a checksum of the content they were generated
+ * for. That allows us to show diagnostics for files that are not open, and
+ * to skip running the diagnostic providers when a file is opened and its
+ * content has not changed since it was last diagnosed.
+ *
+ * The diagnostics are kept in their serialized form, as a GVariant, so the
+ * whole store can be written out (or mapped back in) without copying. A
+ * file is only decoded into IdeDiagnostic instances when it is needed.
+ *
+ * Entries are only trusted to match the file on disk once the file was
+ * checked against the checksum, see _ide_diagnostics_store_validate(). The
+ * owner of the store checks again when the file changes. Entries that were
+ * loaded from disk have not been checked at all. They can still be found by their checksum in the
+ * mean time, which is how a buffer restored from drafts finds the
+ * diagnostics for its content.
+ *
+ * Verified entries keep their decoded and sorted diagnostics around, since
+ * the same files are asked for over and over while they are not open. That
+ * is dropped whenever the entry is replaced or validated again.
+ */
+
+#define STORE_VERSION         2
+#define STORE_VARIANT_TYPE    "(ua{s(sba(uuuusa(uuuu)))})"
+#define ENTRIES_VARIANT_TYPE  "a(uuuusa(uuuu))"
+
+struct _IdeDiagnosticsStore
+{
+  GHashTable *entries;
+  guint       dirty : 1;
+};
+
+typedef struct
+{
+  gchar          *checksum;
+  GVariant       *diagnostics;
+  IdeDiagnostics *decoded;
+  gint64          mtime;
+  guint           verified : 1;
+  guint           from_build : 1;
+} Entry;
+
+static void
+entry_free (gpointer data)
+{
+  Entry *entry = data;
+
+  g_clear_pointer (&entry->checksum, g_free);
+  g_clear_pointer (&entry->diagnostics, g_variant_unref);
+  g_clear_pointer (&entry->decoded, ide_diagnostics_unref);
+  g_slice_free (Entry, entry);
+}
+
+IdeDiagnosticsStore *
+_ide_diagnostics_store_new (void)
+{
+  IdeDiagnosticsStore *self;
+
+  self = g_slice_new0 (IdeDiagnosticsStore);
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, entry_free);
+
+  return self;
+}
+
+void
+_ide_diagnostics_store_free (IdeDiagnosticsStore *self)
+{
+  if (self != NULL)
+    {
+      g_clear_pointer (&self->entries, g_hash_table_unref);
+      g_slice_free (IdeDiagnosticsStore, self);
+    }
+}
+
+/**
+ * _ide_diagnostics_store_load:
+ * @self: An #IdeDiagnosticsStore
+ * @bytes: the contents of a previously serialized store
+ *
+ * Replaces the contents of @self with those found in @bytes. The entries
+ * are not verified until _ide_diagnostics_store_validate() is called for
+ * their file.
+ *
+ * Returns: %TRUE if successful, otherwise %FALSE and @error is set.
+ */
+gboolean
+_ide_diagnostics_store_load (IdeDiagnosticsStore  *self,
+                             GBytes               *bytes,
+                             GError              **error)
+{
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariant) files = NULL;
+  GVariantIter iter;
+  const gchar *uri;
+  const gchar *checksum;
+  GVariant *diagnostics;
+  gboolean from_build;
+  guint version = 0;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (bytes != NULL, FALSE);
+
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE (STORE_VARIANT_TYPE), bytes, FALSE);
+  g_variant_get (variant, "(u@a{s(sba(uuuusa(uuuu)))})", &version, &files);
+
+  if (version != STORE_VERSION)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   "Unsupported diagnostics store version %u",
+                   version);
+      return FALSE;
+    }
+
+  g_hash_table_remove_all (self->entries);
+
+  g_variant_iter_init (&iter, files);
+
+  while (g_variant_iter_next (&iter, "{&s(&sb@" ENTRIES_VARIANT_TYPE ")}", &uri, &checksum, &from_build, &diagnostics))
+    {
+      Entry *entry;
+
+      entry = g_slice_new0 (Entry);
+      entry->checksum = g_strdup (checksum);
+      entry->diagnostics = diagnostics;
+      entry->from_build = !!from_build;
+
+      g_hash_table_insert (self->entries, g_strdup (uri), entry);
+    }
+
+  self->dirty = FALSE;
+
+  return TRUE;
+}
+
+/**
+ * _ide_diagnostics_store_serialize:
+ *
+ * Serializes the store so that it can be loaded again with
+ * _ide_diagnostics_store_load(). This clears the dirty bit.
+ *
+ * Returns: (transfer full): A #GBytes.
+ */
+GBytes *
+_ide_diagnostics_store_serialize (IdeDiagnosticsStore *self)
+{
+  g_autoptr(GVariant) variant = NULL;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(sba(uuuusa(uuuu)))}"));
+
+  g_hash_table_iter_init (&iter, self->entries);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const gchar *uri = key;
+      Entry *entry = value;
+
+      g_variant_builder_add (&builder, "{s(sb@" ENTRIES_VARIANT_TYPE ")}",
+                             uri, entry->checksum, (gboolean)entry->from_build, entry->diagnostics);
+    }
+
+  variant = g_variant_ref_sink (g_variant_new (STORE_VARIANT_TYPE, STORE_VERSION, &builder));
+
+  self->dirty = FALSE;
+
+  return g_variant_get_data_as_bytes (variant);
+}
+
+gboolean
+_ide_diagnostics_store_get_dirty (IdeDiagnosticsStore *self)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  return self->dirty;
+}
+
+guint
+_ide_diagnostics_store_get_size (IdeDiagnosticsStore *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return g_hash_table_size (self->entries);
+}
+
+/**
+ * _ide_diagnostics_store_get_uris:
+ *
+ * Returns: (transfer full): A newly allocated %NULL-terminated array of the
+ *   uris of the files found in the store.
+ */
+gchar **
+_ide_diagnostics_store_get_uris (IdeDiagnosticsStore *self)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gchar **ret;
+  guint i = 0;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  ret = g_new0 (gchar *, g_hash_table_size (self->entries) + 1);
+
+  g_hash_table_iter_init (&iter, self->entries);
+
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    ret [i++] = g_strdup (key);
+
+  return ret;
+}
+
+/**
+ * _ide_diagnostics_store_get_build_uris:
+ *
+ * Returns: (transfer full): A newly allocated %NULL-terminated array of the
+ *   uris of the files whose diagnostics came from a build.
+ */
+gchar **
+_ide_diagnostics_store_get_build_uris (IdeDiagnosticsStore *self)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  gchar **ret;
+  guint i = 0;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  ret = g_new0 (gchar *, g_hash_table_size (self->entries) + 1);
+
+  g_hash_table_iter_init (&iter, self->entries);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      Entry *entry = value;
+
+      if (entry->from_build)
+        ret [i++] = g_strdup (key);
+    }
+
+  return ret;
+}
+
+/**
+ * _ide_diagnostics_store_insert:
+ * @self: An #IdeDiagnosticsStore
+ * @uri: the uri of the file
+ * @checksum: the checksum of the content that was diagnosed
+ * @mtime: the modification time of the file, in microseconds, when it was
+ *   found to match @checksum, or 0 if that is not known
+ * @from_build: if the diagnostics were found in the output of a build
+ * @diagnostics: the diagnostics, as created with _ide_diagnostics_store_encode()
+ *
+ * Replaces the diagnostics for @uri. If @diagnostics is floating, the
+ * reference is consumed.
+ */
+void
+_ide_diagnostics_store_insert (IdeDiagnosticsStore *self,
+                               const gchar         *uri,
+                               const gchar         *checksum,
+                               gint64               mtime,
+                               gboolean             from_build,
+                               GVariant            *diagnostics)
+{
+  Entry *entry;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (uri != NULL);
+  g_return_if_fail (checksum != NULL);
+  g_return_if_fail (diagnostics != NULL);
+  g_return_if_fail (g_variant_is_of_type (diagnostics, G_VARIANT_TYPE (ENTRIES_VARIANT_TYPE)));
+
+  entry = g_slice_new0 (Entry);
+  entry->checksum = g_strdup (checksum);
+  entry->diagnostics = g_variant_ref_sink (diagnostics);
+  entry->mtime = mtime;
+  entry->verified = (mtime != 0);
+  entry->from_build = !!from_build;
+
+  g_hash_table_insert (self->entries, g_strdup (uri), entry);
+
+  self->dirty = TRUE;
+}
+
+void
+_ide_diagnostics_store_remove (IdeDiagnosticsStore *self,
+                               const gchar         *uri)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (uri != NULL);
+
+  if (g_hash_table_remove (self->entries, uri))
+    self->dirty = TRUE;
+}
+
+gboolean
+_ide_diagnostics_store_contains (IdeDiagnosticsStore *self,
+                                 const gchar         *uri)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (uri != NULL, FALSE);
+
+  return g_hash_table_contains (self->entries, uri);
+}
+
+/**
+ * _ide_diagnostics_store_lookup:
+ * @self: An #IdeDiagnosticsStore
+ * @uri: the uri of the file
+ * @checksum: the checksum of the content
+ *
+ * Looks up the diagnostics for @uri, if they were generated for content
+ * matching @checksum.
+ *
+ * Returns: (transfer full) (nullable): the diagnostics, or %NULL.
+ */
+GVariant *
+_ide_diagnostics_store_lookup (IdeDiagnosticsStore *self,
+                               const gchar         *uri,
+                               const gchar         *checksum)
+{
+  Entry *entry;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+  g_return_val_if_fail (checksum != NULL, NULL);
+
+  if (NULL == (entry = g_hash_table_lookup (self->entries, uri)))
+    return NULL;
+
+  if (g_strcmp0 (checksum, entry->checksum) != 0)
+    return NULL;
+
+  return g_variant_ref (entry->diagnostics);
+}
+
+/**
+ * _ide_diagnostics_store_lookup_on_disk:
+ * @self: An #IdeDiagnosticsStore
+ * @uri: the uri of the file
+ * @context: (nullable): the #IdeContext to create the diagnostics for
+ * @needs_validate: (out) (optional): set if the entry has not been checked
+ *   against the file since it was inserted or loaded
+ *
+ * Looks up the diagnostics for the file on disk. They are only returned if
+ * the file was found to match them, the last time it was checked with
+ * _ide_diagnostics_store_validate(). This does not touch the file, so the
+ * caller is responsible for validating the entry again when it changes.
+ *
+ * Returns: (transfer full) (nullable): the diagnostics, sorted by their
+ *   location, or %NULL. They are shared and must not be modified.
+ */
+IdeDiagnostics *
+_ide_diagnostics_store_lookup_on_disk (IdeDiagnosticsStore *self,
+                                       const gchar         *uri,
+                                       IdeContext          *context,
+                                       gboolean            *needs_validate)
+{
+  Entry *entry;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+  g_return_val_if_fail (!context || IDE_IS_CONTEXT (context), NULL);
+
+  if (needs_validate != NULL)
+    *needs_validate = FALSE;
+
+  if (NULL == (entry = g_hash_table_lookup (self->entries, uri)))
+    return NULL;
+
+  if (entry->mtime == 0)
+    {
+      if (needs_validate != NULL)
+        *needs_validate = TRUE;
+      return NULL;
+    }
+
+  if (!entry->verified)
+    return NULL;
+
+  if (entry->decoded == NULL)
+    {
+      g_autoptr(GFile) gfile = g_file_new_for_uri (uri);
+      g_autoptr(IdeFile) file = NULL;
+
+      file = g_object_new (IDE_TYPE_FILE,
+                           "context", context,
+                           "file", gfile,
+                           NULL);
+
+      entry->decoded = _ide_diagnostics_store_decode (entry->diagnostics, file);
+      _ide_diagnostics_sort (entry->decoded);
+    }
+
+  return ide_diagnostics_ref (entry->decoded);
+}
+
+/**
+ * _ide_diagnostics_store_validate:
+ * @self: An #IdeDiagnosticsStore
+ * @uri: the uri of the file
+ * @checksum: (nullable): the checksum of the file on disk, or %NULL if
+ *   the file no longer exists
+ * @mtime: the modification time of the file, in microseconds, from before
+ *   @checksum was computed
+ *
+ * Updates whether the entry for @uri matches the file on disk. Entries that
+ * do not match are kept, in case a buffer has that content unsaved, but are
+ * not returned from _ide_diagnostics_store_lookup_on_disk().
+ */
+void
+_ide_diagnostics_store_validate (IdeDiagnosticsStore *self,
+                                 const gchar         *uri,
+                                 const gchar         *checksum,
+                                 gint64               mtime)
+{
+  Entry *entry;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (uri != NULL);
+
+  if (checksum == NULL)
+    {
+      _ide_diagnostics_store_remove (self, uri);
+      return;
+    }
+
+  if (NULL != (entry = g_hash_table_lookup (self->entries, uri)))
+    {
+      entry->verified = (g_strcmp0 (checksum, entry->checksum) == 0);
+      entry->mtime = mtime;
+      g_clear_pointer (&entry->decoded, ide_diagnostics_unref);
+    }
+}
+
+/**
+ * _ide_diagnostics_store_drop_build:
+ * @self: An #IdeDiagnosticsStore
+ * @uri: the uri of the file
+ * @checksum: (nullable): the checksum of the file on disk, or %NULL if
+ *   the file no longer exists
+ *
+ * Call this for files that a successful build reported nothing for. If the
+ * entry for @uri came from a build and the file has changed since, the
+ * build compiled it again without any diagnostics, so the entry is removed.
+ */
+void
+_ide_diagnostics_store_drop_build (IdeDiagnosticsStore *self,
+                                   const gchar         *uri,
+                                   const gchar         *checksum)
+{
+  Entry *entry;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (uri != NULL);
+
+  if (NULL == (entry = g_hash_table_lookup (self->entries, uri)) || !entry->from_build)
+    return;
+
+  if (g_strcmp0 (checksum, entry->checksum) != 0)
+    _ide_diagnostics_store_remove (self, uri);
+}
+
+/**
+ * _ide_diagnostics_store_encode:
+ * @diagnostics: (array length=n_diagnostics): the diagnostics to encode
+ * @n_diagnostics: the number of elements in @diagnostics
+ *
+ * Encodes @diagnostics in the form used by the store. Fixits are not kept,
+ * since they are only useful once the file is open and the providers have
+ * run again. Diagnostics without a location are skipped.
+ *
+ * Returns: (transfer floating): A new #GVariant.
+ */
+GVariant *
+_ide_diagnostics_store_encode (IdeDiagnostic **diagnostics,
+                               guint           n_diagnostics)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (ENTRIES_VARIANT_TYPE));
+
+  for (i = 0; i < n_diagnostics; i++)
+    {
+      IdeDiagnostic *diagnostic = diagnostics [i];
+      IdeSourceLocation *location;
+      const gchar *text;
+      guint n_ranges;
+      guint j;
+
+      if (NULL == (location = ide_diagnostic_get_location (diagnostic)))
+        continue;
+
+      text = ide_diagnostic_get_text (diagnostic);
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(uuuusa(uuuu))"));
+      g_variant_builder_add (&builder, "u", ide_diagnostic_get_severity (diagnostic));
+      g_variant_builder_add (&builder, "u", ide_source_location_get_line (location));
+      g_variant_builder_add (&builder, "u", ide_source_location_get_line_offset (location));
+      g_variant_builder_add (&builder, "u", ide_source_location_get_offset (location));
+      g_variant_builder_add (&builder, "s", text ? text : "");
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(uuuu)"));
+
+      n_ranges = ide_diagnostic_get_num_ranges (diagnostic);
+
+      for (j = 0; j < n_ranges; j++)
+        {
+          IdeSourceRange *range = ide_diagnostic_get_range (diagnostic, j);
+          IdeSourceLocation *begin = ide_source_range_get_begin (range);
+          IdeSourceLocation *end = ide_source_range_get_end (range);
+
+          g_variant_builder_add (&builder, "(uuuu)",
+                                 ide_source_location_get_line (begin),
+                                 ide_source_location_get_line_offset (begin),
+                                 ide_source_location_get_line (end),
+                                 ide_source_location_get_line_offset (end));
+        }
+
+      g_variant_builder_close (&builder);
+      g_variant_builder_close (&builder);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+/**
+ * _ide_diagnostics_store_decode:
+ * @diagnostics: diagnostics created with _ide_diagnostics_store_encode()
+ * @file: the file the diagnostics belong to
+ *
+ * Creates new #IdeDiagnostic instances from @diagnostics. Ranges do not
+ * retain their character offset, only the line and line offset.
+ *
+ * Returns: (transfer full): A new #IdeDiagnostics.
+ */
+IdeDiagnostics *
+_ide_diagnostics_store_decode (GVariant *diagnostics,
+                               IdeFile  *file)
+{
+  GPtrArray *ar;
+  GVariantIter iter;
+  GVariantIter *ranges;
+  const gchar *text;
+  guint severity;
+  guint line;
+  guint line_offset;
+  guint offset;
+
+  g_return_val_if_fail (diagnostics != NULL, NULL);
+  g_return_val_if_fail (IDE_IS_FILE (file), NULL);
+
+  ar = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_diagnostic_unref);
+
+  g_variant_iter_init (&iter, diagnostics);
+
+  while (g_variant_iter_next (&iter, "(uuuu&sa(uuuu))", &severity, &line, &line_offset, &offset, &text, &ranges))
+    {
+      g_autoptr(IdeSourceLocation) location = NULL;
+      IdeDiagnostic *diagnostic;
+      guint begin_line;
+      guint begin_line_offset;
+      guint end_line;
+      guint end_line_offset;
+
+      location = ide_source_location_new (file, line, line_offset, offset);
+      diagnostic = ide_diagnostic_new (MIN (severity, IDE_DIAGNOSTIC_FATAL), text, location);
+
+      while (g_variant_iter_next (ranges, "(uuuu)", &begin_line, &begin_line_offset, &end_line, &end_line_offset))
+        {
+          g_autoptr(IdeSourceLocation) begin = NULL;
+          g_autoptr(IdeSourceLocation) end = NULL;
+
+          begin = ide_source_location_new (file, begin_line, begin_line_offset, 0);
+          end = ide_source_location_new (file, end_line, end_line_offset, 0);
+
+          ide_diagnostic_take_range (diagnostic, ide_source_range_new (begin, end));
+        }
+
+      g_variant_iter_free (ranges);
+
+      g_ptr_array_add (ar, diagnostic);
+    }
+
+  return ide_diagnostics_new (ar);
+}
@@ -0,0 +1,71 @@
+/* ide-diagnostics-store.h
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_DIAGNOSTICS_STORE_H
+#define IDE_DIAGNOSTICS_STORE_H
+
+#include "ide-types.h"
+
+G_BEGIN_DECLS
+
+typedef struct _IdeDiagnosticsStore IdeDiagnosticsStore;
+
+IdeDiagnosticsStore  *_ide_diagnostics_store_new            (void);
+void                  _ide_diagnostics_store_free           (IdeDiagnosticsStore  *self);
+gboolean              _ide_diagnostics_store_load           (IdeDiagnosticsStore  *self,
+                                                             GBytes               *bytes,
+                                                             GError              **error);
+GBytes               *_ide_diagnostics_store_serialize      (IdeDiagnosticsStore  *self);
+gboolean              _ide_diagnostics_store_get_dirty      (IdeDiagnosticsStore  *self);
+guint                 _ide_diagnostics_store_get_size       (IdeDiagnosticsStore  *self);
+gchar               **_ide_diagnostics_store_get_uris       (IdeDiagnosticsStore  *self);
+gchar               **_ide_diagnostics_store_get_build_uris (IdeDiagnosticsStore  *self);
+void                  _ide_diagnostics_store_insert         (IdeDiagnosticsStore  *self,
+                                                             const gchar          *uri,
+                                                             const gchar          *checksum,
+                                                             gint64                mtime,
+                                                             gboolean              from_build,
+                                                             GVariant             *diagnostics);
+void                  _ide_diagnostics_store_remove         (IdeDiagnosticsStore  *self,
+                                                             const gchar          *uri);
+gboolean              _ide_diagnostics_store_contains       (IdeDiagnosticsStore  *self,
+                                                             const gchar          *uri);
+GVariant             *_ide_diagnostics_store_lookup         (IdeDiagnosticsStore  *self,
+                                                             const gchar          *uri,
+                                                             const gchar          *checksum);
+IdeDiagnostics       *_ide_diagnostics_store_lookup_on_disk (IdeDiagnosticsStore  *self,
+                                                             const gchar          *uri,
+                                                             IdeContext           *context,
+                                                             gboolean             *needs_validate);
+void                  _ide_diagnostics_store_validate       (IdeDiagnosticsStore  *self,
+                                                             const gchar          *uri,
+                                                             const gchar          *checksum,
+                                                             gint64                mtime);
+void                  _ide_diagnostics_store_drop_build     (IdeDiagnosticsStore  *self,
+                                                             const gchar          *uri,
+                                                             const gchar          *checksum);
+GVariant             *_ide_diagnostics_store_encode         (IdeDiagnostic       **diagnostics,
+                                                             guint                 n_diagnostics);
+IdeDiagnostics       *_ide_diagnostics_store_decode         (GVariant             *diagnostics,
+                                                             IdeFile              *file);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeDiagnosticsStore, _ide_diagnostics_store_free)
+
+G_END_DECLS
+
+#endif /* IDE_DIAGNOSTICS_STORE_H */
@@ -22,6 +22,8 @@
 
 #include "ide-diagnostic.h"
 #include "ide-diagnostics.h"
+#include "ide-internal.h"
+#include "ide-source-location.h"
 
 G_DEFINE_BOXED_TYPE (IdeDiagnostics, ide_diagnostics, ide_diagnostics_ref, ide_diagnostics_unref)
 
@@ -31,6 +33,12 @@ struct _IdeDiagnostics
 {
   volatile gint  ref_count;
   GPtrArray     *diagnostics;
+
+  /*
+   * Set by _ide_diagnostics_sort() so that we can binary search by line.
+   * Sorted diagnostics are shared with every caller, so they are frozen.
+   */
+  guint          sorted : 1;
 };
 
 /**
@@ -101,6 +109,7 @@ ide_diagnostics_merge (IdeDiagnostics *self,
 
   g_return_if_fail (self);
   g_return_if_fail (other);
+  g_return_if_fail (!self->sorted);
 
   if (!self->diagnostics)
     {
@@ -160,6 +169,120 @@ ide_diagnostics_add (IdeDiagnostics *self,
 {
   g_assert (self != NULL);
   g_assert (diagnostic != NULL);
+  g_return_if_fail (!self->sorted);
 
   g_ptr_array_add (self->diagnostics, ide_diagnostic_ref (diagnostic));
 }
+
+static gint
+compare_by_location (gconstpointer a,
+                     gconstpointer b)
+{
+  IdeSourceLocation *location_a = ide_diagnostic_get_location (*(IdeDiagnostic **)a);
+  IdeSourceLocation *location_b = ide_diagnostic_get_location (*(IdeDiagnostic **)b);
+  guint line_a;
+  guint line_b;
+  guint line_offset_a;
+  guint line_offset_b;
+
+  /* Diagnostics without a location go last */
+  if (location_a == NULL || location_b == NULL)
+    return (location_a == NULL) - (location_b == NULL);
+
+  line_a = ide_source_location_get_line (location_a);
+  line_b = ide_source_location_get_line (location_b);
+
+  if (line_a != line_b)
+    return line_a < line_b ? -1 : 1;
+
+  line_offset_a = ide_source_location_get_line_offset (location_a);
+  line_offset_b = ide_source_location_get_line_offset (location_b);
+
+  if (line_offset_a != line_offset_b)
+    return line_offset_a < line_offset_b ? -1 : 1;
+
+  return 0;
+}
+
+/**
+ * _ide_diagnostics_sort:
+ *
+ * Sorts the diagnostics by line and line offset, so that they can be
+ * looked up with _ide_diagnostics_lookup_line(). All of the diagnostics
+ * are expected to be in the same file.
+ *
+ * Sorted diagnostics are handed out as shared snapshots, so @self must not
+ * be added to afterwards.
+ */
+void
+_ide_diagnostics_sort (IdeDiagnostics *self)
+{
+  g_return_if_fail (self);
+
+  if (self->diagnostics != NULL)
+    g_ptr_array_sort (self->diagnostics, compare_by_location);
+
+  self->sorted = TRUE;
+}
+
+/**
+ * _ide_diagnostics_lookup_line:
+ * @self: An #IdeDiagnostics
+ * @line: the line, starting from zero
+ * @begin: (out): the index of the first diagnostic on @line
+ * @end: (out): the index after the last diagnostic on @line
+ *
+ * Finds the diagnostics located on @line in O(log n). The diagnostics must
+ * have been sorted with _ide_diagnostics_sort().
+ *
+ * Returns: %TRUE if @self is sorted and @begin and @end were set, otherwise
+ *   %FALSE and the caller must scan the diagnostics.
+ */
+gboolean
+_ide_diagnostics_lookup_line (IdeDiagnostics *self,
+                              guint           line,
+                              gsize          *begin,
+                              gsize          *end)
+{
+  gsize lo = 0;
+  gsize hi;
+
+  g_return_val_if_fail (self, FALSE);
+  g_return_val_if_fail (begin != NULL, FALSE);
+  g_return_val_if_fail (end != NULL, FALSE);
+
+  if (!self->sorted)
+    return FALSE;
+
+  hi = ide_diagnostics_get_size (self);
+
+  /* Find the first diagnostic at or after @line */
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      IdeSourceLocation *location;
+
+      location = ide_diagnostic_get_location (g_ptr_array_index (self->diagnostics, mid));
+
+      if (location != NULL && ide_source_location_get_line (location) < line)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  *begin = lo;
+
+  for (hi = lo; hi < ide_diagnostics_get_size (self); hi++)
+    {
+      IdeSourceLocation *location;
+
+      location = ide_diagnostic_get_location (g_ptr_array_index (self->diagnostics, hi));
+
+      if (location == NULL || ide_source_location_get_line (location) != line)
+        break;
+    }
+
+  *end = hi;
+
+  return TRUE;
+}
@@ -21,6 +21,7 @@
 #include <glib/gi18n.h>
 
 #include "ide-debug.h"
+#include "ide-internal.h"
 
 #include "application/ide-application.h"
 #include "diagnostics/ide-source-location.h"
@@ -56,6 +57,9 @@ enum {
 
 static GParamSpec *properties [LAST_PROP];
 
+static void ide_editor_frame_set_show_map (IdeEditorFrame *self,
+                                           gboolean        show_map);
+
 static void
 update_replace_actions_sensitivity (IdeEditorFrame *self)
 {
@@ -607,6 +611,9 @@ ide_editor_frame_set_document (IdeEditorFrame *self,
 
   gtk_text_view_set_buffer (GTK_TEXT_VIEW (self->source_view), GTK_TEXT_BUFFER (buffer));
 
+  if (_ide_buffer_get_large_file (buffer) != NULL)
+    ide_editor_frame_set_show_map (self, FALSE);
+
   g_signal_connect_object (buffer,
                            "notify::busy",
                            G_CALLBACK (ide_editor_frame_update_ruler),
@@ -886,6 +893,15 @@ ide_editor_frame_set_show_map (IdeEditorFrame *self,
 {
   g_assert (IDE_IS_EDITOR_FRAME (self));
 
+  /* The source map would have to render the whole window of a large file */
+  if (show_map)
+    {
+      GtkTextBuffer *buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (self->source_view));
+
+      if (IDE_IS_BUFFER (buffer) && _ide_buffer_get_large_file (IDE_BUFFER (buffer)) != NULL)
+        show_map = FALSE;
+    }
+
   if (show_map != ide_editor_frame_get_show_map (self))
     {
       if (self->source_map != NULL)
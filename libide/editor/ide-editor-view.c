@@ -23,6 +23,7 @@
 #include <glib/gprintf.h>
 
 #include "ide-debug.h"
+#include "ide-internal.h"
 #include "ide-macros.h"
 
 #include "buffers/ide-buffer-manager.h"
@@ -289,9 +290,10 @@ ide_editor_view_set_document (IdeEditorView *self,
       g_settings_bind (self->settings, "style-scheme-name",
                        document, "style-scheme-name",
                        G_SETTINGS_BIND_GET);
-      g_settings_bind (self->settings, "highlight-matching-brackets",
-                       document, "highlight-matching-brackets",
-                       G_SETTINGS_BIND_GET);
+      if (_ide_buffer_get_large_file (document) == NULL)
+        g_settings_bind (self->settings, "highlight-matching-brackets",
+                         document, "highlight-matching-brackets",
+                         G_SETTINGS_BIND_GET);
 
       g_signal_connect_object (document,
                                "modified-changed",
@@ -18,6 +18,7 @@
 
 #define G_LOG_DOMAIN "ide-highlight-engine"
 
+#include <egg-counter.h>
 #include <egg-signal-group.h>
 #include <glib/gi18n.h>
 #include <string.h>
@@ -58,6 +59,8 @@ struct _IdeHighlightEngine
 
 G_DEFINE_TYPE (IdeHighlightEngine, ide_highlight_engine, IDE_TYPE_OBJECT)
 
+EGG_DEFINE_HISTOGRAM (TickTime, "HighlightEngine", "Tick", "Time spent in a single highlight tick, in usec.")
+
 enum {
   PROP_0,
   PROP_BUFFER,
@@ -368,7 +371,14 @@ ide_highlight_engine_work_timeout_handler (gpointer data)
 
   if (self->enabled)
     {
-      if (ide_highlight_engine_tick (self))
+      gint64 begin_time = g_get_monotonic_time ();
+      gboolean ret;
+
+      ret = ide_highlight_engine_tick (self);
+      EGG_HISTOGRAM_RECORD_SINCE (TickTime, begin_time);
+      IDE_MARK_END (begin_time, "HighlightEngine:Tick");
+
+      if (ret)
         return G_SOURCE_CONTINUE;
     }
 
@@ -385,6 +395,14 @@ ide_highlight_engine_queue_work (IdeHighlightEngine *self)
   if ((self->highlighter == NULL) || (self->buffer == NULL) || (self->work_timeout != 0))
     return;
 
+  /*
+   * Large files only hold a window of the file, don't bother indexing it.
+   * Deferred buffers will rebuild the highlight when they are resumed.
+   */
+  if (_ide_buffer_get_large_file (self->buffer) != NULL ||
+      _ide_buffer_get_deferred (self->buffer))
+    return;
+
   self->work_timeout =  gdk_threads_add_idle_full (G_PRIORITY_LOW,
                                                    ide_highlight_engine_work_timeout_handler,
                                                    self,
@@ -27,6 +27,7 @@
 
 #include "ide-context.h"
 #include "ide-debug.h"
+#include "ide-internal.h"
 
 #include "diagnostics/ide-source-location.h"
 #include "files/ide-file.h"
@@ -462,6 +463,76 @@ ide_back_forward_list_init (IdeBackForwardList *self)
   self->forward = g_queue_new ();
 }
 
+static void
+add_nearby_file (GPtrArray          *ar,
+                 IdeBackForwardItem *item)
+{
+  g_autoptr(GFile) file = NULL;
+  IdeUri *uri;
+  guint i;
+
+  if (item == NULL || NULL == (uri = ide_back_forward_item_get_uri (item)))
+    return;
+
+  if (NULL == (file = ide_uri_to_file (uri)))
+    return;
+
+  for (i = 0; i < ar->len; i++)
+    {
+      if (g_file_equal (file, g_ptr_array_index (ar, i)))
+        return;
+    }
+
+  g_ptr_array_add (ar, g_steal_pointer (&file));
+}
+
+/**
+ * _ide_back_forward_list_get_nearby_files:
+ * @self: A #IdeBackForwardList.
+ * @max_files: the maximum number of files to return.
+ *
+ * Gets the files for the items closest to the current item, alternating
+ * between the backward and forward directions. These are the files the
+ * user is most likely to jump to next.
+ *
+ * Returns: (transfer container) (element-type GFile): An array of #GFile
+ *   containing no duplicates.
+ */
+GPtrArray *
+_ide_back_forward_list_get_nearby_files (IdeBackForwardList *self,
+                                         guint               max_files)
+{
+  GPtrArray *ret;
+  GList *backward;
+  GList *forward;
+
+  g_return_val_if_fail (IDE_IS_BACK_FORWARD_LIST (self), NULL);
+
+  ret = g_ptr_array_new_with_free_func (g_object_unref);
+
+  add_nearby_file (ret, self->current_item);
+
+  backward = self->backward->head;
+  forward = self->forward->head;
+
+  while ((backward != NULL || forward != NULL) && ret->len < max_files)
+    {
+      if (backward != NULL)
+        {
+          add_nearby_file (ret, backward->data);
+          backward = backward->next;
+        }
+
+      if (forward != NULL && ret->len < max_files)
+        {
+          add_nearby_file (ret, forward->data);
+          forward = forward->next;
+        }
+    }
+
+  return ret;
+}
+
 void
 _ide_back_forward_list_foreach (IdeBackForwardList *self,
                                 GFunc               callback,
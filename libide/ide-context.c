@@ -18,6 +18,7 @@
 
 #define G_LOG_DOMAIN "ide-context"
 
+#include <egg-counter.h>
 #include <glib/gi18n.h>
 #include <libpeas/peas.h>
 
@@ -54,7 +55,8 @@
 #include "vcs/ide-vcs.h"
 #include "workbench/ide-workbench.h"
 
-#define RESTORE_FILES_MAX_FILES 20
+#define RESTORE_FILES_MAX_FILES    20
+#define RESTORE_FILES_MAX_PARALLEL 4
 
 struct _IdeContext
 {
@@ -97,6 +99,9 @@ G_DEFINE_TYPE_EXTENDED (IdeContext, ide_context, G_TYPE_OBJECT, 0,
                         G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE,
                                                async_initable_init))
 
+EGG_DEFINE_COUNTER (restore_time, "IdeContext", "Restore Time",
+                    "Time spent restoring the previous session, in msec.")
+
 enum {
   PROP_0,
   PROP_BACK_FORWARD_LIST,
@@ -1721,6 +1726,53 @@ ide_context_unload_back_forward_list (gpointer             source_object,
   IDE_EXIT;
 }
 
+static void
+ide_context_unload__diagnostics_manager_save_cb (GObject      *object,
+                                                 GAsyncResult *result,
+                                                 gpointer      user_data)
+{
+  IdeDiagnosticsManager *diagnostics_manager = (IdeDiagnosticsManager *)object;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GError) error = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (diagnostics_manager));
+  g_assert (G_IS_TASK (task));
+
+  /* nice to know, but not critical to save process */
+  if (!_ide_diagnostics_manager_save_finish (diagnostics_manager, result, &error))
+    g_warning ("%s", error->message);
+
+  g_task_return_boolean (task, TRUE);
+
+  IDE_EXIT;
+}
+
+static void
+ide_context_unload_diagnostics_manager (gpointer             source_object,
+                                        GCancellable        *cancellable,
+                                        GAsyncReadyCallback  callback,
+                                        gpointer             user_data)
+{
+  IdeContext *self = source_object;
+  g_autoptr(GTask) task = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_CONTEXT (self));
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+
+  _ide_diagnostics_manager_save_async (self->diagnostics_manager,
+                                       cancellable,
+                                       ide_context_unload__diagnostics_manager_save_cb,
+                                       g_object_ref (task));
+
+  IDE_EXIT;
+}
+
 static void
 ide_context_unload__unsaved_files_save_cb (GObject      *object,
                                            GAsyncResult *result,
@@ -1821,6 +1873,7 @@ ide_context_do_unload_locked (IdeContext *self)
                         ide_context_unload_configuration_manager,
                         ide_context_unload_back_forward_list,
                         ide_context_unload_buffer_manager,
+                        ide_context_unload_diagnostics_manager,
                         ide_context_unload_unsaved_files,
                         ide_context_unload_services,
                         NULL);
@@ -1892,7 +1945,45 @@ ide_context_unload_finish (IdeContext    *self,
   IDE_RETURN (ret);
 }
 
-static gboolean restore_in_idle (gpointer user_data);
+typedef struct
+{
+  GPtrArray *files;
+  gint64     begin_time;
+  guint      index;
+  guint      active;
+} RestoreState;
+
+static void ide_context_restore_load_next (GTask *task);
+
+static void
+restore_state_free (gpointer data)
+{
+  RestoreState *state = data;
+
+  g_clear_pointer (&state->files, g_ptr_array_unref);
+  g_slice_free (RestoreState, state);
+}
+
+static gint
+restore_compare_by_sequence (gconstpointer a,
+                             gconstpointer b)
+{
+  IdeUnsavedFile *uf_a = *(IdeUnsavedFile **)a;
+  IdeUnsavedFile *uf_b = *(IdeUnsavedFile **)b;
+  gint64 seq_a = ide_unsaved_file_get_sequence (uf_a);
+  gint64 seq_b = ide_unsaved_file_get_sequence (uf_b);
+
+  /*
+   * Most recently modified first. Restored drafts are given their sequence
+   * in the order they were last saved to the drafts journal.
+   */
+  if (seq_a > seq_b)
+    return -1;
+  else if (seq_a < seq_b)
+    return 1;
+  else
+    return 0;
+}
 
 static void
 ide_context_restore__load_file_cb (GObject      *object,
@@ -1900,62 +1991,102 @@ ide_context_restore__load_file_cb (GObject      *object,
                                    gpointer      user_data)
 {
   IdeBufferManager *buffer_manager = (IdeBufferManager *)object;
+  g_autoptr(IdeBuffer) buffer = NULL;
   g_autoptr(GTask) task = user_data;
   g_autoptr(GError) error = NULL;
+  RestoreState *state;
+  IdeContext *self;
 
   g_assert (IDE_IS_BUFFER_MANAGER (buffer_manager));
   g_assert (G_IS_TASK (task));
 
-  if (!ide_buffer_manager_load_file_finish (buffer_manager, result, &error))
+  self = g_task_get_source_object (task);
+  state = g_task_get_task_data (task);
+
+  g_assert (IDE_IS_CONTEXT (self));
+  g_assert (state != NULL);
+  g_assert (state->active > 0);
+
+  state->active--;
+
+  if (!(buffer = ide_buffer_manager_load_file_finish (buffer_manager, result, &error)))
     {
       g_warning ("%s", error->message);
       /* TODO: add error into grouped error */
     }
 
-  g_idle_add (restore_in_idle, g_object_ref (task));
+  if (state->index < state->files->len)
+    {
+      ide_context_restore_load_next (task);
+      return;
+    }
+
+  if (state->active > 0)
+    return;
+
+  self->restoring = FALSE;
+
+  EGG_COUNTER_ADD (restore_time, (g_get_monotonic_time () - state->begin_time) / 1000);
+
+  /* Now catch up on highlighting and diagnostics of background buffers */
+  _ide_buffer_manager_resume_deferred (self->buffer_manager);
+
+  g_task_return_boolean (task, TRUE);
 }
 
-static gboolean
-restore_in_idle (gpointer user_data)
+/*
+ * Starts loading the next files to restore, keeping up to
+ * RESTORE_FILES_MAX_PARALLEL loads in flight. The first file is the most
+ * recently modified one and is the only one given a view. The rest are
+ * loaded in the background and will get a view when they are focused.
+ */
+static void
+ide_context_restore_load_next (GTask *task)
 {
-  g_autoptr(IdeFile) ifile = NULL;
-  g_autoptr(GTask) task = user_data;
-  IdeUnsavedFile *uf;
+  RestoreState *state;
   IdeContext *self;
-  GPtrArray *ar;
-  GFile *file;
-  IdeWorkbenchOpenFlags flags;
 
   g_assert (G_IS_TASK (task));
 
   self = g_task_get_source_object (task);
-  ar = g_task_get_task_data (task);
+  state = g_task_get_task_data (task);
 
-  if (ar == NULL || ar->len == 0)
+  while (state->active < RESTORE_FILES_MAX_PARALLEL && state->index < state->files->len)
     {
-      self->restoring = FALSE;
-      g_task_return_boolean (task, TRUE);
-      return G_SOURCE_REMOVE;
-    }
+      g_autoptr(IdeFile) ifile = NULL;
+      IdeWorkbenchOpenFlags flags;
+      IdeUnsavedFile *uf;
+      GFile *file;
+
+      uf = g_ptr_array_index (state->files, state->index);
+      file = ide_unsaved_file_get_file (uf);
+      ifile = ide_project_get_project_file (self->project, file);
+
+      flags = (state->index == 0) ? IDE_WORKBENCH_OPEN_FLAGS_NONE
+                                  : IDE_WORKBENCH_OPEN_FLAGS_BACKGROUND;
+
+      state->index++;
+      state->active++;
 
-  g_assert (ar != NULL);
-  g_assert (ar->len > 0);
+      ide_buffer_manager_load_file_async (self->buffer_manager,
+                                          ifile,
+                                          FALSE,
+                                          flags,
+                                          NULL,
+                                          g_task_get_cancellable (task),
+                                          ide_context_restore__load_file_cb,
+                                          g_object_ref (task));
+    }
+}
 
-  uf = g_ptr_array_index (ar, ar->len - 1);
-  file = ide_unsaved_file_get_file (uf);
-  ifile = ide_project_get_project_file (self->project, file);
-  g_ptr_array_remove_index (ar, ar->len - 1);
+static gboolean
+restore_in_idle (gpointer user_data)
+{
+  g_autoptr(GTask) task = user_data;
 
-  flags = IDE_WORKBENCH_OPEN_FLAGS_NONE;
+  g_assert (G_IS_TASK (task));
 
-  ide_buffer_manager_load_file_async (self->buffer_manager,
-                                      ifile,
-                                      FALSE,
-                                      flags,
-                                      NULL,
-                                      g_task_get_cancellable (task),
-                                      ide_context_restore__load_file_cb,
-                                      g_object_ref (task));
+  ide_context_restore_load_next (task);
 
   return G_SOURCE_REMOVE;
 }
@@ -1968,6 +2099,7 @@ ide_context_restore_async (IdeContext          *self,
 {
   g_autoptr(GTask) task = NULL;
   g_autoptr(GPtrArray) ar = NULL;
+  RestoreState *state;
 
   g_return_if_fail (IDE_IS_CONTEXT (self));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
@@ -2008,7 +2140,13 @@ ide_context_restore_async (IdeContext          *self,
 
   self->restoring = TRUE;
 
-  g_task_set_task_data (task, g_ptr_array_ref (ar), (GDestroyNotify)g_ptr_array_unref);
+  g_ptr_array_sort (ar, restore_compare_by_sequence);
+
+  state = g_slice_new0 (RestoreState);
+  state->files = g_ptr_array_ref (ar);
+  state->begin_time = g_get_monotonic_time ();
+
+  g_task_set_task_data (task, state, restore_state_free);
 
   g_idle_add (restore_in_idle, g_object_ref (task));
 }
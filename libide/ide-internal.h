@@ -23,6 +23,8 @@
 
 #include "ide-types.h"
 
+#include "buffers/ide-buffer-snapshot.h"
+#include "buffers/ide-large-file.h"
 #include "highlighting/ide-highlight-engine.h"
 #include "history/ide-back-forward-item.h"
 #include "history/ide-back-forward-list.h"
@@ -33,19 +35,47 @@
 
 G_BEGIN_DECLS
 
+typedef struct _IdeUnsavedTempFile IdeUnsavedTempFile;
+
+GPtrArray          *_ide_back_forward_list_get_nearby_files (IdeBackForwardList    *self,
+                                                             guint                  max_files);
 void                _ide_battery_monitor_init               (void);
 void                _ide_battery_monitor_shutdown           (void);
 void                _ide_buffer_set_changed_on_volume       (IdeBuffer             *self,
                                                              gboolean               changed_on_volume);
+void                _ide_buffer_get_diagnostic_line_flags   (IdeBuffer             *self,
+                                                             guint                  begin_line,
+                                                             guint                  end_line,
+                                                             IdeBufferLineFlags    *flags);
+gboolean            _ide_buffer_get_deferred                (IdeBuffer             *self);
+void                _ide_buffer_set_deferred                (IdeBuffer             *self,
+                                                             gboolean               deferred);
+void                _ide_buffer_trim                        (IdeBuffer             *self);
+void                _ide_buffer_add_mapped_view             (IdeBuffer             *self);
+void                _ide_buffer_remove_mapped_view          (IdeBuffer             *self);
+gboolean            _ide_buffer_get_mapped                  (IdeBuffer             *self);
 gboolean            _ide_buffer_get_loading                 (IdeBuffer             *self);
 void                _ide_buffer_set_loading                 (IdeBuffer             *self,
                                                              gboolean               loading);
+IdeLargeFile       *_ide_buffer_get_large_file              (IdeBuffer             *self);
+void                _ide_buffer_set_large_file              (IdeBuffer             *self,
+                                                             IdeLargeFile          *large_file);
+guint               _ide_buffer_get_large_file_first_line   (IdeBuffer             *self);
+void                _ide_buffer_set_large_file_window_async (IdeBuffer             *self,
+                                                             guint                  line,
+                                                             GCancellable          *cancellable,
+                                                             GAsyncReadyCallback    callback,
+                                                             gpointer               user_data);
+gboolean            _ide_buffer_set_large_file_window_finish (IdeBuffer            *self,
+                                                             GAsyncResult          *result,
+                                                             GError               **error);
 void                _ide_buffer_set_mtime                   (IdeBuffer             *self,
                                                              const GTimeVal        *mtime);
 void                _ide_buffer_set_read_only               (IdeBuffer             *buffer,
                                                              gboolean               read_only);
 void                _ide_buffer_manager_reclaim             (IdeBufferManager      *self,
                                                              IdeBuffer             *buffer);
+void                _ide_buffer_manager_resume_deferred     (IdeBufferManager      *self);
 void                _ide_build_system_set_project_file      (IdeBuildSystem        *self,
                                                              GFile                 *project_file);
 void                _ide_configuration_set_prebuild         (IdeConfiguration      *self,
@@ -53,6 +83,20 @@ void                _ide_configuration_set_prebuild         (IdeConfiguration
 void                _ide_configuration_set_postbuild        (IdeConfiguration      *self,
                                                              IdeBuildCommandQueue  *postbuild);
 gboolean            _ide_context_is_restoring               (IdeContext            *self);
+gboolean            _ide_diagnostics_lookup_line            (IdeDiagnostics        *self,
+                                                             guint                  line,
+                                                             gsize                 *begin,
+                                                             gsize                 *end);
+void                _ide_diagnostics_manager_queue_diagnose (IdeDiagnosticsManager *self,
+                                                             IdeBuffer             *buffer);
+void                _ide_diagnostics_manager_save_async     (IdeDiagnosticsManager *self,
+                                                             GCancellable          *cancellable,
+                                                             GAsyncReadyCallback    callback,
+                                                             gpointer               user_data);
+gboolean            _ide_diagnostics_manager_save_finish    (IdeDiagnosticsManager *self,
+                                                             GAsyncResult          *result,
+                                                             GError               **error);
+void                _ide_diagnostics_sort                   (IdeDiagnostics        *self);
 const gchar        *_ide_file_get_content_type              (IdeFile               *self);
 GtkSourceFile      *_ide_file_set_content_type              (IdeFile               *self,
                                                              const gchar           *content_type);
@@ -83,9 +127,15 @@ void                _ide_source_view_set_modifier           (IdeSourceView
                                                              gunichar               modifier);
 void                _ide_thread_pool_init                   (gboolean               is_worker);
 IdeUnsavedFile     *_ide_unsaved_file_new                   (GFile                 *file,
-                                                             GBytes                *content,
-                                                             const gchar           *temp_path,
+                                                             IdeBufferSnapshot     *snapshot,
+                                                             IdeUnsavedTempFile    *temp_file,
                                                              gint64                 sequence);
+IdeUnsavedTempFile *_ide_unsaved_temp_file_new              (GFile                 *file);
+IdeUnsavedTempFile *_ide_unsaved_temp_file_ref              (IdeUnsavedTempFile    *self);
+void                _ide_unsaved_temp_file_unref            (IdeUnsavedTempFile    *self);
+void                _ide_unsaved_files_update_snapshot      (IdeUnsavedFiles       *self,
+                                                             GFile                 *file,
+                                                             IdeBufferSnapshot     *snapshot);
 void                _ide_highlighter_set_highlighter_engine (IdeHighlighter        *highlighter,
                                                              IdeHighlightEngine    *highlight_engine);
 const gchar        *_ide_source_view_get_mode_name          (IdeSourceView         *self);
@@ -85,6 +85,7 @@ G_BEGIN_DECLS
 #include "langserv/ide-langserv-symbol-resolver.h"
 #include "local/ide-local-device.h"
 #include "logging/ide-log.h"
+#include "logging/ide-mark.h"
 #include "preferences/ide-preferences-addin.h"
 #include "preferences/ide-preferences.h"
 #include "projects/ide-project-edit.h"
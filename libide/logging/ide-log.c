@@ -26,7 +26,12 @@
 #endif
 
 #include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -34,14 +39,65 @@
 
 #include "logging/ide-log.h"
 
+/*
+ * Formatting happens on the thread that logged the message, but writing to
+ * the log destinations happens on a dedicated writer thread so that neither
+ * worker threads nor the main thread block on terminal or disk I/O.
+ *
+ * Messages are passed to the writer through a bounded multi-producer,
+ * single-consumer ring. Each cell has a sequence number which tells
+ * producers whether the cell is free for the position they claimed, and
+ * tells the consumer whether the cell has been published. Producers only
+ * contend on a single compare-and-exchange of the enqueue position.
+ *
+ * When the ring is full the message is dropped and counted. The writer
+ * reports the number of dropped messages with the next batch it writes.
+ *
+ * Critical and error messages are written before ide_log_handler()
+ * returns, since the process is likely about to abort.
+ *
+ * Producers register themselves in n_producers before checking whether the
+ * writer is stopping, and the writer only exits once the queue is empty and
+ * no producer is in the middle of enqueuing. Producers that find the writer
+ * stopping write the message themselves, so nothing logged during
+ * ide_log_shutdown() is lost.
+ */
+
+#define QUEUE_SIZE 1024
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+#define MAX_BATCH  64
+
+G_STATIC_ASSERT ((QUEUE_SIZE & QUEUE_MASK) == 0);
+
 typedef const gchar *(*IdeLogLevelStrFunc) (GLogLevelFlags log_level);
 
-static GPtrArray          *channels;
+typedef struct
+{
+  volatile gint  sequence;
+  gchar         *message;
+  gsize          len;
+} LogCell;
+
+static GArray             *fds;
 static GLogFunc            last_handler;
 static int                 log_verbosity;
 static IdeLogLevelStrFunc  log_level_str_func;
 
-G_LOCK_DEFINE (channels_lock);
+static LogCell             cells [QUEUE_SIZE];
+static volatile gint       enqueue_pos;
+static volatile gint       dequeue_pos;
+static volatile gint       written_pos;
+static volatile gint       n_dropped;
+
+static GThread            *writer_thread;
+static volatile gint       writer_waiting;
+static volatile gint       writer_stopping;
+static volatile gint       writer_exited;
+static volatile gint       n_producers;
+static GMutex              writer_mutex;
+static GCond               writer_cond;
+static GCond               flushed_cond;
+static volatile gint       n_flush_waiters;
 
 /**
  * ide_log_get_thread:
@@ -107,18 +163,279 @@ ide_log_level_str_with_color (GLogLevelFlags log_level)
 }
 
 /**
- * ide_log_write_to_channel:
- * @channel: A #GIOChannel.
- * @message: A string log message.
+ * ide_log_write_fully:
+ * @fd: a file-descriptor to write to.
+ * @iov: an array of struct iovec.
+ * @n_iov: the number of elements in @iov.
  *
- * Writes @message to @channel and flushes the channel.
+ * Writes all of @iov to @fd using as few writev() calls as possible,
+ * handling short writes. @iov is modified in the process.
  */
 static void
-ide_log_write_to_channel (GIOChannel  *channel,
-                          const gchar *message)
+ide_log_write_fully (gint          fd,
+                     struct iovec *iov,
+                     guint         n_iov)
+{
+  while (n_iov > 0)
+    {
+      gssize n_written = writev (fd, iov, MIN (n_iov, IOV_MAX));
+
+      if (n_written < 0)
+        {
+          if (errno == EINTR || errno == EAGAIN)
+            continue;
+          return;
+        }
+
+      while (n_iov > 0 && (gsize)n_written >= iov->iov_len)
+        {
+          n_written -= iov->iov_len;
+          iov++;
+          n_iov--;
+        }
+
+      if (n_iov > 0)
+        {
+          iov->iov_base = (guint8 *)iov->iov_base + n_written;
+          iov->iov_len -= n_written;
+        }
+    }
+}
+
+static void
+ide_log_write_to_fds (const struct iovec *iov,
+                      guint               n_iov)
+{
+  struct iovec copy [MAX_BATCH + 1];
+  guint i;
+
+  g_assert (n_iov <= G_N_ELEMENTS (copy));
+
+  for (i = 0; i < fds->len; i++)
+    {
+      memcpy (copy, iov, sizeof (struct iovec) * n_iov);
+      ide_log_write_fully (g_array_index (fds, gint, i), copy, n_iov);
+    }
+}
+
+static gboolean
+ide_log_enqueue (gchar *message,
+                 gsize  len,
+                 gint  *position)
+{
+  LogCell *cell;
+  gint pos;
+
+  pos = g_atomic_int_get (&enqueue_pos);
+
+  for (;;)
+    {
+      gint diff;
+
+      cell = &cells [pos & QUEUE_MASK];
+      diff = g_atomic_int_get (&cell->sequence) - pos;
+
+      if (diff == 0)
+        {
+          if (g_atomic_int_compare_and_exchange (&enqueue_pos, pos, pos + 1))
+            break;
+          pos = g_atomic_int_get (&enqueue_pos);
+        }
+      else if (diff < 0)
+        {
+          /* The writer has not caught up, the queue is full */
+          return FALSE;
+        }
+      else
+        {
+          pos = g_atomic_int_get (&enqueue_pos);
+        }
+    }
+
+  cell->message = message;
+  cell->len = len;
+  g_atomic_int_set (&cell->sequence, pos + 1);
+
+  if (position != NULL)
+    *position = pos;
+
+  /*
+   * The writer sets writer_waiting and re-checks the queue while holding
+   * writer_mutex before it sleeps, so it cannot miss this signal.
+   */
+  if (g_atomic_int_get (&writer_waiting))
+    {
+      g_mutex_lock (&writer_mutex);
+      g_cond_signal (&writer_cond);
+      g_mutex_unlock (&writer_mutex);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+ide_log_dequeue (gchar **message,
+                 gsize  *len)
 {
-  g_io_channel_write_chars (channel, message, -1, NULL, NULL);
-  g_io_channel_flush (channel, NULL);
+  LogCell *cell;
+  gint pos = dequeue_pos;
+
+  cell = &cells [pos & QUEUE_MASK];
+
+  if (g_atomic_int_get (&cell->sequence) - (pos + 1) < 0)
+    return FALSE;
+
+  *message = cell->message;
+  *len = cell->len;
+
+  cell->message = NULL;
+  g_atomic_int_set (&cell->sequence, pos + QUEUE_SIZE);
+  g_atomic_int_set (&dequeue_pos, pos + 1);
+
+  return TRUE;
+}
+
+static gpointer
+ide_log_writer (gpointer data)
+{
+  for (;;)
+    {
+      struct iovec iov [MAX_BATCH + 1];
+      gchar *messages [MAX_BATCH];
+      gchar *dropped_message = NULL;
+      guint n_messages = 0;
+      guint n_iov = 0;
+      gint dropped;
+      guint i;
+
+      if ((dropped = g_atomic_int_and (&n_dropped, 0)) > 0)
+        {
+          dropped_message = g_strdup_printf ("Log queue overflowed, %d messages were dropped\n",
+                                             dropped);
+          iov [n_iov].iov_base = dropped_message;
+          iov [n_iov].iov_len = strlen (dropped_message);
+          n_iov++;
+        }
+
+      while (n_messages < MAX_BATCH)
+        {
+          gsize len;
+
+          if (!ide_log_dequeue (&messages [n_messages], &len))
+            break;
+
+          iov [n_iov].iov_base = messages [n_messages];
+          iov [n_iov].iov_len = len;
+          n_iov++;
+          n_messages++;
+        }
+
+      if (n_iov > 0)
+        ide_log_write_to_fds (iov, n_iov);
+
+      g_atomic_int_set (&written_pos, g_atomic_int_get (&dequeue_pos));
+
+      for (i = 0; i < n_messages; i++)
+        g_free (messages [i]);
+      g_free (dropped_message);
+
+      if (g_atomic_int_get (&n_flush_waiters) > 0)
+        {
+          g_mutex_lock (&writer_mutex);
+          g_cond_broadcast (&flushed_cond);
+          g_mutex_unlock (&writer_mutex);
+        }
+
+      /* Keep draining while the batch was full */
+      if (n_messages == MAX_BATCH)
+        continue;
+
+      g_mutex_lock (&writer_mutex);
+      g_atomic_int_set (&writer_waiting, TRUE);
+      if (g_atomic_int_get (&enqueue_pos) == g_atomic_int_get (&dequeue_pos) &&
+          g_atomic_int_get (&n_dropped) == 0)
+        {
+          if (g_atomic_int_get (&writer_stopping) && g_atomic_int_get (&n_producers) == 0)
+            {
+              g_atomic_int_set (&writer_waiting, FALSE);
+              g_mutex_unlock (&writer_mutex);
+              break;
+            }
+          g_cond_wait (&writer_cond, &writer_mutex);
+        }
+      g_atomic_int_set (&writer_waiting, FALSE);
+      g_mutex_unlock (&writer_mutex);
+    }
+
+  /* Release anyone still waiting for a message to be written */
+  g_mutex_lock (&writer_mutex);
+  g_atomic_int_set (&writer_exited, TRUE);
+  g_cond_broadcast (&flushed_cond);
+  g_mutex_unlock (&writer_mutex);
+
+  return NULL;
+}
+
+/**
+ * ide_log_wait_for_position:
+ * @position: the queue position to wait for.
+ *
+ * Blocks until the writer thread has written the message at @position, or
+ * has exited.
+ */
+static void
+ide_log_wait_for_position (gint position)
+{
+  g_atomic_int_inc (&n_flush_waiters);
+
+  g_mutex_lock (&writer_mutex);
+  while (g_atomic_int_get (&written_pos) - position <= 0 &&
+         !g_atomic_int_get (&writer_exited))
+    {
+      /* Wake up the writer in case it is sleeping */
+      g_cond_signal (&writer_cond);
+      g_cond_wait (&flushed_cond, &writer_mutex);
+    }
+  g_mutex_unlock (&writer_mutex);
+
+  g_atomic_int_add (&n_flush_waiters, -1);
+}
+
+/**
+ * ide_log_flush:
+ *
+ * Blocks until every message queued so far has been written.
+ */
+static void
+ide_log_flush (void)
+{
+  GThread *thread = g_atomic_pointer_get (&writer_thread);
+  gint position;
+
+  if (thread == NULL || thread == g_thread_self () || g_atomic_int_get (&writer_stopping))
+    return;
+
+  position = g_atomic_int_get (&enqueue_pos) - 1;
+
+  if (position - g_atomic_int_get (&written_pos) >= 0)
+    ide_log_wait_for_position (position);
+}
+
+/**
+ * ide_log_producer_done:
+ *
+ * Unregisters the calling thread as a producer, waking up the writer if it
+ * is waiting for producers to finish before exiting.
+ */
+static void
+ide_log_producer_done (void)
+{
+  if (g_atomic_int_dec_and_test (&n_producers) && g_atomic_int_get (&writer_stopping))
+    {
+      g_mutex_lock (&writer_mutex);
+      g_cond_signal (&writer_cond);
+      g_mutex_unlock (&writer_mutex);
+    }
 }
 
 /**
@@ -145,8 +462,12 @@ ide_log_handler (const gchar    *log_domain,
   const gchar *level;
   gchar ftime[32];
   gchar *buffer;
+  GThread *thread;
+  gboolean synchronous;
+  gint position;
+  gsize len;
 
-  if (G_LIKELY (channels->len))
+  if (G_LIKELY (fds->len))
     {
       switch ((int)log_level)
         {
@@ -177,7 +498,7 @@ ide_log_handler (const gchar    *log_domain,
       level = log_level_str_func (log_level);
       g_get_current_time (&tv);
       t = (time_t) tv.tv_sec;
-      tt = *localtime (&t);
+      localtime_r (&t, &tt);
       strftime (ftime, sizeof (ftime), "%H:%M:%S", &tt);
       buffer = g_strdup_printf ("%s.%04ld  %30s[%d]: %s: %s\n",
                                 ftime,
@@ -186,13 +507,56 @@ ide_log_handler (const gchar    *log_domain,
                                 ide_log_get_thread (),
                                 level,
                                 message);
-      G_LOCK (channels_lock);
-      g_ptr_array_foreach (channels, (GFunc) ide_log_write_to_channel, buffer);
-      G_UNLOCK (channels_lock);
-      g_free (buffer);
+      len = strlen (buffer);
+
+      synchronous = (log_level & (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_FLAG_FATAL)) != 0;
+
+      thread = g_atomic_pointer_get (&writer_thread);
+
+      /* Must be registered before checking writer_stopping, see above */
+      g_atomic_int_inc (&n_producers);
+
+      if (thread == NULL ||
+          thread == g_thread_self () ||
+          g_atomic_int_get (&writer_stopping))
+        {
+          struct iovec iov = { buffer, len };
+
+          ide_log_producer_done ();
+          ide_log_write_to_fds (&iov, 1);
+          g_free (buffer);
+        }
+      else if (ide_log_enqueue (buffer, len, &position))
+        {
+          ide_log_producer_done ();
+          if (synchronous)
+            ide_log_wait_for_position (position);
+        }
+      else if (synchronous)
+        {
+          struct iovec iov = { buffer, len };
+
+          /* Never drop a critical, write it ourselves */
+          ide_log_producer_done ();
+          ide_log_write_to_fds (&iov, 1);
+          g_free (buffer);
+        }
+      else
+        {
+          g_atomic_int_inc (&n_dropped);
+          ide_log_producer_done ();
+          g_free (buffer);
+        }
     }
 }
 
+static void
+ide_log_add_fd (gint fd)
+{
+  if (fd != -1)
+    g_array_append_val (fds, fd);
+}
+
 /**
  * ide_log_init:
  * @stdout_: Indicates logging should be written to stdout.
@@ -205,25 +569,30 @@ ide_log_init (gboolean     stdout_,
               const gchar *filename)
 {
   static gsize initialized = FALSE;
-  GIOChannel *channel;
+  guint i;
 
   if (g_once_init_enter (&initialized))
     {
       log_level_str_func = ide_log_level_str;
-      channels = g_ptr_array_new ();
+      fds = g_array_new (FALSE, FALSE, sizeof (gint));
       if (filename)
-        {
-          channel = g_io_channel_new_file (filename, "a", NULL);
-          g_ptr_array_add (channels, channel);
-        }
+        ide_log_add_fd (open (filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640));
       if (stdout_)
         {
-          channel = g_io_channel_unix_new (STDOUT_FILENO);
-          g_ptr_array_add (channels, channel);
+          ide_log_add_fd (STDOUT_FILENO);
           if ((filename == NULL) && isatty (STDOUT_FILENO))
             log_level_str_func = ide_log_level_str_with_color;
         }
 
+      for (i = 0; i < QUEUE_SIZE; i++)
+        cells [i].sequence = i;
+
+      if (fds->len > 0)
+        {
+          writer_thread = g_thread_new ("ide-log-writer", ide_log_writer, NULL);
+          atexit (ide_log_flush);
+        }
+
       g_log_set_default_handler (ide_log_handler, NULL);
       g_once_init_leave (&initialized, TRUE);
     }
@@ -232,11 +601,26 @@ ide_log_init (gboolean     stdout_,
 /**
  * ide_log_shutdown:
  *
- * Cleans up after the logging subsystem.
+ * Cleans up after the logging subsystem. Any queued messages are written
+ * before this function returns.
  */
 void
 ide_log_shutdown (void)
 {
+  GThread *thread = g_atomic_pointer_get (&writer_thread);
+
+  if (thread != NULL)
+    {
+      /* From here on, new messages are written by the thread logging them */
+      g_mutex_lock (&writer_mutex);
+      g_atomic_int_set (&writer_stopping, TRUE);
+      g_cond_signal (&writer_cond);
+      g_mutex_unlock (&writer_mutex);
+
+      g_thread_join (thread);
+      g_atomic_pointer_set (&writer_thread, NULL);
+    }
+
   if (last_handler)
     {
       g_log_set_default_handler (last_handler, NULL);
@@ -0,0 +1,425 @@
+/* ide-mark.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-mark"
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#ifdef __linux__
+# include <sys/types.h>
+# include <sys/syscall.h>
+#endif
+
+#include <unistd.h>
+
+#include "logging/ide-mark.h"
+
+/*
+ * Every thread that records a mark gets its own ring of MarkEntry. Only
+ * the owning thread writes to a ring, so recording a mark is a handful of
+ * stores followed by a single atomic store publishing the new head. That
+ * keeps it cheap enough to be left enabled in release builds, unlike the
+ * IDE_ENTRY/IDE_EXIT tracing which goes through g_log().
+ *
+ * Readers copy a ring without synchronizing with the writer and then
+ * discard any entry the writer may have overwritten in the mean time, by
+ * looking at the head again after the copy.
+ *
+ * Rings are never freed. When a thread exits its ring is released and
+ * reused by the next thread that records a mark, so short-lived threads
+ * do not grow memory usage while their history remains available.
+ *
+ * Stalls of the main loop are detected by a source that never dispatches.
+ * Its check() runs right after the main context returns from poll() and
+ * its prepare() runs at the start of the next iteration, so the time in
+ * between is what the main loop spent dispatching: idle callbacks, I/O
+ * completions, layout and painting alike.
+ */
+
+#define RING_SIZE          2048
+#define RING_MASK          (RING_SIZE - 1)
+#define DEFAULT_LONG_FRAME (G_USEC_PER_SEC / 10)
+
+G_STATIC_ASSERT ((RING_SIZE & RING_MASK) == 0);
+
+typedef struct
+{
+  const gchar *name;
+  gint64       begin_time;
+  gint64       duration;
+  gint         thread_id;
+} MarkEntry;
+
+typedef struct
+{
+  GSource source;
+  gint64  check_time;
+} DispatchWatch;
+
+typedef struct _MarkRing
+{
+  struct _MarkRing *next;
+  volatile guint    head;
+  volatile gint     in_use;
+  gint              thread_id;
+  MarkEntry         entries [RING_SIZE];
+} MarkRing;
+
+static void ide_mark_ring_release (gpointer data);
+
+static MarkRing *rings;
+static GPrivate  current_ring = G_PRIVATE_INIT (ide_mark_ring_release);
+static GHookList long_frame_hooks;
+static gint64    long_frame_threshold;
+static GSource  *dispatch_watch;
+
+static inline gint
+ide_mark_get_thread (void)
+{
+#ifdef __linux__
+  return (gint) syscall (SYS_gettid);
+#else
+  return GPOINTER_TO_INT (g_thread_self ());
+#endif /* __linux__ */
+}
+
+static void
+ide_mark_ring_release (gpointer data)
+{
+  MarkRing *ring = data;
+
+  g_atomic_int_set (&ring->in_use, FALSE);
+}
+
+static MarkRing *
+ide_mark_ring_acquire (void)
+{
+  MarkRing *ring;
+
+  for (ring = g_atomic_pointer_get (&rings); ring != NULL; ring = ring->next)
+    {
+      if (g_atomic_int_compare_and_exchange (&ring->in_use, FALSE, TRUE))
+        goto claimed;
+    }
+
+  ring = g_new0 (MarkRing, 1);
+  ring->in_use = TRUE;
+
+  do
+    ring->next = g_atomic_pointer_get (&rings);
+  while (!g_atomic_pointer_compare_and_exchange (&rings, ring->next, ring));
+
+claimed:
+  ring->thread_id = ide_mark_get_thread ();
+  g_private_set (&current_ring, ring);
+
+  return ring;
+}
+
+/**
+ * ide_mark_record:
+ * @name: a static string naming the mark, such as "Clang:Parse"
+ * @begin_time: the monotonic time when the operation started, in usec
+ * @end_time: the monotonic time when the operation completed, in usec
+ *
+ * Records a mark in the timeline of the calling thread.
+ *
+ * @name is not copied, it must be a string that lives as long as the
+ * process such as a string literal.
+ *
+ * This is safe to call from any thread and does not block.
+ */
+void
+ide_mark_record (const gchar *name,
+                 gint64       begin_time,
+                 gint64       end_time)
+{
+  MarkRing *ring;
+  MarkEntry *entry;
+  guint head;
+
+  if G_UNLIKELY (NULL == (ring = g_private_get (&current_ring)))
+    ring = ide_mark_ring_acquire ();
+
+  head = ring->head;
+
+  entry = &ring->entries [head & RING_MASK];
+  entry->name = name;
+  entry->begin_time = begin_time;
+  entry->duration = end_time - begin_time;
+  entry->thread_id = ring->thread_id;
+
+  g_atomic_int_set (&ring->head, head + 1);
+}
+
+static gint
+compare_marks (gconstpointer a,
+               gconstpointer b)
+{
+  const IdeMark *ma = a;
+  const IdeMark *mb = b;
+
+  if (ma->begin_time < mb->begin_time)
+    return -1;
+  else if (ma->begin_time > mb->begin_time)
+    return 1;
+  else
+    return 0;
+}
+
+/**
+ * ide_mark_foreach:
+ * @func: (scope call): a callback for each mark
+ * @user_data: closure data for @func
+ *
+ * Calls @func for every mark still available in the rings of all threads,
+ * in the order they were started.
+ *
+ * Recording threads are not paused while reading, so marks recorded while
+ * this function runs may or may not be included.
+ */
+void
+ide_mark_foreach (IdeMarkForeachFunc func,
+                  gpointer           user_data)
+{
+  g_autoptr(GArray) marks = NULL;
+  MarkEntry *copy;
+  MarkRing *ring;
+  guint i;
+
+  g_return_if_fail (func != NULL);
+
+  marks = g_array_new (FALSE, FALSE, sizeof (IdeMark));
+  copy = g_new (MarkEntry, RING_SIZE);
+
+  for (ring = g_atomic_pointer_get (&rings); ring != NULL; ring = ring->next)
+    {
+      guint begin;
+      guint end;
+      guint head;
+
+      end = g_atomic_int_get (&ring->head);
+      begin = (end > RING_SIZE) ? end - RING_SIZE : 0;
+
+      for (i = begin; i != end; i++)
+        copy [i & RING_MASK] = ring->entries [i & RING_MASK];
+
+      /*
+       * The writer may have lapped us while copying. Anything at or below
+       * the new head minus the ring size could have been overwritten.
+       */
+      head = g_atomic_int_get (&ring->head);
+
+      for (i = begin; i != end; i++)
+        {
+          MarkEntry *entry = &copy [i & RING_MASK];
+          IdeMark mark;
+
+          if ((head - i) >= RING_SIZE || entry->name == NULL)
+            continue;
+
+          mark.name = entry->name;
+          mark.begin_time = entry->begin_time;
+          mark.duration = entry->duration;
+          mark.thread_id = entry->thread_id;
+
+          g_array_append_val (marks, mark);
+        }
+    }
+
+  g_free (copy);
+
+  g_array_sort (marks, compare_marks);
+
+  for (i = 0; i < marks->len; i++)
+    func (&g_array_index (marks, IdeMark, i), user_data);
+}
+
+/**
+ * ide_mark_get_long_frame_threshold:
+ *
+ * Gets the duration after which an iteration of the main loop is considered
+ * a long frame, in usec.
+ * This defaults to 100 msec and can be changed with the
+ * IDE_LONG_FRAME_MSEC environment variable.
+ *
+ * Returns: the threshold in usec.
+ */
+gint64
+ide_mark_get_long_frame_threshold (void)
+{
+  static gsize initialized;
+
+  if (g_once_init_enter (&initialized))
+    {
+      const gchar *env = g_getenv ("IDE_LONG_FRAME_MSEC");
+      gint64 msec = env ? g_ascii_strtoll (env, NULL, 10) : 0;
+
+      long_frame_threshold = (msec > 0) ? msec * 1000 : DEFAULT_LONG_FRAME;
+
+      g_once_init_leave (&initialized, TRUE);
+    }
+
+  return long_frame_threshold;
+}
+
+static void
+ide_mark_long_frame (gint64 begin_time,
+                     gint64 end_time)
+{
+  GHook *hook;
+
+  ide_mark_record ("MainLoop:Stall", begin_time, end_time);
+
+  if (!long_frame_hooks.is_setup)
+    return;
+
+  hook = g_hook_first_valid (&long_frame_hooks, TRUE);
+
+  while (hook != NULL)
+    {
+      IdeMarkLongFrameFunc func = hook->func;
+
+      func (begin_time, end_time - begin_time, hook->data);
+
+      hook = g_hook_next_valid (&long_frame_hooks, hook, TRUE);
+    }
+}
+
+static gboolean
+dispatch_watch_prepare (GSource *source,
+                        gint    *timeout)
+{
+  DispatchWatch *watch = (DispatchWatch *)source;
+
+  *timeout = -1;
+
+  if (watch->check_time != 0)
+    {
+      gint64 now = g_get_monotonic_time ();
+
+      if G_UNLIKELY ((now - watch->check_time) >= ide_mark_get_long_frame_threshold ())
+        ide_mark_long_frame (watch->check_time, now);
+
+      watch->check_time = 0;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+dispatch_watch_check (GSource *source)
+{
+  DispatchWatch *watch = (DispatchWatch *)source;
+
+  watch->check_time = g_get_monotonic_time ();
+
+  return FALSE;
+}
+
+static GSourceFuncs dispatch_watch_funcs = {
+  dispatch_watch_prepare,
+  dispatch_watch_check,
+};
+
+/*
+ * Installs the source measuring how long each iteration of the main loop
+ * spends dispatching. This is done lazily from the main thread, the first
+ * time a frame is painted or a long frame handler is registered.
+ */
+static void
+ide_mark_watch_dispatch (void)
+{
+  if G_LIKELY (dispatch_watch != NULL)
+    return;
+
+  dispatch_watch = g_source_new (&dispatch_watch_funcs, sizeof (DispatchWatch));
+  g_source_set_name (dispatch_watch, "IdeMark dispatch watch");
+  /* The main context skips lower priority sources once one is ready. */
+  g_source_set_priority (dispatch_watch, G_PRIORITY_HIGH);
+  g_source_attach (dispatch_watch, NULL);
+}
+
+/**
+ * ide_mark_frame:
+ * @begin_time: the monotonic time the frame started, in usec
+ * @end_time: the monotonic time the frame completed, in usec
+ *
+ * Records a "Frame" mark for the main loop.
+ *
+ * Long frames are not detected from these marks, since most stalls happen
+ * outside of painting. See ide_mark_add_long_frame_func().
+ *
+ * This must be called from the main thread.
+ */
+void
+ide_mark_frame (gint64 begin_time,
+                gint64 end_time)
+{
+  ide_mark_record ("Frame", begin_time, end_time);
+  ide_mark_watch_dispatch ();
+}
+
+/**
+ * ide_mark_add_long_frame_func:
+ * @func: (scope notified): a callback for long frames
+ * @user_data: closure data for @func
+ * @notify: a destroy notify for @user_data
+ *
+ * Registers @func to be called on the main thread whenever an iteration
+ * of the main loop spends longer than ide_mark_get_long_frame_threshold()
+ * dispatching. That covers painting as well as blocking work in idle
+ * callbacks, I/O completions and layout. This allows the timeline to be
+ * saved while the marks leading up to the stall are still available.
+ *
+ * Returns: a handler id for ide_mark_remove_long_frame_func().
+ */
+guint
+ide_mark_add_long_frame_func (IdeMarkLongFrameFunc func,
+                              gpointer             user_data,
+                              GDestroyNotify       notify)
+{
+  GHook *hook;
+
+  g_return_val_if_fail (func != NULL, 0);
+
+  ide_mark_watch_dispatch ();
+
+  if (!long_frame_hooks.is_setup)
+    g_hook_list_init (&long_frame_hooks, sizeof (GHook));
+
+  hook = g_hook_alloc (&long_frame_hooks);
+  hook->func = func;
+  hook->data = user_data;
+  hook->destroy = notify;
+
+  g_hook_append (&long_frame_hooks, hook);
+
+  return hook->hook_id;
+}
+
+void
+ide_mark_remove_long_frame_func (guint handler_id)
+{
+  g_return_if_fail (handler_id != 0);
+
+  if (!long_frame_hooks.is_setup || !g_hook_destroy (&long_frame_hooks, handler_id))
+    g_warning ("No such long frame handler %u", handler_id);
+}
@@ -0,0 +1,76 @@
+/* ide-mark.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_MARK_H
+#define IDE_MARK_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * IdeMark:
+ * @name: the static string provided to ide_mark_record()
+ * @begin_time: the monotonic time the mark started, in usec
+ * @duration: the duration of the mark, in usec
+ * @thread_id: the kernel thread id (or thread pointer) that recorded the mark
+ *
+ * A single entry of the timeline recorded by ide_mark_record().
+ */
+typedef struct
+{
+  const gchar *name;
+  gint64       begin_time;
+  gint64       duration;
+  gint         thread_id;
+} IdeMark;
+
+/**
+ * IdeMarkForeachFunc:
+ * @mark: an #IdeMark
+ * @user_data: closure data provided to ide_mark_foreach()
+ */
+typedef void (*IdeMarkForeachFunc)   (const IdeMark *mark,
+                                      gpointer       user_data);
+
+/**
+ * IdeMarkLongFrameFunc:
+ * @begin_time: the monotonic time the main loop started dispatching, in usec
+ * @duration: how long the main loop spent dispatching, in usec
+ * @user_data: closure data provided to ide_mark_add_long_frame_func()
+ */
+typedef void (*IdeMarkLongFrameFunc) (gint64         begin_time,
+                                      gint64         duration,
+                                      gpointer       user_data);
+
+void   ide_mark_record                   (const gchar          *name,
+                                          gint64                begin_time,
+                                          gint64                end_time);
+void   ide_mark_frame                    (gint64                begin_time,
+                                          gint64                end_time);
+void   ide_mark_foreach                  (IdeMarkForeachFunc    func,
+                                          gpointer              user_data);
+gint64 ide_mark_get_long_frame_threshold (void);
+guint  ide_mark_add_long_frame_func      (IdeMarkLongFrameFunc  func,
+                                          gpointer              user_data,
+                                          GDestroyNotify        notify);
+void   ide_mark_remove_long_frame_func   (guint                 handler_id);
+
+G_END_DECLS
+
+#endif /* IDE_MARK_H */
@@ -18,24 +18,84 @@
 
 #define G_LOG_DOMAIN "ide-line-diagnostics-gutter-renderer"
 
+#include "ide-internal.h"
+
 #include "buffers/ide-buffer.h"
 #include "sourceview/ide-line-diagnostics-gutter-renderer.h"
 
 struct _IdeLineDiagnosticsGutterRenderer
 {
   GtkSourceGutterRendererPixbuf parent_instance;
+
+  /*
+   * The flags for the lines being drawn, collected in ::begin so that we
+   * only need a single range query per frame rather than one per line.
+   */
+  GArray *line_flags;
+  guint   begin_line;
 };
 
 G_DEFINE_TYPE (IdeLineDiagnosticsGutterRenderer,
                ide_line_diagnostics_gutter_renderer,
                GTK_SOURCE_TYPE_GUTTER_RENDERER_PIXBUF)
 
+static void
+ide_line_diagnostics_gutter_renderer_begin (GtkSourceGutterRenderer *renderer,
+                                            cairo_t                 *cr,
+                                            GdkRectangle            *bg_area,
+                                            GdkRectangle            *cell_area,
+                                            GtkTextIter             *begin,
+                                            GtkTextIter             *end)
+{
+  IdeLineDiagnosticsGutterRenderer *self = (IdeLineDiagnosticsGutterRenderer *)renderer;
+  GtkTextBuffer *buffer;
+  guint end_line;
+
+  g_assert (IDE_IS_LINE_DIAGNOSTICS_GUTTER_RENDERER (self));
+  g_assert (begin != NULL);
+  g_assert (end != NULL);
+
+  if (GTK_SOURCE_GUTTER_RENDERER_CLASS (ide_line_diagnostics_gutter_renderer_parent_class)->begin)
+    GTK_SOURCE_GUTTER_RENDERER_CLASS (ide_line_diagnostics_gutter_renderer_parent_class)->begin (renderer, cr, bg_area, cell_area, begin, end);
+
+  g_array_set_size (self->line_flags, 0);
+
+  buffer = gtk_text_iter_get_buffer (begin);
+
+  if (!IDE_IS_BUFFER (buffer))
+    return;
+
+  self->begin_line = gtk_text_iter_get_line (begin);
+  end_line = MAX (self->begin_line, gtk_text_iter_get_line (end));
+
+  g_array_set_size (self->line_flags, end_line - self->begin_line + 1);
+  _ide_buffer_get_diagnostic_line_flags (IDE_BUFFER (buffer),
+                                         self->begin_line,
+                                         end_line,
+                                         (IdeBufferLineFlags *)(gpointer)self->line_flags->data);
+}
+
+static void
+ide_line_diagnostics_gutter_renderer_end (GtkSourceGutterRenderer *renderer)
+{
+  IdeLineDiagnosticsGutterRenderer *self = (IdeLineDiagnosticsGutterRenderer *)renderer;
+
+  g_assert (IDE_IS_LINE_DIAGNOSTICS_GUTTER_RENDERER (self));
+
+  /* The buffer may change before the next frame, don't keep stale flags */
+  g_array_set_size (self->line_flags, 0);
+
+  if (GTK_SOURCE_GUTTER_RENDERER_CLASS (ide_line_diagnostics_gutter_renderer_parent_class)->end)
+    GTK_SOURCE_GUTTER_RENDERER_CLASS (ide_line_diagnostics_gutter_renderer_parent_class)->end (renderer);
+}
+
 static void
 ide_line_diagnostics_gutter_renderer_query_data (GtkSourceGutterRenderer      *renderer,
                                                  GtkTextIter                  *begin,
                                                  GtkTextIter                  *end,
                                                  GtkSourceGutterRendererState  state)
 {
+  IdeLineDiagnosticsGutterRenderer *self = (IdeLineDiagnosticsGutterRenderer *)renderer;
   GtkTextBuffer *buffer;
   IdeBufferLineFlags flags;
   const gchar *icon_name = NULL;
@@ -51,7 +111,12 @@ ide_line_diagnostics_gutter_renderer_query_data (GtkSourceGutterRenderer      *r
     return;
 
   line = gtk_text_iter_get_line (begin);
-  flags = ide_buffer_get_line_flags (IDE_BUFFER (buffer), line);
+
+  if (line >= self->begin_line && line - self->begin_line < self->line_flags->len)
+    flags = g_array_index (self->line_flags, IdeBufferLineFlags, line - self->begin_line);
+  else
+    flags = ide_buffer_get_line_flags (IDE_BUFFER (buffer), line);
+
   flags &= IDE_BUFFER_LINE_FLAGS_DIAGNOSTICS_MASK;
 
   if (flags == 0)
@@ -71,15 +136,31 @@ ide_line_diagnostics_gutter_renderer_query_data (GtkSourceGutterRenderer      *r
     g_object_set (renderer, "pixbuf", NULL, NULL);
 }
 
+static void
+ide_line_diagnostics_gutter_renderer_finalize (GObject *object)
+{
+  IdeLineDiagnosticsGutterRenderer *self = (IdeLineDiagnosticsGutterRenderer *)object;
+
+  g_clear_pointer (&self->line_flags, g_array_unref);
+
+  G_OBJECT_CLASS (ide_line_diagnostics_gutter_renderer_parent_class)->finalize (object);
+}
+
 static void
 ide_line_diagnostics_gutter_renderer_class_init (IdeLineDiagnosticsGutterRendererClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
   GtkSourceGutterRendererClass *renderer_class = GTK_SOURCE_GUTTER_RENDERER_CLASS (klass);
 
+  object_class->finalize = ide_line_diagnostics_gutter_renderer_finalize;
+
+  renderer_class->begin = ide_line_diagnostics_gutter_renderer_begin;
+  renderer_class->end = ide_line_diagnostics_gutter_renderer_end;
   renderer_class->query_data = ide_line_diagnostics_gutter_renderer_query_data;
 }
 
 static void
 ide_line_diagnostics_gutter_renderer_init (IdeLineDiagnosticsGutterRenderer *self)
 {
+  self->line_flags = g_array_new (FALSE, TRUE, sizeof (IdeBufferLineFlags));
 }
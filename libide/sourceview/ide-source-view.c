@@ -85,6 +85,7 @@
 #define DEFAULT_OVERSCROLL_NUM_LINES 1
 #define TAG_DEFINITION "action::hover-definition"
 #define DEFINITION_HIGHLIGHT_MODIFIER GDK_CONTROL_MASK
+#define LARGE_FILE_EDGE_LINES 500
 
 #define ALL_ACCELS_MASK (GDK_CONTROL_MASK | GDK_SHIFT_MASK | GDK_MOD1_MASK)
 
@@ -164,6 +165,9 @@ typedef struct
   guint                        delay_size_allocate_chainup;
   GtkAllocation                delay_size_allocation;
 
+  guint                        large_file_handler;
+  guint                        large_file_top_line;
+
   IdeSourceLocation           *definition_src_location;
   GtkTextMark                 *definition_highlight_start_mark;
   GtkTextMark                 *definition_highlight_end_mark;
@@ -174,6 +178,7 @@ typedef struct
   GRegex                      *include_regex;
 
   guint                        auto_indent : 1;
+  guint                        buffer_mapped : 1;
   guint                        completion_blocked : 1;
   guint                        completion_visible : 1;
   guint                        enable_word_completion : 1;
@@ -182,6 +187,7 @@ typedef struct
   guint                        in_replay_macro : 1;
   guint                        insert_mark_cleared : 1;
   guint                        insert_matching_brace : 1;
+  guint                        large_file_loading : 1;
   guint                        overwrite_braces : 1;
   guint                        recording_macro : 1;
   guint                        rubberband_search : 1;
@@ -1475,6 +1481,8 @@ ide_source_view__buffer_loaded_cb (IdeSourceView *self,
       priv->completion_blocked = FALSE;
     }
 
+  gtk_text_view_set_editable (GTK_TEXT_VIEW (self), _ide_buffer_get_large_file (buffer) == NULL);
+
   insert = gtk_text_buffer_get_insert (GTK_TEXT_BUFFER (buffer));
 
   /* Store the line offset so movements are correct. */
@@ -1489,6 +1497,146 @@ ide_source_view__buffer_loaded_cb (IdeSourceView *self,
   IDE_EXIT;
 }
 
+static void
+ide_source_view_slide_large_file_cb (GObject      *object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data)
+{
+  IdeBuffer *buffer = (IdeBuffer *)object;
+  g_autoptr(IdeSourceView) self = user_data;
+  IdeSourceViewPrivate *priv = ide_source_view_get_instance_private (self);
+  g_autoptr(GError) error = NULL;
+  GtkTextIter top;
+  guint top_line;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_BUFFER (buffer));
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+
+  priv->large_file_loading = FALSE;
+
+  if (!_ide_buffer_set_large_file_window_finish (buffer, result, &error))
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Failed to read large file: %s", error->message);
+      IDE_EXIT;
+    }
+
+  if (buffer != priv->buffer)
+    IDE_EXIT;
+
+  /* Keep the same line of the file at the top of the view */
+  top_line = priv->large_file_top_line - _ide_buffer_get_large_file_first_line (buffer);
+  gtk_text_buffer_get_iter_at_line (GTK_TEXT_BUFFER (buffer), &top, top_line);
+  gtk_text_buffer_place_cursor (GTK_TEXT_BUFFER (buffer), &top);
+  gtk_text_buffer_move_mark (GTK_TEXT_BUFFER (buffer), priv->scroll_mark, &top);
+  ide_source_view_scroll_to_mark (self, priv->scroll_mark, 0.0, TRUE, 0.0, 0.0, FALSE);
+
+  IDE_EXIT;
+}
+
+static gboolean
+ide_source_view_slide_large_file (gpointer data)
+{
+  IdeSourceView *self = data;
+  IdeSourceViewPrivate *priv = ide_source_view_get_instance_private (self);
+  IdeLargeFile *large_file;
+  GdkRectangle visible_rect;
+  GtkTextIter top;
+  GtkTextIter bottom;
+  guint first_line;
+  guint top_line;
+  guint n_lines;
+  guint n_file_lines;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+
+  priv->large_file_handler = 0;
+
+  /*
+   * Splits share the buffer and therefore the window, so only the view the
+   * user is working in may move it. Otherwise the views would keep moving
+   * the window back and forth to show their own lines.
+   */
+  if (priv->buffer == NULL ||
+      priv->large_file_loading ||
+      !gtk_widget_has_focus (GTK_WIDGET (self)) ||
+      NULL == (large_file = _ide_buffer_get_large_file (priv->buffer)))
+    IDE_RETURN (G_SOURCE_REMOVE);
+
+  ide_source_view_get_visible_rect (self, &visible_rect);
+  gtk_text_view_get_iter_at_location (GTK_TEXT_VIEW (self), &top, visible_rect.x, visible_rect.y);
+  gtk_text_view_get_iter_at_location (GTK_TEXT_VIEW (self), &bottom,
+                                      visible_rect.x, _GDK_RECTANGLE_Y2 (&visible_rect));
+
+  first_line = _ide_buffer_get_large_file_first_line (priv->buffer);
+  n_lines = gtk_text_buffer_get_line_count (GTK_TEXT_BUFFER (priv->buffer));
+  n_file_lines = _ide_large_file_get_n_lines (large_file);
+  top_line = gtk_text_iter_get_line (&top);
+
+  /*
+   * Only move the window once the user gets close to either edge of it, and
+   * only if there is more of the file in that direction.
+   */
+  if (!((first_line > 0 && top_line < LARGE_FILE_EDGE_LINES) ||
+        (first_line + n_lines < n_file_lines &&
+         gtk_text_iter_get_line (&bottom) + LARGE_FILE_EDGE_LINES > n_lines)))
+    IDE_RETURN (G_SOURCE_REMOVE);
+
+  top_line += first_line;
+
+  /* Don't queue more reads while the user keeps scrolling */
+  priv->large_file_loading = TRUE;
+  priv->large_file_top_line = top_line;
+
+  _ide_buffer_set_large_file_window_async (priv->buffer,
+                                           top_line,
+                                           NULL,
+                                           ide_source_view_slide_large_file_cb,
+                                           g_object_ref (self));
+
+  IDE_RETURN (G_SOURCE_REMOVE);
+}
+
+static void
+ide_source_view__vadj_value_changed (IdeSourceView *self,
+                                     GtkAdjustment *adj)
+{
+  IdeSourceViewPrivate *priv = ide_source_view_get_instance_private (self);
+
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+  g_assert (GTK_IS_ADJUSTMENT (adj));
+
+  if (priv->large_file_handler != 0 ||
+      priv->buffer == NULL ||
+      !gtk_widget_has_focus (GTK_WIDGET (self)) ||
+      _ide_buffer_get_large_file (priv->buffer) == NULL ||
+      adj != gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (self)))
+    return;
+
+  priv->large_file_handler = g_idle_add (ide_source_view_slide_large_file, self);
+}
+
+static void
+ide_source_view__notify_vadjustment (IdeSourceView *self,
+                                     GParamSpec    *pspec,
+                                     gpointer       unused)
+{
+  GtkAdjustment *adj;
+
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+
+  if (NULL != (adj = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (self))))
+    g_signal_connect_object (adj,
+                             "value-changed",
+                             G_CALLBACK (ide_source_view__vadj_value_changed),
+                             self,
+                             G_CONNECT_SWAPPED);
+}
+
 static void
 ide_source_view__completion_provider_added (IdeExtensionSetAdapter *adapter,
                                             PeasPluginInfo         *plugin_info,
@@ -1609,6 +1757,37 @@ ide_source_view__buffer__notify_can_undo (IdeSourceView *self,
   egg_widget_action_group_set_action_enabled (EGG_WIDGET_ACTION_GROUP (group), "undo", can_undo);
 }
 
+/*
+ * Tells the buffer while it is visible in this view, so that buffers shown
+ * in an unfocused split are not trimmed by the buffer manager.
+ */
+static void
+ide_source_view_set_buffer_mapped (IdeSourceView *self,
+                                   gboolean       buffer_mapped)
+{
+  IdeSourceViewPrivate *priv = ide_source_view_get_instance_private (self);
+
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+
+  buffer_mapped = !!buffer_mapped;
+
+  if (buffer_mapped == priv->buffer_mapped)
+    return;
+
+  /* Only the bound buffer is tracked */
+  if (buffer_mapped &&
+      (priv->buffer == NULL ||
+       gtk_text_view_get_buffer (GTK_TEXT_VIEW (self)) != GTK_TEXT_BUFFER (priv->buffer)))
+    return;
+
+  priv->buffer_mapped = buffer_mapped;
+
+  if (buffer_mapped)
+    _ide_buffer_add_mapped_view (priv->buffer);
+  else
+    _ide_buffer_remove_mapped_view (priv->buffer);
+}
+
 static void
 ide_source_view_bind_buffer (IdeSourceView  *self,
                              IdeBuffer      *buffer,
@@ -1632,6 +1811,9 @@ ide_source_view_bind_buffer (IdeSourceView  *self,
 
   ide_buffer_hold (buffer);
 
+  if (gtk_widget_get_mapped (GTK_WIDGET (self)))
+    ide_source_view_set_buffer_mapped (self, TRUE);
+
   if (_ide_buffer_get_loading (buffer))
     {
       GtkSourceCompletion *completion;
@@ -1681,6 +1863,8 @@ ide_source_view_bind_buffer (IdeSourceView  *self,
 
   g_clear_object (&search_settings);
 
+  gtk_text_view_set_editable (GTK_TEXT_VIEW (self), _ide_buffer_get_large_file (buffer) == NULL);
+
   /* Create scroll mark used by movements and our scrolling helper */
   gtk_text_buffer_get_start_iter (GTK_TEXT_BUFFER (buffer), &iter);
   priv->scroll_mark = gtk_text_buffer_create_mark (GTK_TEXT_BUFFER (buffer), NULL, &iter, TRUE);
@@ -1752,6 +1936,8 @@ ide_source_view_unbind_buffer (IdeSourceView  *self,
   g_clear_object (&priv->definition_highlight_start_mark);
   g_clear_object (&priv->definition_highlight_end_mark);
 
+  ide_source_view_set_buffer_mapped (self, FALSE);
+
   ide_buffer_release (priv->buffer);
 
   IDE_EXIT;
@@ -4939,6 +5125,30 @@ ide_source_view_real_draw (GtkWidget *widget,
   return ret;
 }
 
+static void
+ide_source_view_map (GtkWidget *widget)
+{
+  IdeSourceView *self = (IdeSourceView *)widget;
+
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+
+  GTK_WIDGET_CLASS (ide_source_view_parent_class)->map (widget);
+
+  ide_source_view_set_buffer_mapped (self, TRUE);
+}
+
+static void
+ide_source_view_unmap (GtkWidget *widget)
+{
+  IdeSourceView *self = (IdeSourceView *)widget;
+
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+
+  ide_source_view_set_buffer_mapped (self, FALSE);
+
+  GTK_WIDGET_CLASS (ide_source_view_parent_class)->unmap (widget);
+}
+
 static gboolean
 ide_source_view_focus_in_event (GtkWidget     *widget,
                                 GdkEventFocus *event)
@@ -4977,6 +5187,12 @@ ide_source_view_focus_in_event (GtkWidget     *widget,
 
   ret = GTK_WIDGET_CLASS (ide_source_view_parent_class)->focus_in_event (widget, event);
 
+  /* We may have been scrolled near the edge of a large file window meanwhile */
+  if (priv->large_file_handler == 0 &&
+      priv->buffer != NULL &&
+      _ide_buffer_get_large_file (priv->buffer) != NULL)
+    priv->large_file_handler = g_idle_add (ide_source_view_slide_large_file, self);
+
   return ret;
 }
 
@@ -5935,6 +6151,12 @@ ide_source_view_dispose (GObject *object)
       priv->delay_size_allocate_chainup = 0;
     }
 
+  if (priv->large_file_handler)
+    {
+      g_source_remove (priv->large_file_handler);
+      priv->large_file_handler = 0;
+    }
+
   g_clear_object (&priv->capture);
   g_clear_object (&priv->indenter_adapter);
   g_clear_object (&priv->line_change_renderer);
@@ -6212,10 +6434,12 @@ ide_source_view_class_init (IdeSourceViewClass *klass)
   widget_class->focus_out_event = ide_source_view_focus_out_event;
   widget_class->key_press_event = ide_source_view_key_press_event;
   widget_class->key_release_event = ide_source_view_key_release_event;
+  widget_class->map = ide_source_view_map;
   widget_class->query_tooltip = ide_source_view_query_tooltip;
   widget_class->scroll_event = ide_source_view_scroll_event;
   widget_class->size_allocate = ide_source_view_size_allocate;
   widget_class->style_updated = ide_source_view_real_style_updated;
+  widget_class->unmap = ide_source_view_unmap;
 
   text_view_class->delete_from_cursor = ide_source_view_real_delete_from_cursor;
   text_view_class->draw_layer = ide_source_view_real_draw_layer;
@@ -7116,6 +7340,11 @@ ide_source_view_init (IdeSourceView *self)
   egg_binding_group_bind (priv->file_setting_bindings, "overwrite-braces",
                           self, "overwrite-braces", G_BINDING_SYNC_CREATE);
 
+  g_signal_connect (self,
+                    "notify::vadjustment",
+                    G_CALLBACK (ide_source_view__notify_vadjustment),
+                    NULL);
+
   priv->buffer_signals = egg_signal_group_new (IDE_TYPE_BUFFER);
 
   egg_signal_group_connect_object (priv->buffer_signals,
@@ -23,13 +23,34 @@
 #include "ide-debug.h"
 
 #include "threading/ide-thread-pool.h"
+#include "util/ide-battery-monitor.h"
+
+/*
+ * Each IdeThreadPoolKind is a "lane" with its own worker threads and one
+ * queue per IdeThreadPoolPriority. Workers always drain interactive work
+ * first, then visible work, and only then background work. Background work
+ * may never occupy every thread of a lane, so that a keystroke-driven parse
+ * does not have to wait for a long running index operation to complete.
+ *
+ * When a lane runs out of interactive and visible work, its idle workers
+ * will steal interactive and visible work from the other lanes. Background
+ * work is never stolen so that indexing cannot starve the compiler lane.
+ *
+ * Lanes are sized from the number of processors, and shrink while the
+ * battery monitor asks us to conserve power.
+ */
 
-#define COMPILER_MAX_THREADS 4
-#define INDEXER_MAX_THREADS  1
+#define COMPILER_MIN_THREADS 2
+#define COMPILER_MAX_THREADS 8
+#define INDEXER_MAX_THREADS  2
+#define CONSERVE_CHECK_USEC  (5 * G_USEC_PER_SEC)
 
 typedef struct
 {
   int type;
+  IdeThreadPoolKind kind;
+  IdeThreadPoolPriority priority;
+  gint64 queued_at;
   union {
     struct {
       GTask           *task;
@@ -42,61 +63,357 @@ typedef struct
   };
 } WorkItem;
 
+typedef struct
+{
+  IdeThreadPoolKind  kind;
+  const gchar       *name;
+  GQueue             queues [IDE_THREAD_POOL_PRIORITY_LAST];
+  GCond              cond;
+  guint              max_threads;
+  guint              n_threads;
+  guint              n_idle;
+  guint              n_background;
+} Lane;
+
 EGG_DEFINE_COUNTER (TotalTasks, "ThreadPool", "Total Tasks", "Total number of tasks processed.")
 EGG_DEFINE_COUNTER (QueuedTasks, "ThreadPool", "Queued Tasks", "Current number of pending tasks.")
-
-static GThreadPool *thread_pools [IDE_THREAD_POOL_LAST];
+EGG_DEFINE_COUNTER (CancelledTasks, "ThreadPool", "Cancelled Tasks", "Tasks dropped because they were cancelled before starting.")
+EGG_DEFINE_COUNTER (StolenTasks, "ThreadPool", "Stolen Tasks", "Tasks run by a worker thread from another lane.")
+EGG_DEFINE_COUNTER (CompilerTasks, "ThreadPool", "Compiler Tasks", "Number of tasks started on the compiler lane.")
+EGG_DEFINE_COUNTER (CompilerWait, "ThreadPool", "Compiler Wait", "Total time in usec compiler tasks spent queued.")
+EGG_DEFINE_COUNTER (IndexerTasks, "ThreadPool", "Indexer Tasks", "Number of tasks started on the indexer lane.")
+EGG_DEFINE_COUNTER (IndexerWait, "ThreadPool", "Indexer Wait", "Total time in usec indexer tasks spent queued.")
+
+static GMutex lane_mutex;
+static Lane lanes [IDE_THREAD_POOL_LAST];
+static gboolean initialized;
+static volatile gint pending [IDE_THREAD_POOL_LAST];
+static volatile gint conserve;
+static gint64 conserve_checked_at;
 
 enum {
   TYPE_TASK,
   TYPE_FUNC,
 };
 
-static inline GThreadPool *
-ide_thread_pool_get_pool (IdeThreadPoolKind kind)
+static gpointer ide_thread_pool_thread (gpointer data);
+
+static gboolean
+ide_thread_pool_should_conserve (void)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  /*
+   * Querying the battery monitor takes a lock and looks at cached D-Bus
+   * properties, so only do it every few seconds. Racing here is harmless,
+   * the worst case is that two threads both refresh the value.
+   */
+  if (now - conserve_checked_at > CONSERVE_CHECK_USEC)
+    {
+      conserve_checked_at = now;
+      g_atomic_int_set (&conserve, ide_battery_monitor_get_should_conserve ());
+    }
+
+  return g_atomic_int_get (&conserve);
+}
+
+static inline guint
+ide_thread_pool_lane_get_max_threads (Lane *lane)
+{
+  if (g_atomic_int_get (&conserve))
+    return MAX (1, lane->max_threads / 2);
+  return lane->max_threads;
+}
+
+static inline guint
+ide_thread_pool_lane_get_max_background (Lane *lane)
+{
+  guint max_threads = ide_thread_pool_lane_get_max_threads (lane);
+
+  /* Always keep a thread in reserve for foreground work, if we can. */
+  return max_threads > 1 ? max_threads - 1 : 1;
+}
+
+static gboolean
+ide_thread_pool_lane_has_work (Lane *lane)
+{
+  for (guint i = 0; i < IDE_THREAD_POOL_PRIORITY_LAST; i++)
+    {
+      if (lane->queues [i].length > 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static WorkItem *
+ide_thread_pool_pop_locked (Lane *lane)
 {
-  return thread_pools [kind];
+  WorkItem *item;
+  guint busy;
+
+  g_assert (lane != NULL);
+
+  /* Park threads that are above our (possibly reduced) thread budget. */
+  busy = lane->n_threads - lane->n_idle - 1;
+  if (busy >= ide_thread_pool_lane_get_max_threads (lane))
+    return NULL;
+
+  if (NULL != (item = g_queue_pop_head (&lane->queues [IDE_THREAD_POOL_PRIORITY_INTERACTIVE])) ||
+      NULL != (item = g_queue_pop_head (&lane->queues [IDE_THREAD_POOL_PRIORITY_VISIBLE])))
+    return item;
+
+  if (lane->n_background < ide_thread_pool_lane_get_max_background (lane) &&
+      NULL != (item = g_queue_pop_head (&lane->queues [IDE_THREAD_POOL_PRIORITY_BACKGROUND])))
+    return item;
+
+  /* Nothing to do locally, try to steal foreground work from another lane. */
+  for (guint i = 0; i < IDE_THREAD_POOL_LAST; i++)
+    {
+      Lane *other = &lanes [i];
+
+      if (other == lane)
+        continue;
+
+      if (NULL != (item = g_queue_pop_head (&other->queues [IDE_THREAD_POOL_PRIORITY_INTERACTIVE])) ||
+          NULL != (item = g_queue_pop_head (&other->queues [IDE_THREAD_POOL_PRIORITY_VISIBLE])))
+        {
+          EGG_COUNTER_INC (StolenTasks);
+          return item;
+        }
+    }
+
+  return NULL;
+}
+
+static void
+ide_thread_pool_wake_locked (Lane                  *lane,
+                             IdeThreadPoolPriority  priority)
+{
+  g_assert (lane != NULL);
+
+  if (lane->n_idle > 0)
+    {
+      g_cond_signal (&lane->cond);
+      return;
+    }
+
+  if (lane->n_threads < ide_thread_pool_lane_get_max_threads (lane))
+    {
+      g_autofree gchar *name = NULL;
+      GThread *thread;
+
+      name = g_strdup_printf ("ide-%s-%u", lane->name, lane->n_threads);
+      thread = g_thread_new (name, ide_thread_pool_thread, lane);
+      g_thread_unref (thread);
+
+      lane->n_threads++;
+
+      return;
+    }
+
+  if (priority == IDE_THREAD_POOL_PRIORITY_BACKGROUND)
+    return;
+
+  /* Every thread in this lane is busy, see if another lane can help out. */
+  for (guint i = 0; i < IDE_THREAD_POOL_LAST; i++)
+    {
+      Lane *other = &lanes [i];
+
+      if (other != lane && other->n_idle > 0)
+        {
+          g_cond_signal (&other->cond);
+          return;
+        }
+    }
+}
+
+static void
+ide_thread_pool_record_wait (WorkItem *work_item)
+{
+  gint64 waited = g_get_monotonic_time () - work_item->queued_at;
+
+  switch (work_item->kind)
+    {
+    case IDE_THREAD_POOL_COMPILER:
+      EGG_COUNTER_INC (CompilerTasks);
+      EGG_COUNTER_ADD (CompilerWait, waited);
+      break;
+
+    case IDE_THREAD_POOL_INDEXER:
+      EGG_COUNTER_INC (IndexerTasks);
+      EGG_COUNTER_ADD (IndexerWait, waited);
+      break;
+
+    case IDE_THREAD_POOL_LAST:
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+ide_thread_pool_run (WorkItem *work_item)
+{
+  static const gchar *mark_names [] = {
+    [IDE_THREAD_POOL_COMPILER] = "ThreadPool:Compiler",
+    [IDE_THREAD_POOL_INDEXER] = "ThreadPool:Indexer",
+  };
+  gint64 begin_time;
+
+  g_assert (work_item != NULL);
+
+  EGG_COUNTER_DEC (QueuedTasks);
+
+  ide_thread_pool_record_wait (work_item);
+
+  begin_time = g_get_monotonic_time ();
+
+  if (work_item->type == TYPE_TASK)
+    {
+      GTask *task = work_item->task.task;
+      GCancellable *cancellable = g_task_get_cancellable (task);
+
+      /*
+       * If the cancellable fired while the task was queued, there is no
+       * reason to run the worker at all. The caller would only get the
+       * cancellation error anyway (as long as the task checks its
+       * cancellable), so return it now and free up the thread.
+       */
+      if (g_task_get_check_cancellable (task) &&
+          g_cancellable_is_cancelled (cancellable))
+        {
+          EGG_COUNTER_INC (CancelledTasks);
+          g_task_return_error_if_cancelled (task);
+        }
+      else
+        {
+          work_item->task.func (task,
+                                g_task_get_source_object (task),
+                                g_task_get_task_data (task),
+                                cancellable);
+        }
+
+      g_object_unref (task);
+    }
+  else if (work_item->type == TYPE_FUNC)
+    {
+      work_item->func.callback (work_item->func.data);
+    }
+
+  IDE_MARK_END (begin_time, mark_names [work_item->kind]);
+
+  g_atomic_int_add (&pending [work_item->kind], -1);
+}
+
+static gpointer
+ide_thread_pool_thread (gpointer data)
+{
+  Lane *lane = data;
+
+  g_assert (lane != NULL);
+
+  g_mutex_lock (&lane_mutex);
+
+  for (;;)
+    {
+      WorkItem *work_item;
+      Lane *owner;
+      gboolean background;
+
+      while (NULL == (work_item = ide_thread_pool_pop_locked (lane)))
+        {
+          lane->n_idle++;
+          g_cond_wait (&lane->cond, &lane_mutex);
+          lane->n_idle--;
+        }
+
+      owner = &lanes [work_item->kind];
+      background = (work_item->priority == IDE_THREAD_POOL_PRIORITY_BACKGROUND);
+
+      if (background)
+        owner->n_background++;
+
+      g_mutex_unlock (&lane_mutex);
+      ide_thread_pool_run (work_item);
+      g_slice_free (WorkItem, work_item);
+      g_mutex_lock (&lane_mutex);
+
+      /* A background slot freed up, let a parked thread pick up more. */
+      if (background)
+        {
+          owner->n_background--;
+          if (owner != lane && owner->n_idle > 0 && ide_thread_pool_lane_has_work (owner))
+            g_cond_signal (&owner->cond);
+        }
+    }
+
+  g_assert_not_reached ();
+
+  return NULL;
+}
+
+static void
+ide_thread_pool_push_item (WorkItem *work_item)
+{
+  Lane *lane = &lanes [work_item->kind];
+
+  EGG_COUNTER_INC (QueuedTasks);
+  g_atomic_int_inc (&pending [work_item->kind]);
+
+  ide_thread_pool_should_conserve ();
+
+  work_item->queued_at = g_get_monotonic_time ();
+
+  g_mutex_lock (&lane_mutex);
+  g_queue_push_tail (&lane->queues [work_item->priority], work_item);
+  ide_thread_pool_wake_locked (lane, work_item->priority);
+  g_mutex_unlock (&lane_mutex);
 }
 
 /**
- * ide_thread_pool_push_task:
+ * ide_thread_pool_push_task_with_priority:
  * @kind: The task kind.
+ * @priority: The priority of the task.
  * @task: A #GTask to execute.
  * @func: (scope async): The thread worker to execute for @task.
  *
- * This pushes a task to be executed on a worker thread based on the task kind as denoted by
- * @kind. Some tasks will be placed on special work queues or throttled based on priority.
+ * Like ide_thread_pool_push_task() but allows specifying the priority of
+ * the task. Interactive tasks are run before visible tasks, which are run
+ * before background tasks.
+ *
+ * If the cancellable of @task is cancelled before a worker thread picks
+ * up @task, @func will not be called and @task will be completed with
+ * %G_IO_ERROR_CANCELLED.
  */
 void
-ide_thread_pool_push_task (IdeThreadPoolKind  kind,
-                           GTask             *task,
-                           GTaskThreadFunc    func)
+ide_thread_pool_push_task_with_priority (IdeThreadPoolKind      kind,
+                                         IdeThreadPoolPriority  priority,
+                                         GTask                 *task,
+                                         GTaskThreadFunc        func)
 {
-  GThreadPool *pool;
-
   IDE_ENTRY;
 
   g_return_if_fail (kind >= 0);
   g_return_if_fail (kind < IDE_THREAD_POOL_LAST);
+  g_return_if_fail (priority >= 0);
+  g_return_if_fail (priority < IDE_THREAD_POOL_PRIORITY_LAST);
   g_return_if_fail (G_IS_TASK (task));
   g_return_if_fail (func != NULL);
 
   EGG_COUNTER_INC (TotalTasks);
 
-  pool = ide_thread_pool_get_pool (kind);
-
-  if (pool != NULL)
+  if (initialized)
     {
       WorkItem *work_item;
 
       work_item = g_slice_new0 (WorkItem);
       work_item->type = TYPE_TASK;
+      work_item->kind = kind;
+      work_item->priority = priority;
       work_item->task.task = g_object_ref (task);
       work_item->task.func = func;
 
-      EGG_COUNTER_INC (QueuedTasks);
-
-      g_thread_pool_push (pool, work_item, NULL);
+      ide_thread_pool_push_item (work_item);
     }
   else
     {
@@ -107,42 +424,117 @@ ide_thread_pool_push_task (IdeThreadPoolKind  kind,
 }
 
 /**
- * ide_thread_pool_push:
+ * ide_thread_pool_raise_task_priority:
+ * @kind: The task kind.
+ * @task: A #GTask previously pushed to the thread pool.
+ * @priority: The new priority of the task.
+ *
+ * Moves @task to the queue for @priority if it is still waiting for a
+ * worker thread at a lower priority. This is useful when a caller that the
+ * user is waiting on joins work that was started in the background.
+ *
+ * Returns: %TRUE if the priority of @task was raised.
+ */
+gboolean
+ide_thread_pool_raise_task_priority (IdeThreadPoolKind      kind,
+                                     GTask                 *task,
+                                     IdeThreadPoolPriority  priority)
+{
+  gboolean ret = FALSE;
+  Lane *lane;
+
+  g_return_val_if_fail (kind >= 0, FALSE);
+  g_return_val_if_fail (kind < IDE_THREAD_POOL_LAST, FALSE);
+  g_return_val_if_fail (priority >= 0, FALSE);
+  g_return_val_if_fail (priority < IDE_THREAD_POOL_PRIORITY_LAST, FALSE);
+  g_return_val_if_fail (G_IS_TASK (task), FALSE);
+
+  if (!initialized)
+    return FALSE;
+
+  lane = &lanes [kind];
+
+  g_mutex_lock (&lane_mutex);
+
+  for (guint i = priority + 1; !ret && i < IDE_THREAD_POOL_PRIORITY_LAST; i++)
+    {
+      for (GList *iter = lane->queues [i].head; iter != NULL; iter = iter->next)
+        {
+          WorkItem *work_item = iter->data;
+
+          if (work_item->type == TYPE_TASK && work_item->task.task == task)
+            {
+              g_queue_delete_link (&lane->queues [i], iter);
+              work_item->priority = priority;
+              g_queue_push_tail (&lane->queues [priority], work_item);
+              ide_thread_pool_wake_locked (lane, priority);
+              ret = TRUE;
+              break;
+            }
+        }
+    }
+
+  g_mutex_unlock (&lane_mutex);
+
+  return ret;
+}
+
+/**
+ * ide_thread_pool_push_task:
+ * @kind: The task kind.
+ * @task: A #GTask to execute.
+ * @func: (scope async): The thread worker to execute for @task.
+ *
+ * This pushes a task to be executed on a worker thread based on the task kind as denoted by
+ * @kind. Some tasks will be placed on special work queues or throttled based on priority.
+ *
+ * The task is queued with %IDE_THREAD_POOL_PRIORITY_VISIBLE.
+ */
+void
+ide_thread_pool_push_task (IdeThreadPoolKind  kind,
+                           GTask             *task,
+                           GTaskThreadFunc    func)
+{
+  ide_thread_pool_push_task_with_priority (kind, IDE_THREAD_POOL_PRIORITY_VISIBLE, task, func);
+}
+
+/**
+ * ide_thread_pool_push_with_priority:
  * @kind: the threadpool kind to use.
+ * @priority: the priority of the work item.
  * @func: (scope async) (closure func_data): A function to call in the worker thread.
  * @func_data: user data for @func.
  *
- * Runs the callback on the thread pool thread.
+ * Like ide_thread_pool_push() but allows specifying the priority.
  */
 void
-ide_thread_pool_push (IdeThreadPoolKind kind,
-                      IdeThreadFunc     func,
-                      gpointer          func_data)
+ide_thread_pool_push_with_priority (IdeThreadPoolKind     kind,
+                                    IdeThreadPoolPriority priority,
+                                    IdeThreadFunc         func,
+                                    gpointer              func_data)
 {
-  GThreadPool *pool;
-
   IDE_ENTRY;
 
   g_return_if_fail (kind >= 0);
   g_return_if_fail (kind < IDE_THREAD_POOL_LAST);
+  g_return_if_fail (priority >= 0);
+  g_return_if_fail (priority < IDE_THREAD_POOL_PRIORITY_LAST);
   g_return_if_fail (func != NULL);
 
   EGG_COUNTER_INC (TotalTasks);
 
-  pool = ide_thread_pool_get_pool (kind);
-
-  if (pool != NULL)
+  if (initialized)
     {
       WorkItem *work_item;
 
       work_item = g_slice_new0 (WorkItem);
       work_item->type = TYPE_FUNC;
+      work_item->kind = kind;
+      work_item->priority = priority;
       work_item->func.callback = func;
       work_item->func.data = func_data;
 
-      EGG_COUNTER_INC (QueuedTasks);
-
-      g_thread_pool_push (pool, work_item, NULL);
+      ide_thread_pool_push_item (work_item);
     }
   else
     {
@@ -152,69 +544,86 @@ ide_thread_pool_push (IdeThreadPoolKind kind,
   IDE_EXIT;
 }
 
-static void
-ide_thread_pool_worker (gpointer data,
-                        gpointer user_data)
+/**
+ * ide_thread_pool_push:
+ * @kind: the threadpool kind to use.
+ * @func: (scope async) (closure func_data): A function to call in the worker thread.
+ * @func_data: user data for @func.
+ *
+ * Runs the callback on the thread pool thread.
+ *
+ * The work item is queued with %IDE_THREAD_POOL_PRIORITY_VISIBLE.
+ */
+void
+ide_thread_pool_push (IdeThreadPoolKind kind,
+                      IdeThreadFunc     func,
+                      gpointer          func_data)
 {
-  WorkItem *work_item = data;
-  gpointer source_object;
-  gpointer task_data;
-  GCancellable *cancellable;
-
-  g_assert (work_item != NULL);
-
-  EGG_COUNTER_DEC (QueuedTasks);
-
-  if (work_item->type == TYPE_TASK)
-    {
-      source_object = g_task_get_source_object (work_item->task.task);
-      task_data = g_task_get_task_data (work_item->task.task);
-      cancellable = g_task_get_cancellable (work_item->task.task);
-
-      work_item->task.func (work_item->task.task, source_object, task_data, cancellable);
+  ide_thread_pool_push_with_priority (kind, IDE_THREAD_POOL_PRIORITY_VISIBLE, func, func_data);
+}
 
-      g_object_unref (work_item->task.task);
-    }
-  else if (work_item->type == TYPE_FUNC)
-    {
-      work_item->func.callback (work_item->func.data);
-    }
+/**
+ * ide_thread_pool_is_idle:
+ * @kind: the threadpool kind to check.
+ *
+ * Checks if the thread pool has neither queued nor running work items. This
+ * is useful to defer speculative work until the pool would otherwise sit
+ * idle. The result is only a hint, as other threads may push work at any
+ * time.
+ *
+ * Returns: %TRUE if the thread pool is idle.
+ */
+gboolean
+ide_thread_pool_is_idle (IdeThreadPoolKind kind)
+{
+  g_return_val_if_fail (kind >= 0, FALSE);
+  g_return_val_if_fail (kind < IDE_THREAD_POOL_LAST, FALSE);
 
-  g_slice_free (WorkItem, work_item);
+  return g_atomic_int_get (&pending [kind]) == 0;
 }
 
 void
 _ide_thread_pool_init (gboolean is_worker)
 {
-  gint compiler = COMPILER_MAX_THREADS;
-  gint indexer = INDEXER_MAX_THREADS;
-  gboolean exclusive = FALSE;
+  guint n_processors = g_get_num_processors ();
+  guint compiler;
+  guint indexer;
 
+  g_return_if_fail (!initialized);
+
+  /*
+   * Compiler tasks (such as those from Clang) are CPU bound but also very
+   * memory hungry, so use at most half of the processors. Indexing is
+   * never urgent, so keep it to a thread or two. Worker processes only
+   * ever service a single client, so a single thread per lane is enough.
+   */
   if (is_worker)
     {
       compiler = 1;
       indexer = 1;
-      exclusive = TRUE;
+    }
+  else
+    {
+      compiler = CLAMP (n_processors / 2, COMPILER_MIN_THREADS, COMPILER_MAX_THREADS);
+      indexer = CLAMP (n_processors / 4, 1, INDEXER_MAX_THREADS);
     }
 
-  /*
-   * Create our thread pool exclusive to compiler tasks (such as those from Clang).
-   * We don't want to consume threads from other GTask's such as those regarding IO so we manage
-   * these work items exclusively.
-   */
-  thread_pools [IDE_THREAD_POOL_COMPILER] = g_thread_pool_new (ide_thread_pool_worker,
-                                                               NULL,
-                                                               compiler,
-                                                               exclusive,
-                                                               NULL);
+  IDE_TRACE_MSG ("Thread pool lanes: compiler=%u indexer=%u", compiler, indexer);
 
-  /*
-   * Create our pool exclusive to things like indexing. Such examples including building of
-   * ctags indexes or highlight indexes.
-   */
-  thread_pools [IDE_THREAD_POOL_INDEXER] = g_thread_pool_new (ide_thread_pool_worker,
-                                                              NULL,
-                                                              indexer,
-                                                              exclusive,
-                                                              NULL);
+  lanes [IDE_THREAD_POOL_COMPILER].kind = IDE_THREAD_POOL_COMPILER;
+  lanes [IDE_THREAD_POOL_COMPILER].name = "compiler";
+  lanes [IDE_THREAD_POOL_COMPILER].max_threads = compiler;
+
+  lanes [IDE_THREAD_POOL_INDEXER].kind = IDE_THREAD_POOL_INDEXER;
+  lanes [IDE_THREAD_POOL_INDEXER].name = "indexer";
+  lanes [IDE_THREAD_POOL_INDEXER].max_threads = indexer;
+
+  for (guint i = 0; i < IDE_THREAD_POOL_LAST; i++)
+    {
+      for (guint j = 0; j < IDE_THREAD_POOL_PRIORITY_LAST; j++)
+        g_queue_init (&lanes [i].queues [j]);
+      g_cond_init (&lanes [i].cond);
+    }
+
+  initialized = TRUE;
 }
@@ -30,11 +30,20 @@ typedef struct
   gssize  pos;
 } IdeLineReader;
 
-void   ide_line_reader_init (IdeLineReader *reader,
-                             gchar         *contents,
-                             gssize         length);
-gchar *ide_line_reader_next (IdeLineReader *reader,
-                             gsize         *length);
+typedef struct
+{
+  const gchar *line;
+  gsize        length;
+} IdeLineSpan;
+
+void   ide_line_reader_init       (IdeLineReader *reader,
+                                   gchar         *contents,
+                                   gssize         length);
+gchar *ide_line_reader_next       (IdeLineReader *reader,
+                                   gsize         *length);
+guint  ide_line_reader_next_spans (IdeLineReader *reader,
+                                   IdeLineSpan   *spans,
+                                   guint          n_spans);
 
 G_END_DECLS
 
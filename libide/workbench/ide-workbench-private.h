@@ -53,6 +53,8 @@ struct _IdeWorkbench
   GtkSizeGroup              *header_size_group;
 
   GObject                   *selection_owner;
+
+  gint64                     paint_begin_time;
 };
 
 void     ide_workbench_set_context         (IdeWorkbench *workbench,
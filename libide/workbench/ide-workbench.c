@@ -230,6 +230,57 @@ ide_workbench_finalize (GObject *object)
   G_OBJECT_CLASS (ide_workbench_parent_class)->finalize (object);
 }
 
+static void
+ide_workbench_before_paint (IdeWorkbench  *self,
+                            GdkFrameClock *frame_clock)
+{
+  g_assert (IDE_IS_WORKBENCH (self));
+
+  self->paint_begin_time = g_get_monotonic_time ();
+}
+
+static void
+ide_workbench_after_paint (IdeWorkbench  *self,
+                           GdkFrameClock *frame_clock)
+{
+  g_assert (IDE_IS_WORKBENCH (self));
+
+  if (self->paint_begin_time != 0)
+    {
+      ide_mark_frame (self->paint_begin_time, g_get_monotonic_time ());
+      self->paint_begin_time = 0;
+    }
+}
+
+static void
+ide_workbench_realize (GtkWidget *widget)
+{
+  IdeWorkbench *self = (IdeWorkbench *)widget;
+  GdkFrameClock *frame_clock;
+
+  g_assert (IDE_IS_WORKBENCH (self));
+
+  GTK_WIDGET_CLASS (ide_workbench_parent_class)->realize (widget);
+
+  /*
+   * Record a mark for every frame so that painting shows up in the
+   * timeline. Stalls anywhere in the main loop, painting or not, are
+   * detected by IdeMark itself.
+   */
+  frame_clock = gtk_widget_get_frame_clock (widget);
+
+  g_signal_connect_object (frame_clock,
+                           "before-paint",
+                           G_CALLBACK (ide_workbench_before_paint),
+                           self,
+                           G_CONNECT_SWAPPED);
+  g_signal_connect_object (frame_clock,
+                           "after-paint",
+                           G_CALLBACK (ide_workbench_after_paint),
+                           self,
+                           G_CONNECT_SWAPPED);
+}
+
 static void
 ide_workbench_get_property (GObject    *object,
                             guint       prop_id,
@@ -300,6 +351,7 @@ ide_workbench_class_init (IdeWorkbenchClass *klass)
   object_class->set_property = ide_workbench_set_property;
 
   widget_class->delete_event = ide_workbench_delete_event;
+  widget_class->realize = ide_workbench_realize;
 
   /**
    * IdeWorkbench:context:
@@ -44,6 +44,10 @@
 #define FAKE_VALAC   "__LIBIDE_FAKE_VALAC__"
 #define PRINT_VARS   "include Makefile\nprint-%: ; @echo $* = $($*)\n"
 
+/* Budgets for the per-file caches, in bytes. */
+#define FILE_TARGETS_MAX_COST (1024 * 1024)
+#define FILE_FLAGS_MAX_COST   (4 * 1024 * 1024)
+
 struct _IdeMakecache
 {
   IdeObject     parent_instance;
@@ -1405,6 +1409,42 @@ ide_makecache_class_init (IdeMakecacheClass *klass)
   g_object_class_install_properties (object_class, LAST_PROP, properties);
 }
 
+static gsize
+ide_makecache_file_targets_cost (gconstpointer value,
+                                 gpointer      user_data)
+{
+  const GPtrArray *targets = value;
+  gsize cost = sizeof *targets + (targets->len * sizeof (gpointer));
+  guint i;
+
+  for (i = 0; i < targets->len; i++)
+    {
+      IdeMakecacheTarget *target = g_ptr_array_index (targets, i);
+      const gchar *subdir = ide_makecache_target_get_subdir (target);
+      const gchar *name = ide_makecache_target_get_target (target);
+
+      cost += 64;
+      cost += subdir ? strlen (subdir) + 1 : 0;
+      cost += name ? strlen (name) + 1 : 0;
+    }
+
+  return cost;
+}
+
+static gsize
+ide_makecache_file_flags_cost (gconstpointer value,
+                               gpointer      user_data)
+{
+  const gchar * const *flags = value;
+  gsize cost = sizeof (gchar *);
+  guint i;
+
+  for (i = 0; flags [i] != NULL; i++)
+    cost += sizeof (gchar *) + strlen (flags [i]) + 1;
+
+  return cost;
+}
+
 static void
 ide_makecache_init (IdeMakecache *self)
 {
@@ -1424,6 +1464,11 @@ ide_makecache_init (IdeMakecache *self)
                                                  NULL);
 
   egg_task_cache_set_name (self->file_targets_cache, "makecache: file-targets-cache");
+  egg_task_cache_set_cost_func (self->file_targets_cache,
+                                ide_makecache_file_targets_cost,
+                                NULL, NULL);
+  egg_task_cache_set_max_cost (self->file_targets_cache, FILE_TARGETS_MAX_COST);
+  egg_task_cache_set_evict_policy (self->file_targets_cache, EGG_TASK_CACHE_EVICT_LRU);
 
   self->file_flags_cache = egg_task_cache_new ((GHashFunc)g_file_hash,
                                                (GEqualFunc)g_file_equal,
@@ -1437,6 +1482,11 @@ ide_makecache_init (IdeMakecache *self)
                                                NULL);
 
   egg_task_cache_set_name (self->file_flags_cache, "makecache: file-flags-cache");
+  egg_task_cache_set_cost_func (self->file_flags_cache,
+                                ide_makecache_file_flags_cost,
+                                NULL, NULL);
+  egg_task_cache_set_max_cost (self->file_flags_cache, FILE_FLAGS_MAX_COST);
+  egg_task_cache_set_evict_policy (self->file_flags_cache, EGG_TASK_CACHE_EVICT_LRU);
 }
 
 GFile *
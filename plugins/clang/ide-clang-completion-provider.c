@@ -24,6 +24,7 @@
 #include "ide-clang-completion-item.h"
 #include "ide-clang-completion-item-private.h"
 #include "ide-clang-completion-provider.h"
+#include "ide-clang-completion-results.h"
 #include "ide-clang-service.h"
 #include "ide-clang-translation-unit.h"
 
@@ -31,32 +32,27 @@ struct _IdeClangCompletionProvider
 {
   IdeObject      parent_instance;
 
-  GSettings     *settings;
-  gchar         *last_line;
-  GPtrArray     *last_results;
-  gchar         *last_query;
+  GSettings                 *settings;
+  gchar                     *last_line;
   /*
-   * As an optimization, the linked list for result nodes are
-   * embedded in the IdeClangCompletionItem structures and we
-   * do not allocate them. This is the pointer to the first item
-   * in the result set that matches our query. It is not allocated
-   * and do not tree to free it or perform g_list_*() operations
-   * upon it.
+   * The unfiltered results from clang. Proposal objects are only
+   * created for the rows that match the query, and the filtered rows
+   * are narrowed in place while the user keeps typing.
    */
-  GList         *head;
+  IdeClangCompletionResults *last_results;
   /*
    * We save a weak pointer to the view that performed the request
    * so that we can push a snippet onto the view instead of inserting
    * text into the buffer.
    */
-  IdeSourceView *view;
+  IdeSourceView             *view;
   /*
    * The saved offset used when generating results. This is our position
    * where we moved past all the junk to a stop character (as required
    * by clang).
    */
-  guint stop_line;
-  guint stop_line_offset;
+  guint                      stop_line;
+  guint                      stop_line_offset;
 };
 
 typedef struct
@@ -91,33 +87,6 @@ ide_clang_completion_state_free (IdeClangCompletionState *state)
   g_slice_free (IdeClangCompletionState, state);
 }
 
-static gint
-sort_by_priority (gconstpointer a,
-                  gconstpointer b)
-{
-  const IdeClangCompletionItem *itema = (const IdeClangCompletionItem *)a;
-  const IdeClangCompletionItem *itemb = (const IdeClangCompletionItem *)b;
-
-  if (itema->priority < itemb->priority)
-    return -1;
-  else if (itema->priority > itemb->priority)
-    return 1;
-
-  /* If the item is in the result set here, we should have a valid
-   * typed_text field because we already scored the completion item.
-   */
-
-  return g_strcmp0 (itema->typed_text, itemb->typed_text);
-}
-
-static void
-ide_clang_completion_provider_sort_by_priority (IdeClangCompletionProvider *self)
-{
-  g_assert (IDE_IS_CLANG_COMPLETION_PROVIDER (self));
-
-  self->head = g_list_sort (self->head, sort_by_priority);
-}
-
 static gchar *
 ide_clang_completion_provider_get_name (GtkSourceCompletionProvider *provider)
 {
@@ -217,154 +186,25 @@ ide_clang_completion_provider_can_replay (IdeClangCompletionProvider *self,
 
 static void
 ide_clang_completion_provider_save_results (IdeClangCompletionProvider *self,
-                                            GPtrArray                  *results,
-                                            const gchar                *line,
-                                            const gchar                *query)
+                                            IdeClangCompletionResults  *results,
+                                            const gchar                *line)
 {
   IDE_ENTRY;
 
   g_assert (IDE_IS_CLANG_COMPLETION_PROVIDER (self));
 
-  g_clear_pointer (&self->last_results, g_ptr_array_unref);
+  g_clear_pointer (&self->last_results, ide_clang_completion_results_unref);
   g_clear_pointer (&self->last_line, g_free);
-  g_clear_pointer (&self->last_query, g_free);
-  self->head = NULL;
-
-  if (query && !*query)
-    query = NULL;
 
   if (results != NULL)
     {
       self->last_line = g_strdup (line);
-      self->last_query = g_strdup (query);
-      self->last_results = g_ptr_array_ref (results);
-      if (results->len > 0)
-        {
-          IdeClangCompletionItem *head = g_ptr_array_index (results, 0);
-          self->head = &head->link;
-        }
+      self->last_results = ide_clang_completion_results_ref (results);
     }
 
   IDE_EXIT;
 }
 
-static void
-ide_clang_completion_provider_update_links (IdeClangCompletionProvider *self,
-                                            GPtrArray                  *results)
-{
-  IdeClangCompletionItem *item;
-  IdeClangCompletionItem *next;
-  IdeClangCompletionItem *prev;
-  guint i;
-
-  IDE_ENTRY;
-
-  g_assert (IDE_IS_CLANG_COMPLETION_PROVIDER (self));
-  g_assert (results != NULL);
-
-  if G_UNLIKELY (results->len == 0)
-    {
-      self->head = NULL;
-      IDE_EXIT;
-    }
-
-  /* Unrolling loops for the gentoo crowd */
-
-  item = g_ptr_array_index (results, 0);
-  item->link.prev = NULL;
-  item->link.next = (results->len == 1) ? NULL : &((IdeClangCompletionItem*)g_ptr_array_index (results, 1))->link;
-
-  self->head = &item->link;
-
-  prev = item;
-
-  for (i = 1; i < (results->len - 1); i++)
-    {
-      item = g_ptr_array_index (results, i);
-      next = g_ptr_array_index (results, i + 1);
-
-      item->link.prev = &prev->link;
-      item->link.next = &next->link;
-
-      prev = item;
-    }
-
-  if (results->len > 1)
-    {
-      item = g_ptr_array_index (results, results->len - 1);
-      item->link.prev = &((IdeClangCompletionItem*)g_ptr_array_index (results, results->len-2))->link;
-      item->link.next = NULL;
-    }
-
-  IDE_EXIT;
-}
-
-static void
-ide_clang_completion_provider_refilter (IdeClangCompletionProvider *self,
-                                        GPtrArray                  *results,
-                                        const gchar                *query)
-{
-  g_autofree gchar *lower = NULL;
-
-  IDE_ENTRY;
-
-  g_assert (IDE_IS_CLANG_COMPLETION_PROVIDER (self));
-  g_assert (results != NULL);
-  g_assert (query != NULL);
-
-  if (results->len == 0)
-    IDE_EXIT;
-
-  IDE_TRACE_MSG ("Filtering with query \"%s\"", query);
-
-  /*
-   * By traversing the linked list nodes instead of the array, we allow
-   * ourselves to avoid rechecking items we already know filtered.
-   * We do need to be mindful of this in case the user backspaced
-   * and our list is no longer a continual "deep dive" of matched items.
-   */
-  if ((self->last_query != NULL) && g_str_has_prefix (query, self->last_query))
-    ide_clang_completion_provider_update_links (self, results);
-
-  lower = g_utf8_casefold (query, -1);
-
-  if (!g_str_is_ascii (lower))
-    {
-      g_warning ("Item filtering requires ascii input.");
-      IDE_EXIT;
-    }
-
-  for (GList *iter = self->head; iter; iter = iter->next)
-    {
-      IdeClangCompletionItem *item = iter->data;
-      const gchar *typed_text;
-      guint priority;
-
-      typed_text = ide_clang_completion_item_get_typed_text (item);
-
-      if (!ide_completion_item_fuzzy_match (typed_text, lower, &priority))
-        {
-          if (iter->prev != NULL)
-            iter->prev->next = iter->next;
-          else
-            self->head = iter->next;
-
-          if (iter->next != NULL)
-            iter->next->prev = iter->prev;
-
-          continue;
-        }
-
-      /* Save the generated priority for further sorting */
-      item->priority = priority;
-    }
-
-  g_free (self->last_query);
-  self->last_query = g_strdup (query);
-
-  IDE_EXIT;
-}
-
 static void
 ide_clang_completion_provider_code_complete_cb (GObject      *object,
                                                 GAsyncResult *result,
@@ -372,7 +212,7 @@ ide_clang_completion_provider_code_complete_cb (GObject      *object,
 {
   IdeClangTranslationUnit *unit = (IdeClangTranslationUnit *)object;
   IdeClangCompletionState *state = user_data;
-  g_autoptr(GPtrArray) results = NULL;
+  g_autoptr(IdeClangCompletionResults) results = NULL;
   GError *error = NULL;
 
   IDE_ENTRY;
@@ -395,28 +235,22 @@ ide_clang_completion_provider_code_complete_cb (GObject      *object,
       IDE_EXIT;
     }
 
-  ide_clang_completion_provider_save_results (state->self, results, state->line, state->query);
-  ide_clang_completion_provider_update_links (state->self, results);
+  ide_clang_completion_provider_save_results (state->self, results, state->line);
 
   if (!g_cancellable_is_cancelled (state->cancellable))
     {
-      if (results->len > 0)
-        {
-          if (state->query && *state->query)
-            ide_clang_completion_provider_refilter (state->self, results, state->query);
-          ide_clang_completion_provider_sort_by_priority (state->self);
-          IDE_TRACE_MSG ("%d results returned from clang", results->len);
-          gtk_source_completion_context_add_proposals (state->context,
-                                                       GTK_SOURCE_COMPLETION_PROVIDER (state->self),
-                                                       state->self->head, TRUE);
-        }
-      else
-        {
-          IDE_TRACE_MSG ("No results returned from clang");
-          gtk_source_completion_context_add_proposals (state->context,
-                                                       GTK_SOURCE_COMPLETION_PROVIDER (state->self),
-                                                       NULL, TRUE);
-        }
+      GList *head;
+
+      ide_clang_completion_results_refilter (results, state->query);
+      head = ide_clang_completion_results_get_list (results);
+
+      IDE_TRACE_MSG ("%u results from clang matched \"%s\"",
+                     ide_clang_completion_results_get_size (results),
+                     state->query ?: "");
+
+      gtk_source_completion_context_add_proposals (state->context,
+                                                   GTK_SOURCE_COMPLETION_PROVIDER (state->self),
+                                                   head, TRUE);
     }
   else
     {
@@ -567,14 +401,16 @@ ide_clang_completion_provider_populate (GtkSourceCompletionProvider *provider,
       IDE_PROBE;
 
       /*
-       * Filter the items that no longer match our query.
-       * We save a little state so that we can optimize further
-       * passes of this operation by traversing the already filtered
-       * linked list instead of all items.
+       * Filter the items that no longer match our query. The result set
+       * narrows the rows that matched the previous query rather than
+       * checking every result again, and reuses the proposals it already
+       * created for them.
        */
-      ide_clang_completion_provider_refilter (self, self->last_results, prefix);
-      ide_clang_completion_provider_sort_by_priority (self);
-      gtk_source_completion_context_add_proposals (context, provider, self->head, TRUE);
+      ide_clang_completion_results_refilter (self->last_results, prefix);
+      gtk_source_completion_context_add_proposals (context,
+                                                   provider,
+                                                   ide_clang_completion_results_get_list (self->last_results),
+                                                   TRUE);
 
       IDE_EXIT;
     }
@@ -732,9 +568,8 @@ ide_clang_completion_provider_finalize (GObject *object)
 {
   IdeClangCompletionProvider *self = (IdeClangCompletionProvider *)object;
 
-  g_clear_pointer (&self->last_results, g_ptr_array_unref);
+  g_clear_pointer (&self->last_results, ide_clang_completion_results_unref);
   g_clear_pointer (&self->last_line, g_free);
-  g_clear_pointer (&self->last_query, g_free);
   g_clear_object (&self->settings);
 
   G_OBJECT_CLASS (ide_clang_completion_provider_parent_class)->finalize (object);
@@ -0,0 +1,349 @@
+/* ide-clang-completion-results.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-clang-completion-results"
+
+#include <egg-counter.h>
+#include <string.h>
+
+#include "ide-clang-completion-item.h"
+#include "ide-clang-completion-item-private.h"
+#include "ide-clang-completion-results.h"
+
+/*
+ * IdeClangCompletionResults wraps the CXCodeCompleteResults from clang
+ * without inflating a GObject for every result. Completing after "->" or
+ * at the top of a scope can easily yield tens of thousands of results, of
+ * which the user only ever sees the handful that match what they type.
+ *
+ * We extract the typed-text of every result once (on the worker thread)
+ * into a single string chunk and filter over a flat array of records.
+ * IdeClangCompletionItem proposals are only created for the best
+ * MAX_PROPOSALS rows that survive the filter, since that is all we hand to
+ * GtkSourceCompletion. Nobody scrolls through thousands of proposals; the
+ * rest show up as the user keeps typing and the query narrows. Proposals
+ * are cached by result index so that replaying the query reuses both the
+ * narrowed record array and the proposals.
+ */
+
+#define MAX_PROPOSALS 500
+
+typedef struct
+{
+  const gchar *typed_text;
+  guint        index;
+  guint        priority;
+} IdeClangCompletionRecord;
+
+struct _IdeClangCompletionResults
+{
+  volatile gint            ref_count;
+
+  IdeRefPtr               *results;
+  GStringChunk            *strings;
+  GArray                  *records;
+  GArray                  *filtered;
+  gchar                   *query;
+  IdeClangCompletionItem **items;
+};
+
+EGG_DEFINE_COUNTER (instances, "Clang", "Completion Results", "Number of clang completion result sets")
+EGG_DEFINE_COUNTER (inflated, "Clang", "Completion Proposals", "Number of clang completion proposals created")
+
+static const gchar *
+get_typed_text (CXCompletionResult *result,
+                GStringChunk       *strings)
+{
+  unsigned num_chunks;
+  unsigned i;
+
+  num_chunks = clang_getNumCompletionChunks (result->CompletionString);
+
+  for (i = 0; i < num_chunks; i++)
+    {
+      if (clang_getCompletionChunkKind (result->CompletionString, i) == CXCompletionChunk_TypedText)
+        {
+          const gchar *ret;
+          CXString cxstr;
+
+          cxstr = clang_getCompletionChunkText (result->CompletionString, i);
+          ret = g_string_chunk_insert_const (strings, clang_getCString (cxstr) ?: "");
+          clang_disposeString (cxstr);
+
+          return ret;
+        }
+    }
+
+  /* Implausible, but see ide_clang_completion_item_get_typed_text() */
+  return "";
+}
+
+/**
+ * ide_clang_completion_results_new:
+ * @results: (transfer full): The results from clang_codeCompleteAt().
+ *
+ * Creates a new result set taking ownership of @results. This is safe to
+ * call from a worker thread.
+ *
+ * Returns: (transfer full): An #IdeClangCompletionResults.
+ */
+IdeClangCompletionResults *
+ide_clang_completion_results_new (CXCodeCompleteResults *results)
+{
+  IdeClangCompletionResults *self;
+  guint i;
+
+  g_return_val_if_fail (results != NULL, NULL);
+
+  self = g_slice_new0 (IdeClangCompletionResults);
+  self->ref_count = 1;
+  self->results = ide_ref_ptr_new (results, (GDestroyNotify)clang_disposeCodeCompleteResults);
+  self->strings = g_string_chunk_new (4096);
+  self->records = g_array_sized_new (FALSE, FALSE, sizeof (IdeClangCompletionRecord), results->NumResults);
+  self->items = g_new0 (IdeClangCompletionItem *, results->NumResults);
+
+  for (i = 0; i < results->NumResults; i++)
+    {
+      IdeClangCompletionRecord record;
+
+      record.typed_text = get_typed_text (&results->Results [i], self->strings);
+      record.index = i;
+      record.priority = 0;
+
+      g_array_append_val (self->records, record);
+    }
+
+  EGG_COUNTER_INC (instances);
+
+  return self;
+}
+
+IdeClangCompletionResults *
+ide_clang_completion_results_ref (IdeClangCompletionResults *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+ide_clang_completion_results_unref (IdeClangCompletionResults *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      guint i;
+
+      for (i = 0; i < self->records->len; i++)
+        g_clear_object (&self->items [i]);
+
+      g_clear_pointer (&self->items, g_free);
+      g_clear_pointer (&self->filtered, g_array_unref);
+      g_clear_pointer (&self->records, g_array_unref);
+      g_clear_pointer (&self->strings, g_string_chunk_free);
+      g_clear_pointer (&self->results, ide_ref_ptr_unref);
+      g_clear_pointer (&self->query, g_free);
+
+      g_slice_free (IdeClangCompletionResults, self);
+
+      EGG_COUNTER_DEC (instances);
+    }
+}
+
+/**
+ * ide_clang_completion_results_get_size:
+ *
+ * Gets the number of rows matching the last query, or the total number of
+ * results if ide_clang_completion_results_refilter() has not been called.
+ */
+guint
+ide_clang_completion_results_get_size (IdeClangCompletionResults *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  if (self->filtered != NULL)
+    return self->filtered->len;
+
+  return self->records->len;
+}
+
+static gint
+sort_by_priority (gconstpointer a,
+                  gconstpointer b)
+{
+  const IdeClangCompletionRecord *recorda = a;
+  const IdeClangCompletionRecord *recordb = b;
+
+  if (recorda->priority < recordb->priority)
+    return -1;
+  else if (recorda->priority > recordb->priority)
+    return 1;
+
+  return strcmp (recorda->typed_text, recordb->typed_text);
+}
+
+/**
+ * ide_clang_completion_results_refilter:
+ * @self: An #IdeClangCompletionResults.
+ * @query: (nullable): The text typed so far.
+ *
+ * Narrows the result set to the rows fuzzy matching @query and sorts them
+ * by match score. If @query extends the previous query, only the rows that
+ * matched the previous query are checked.
+ */
+void
+ide_clang_completion_results_refilter (IdeClangCompletionResults *self,
+                                       const gchar               *query)
+{
+  g_autofree gchar *lower = NULL;
+  guint i;
+  guint j;
+
+  IDE_ENTRY;
+
+  g_return_if_fail (self != NULL);
+
+  if (query == NULL)
+    query = "";
+
+  lower = g_utf8_casefold (query, -1);
+
+  if (!g_str_is_ascii (lower))
+    {
+      g_warning ("Item filtering requires ascii input.");
+      IDE_EXIT;
+    }
+
+  if (self->filtered != NULL && g_strcmp0 (self->query, lower) == 0)
+    IDE_EXIT;
+
+  IDE_TRACE_MSG ("Filtering with query \"%s\"", lower);
+
+  /*
+   * If the user backspaced, or this is the first pass, we need to start
+   * over from the full result set. Otherwise we can narrow the rows that
+   * we already know matched.
+   */
+  if (self->filtered == NULL ||
+      self->query == NULL ||
+      !g_str_has_prefix (lower, self->query))
+    {
+      g_clear_pointer (&self->filtered, g_array_unref);
+      self->filtered = g_array_sized_new (FALSE, FALSE,
+                                          sizeof (IdeClangCompletionRecord),
+                                          self->records->len);
+      g_array_append_vals (self->filtered, self->records->data, self->records->len);
+    }
+
+  if (*lower != '\0')
+    {
+      for (i = 0, j = 0; i < self->filtered->len; i++)
+        {
+          IdeClangCompletionRecord *record;
+          guint priority;
+
+          record = &g_array_index (self->filtered, IdeClangCompletionRecord, i);
+
+          if (ide_completion_item_fuzzy_match (record->typed_text, lower, &priority))
+            {
+              record->priority = priority;
+              if (i != j)
+                g_array_index (self->filtered, IdeClangCompletionRecord, j) = *record;
+              j++;
+            }
+        }
+
+      g_array_set_size (self->filtered, j);
+    }
+
+  g_array_sort (self->filtered, sort_by_priority);
+
+  g_free (self->query);
+  self->query = g_steal_pointer (&lower);
+
+  IDE_EXIT;
+}
+
+/**
+ * ide_clang_completion_results_get_list:
+ * @self: An #IdeClangCompletionResults.
+ *
+ * Gets the proposals for the best rows matching the last query, creating
+ * them as necessary. At most MAX_PROPOSALS proposals are returned, even if
+ * ide_clang_completion_results_get_size() is larger.
+ *
+ * As an optimization, the linked list nodes are embedded in the
+ * #IdeClangCompletionItem structures and are not allocated. Do not free
+ * the result or perform g_list_*() operations upon it. It is only valid
+ * until the next call to ide_clang_completion_results_get_list().
+ *
+ * Returns: (transfer none) (element-type IdeClangCompletionItem) (nullable):
+ *   The first proposal, or %NULL.
+ */
+GList *
+ide_clang_completion_results_get_list (IdeClangCompletionResults *self)
+{
+  GList *head = NULL;
+  GList *prev = NULL;
+  GArray *rows;
+  guint n_rows;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  if (self->filtered == NULL)
+    ide_clang_completion_results_refilter (self, NULL);
+
+  rows = self->filtered ?: self->records;
+  n_rows = MIN (rows->len, MAX_PROPOSALS);
+
+  for (i = 0; i < n_rows; i++)
+    {
+      const IdeClangCompletionRecord *record;
+      IdeClangCompletionItem *item;
+
+      record = &g_array_index (rows, IdeClangCompletionRecord, i);
+      item = self->items [record->index];
+
+      if (item == NULL)
+        {
+          item = ide_clang_completion_item_new (self->results, record->index);
+          item->typed_text = g_strdup (record->typed_text);
+          self->items [record->index] = item;
+          EGG_COUNTER_INC (inflated);
+        }
+
+      item->priority = record->priority;
+      item->link.prev = prev;
+      item->link.next = NULL;
+
+      if (prev != NULL)
+        prev->next = &item->link;
+      else
+        head = &item->link;
+
+      prev = &item->link;
+    }
+
+  return head;
+}
@@ -0,0 +1,41 @@
+/* ide-clang-completion-results.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_CLANG_COMPLETION_RESULTS_H
+#define IDE_CLANG_COMPLETION_RESULTS_H
+
+#include <clang-c/Index.h>
+#include <ide.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IdeClangCompletionResults IdeClangCompletionResults;
+
+IdeClangCompletionResults *ide_clang_completion_results_new      (CXCodeCompleteResults     *results);
+IdeClangCompletionResults *ide_clang_completion_results_ref      (IdeClangCompletionResults *self);
+void                       ide_clang_completion_results_unref    (IdeClangCompletionResults *self);
+guint                      ide_clang_completion_results_get_size (IdeClangCompletionResults *self);
+void                       ide_clang_completion_results_refilter (IdeClangCompletionResults *self,
+                                                                  const gchar               *query);
+GList                     *ide_clang_completion_results_get_list (IdeClangCompletionResults *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeClangCompletionResults, ide_clang_completion_results_unref)
+
+G_END_DECLS
+
+#endif /* IDE_CLANG_COMPLETION_RESULTS_H */
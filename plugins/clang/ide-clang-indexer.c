@@ -0,0 +1,1360 @@
+/* ide-clang-indexer.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "clang-indexer"
+
+#include <clang-c/Index.h>
+#include <egg-counter.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "ide-clang-indexer.h"
+#include "ide-clang-private.h"
+
+/*
+ * The indexer walks every compilation unit in the project that the build
+ * system knows how to compile and records the USR of every declaration,
+ * definition and reference found within the project tree.
+ *
+ * The database is stored as a single GVariant in the cache directory. Each
+ * compilation unit is stored as a "(ssasasa(uuuuy)as)" tuple containing the
+ * path of the unit, a hash of its contents and build flags, a table of
+ * files, a sorted table of USRs, an array of occurrences sorted by USR, and
+ * the files included by the unit. That allows us to map the database and
+ * binary search it directly without inflating it into lots of little
+ * allocations.
+ *
+ * The hash also covers the modification time of every included file, so a
+ * unit is indexed again when it, its build flags, or any of its headers
+ * change. Saving a header from the editor requeues the units including it.
+ */
+
+#define INDEX_FORMAT_VERSION 2
+#define INDEX_DELAY_SECONDS  10
+#define SAVE_DELAY_SECONDS   5
+#define MAX_IN_FLIGHT        2
+#define UNIT_VARIANT_TYPE    "(ssasasa(uuuuy)as)"
+#define INDEX_VARIANT_TYPE   "(ua" UNIT_VARIANT_TYPE ")"
+
+struct _IdeClangIndexer
+{
+  IdeObject     parent_instance;
+
+  GCancellable *cancellable;
+  gchar        *path;
+
+  /* Maps the path of a compilation unit to its GVariant */
+  GHashTable   *units;
+
+  /* Paths of compilation units waiting to be indexed */
+  GQueue        queue;
+  GHashTable   *queued;
+
+  guint         start_timeout;
+  guint         save_timeout;
+  guint         in_flight;
+
+  guint         loaded : 1;
+  guint         stopped : 1;
+};
+
+typedef struct
+{
+  guint32 usr;
+  guint32 file;
+  guint32 line;
+  guint32 column;
+  guint8  kind;
+  guint8  padding [3];
+} IndexOccurrence;
+
+G_STATIC_ASSERT (sizeof (IndexOccurrence) == 20);
+
+typedef struct
+{
+  gchar    *path;
+  gchar    *workpath;
+  gchar    *old_hash;
+  gchar   **old_deps;
+  gchar   **argv;
+} IndexRequest;
+
+typedef struct
+{
+  const gchar  *workpath;
+  GCancellable *cancellable;
+  GHashTable   *usrs;
+  GPtrArray    *usr_strs;
+  GHashTable   *files;
+  GPtrArray    *file_strs;
+  GArray       *occurrences;
+  GHashTable   *deps;
+  GPtrArray    *dep_strs;
+  GArray       *dep_mtimes;
+} IndexState;
+
+G_DEFINE_TYPE (IdeClangIndexer, ide_clang_indexer, IDE_TYPE_OBJECT)
+
+EGG_DEFINE_COUNTER (indexed_units, "Clang", "Indexed Units", "Number of compilation units indexed")
+EGG_DEFINE_COUNTER (skipped_units, "Clang", "Unchanged Units", "Number of compilation units that did not need indexing")
+
+static void
+index_request_free (gpointer data)
+{
+  IndexRequest *request = data;
+
+  g_free (request->path);
+  g_free (request->workpath);
+  g_free (request->old_hash);
+  g_strfreev (request->old_deps);
+  g_strfreev (request->argv);
+  g_slice_free (IndexRequest, request);
+}
+
+static gboolean
+is_compilation_unit (const gchar *name)
+{
+  static const gchar *suffixes[] = { ".c", ".cc", ".cpp", ".cxx", ".m", NULL };
+  guint i;
+
+  for (i = 0; suffixes [i]; i++)
+    {
+      if (g_str_has_suffix (name, suffixes [i]))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static int
+index_abort_query (CXClientData  client_data,
+                   void         *reserved)
+{
+  IndexState *state = client_data;
+
+  return g_cancellable_is_cancelled (state->cancellable);
+}
+
+static CXIdxClientFile
+index_included_file (CXClientData                 client_data,
+                     const CXIdxIncludedFileInfo *info)
+{
+  IndexState *state = client_data;
+  g_auto(CXString) cxstr = { 0 };
+  g_autoptr(GFile) file = NULL;
+  const gchar *path;
+  gchar *canonical;
+  gint64 mtime;
+
+  if (info->file == NULL)
+    return NULL;
+
+  cxstr = clang_getFileName (info->file);
+
+  if (NULL == (path = clang_getCString (cxstr)))
+    return NULL;
+
+  /*
+   * Clang gives us the path as it was found on the include path, which may
+   * be relative or contain "..". Canonicalize it so that it matches the path
+   * of a buffer when the header is saved.
+   */
+  file = g_file_new_for_path (path);
+  canonical = g_file_get_path (file);
+
+  if (g_hash_table_contains (state->deps, canonical))
+    {
+      g_free (canonical);
+      return NULL;
+    }
+
+  mtime = clang_getFileTime (info->file);
+
+  g_hash_table_add (state->deps, canonical);
+  g_ptr_array_add (state->dep_strs, canonical);
+  g_array_append_val (state->dep_mtimes, mtime);
+
+  return NULL;
+}
+
+/*
+ * A plain prefix check would also match siblings of the project directory
+ * such as "/src/project-old" for "/src/project", so the prefix must end at
+ * a directory separator.
+ */
+static gboolean
+path_is_in_workpath (const gchar *path,
+                     const gchar *workpath)
+{
+  gsize len;
+
+  g_assert (path != NULL);
+  g_assert (workpath != NULL);
+
+  len = strlen (workpath);
+
+  if (strncmp (path, workpath, len) != 0)
+    return FALSE;
+
+  return (len > 0 && workpath [len - 1] == G_DIR_SEPARATOR) ||
+         path [len] == G_DIR_SEPARATOR;
+}
+
+static guint
+index_state_get_file (IndexState *state,
+                      CXFile      cxfile)
+{
+  g_auto(CXString) cxstr = { 0 };
+  const gchar *path;
+  gpointer value;
+  guint idx = G_MAXUINT;
+
+  if (cxfile == NULL)
+    return G_MAXUINT;
+
+  if (g_hash_table_lookup_extended (state->files, cxfile, NULL, &value))
+    return GPOINTER_TO_UINT (value);
+
+  /*
+   * We only store occurrences found within the project tree, everything
+   * else (such as system headers) would only bloat the database.
+   */
+  cxstr = clang_getFileName (cxfile);
+  path = clang_getCString (cxstr);
+
+  if (path != NULL && path_is_in_workpath (path, state->workpath))
+    {
+      idx = state->file_strs->len;
+      g_ptr_array_add (state->file_strs, g_strdup (path));
+    }
+
+  g_hash_table_insert (state->files, cxfile, GUINT_TO_POINTER (idx));
+
+  return idx;
+}
+
+static void
+index_state_add (IndexState  *state,
+                 const gchar *usr,
+                 CXIdxLoc     loc,
+                 guint8       kind)
+{
+  IndexOccurrence occurrence = { 0 };
+  CXFile cxfile = NULL;
+  unsigned line = 0;
+  unsigned column = 0;
+  gpointer value;
+  guint file;
+
+  if (usr == NULL || *usr == '\0')
+    return;
+
+  clang_indexLoc_getFileLocation (loc, NULL, &cxfile, &line, &column, NULL);
+
+  if (G_MAXUINT == (file = index_state_get_file (state, cxfile)))
+    return;
+
+  if (!g_hash_table_lookup_extended (state->usrs, usr, NULL, &value))
+    {
+      gchar *copy = g_strdup (usr);
+
+      value = GUINT_TO_POINTER (state->usr_strs->len);
+      g_ptr_array_add (state->usr_strs, copy);
+      g_hash_table_insert (state->usrs, copy, value);
+    }
+
+  occurrence.usr = GPOINTER_TO_UINT (value);
+  occurrence.file = file;
+  occurrence.line = line > 0 ? line - 1 : 0;
+  occurrence.column = column > 0 ? column - 1 : 0;
+  occurrence.kind = kind;
+
+  g_array_append_val (state->occurrences, occurrence);
+}
+
+static void
+index_declaration (CXClientData         client_data,
+                   const CXIdxDeclInfo *info)
+{
+  if (info->entityInfo != NULL)
+    index_state_add (client_data,
+                     info->entityInfo->USR,
+                     info->loc,
+                     info->isDefinition ? IDE_CLANG_INDEX_DEFINITION
+                                        : IDE_CLANG_INDEX_DECLARATION);
+}
+
+static void
+index_entity_reference (CXClientData              client_data,
+                        const CXIdxEntityRefInfo *info)
+{
+  if (info->referencedEntity != NULL)
+    index_state_add (client_data,
+                     info->referencedEntity->USR,
+                     info->loc,
+                     IDE_CLANG_INDEX_REFERENCE);
+}
+
+static gint
+compare_occurrence (gconstpointer a,
+                    gconstpointer b)
+{
+  const IndexOccurrence *oa = a;
+  const IndexOccurrence *ob = b;
+
+  if (oa->usr != ob->usr)
+    return oa->usr < ob->usr ? -1 : 1;
+  if (oa->file != ob->file)
+    return oa->file < ob->file ? -1 : 1;
+  if (oa->line != ob->line)
+    return oa->line < ob->line ? -1 : 1;
+  if (oa->column != ob->column)
+    return oa->column < ob->column ? -1 : 1;
+
+  return (gint)oa->kind - (gint)ob->kind;
+}
+
+static gint
+compare_usr_index (gconstpointer a,
+                   gconstpointer b,
+                   gpointer      user_data)
+{
+  GPtrArray *usr_strs = user_data;
+
+  return strcmp (g_ptr_array_index (usr_strs, *(const guint *)a),
+                 g_ptr_array_index (usr_strs, *(const guint *)b));
+}
+
+static gchar *
+compute_unit_hash (const gchar         *contents,
+                   gsize                len,
+                   const gchar * const *argv,
+                   const gchar * const *deps,
+                   const gint64        *mtimes)
+{
+  g_autoptr(GChecksum) checksum = NULL;
+  guint i;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (const guchar *)contents, len);
+
+  for (i = 0; argv [i] != NULL; i++)
+    g_checksum_update (checksum, (const guchar *)argv [i], -1);
+
+  for (i = 0; deps != NULL && deps [i] != NULL; i++)
+    {
+      g_checksum_update (checksum, (const guchar *)deps [i], strlen (deps [i]) + 1);
+      g_checksum_update (checksum, (const guchar *)&mtimes [i], sizeof mtimes [i]);
+    }
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+/*
+ * Hashes the unit using the files it included when it was last indexed, as
+ * they are on disk now. If none of them changed, this matches the hash that
+ * was stored with the unit.
+ */
+static gchar *
+compute_old_unit_hash (const gchar         *contents,
+                       gsize                len,
+                       const gchar * const *argv,
+                       const gchar * const *deps)
+{
+  g_autofree gint64 *mtimes = NULL;
+  guint n_deps;
+  guint i;
+
+  n_deps = deps ? g_strv_length ((gchar **)deps) : 0;
+  mtimes = g_new0 (gint64, n_deps + 1);
+
+  for (i = 0; i < n_deps; i++)
+    {
+      GStatBuf st;
+
+      if (g_stat (deps [i], &st) == 0)
+        mtimes [i] = st.st_mtime;
+      else
+        mtimes [i] = -1;
+    }
+
+  return compute_unit_hash (contents, len, argv, deps, mtimes);
+}
+
+static GVariant *
+index_state_to_variant (IndexState  *state,
+                        const gchar *path,
+                        const gchar *hash)
+{
+  g_autofree guint *order = NULL;
+  g_autofree guint *remap = NULL;
+  g_autofree const gchar **usrs = NULL;
+  GVariant *occurrences;
+  guint n_usrs = state->usr_strs->len;
+  guint i;
+  guint j;
+
+  /*
+   * Sort the USR table so that lookups can binary search it, and then
+   * update the occurrences to point at the new positions before sorting
+   * them by USR as well.
+   */
+  order = g_new (guint, n_usrs + 1);
+  remap = g_new (guint, n_usrs + 1);
+  usrs = g_new0 (const gchar *, n_usrs + 1);
+
+  for (i = 0; i < n_usrs; i++)
+    order [i] = i;
+
+  g_qsort_with_data (order, n_usrs, sizeof (guint), compare_usr_index, state->usr_strs);
+
+  for (i = 0; i < n_usrs; i++)
+    {
+      remap [order [i]] = i;
+      usrs [i] = g_ptr_array_index (state->usr_strs, order [i]);
+    }
+
+  for (i = 0; i < state->occurrences->len; i++)
+    {
+      IndexOccurrence *occurrence = &g_array_index (state->occurrences, IndexOccurrence, i);
+
+      occurrence->usr = remap [occurrence->usr];
+    }
+
+  g_array_sort (state->occurrences, compare_occurrence);
+
+  /* Drop duplicates, such as those from headers that are included twice. */
+  for (i = 0, j = 0; i < state->occurrences->len; i++)
+    {
+      if (j > 0 &&
+          compare_occurrence (&g_array_index (state->occurrences, IndexOccurrence, i),
+                              &g_array_index (state->occurrences, IndexOccurrence, j - 1)) == 0)
+        continue;
+
+      if (i != j)
+        g_array_index (state->occurrences, IndexOccurrence, j) =
+          g_array_index (state->occurrences, IndexOccurrence, i);
+
+      j++;
+    }
+
+  g_array_set_size (state->occurrences, j);
+
+  g_ptr_array_add (state->file_strs, NULL);
+
+  occurrences = g_variant_new_fixed_array (G_VARIANT_TYPE ("(uuuuy)"),
+                                           state->occurrences->data,
+                                           state->occurrences->len,
+                                           sizeof (IndexOccurrence));
+
+  return g_variant_ref_sink (g_variant_new ("(ss^as^as@a(uuuuy)^as)",
+                                            path,
+                                            hash,
+                                            (const gchar * const *)state->file_strs->pdata,
+                                            usrs,
+                                            occurrences,
+                                            (const gchar * const *)state->dep_strs->pdata));
+}
+
+static void
+ide_clang_indexer_index_worker (GTask        *task,
+                                gpointer      source_object,
+                                gpointer      task_data,
+                                GCancellable *cancellable)
+{
+  IndexRequest *request = task_data;
+  g_autofree gchar *contents = NULL;
+  g_autofree gchar *hash = NULL;
+  IndexerCallbacks callbacks = {
+    .abortQuery = index_abort_query,
+    .ppIncludedFile = index_included_file,
+    .indexDeclaration = index_declaration,
+    .indexEntityReference = index_entity_reference,
+  };
+  IndexState state = { 0 };
+  CXIndexAction action;
+  CXIndex index;
+  GVariant *ret;
+  GError *error = NULL;
+  gsize len = 0;
+  int code;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_CLANG_INDEXER (source_object));
+  g_assert (request != NULL);
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  if (!g_file_get_contents (request->path, &contents, &len, &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  if (request->old_hash != NULL)
+    {
+      g_autofree gchar *old_hash = NULL;
+
+      old_hash = compute_old_unit_hash (contents,
+                                        len,
+                                        (const gchar * const *)request->argv,
+                                        (const gchar * const *)request->old_deps);
+
+      if (g_strcmp0 (old_hash, request->old_hash) == 0)
+        {
+          EGG_COUNTER_INC (skipped_units);
+          g_task_return_pointer (task, NULL, NULL);
+          return;
+        }
+    }
+
+  state.workpath = request->workpath;
+  state.cancellable = cancellable;
+  state.usrs = g_hash_table_new (g_str_hash, g_str_equal);
+  state.usr_strs = g_ptr_array_new_with_free_func (g_free);
+  state.files = g_hash_table_new (NULL, NULL);
+  state.file_strs = g_ptr_array_new_with_free_func (g_free);
+  state.occurrences = g_array_new (FALSE, FALSE, sizeof (IndexOccurrence));
+  state.deps = g_hash_table_new (g_str_hash, g_str_equal);
+  state.dep_strs = g_ptr_array_new_with_free_func (g_free);
+  state.dep_mtimes = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  /*
+   * A CXIndex must not be used from multiple threads at once, and we have
+   * several units in flight, so each of them gets its own.
+   */
+  index = clang_createIndex (0, 0);
+  clang_CXIndex_setGlobalOptions (index, CXGlobalOpt_ThreadBackgroundPriorityForAll);
+
+  action = clang_IndexAction_create (index);
+  code = clang_indexSourceFile (action,
+                                &state,
+                                &callbacks,
+                                sizeof callbacks,
+                                CXIndexOpt_SuppressRedundantRefs | CXIndexOpt_SuppressWarnings,
+                                request->path,
+                                (const gchar * const *)request->argv,
+                                g_strv_length (request->argv),
+                                NULL,
+                                0,
+                                NULL,
+                                CXTranslationUnit_None);
+  clang_IndexAction_dispose (action);
+  clang_disposeIndex (index);
+
+  if (g_cancellable_is_cancelled (cancellable))
+    g_task_return_new_error (task,
+                             G_IO_ERROR,
+                             G_IO_ERROR_CANCELLED,
+                             "The operation was cancelled");
+  else if (code != 0)
+    g_task_return_new_error (task,
+                             G_IO_ERROR,
+                             G_IO_ERROR_FAILED,
+                             "Failed to index %s",
+                             request->path);
+  else
+    {
+      g_ptr_array_add (state.dep_strs, NULL);
+      hash = compute_unit_hash (contents,
+                                len,
+                                (const gchar * const *)request->argv,
+                                (const gchar * const *)state.dep_strs->pdata,
+                                (const gint64 *)state.dep_mtimes->data);
+
+      ret = index_state_to_variant (&state, request->path, hash);
+      g_task_return_pointer (task, ret, (GDestroyNotify)g_variant_unref);
+      EGG_COUNTER_INC (indexed_units);
+    }
+
+  g_hash_table_unref (state.usrs);
+  g_ptr_array_unref (state.usr_strs);
+  g_hash_table_unref (state.files);
+  g_ptr_array_unref (state.file_strs);
+  g_array_unref (state.occurrences);
+  g_hash_table_unref (state.deps);
+  g_ptr_array_unref (state.dep_strs);
+  g_array_unref (state.dep_mtimes);
+}
+
+static void
+ide_clang_indexer_save_worker (GTask        *task,
+                               gpointer      source_object,
+                               gpointer      task_data,
+                               GCancellable *cancellable)
+{
+  IdeClangIndexer *self = source_object;
+  GPtrArray *units = task_data;
+  g_autoptr(GVariant) variant = NULL;
+  g_autofree gchar *dir = NULL;
+  GVariantBuilder builder;
+  GError *error = NULL;
+  guint i;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+  g_assert (units != NULL);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" UNIT_VARIANT_TYPE));
+  for (i = 0; i < units->len; i++)
+    g_variant_builder_add_value (&builder, g_ptr_array_index (units, i));
+
+  variant = g_variant_ref_sink (g_variant_new ("(u@a" UNIT_VARIANT_TYPE ")",
+                                               INDEX_FORMAT_VERSION,
+                                               g_variant_builder_end (&builder)));
+
+  dir = g_path_get_dirname (self->path);
+  if (!g_file_test (dir, G_FILE_TEST_IS_DIR))
+    g_mkdir_with_parents (dir, 0750);
+
+  if (!g_file_set_contents (self->path,
+                            g_variant_get_data (variant),
+                            g_variant_get_size (variant),
+                            &error))
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+ide_clang_indexer_save_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+
+  g_assert (IDE_IS_CLANG_INDEXER (object));
+  g_assert (G_IS_TASK (result));
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    g_warning ("Failed to save clang index: %s", error->message);
+}
+
+static gboolean
+ide_clang_indexer_save_timeout (gpointer data)
+{
+  IdeClangIndexer *self = data;
+  g_autoptr(GTask) task = NULL;
+  GHashTableIter iter;
+  GPtrArray *units;
+  gpointer value;
+
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+
+  self->save_timeout = 0;
+
+  units = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+
+  g_hash_table_iter_init (&iter, self->units);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    g_ptr_array_add (units, g_variant_ref (value));
+
+  task = g_task_new (self, NULL, ide_clang_indexer_save_cb, NULL);
+  g_task_set_task_data (task, units, (GDestroyNotify)g_ptr_array_unref);
+  ide_thread_pool_push_task_with_priority (IDE_THREAD_POOL_INDEXER,
+                                           IDE_THREAD_POOL_PRIORITY_BACKGROUND,
+                                           task,
+                                           ide_clang_indexer_save_worker);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ide_clang_indexer_queue_save (IdeClangIndexer *self)
+{
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+
+  if (self->save_timeout == 0)
+    self->save_timeout = g_timeout_add_seconds (SAVE_DELAY_SECONDS,
+                                                ide_clang_indexer_save_timeout,
+                                                self);
+}
+
+static void ide_clang_indexer_pump (IdeClangIndexer *self);
+
+static void
+ide_clang_indexer_index_cb (GObject      *object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  IdeClangIndexer *self = (IdeClangIndexer *)object;
+  g_autoptr(GError) error = NULL;
+  IndexRequest *request;
+  GVariant *unit;
+
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+  g_assert (G_IS_TASK (result));
+
+  self->in_flight--;
+
+  request = g_task_get_task_data (G_TASK (result));
+  unit = g_task_propagate_pointer (G_TASK (result), &error);
+
+  if (unit != NULL)
+    {
+      g_hash_table_insert (self->units, g_strdup (request->path), unit);
+      ide_clang_indexer_queue_save (self);
+    }
+  else if (error != NULL &&
+           !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
+           !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+    g_debug ("%s", error->message);
+
+  ide_clang_indexer_pump (self);
+}
+
+static void
+ide_clang_indexer_get_build_flags_cb (GObject      *object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data)
+{
+  IdeBuildSystem *build_system = (IdeBuildSystem *)object;
+  g_autoptr(GTask) task = user_data;
+  g_auto(GStrv) argv = NULL;
+  IndexRequest *request;
+  GPtrArray *built_argv;
+  const gchar *llvm_flags;
+  guint i;
+
+  g_assert (IDE_IS_BUILD_SYSTEM (build_system));
+  g_assert (G_IS_TASK (task));
+
+  request = g_task_get_task_data (task);
+  argv = ide_build_system_get_build_flags_finish (build_system, result, NULL);
+
+  /*
+   * If the build system does not know how to build the file, it is not a
+   * compilation unit of the project and there is nothing to index.
+   */
+  if (argv == NULL || argv [0] == NULL)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_NOT_SUPPORTED,
+                               "%s is not known to the build system",
+                               request->path);
+      return;
+    }
+
+  built_argv = g_ptr_array_new ();
+  if (NULL != (llvm_flags = _ide_clang_discover_llvm_flags ()))
+    g_ptr_array_add (built_argv, g_strdup (llvm_flags));
+  for (i = 0; argv [i] != NULL; i++)
+    g_ptr_array_add (built_argv, g_strdup (argv [i]));
+  g_ptr_array_add (built_argv, NULL);
+
+  request->argv = (gchar **)g_ptr_array_free (built_argv, FALSE);
+
+  ide_thread_pool_push_task_with_priority (IDE_THREAD_POOL_COMPILER,
+                                           IDE_THREAD_POOL_PRIORITY_BACKGROUND,
+                                           task,
+                                           ide_clang_indexer_index_worker);
+}
+
+static void
+ide_clang_indexer_pump (IdeClangIndexer *self)
+{
+  IdeBuildSystem *build_system;
+  IdeContext *context;
+  GFile *workdir;
+  gchar *path;
+
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+
+  if (!self->loaded || self->stopped)
+    return;
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  build_system = ide_context_get_build_system (context);
+  workdir = ide_vcs_get_working_directory (ide_context_get_vcs (context));
+
+  /*
+   * Only a few units are indexed at a time so that we leave the compiler
+   * pool available for the translation units of the buffers being edited.
+   */
+  while (self->in_flight < MAX_IN_FLIGHT &&
+         NULL != (path = g_queue_pop_head (&self->queue)))
+    {
+      g_autoptr(GTask) task = NULL;
+      g_autoptr(IdeFile) file = NULL;
+      IndexRequest *request;
+      GVariant *unit;
+
+      g_hash_table_remove (self->queued, path);
+
+      request = g_slice_new0 (IndexRequest);
+      request->path = path;
+      request->workpath = g_file_get_path (workdir);
+
+      if (NULL != (unit = g_hash_table_lookup (self->units, path)))
+        {
+          g_variant_get_child (unit, 1, "s", &request->old_hash);
+          g_variant_get_child (unit, 5, "^as", &request->old_deps);
+        }
+
+      task = g_task_new (self, self->cancellable, ide_clang_indexer_index_cb, NULL);
+      g_task_set_priority (task, G_PRIORITY_LOW);
+      g_task_set_task_data (task, request, index_request_free);
+
+      file = ide_file_new_for_path (context, path);
+
+      self->in_flight++;
+
+      ide_build_system_get_build_flags_async (build_system,
+                                              file,
+                                              self->cancellable,
+                                              ide_clang_indexer_get_build_flags_cb,
+                                              g_object_ref (task));
+    }
+}
+
+/**
+ * ide_clang_indexer_queue_file:
+ * @self: An #IdeClangIndexer
+ * @file: A #GFile
+ *
+ * Queues @file to be indexed if it is a compilation unit. If the contents
+ * of the file have not changed since it was last indexed, no work is
+ * performed.
+ */
+void
+ide_clang_indexer_queue_file (IdeClangIndexer *self,
+                              GFile           *file)
+{
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *name = NULL;
+
+  g_return_if_fail (IDE_IS_CLANG_INDEXER (self));
+  g_return_if_fail (G_IS_FILE (file));
+
+  if (self->stopped ||
+      NULL == (path = g_file_get_path (file)) ||
+      NULL == (name = g_file_get_basename (file)) ||
+      !is_compilation_unit (name) ||
+      g_hash_table_contains (self->queued, path))
+    return;
+
+  g_hash_table_add (self->queued, path);
+  g_queue_push_tail (&self->queue, g_steal_pointer (&path));
+
+  ide_clang_indexer_pump (self);
+}
+
+static void
+collect_sources (GFile        *directory,
+                 GPtrArray    *files,
+                 GCancellable *cancellable)
+{
+  g_autoptr(GFileEnumerator) enumerator = NULL;
+  gpointer infoptr;
+
+  g_assert (G_IS_FILE (directory));
+  g_assert (files != NULL);
+
+  enumerator = g_file_enumerate_children (directory,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME","
+                                          G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          cancellable,
+                                          NULL);
+
+  if (enumerator == NULL)
+    return;
+
+  while (NULL != (infoptr = g_file_enumerator_next_file (enumerator, cancellable, NULL)))
+    {
+      g_autoptr(GFileInfo) info = infoptr;
+      const gchar *name = g_file_info_get_name (info);
+      GFileType file_type = g_file_info_get_file_type (info);
+
+      if (name [0] == '.')
+        continue;
+
+      if (file_type == G_FILE_TYPE_DIRECTORY)
+        {
+          g_autoptr(GFile) child = g_file_get_child (directory, name);
+
+          collect_sources (child, files, cancellable);
+        }
+      else if (file_type == G_FILE_TYPE_REGULAR && is_compilation_unit (name))
+        {
+          g_ptr_array_add (files, g_file_get_child (directory, name));
+        }
+    }
+}
+
+static void
+ide_clang_indexer_scan_worker (GTask        *task,
+                               gpointer      source_object,
+                               gpointer      task_data,
+                               GCancellable *cancellable)
+{
+  GFile *workdir = task_data;
+  GPtrArray *files;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_CLANG_INDEXER (source_object));
+  g_assert (G_IS_FILE (workdir));
+
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+  collect_sources (workdir, files, cancellable);
+
+  g_task_return_pointer (task, files, (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void
+ide_clang_indexer_scan_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  IdeClangIndexer *self = (IdeClangIndexer *)object;
+  g_autoptr(GPtrArray) files = NULL;
+  g_autoptr(GHashTable) found = NULL;
+  GHashTableIter iter;
+  IdeContext *context;
+  IdeVcs *vcs;
+  gpointer key;
+  guint i;
+
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+  g_assert (G_IS_TASK (result));
+
+  if (!(files = g_task_propagate_pointer (G_TASK (result), NULL)))
+    return;
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  vcs = ide_context_get_vcs (context);
+  found = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < files->len; i++)
+    {
+      GFile *file = g_ptr_array_index (files, i);
+
+      if (ide_vcs_is_ignored (vcs, file, NULL))
+        continue;
+
+      g_hash_table_add (found, g_file_get_path (file));
+      ide_clang_indexer_queue_file (self, file);
+    }
+
+  /* Drop units that no longer exist in the project. */
+  g_hash_table_iter_init (&iter, self->units);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (!g_hash_table_contains (found, key))
+        {
+          g_hash_table_iter_remove (&iter);
+          ide_clang_indexer_queue_save (self);
+        }
+    }
+}
+
+static gboolean
+ide_clang_indexer_start_timeout (gpointer data)
+{
+  IdeClangIndexer *self = data;
+  g_autoptr(GTask) task = NULL;
+  IdeContext *context;
+  GFile *workdir;
+
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+
+  self->start_timeout = 0;
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  workdir = ide_vcs_get_working_directory (ide_context_get_vcs (context));
+
+  task = g_task_new (self, self->cancellable, ide_clang_indexer_scan_cb, NULL);
+  g_task_set_task_data (task, g_object_ref (workdir), g_object_unref);
+  ide_thread_pool_push_task_with_priority (IDE_THREAD_POOL_INDEXER,
+                                           IDE_THREAD_POOL_PRIORITY_BACKGROUND,
+                                           task,
+                                           ide_clang_indexer_scan_worker);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ide_clang_indexer_load_worker (GTask        *task,
+                               gpointer      source_object,
+                               gpointer      task_data,
+                               GCancellable *cancellable)
+{
+  IdeClangIndexer *self = source_object;
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  guint32 version = 0;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+
+  if (!(mapped = g_mapped_file_new (self->path, FALSE, NULL)))
+    {
+      g_task_return_pointer (task, NULL, NULL);
+      return;
+    }
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (INDEX_VARIANT_TYPE),
+                                                          bytes,
+                                                          FALSE));
+
+  g_variant_get_child (variant, 0, "u", &version);
+
+  if (version != INDEX_FORMAT_VERSION)
+    {
+      g_task_return_pointer (task, NULL, NULL);
+      return;
+    }
+
+  g_task_return_pointer (task,
+                         g_variant_get_child_value (variant, 1),
+                         (GDestroyNotify)g_variant_unref);
+}
+
+static void
+ide_clang_indexer_load_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  IdeClangIndexer *self = (IdeClangIndexer *)object;
+  g_autoptr(GVariant) units = NULL;
+
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+  g_assert (G_IS_TASK (result));
+
+  units = g_task_propagate_pointer (G_TASK (result), NULL);
+
+  if (self->stopped)
+    return;
+
+  if (units != NULL)
+    {
+      GVariantIter iter;
+      GVariant *unit;
+
+      g_variant_iter_init (&iter, units);
+
+      while ((unit = g_variant_iter_next_value (&iter)))
+        {
+          const gchar *path = NULL;
+
+          g_variant_get_child (unit, 0, "&s", &path);
+          g_hash_table_insert (self->units, g_strdup (path), unit);
+        }
+    }
+
+  self->loaded = TRUE;
+
+  self->start_timeout = g_timeout_add_seconds (INDEX_DELAY_SECONDS,
+                                               ide_clang_indexer_start_timeout,
+                                               self);
+
+  ide_clang_indexer_pump (self);
+}
+
+static gboolean
+unit_includes (GVariant    *unit,
+               const gchar *path)
+{
+  g_autoptr(GVariant) deps = NULL;
+  GVariantIter iter;
+  const gchar *dep;
+
+  deps = g_variant_get_child_value (unit, 5);
+  g_variant_iter_init (&iter, deps);
+
+  while (g_variant_iter_next (&iter, "&s", &dep))
+    {
+      if (g_str_equal (dep, path))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+ide_clang_indexer_buffer_saved (IdeClangIndexer  *self,
+                                IdeBuffer        *buffer,
+                                IdeBufferManager *buffer_manager)
+{
+  g_autoptr(GPtrArray) includers = NULL;
+  g_autofree gchar *path = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  IdeFile *file;
+  guint i;
+
+  g_assert (IDE_IS_CLANG_INDEXER (self));
+  g_assert (IDE_IS_BUFFER (buffer));
+
+  if (!(file = ide_buffer_get_file (buffer)))
+    return;
+
+  ide_clang_indexer_queue_file (self, ide_file_get_file (file));
+
+  /*
+   * The units that include the file need to be indexed again too, since
+   * their hash covers it. That is what keeps cross-references found in a
+   * header up to date.
+   */
+  if (!(path = g_file_get_path (ide_file_get_file (file))))
+    return;
+
+  includers = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_hash_table_iter_init (&iter, self->units);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (unit_includes (value, path))
+        g_ptr_array_add (includers, g_file_new_for_path (key));
+    }
+
+  for (i = 0; i < includers->len; i++)
+    ide_clang_indexer_queue_file (self, g_ptr_array_index (includers, i));
+}
+
+void
+ide_clang_indexer_start (IdeClangIndexer *self)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autofree gchar *name = NULL;
+  IdeBufferManager *buffer_manager;
+  IdeContext *context;
+  IdeProject *project;
+
+  g_return_if_fail (IDE_IS_CLANG_INDEXER (self));
+  g_return_if_fail (self->path == NULL);
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  project = ide_context_get_project (context);
+  buffer_manager = ide_context_get_buffer_manager (context);
+
+  name = g_strconcat (ide_project_get_id (project), ".index", NULL);
+  self->path = g_build_filename (g_get_user_cache_dir (),
+                                 ide_get_program_name (),
+                                 "clang",
+                                 name,
+                                 NULL);
+
+  g_signal_connect_object (buffer_manager,
+                           "buffer-saved",
+                           G_CALLBACK (ide_clang_indexer_buffer_saved),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  task = g_task_new (self, self->cancellable, ide_clang_indexer_load_cb, NULL);
+  ide_thread_pool_push_task_with_priority (IDE_THREAD_POOL_INDEXER,
+                                           IDE_THREAD_POOL_PRIORITY_BACKGROUND,
+                                           task,
+                                           ide_clang_indexer_load_worker);
+}
+
+void
+ide_clang_indexer_stop (IdeClangIndexer *self)
+{
+  gchar *path;
+
+  g_return_if_fail (IDE_IS_CLANG_INDEXER (self));
+
+  self->stopped = TRUE;
+
+  g_cancellable_cancel (self->cancellable);
+  ide_clear_source (&self->start_timeout);
+
+  while ((path = g_queue_pop_head (&self->queue)))
+    {
+      g_hash_table_remove (self->queued, path);
+      g_free (path);
+    }
+
+  /* Flush any pending changes to disk. */
+  if (self->save_timeout != 0)
+    {
+      ide_clear_source (&self->save_timeout);
+      ide_clang_indexer_save_timeout (self);
+    }
+}
+
+static gboolean
+find_usr (GVariant    *usrs,
+          const gchar *usr,
+          guint       *index)
+{
+  gsize lo = 0;
+  gsize hi = g_variant_n_children (usrs);
+
+  while (lo < hi)
+    {
+      gsize mid = (lo + hi) / 2;
+      const gchar *str = NULL;
+      gint cmp;
+
+      g_variant_get_child (usrs, mid, "&s", &str);
+      cmp = strcmp (usr, str);
+
+      if (cmp == 0)
+        {
+          *index = mid;
+          return TRUE;
+        }
+      else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return FALSE;
+}
+
+/**
+ * ide_clang_indexer_lookup:
+ * @self: An #IdeClangIndexer
+ * @usr: the USR of the entity, as returned from clang_getCursorUSR()
+ * @kinds: the kinds of occurrences to locate
+ *
+ * Locates the occurrences of @usr throughout the project, without
+ * needing a translation unit for the files that contain them.
+ *
+ * Returns: (transfer container) (element-type Ide.SourceLocation): An array
+ *   of #IdeSourceLocation.
+ */
+GPtrArray *
+ide_clang_indexer_lookup (IdeClangIndexer   *self,
+                          const gchar       *usr,
+                          IdeClangIndexKind  kinds)
+{
+  g_autoptr(GHashTable) seen = NULL;
+  GHashTableIter iter;
+  IdeContext *context;
+  GPtrArray *ret;
+  gpointer value;
+
+  g_return_val_if_fail (IDE_IS_CLANG_INDEXER (self), NULL);
+  g_return_val_if_fail (usr != NULL, NULL);
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  ret = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_source_location_unref);
+  seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  g_hash_table_iter_init (&iter, self->units);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      GVariant *unit = value;
+      g_autoptr(GVariant) files = g_variant_get_child_value (unit, 2);
+      g_autoptr(GVariant) usrs = g_variant_get_child_value (unit, 3);
+      g_autoptr(GVariant) occurrences = g_variant_get_child_value (unit, 4);
+      const IndexOccurrence *occ;
+      gsize n_files;
+      gsize n_occ = 0;
+      gsize lo = 0;
+      gsize hi;
+      guint usr_index;
+
+      if (!find_usr (usrs, usr, &usr_index))
+        continue;
+
+      n_files = g_variant_n_children (files);
+      occ = g_variant_get_fixed_array (occurrences, &n_occ, sizeof *occ);
+      hi = n_occ;
+
+      while (lo < hi)
+        {
+          gsize mid = (lo + hi) / 2;
+
+          if (occ [mid].usr < usr_index)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+      for (; lo < n_occ && occ [lo].usr == usr_index; lo++)
+        {
+          g_autoptr(IdeFile) file = NULL;
+          const gchar *path = NULL;
+          gchar *key;
+
+          if ((occ [lo].kind & kinds) == 0 || occ [lo].file >= n_files)
+            continue;
+
+          g_variant_get_child (files, occ [lo].file, "&s", &path);
+
+          key = g_strdup_printf ("%s:%u:%u", path, occ [lo].line, occ [lo].column);
+
+          if (!g_hash_table_add (seen, key))
+            continue;
+
+          file = ide_file_new_for_path (context, path);
+          g_ptr_array_add (ret, ide_source_location_new (file, occ [lo].line, occ [lo].column, 0));
+        }
+    }
+
+  return ret;
+}
+
+IdeClangIndexer *
+ide_clang_indexer_new (IdeContext *context)
+{
+  g_return_val_if_fail (IDE_IS_CONTEXT (context), NULL);
+
+  return g_object_new (IDE_TYPE_CLANG_INDEXER,
+                       "context", context,
+                       NULL);
+}
+
+static void
+ide_clang_indexer_finalize (GObject *object)
+{
+  IdeClangIndexer *self = (IdeClangIndexer *)object;
+
+  ide_clear_source (&self->start_timeout);
+  ide_clear_source (&self->save_timeout);
+
+  g_queue_foreach (&self->queue, (GFunc)g_free, NULL);
+  g_queue_clear (&self->queue);
+
+  g_clear_pointer (&self->queued, g_hash_table_unref);
+  g_clear_pointer (&self->units, g_hash_table_unref);
+  g_clear_pointer (&self->path, g_free);
+  g_clear_object (&self->cancellable);
+
+  G_OBJECT_CLASS (ide_clang_indexer_parent_class)->finalize (object);
+}
+
+static void
+ide_clang_indexer_class_init (IdeClangIndexerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = ide_clang_indexer_finalize;
+}
+
+static void
+ide_clang_indexer_init (IdeClangIndexer *self)
+{
+  self->cancellable = g_cancellable_new ();
+  self->units = g_hash_table_new_full (g_str_hash,
+                                       g_str_equal,
+                                       g_free,
+                                       (GDestroyNotify)g_variant_unref);
+  self->queued = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&self->queue);
+}
@@ -0,0 +1,48 @@
+/* ide-clang-indexer.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_CLANG_INDEXER_H
+#define IDE_CLANG_INDEXER_H
+
+#include <ide.h>
+
+G_BEGIN_DECLS
+
+#define IDE_TYPE_CLANG_INDEXER (ide_clang_indexer_get_type())
+
+G_DECLARE_FINAL_TYPE (IdeClangIndexer, ide_clang_indexer, IDE, CLANG_INDEXER, IdeObject)
+
+typedef enum
+{
+  IDE_CLANG_INDEX_DEFINITION  = 1 << 0,
+  IDE_CLANG_INDEX_DECLARATION = 1 << 1,
+  IDE_CLANG_INDEX_REFERENCE   = 1 << 2,
+} IdeClangIndexKind;
+
+IdeClangIndexer *ide_clang_indexer_new          (IdeContext        *context);
+void             ide_clang_indexer_start        (IdeClangIndexer   *self);
+void             ide_clang_indexer_stop         (IdeClangIndexer   *self);
+void             ide_clang_indexer_queue_file   (IdeClangIndexer   *self,
+                                                 GFile             *file);
+GPtrArray       *ide_clang_indexer_lookup       (IdeClangIndexer   *self,
+                                                 const gchar       *usr,
+                                                 IdeClangIndexKind  kinds);
+
+G_END_DECLS
+
+#endif /* IDE_CLANG_INDEXER_H */
@@ -24,22 +24,40 @@
 
 #include "ide-clang-service.h"
 #include "ide-clang-symbol-node.h"
+#include "ide-clang-symbol-tree.h"
 #include "ide-clang-translation-unit.h"
 
 G_BEGIN_DECLS
 
+typedef struct
+{
+  CXCursor  cursor;
+  GArray   *children;
+} IdeClangSymbolEntry;
+
 IdeClangTranslationUnit *_ide_clang_translation_unit_new     (IdeContext         *context,
                                                               CXTranslationUnit   tu,
                                                               GFile              *file,
                                                               IdeHighlightIndex  *index,
                                                               gint64              serial);
+gsize                    _ide_clang_translation_unit_get_memory_usage
+                                                             (IdeClangTranslationUnit *self);
+void                     _ide_clang_translation_unit_prepare (IdeClangTranslationUnit *self,
+                                                              IdeFile                 *file);
 void                     _ide_clang_dispose_string           (CXString           *str);
+const gchar             *_ide_clang_discover_llvm_flags      (void);
 IdeSymbolNode           *_ide_clang_symbol_node_new          (IdeContext         *context,
                                                               CXCursor            cursor);
 CXCursor                 _ide_clang_symbol_node_get_cursor   (IdeClangSymbolNode *self);
 GArray                  *_ide_clang_symbol_node_get_children (IdeClangSymbolNode *self);
 void                     _ide_clang_symbol_node_set_children (IdeClangSymbolNode *self,
                                                               GArray             *children);
+GArray                  *_ide_clang_symbol_tree_build_children
+                                                             (CXCursor            parent,
+                                                              const gchar        *path,
+                                                              gboolean            recursive);
+void                     _ide_clang_symbol_tree_set_children (IdeClangSymbolTree *self,
+                                                              GArray             *children);
 
 G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (CXString, _ide_clang_dispose_string)
 
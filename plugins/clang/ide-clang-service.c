@@ -23,20 +23,43 @@
 #include <egg-task-cache.h>
 #include <glib/gi18n.h>
 #include <ide.h>
+#include <string.h>
 
 #include "ide-clang-highlighter.h"
+#include "ide-clang-indexer.h"
 #include "ide-clang-private.h"
 #include "ide-clang-service.h"
+#include "ide-internal.h"
 
-#define DEFAULT_EVICTION_MSEC (60 * 1000)
+#define DEFAULT_EVICTION_MSEC    (5 * 60 * 1000)
+#define DEFAULT_UNITS_MAX_COST   (G_GSIZE_CONSTANT (1024) * 1024 * 1024)
+#define SPECULATE_DELAY_MSEC     1000
+#define SPECULATE_MAX_CANDIDATES 6
+#define RECENTLY_CLOSED_MAX      4
 
 struct _IdeClangService
 {
-  IdeObject     parent_instance;
+  IdeObject        parent_instance;
 
-  CXIndex       index;
-  GCancellable *cancellable;
-  EggTaskCache *units_cache;
+  CXIndex          index;
+  GCancellable    *cancellable;
+  EggTaskCache    *units_cache;
+  IdeFile         *pinned_file;
+  IdeClangIndexer *indexer;
+
+  /*
+   * Speculative parsing of the files the user is likely to visit next.
+   * Only a single speculative parse is in flight at a time, and it uses
+   * speculate_cancellable so that it can be abandoned when real work
+   * arrives for another file. speculate_task is the parse itself, so
+   * that it can be promoted when a real request joins it.
+   */
+  GCancellable    *speculate_cancellable;
+  IdeFile         *speculating;
+  GTask           *speculate_task;
+  GQueue           speculate_queue;
+  GQueue           recently_closed;
+  guint            speculate_source;
 };
 
 typedef struct
@@ -48,6 +71,8 @@ typedef struct
   GPtrArray  *unsaved_files;
   gint64      sequence;
   guint       options;
+  guint       priority;
+  guint       speculative : 1;
 } ParseRequest;
 
 typedef struct
@@ -66,6 +91,18 @@ EGG_DEFINE_COUNTER (ParseAttempts,
                     "Clang",
                     "Total Parse Attempts",
                     "Total number of attempts to create a translation unit.")
+EGG_DEFINE_HISTOGRAM (ParseTime,
+                      "Clang",
+                      "Parse",
+                      "Time spent in clang_parseTranslationUnit2(), in usec.")
+EGG_DEFINE_COUNTER (SpeculativeParses,
+                    "Clang",
+                    "Speculative Parses",
+                    "Number of translation units parsed ahead of being opened.")
+EGG_DEFINE_COUNTER (SpeculativeCancels,
+                    "Clang",
+                    "Speculative Cancels",
+                    "Number of speculative parses abandoned for real work.")
 
 static void
 parse_request_free (gpointer data)
@@ -190,8 +227,8 @@ clear_unsaved_file (gpointer data)
   g_free ((gchar *)uf->Filename);
 }
 
-static const gchar *
-discover_llvm_flags (void)
+const gchar *
+_ide_clang_discover_llvm_flags (void)
 {
   static const gchar *llvm_flags;
   g_autoptr(GSubprocess) subprocess = NULL;
@@ -263,6 +300,7 @@ ide_clang_service_parse_worker (GTask        *task,
   const gchar *llvm_flags;
   enum CXErrorCode code;
   GArray *ar = NULL;
+  gint64 begin_time;
   gsize i;
 
   g_assert (G_IS_TASK (task));
@@ -270,6 +308,28 @@ ide_clang_service_parse_worker (GTask        *task,
   g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
   g_assert (IDE_IS_FILE (request->file));
 
+  /*
+   * Speculative parses may have sat in the queue while real work arrived.
+   * Once clang is parsing we can no longer interrupt it.
+   */
+  if (request->speculative && g_task_return_error_if_cancelled (task))
+    return;
+
+  /*
+   * Speculative candidates are guessed from the names of the files next to
+   * the focused one, so check that they exist here rather than blocking the
+   * main loop on it when they are queued.
+   */
+  if (request->speculative && !g_file_query_exists (ide_file_get_file (request->file), NULL))
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_NOT_FOUND,
+                               _("%s does not exist"),
+                               request->source_filename);
+      return;
+    }
+
   file_copy = g_object_ref (request->file);
 
   ar = g_array_new (FALSE, FALSE, sizeof (struct CXUnsavedFile));
@@ -297,13 +357,14 @@ ide_clang_service_parse_worker (GTask        *task,
    * included. Add a guard NULL just for extra safety.
    */
   built_argv = g_ptr_array_new ();
-  if (NULL != (llvm_flags = discover_llvm_flags ()))
+  if (NULL != (llvm_flags = _ide_clang_discover_llvm_flags ()))
     g_ptr_array_add (built_argv, (gchar *)llvm_flags);
   for (i = 0; request->command_line_args[i] != NULL; i++)
     g_ptr_array_add (built_argv, request->command_line_args[i]);
   g_ptr_array_add (built_argv, NULL);
 
   EGG_COUNTER_INC (ParseAttempts);
+  begin_time = g_get_monotonic_time ();
   code = clang_parseTranslationUnit2 (request->index,
                                       request->source_filename,
                                       (const gchar * const *)built_argv->pdata,
@@ -312,6 +373,8 @@ ide_clang_service_parse_worker (GTask        *task,
                                       ar->len,
                                       request->options,
                                       &tu);
+  EGG_HISTOGRAM_RECORD_SINCE (ParseTime, begin_time);
+  IDE_MARK_END (begin_time, "Clang:Parse");
 
   switch (code)
     {
@@ -356,6 +419,16 @@ ide_clang_service_parse_worker (GTask        *task,
   gfile = ide_file_get_file (request->file);
   ret = _ide_clang_translation_unit_new (context, tu, gfile, index, request->sequence);
 
+  /*
+   * Walk the symbols of the main file while this thread still owns the
+   * translation unit. Once it is returned, the main thread uses it and
+   * libclang does not allow concurrent access.
+   */
+  _ide_clang_translation_unit_prepare (ret, request->file);
+
+  /* Calculate the memory usage now so the cache does not block the main loop. */
+  _ide_clang_translation_unit_get_memory_usage (ret);
+
   g_task_return_pointer (task, g_object_ref (ret), g_object_unref);
 
 cleanup:
@@ -390,6 +463,10 @@ ide_clang_service__get_build_flags_cb (GObject      *object,
 
   request->command_line_args = argv;
 
+  /* Don't parse a speculative request with bogus flags if it was abandoned. */
+  if (request->speculative && g_task_return_error_if_cancelled (task))
+    return;
+
 #ifdef IDE_ENABLE_TRACE
   {
     gchar *cflags;
@@ -400,9 +477,10 @@ ide_clang_service__get_build_flags_cb (GObject      *object,
   }
 #endif
 
-  ide_thread_pool_push_task (IDE_THREAD_POOL_COMPILER,
-                             task,
-                             ide_clang_service_parse_worker);
+  ide_thread_pool_push_task_with_priority (IDE_THREAD_POOL_COMPILER,
+                                           request->priority,
+                                           task,
+                                           ide_clang_service_parse_worker);
 }
 
 static void
@@ -424,6 +502,23 @@ ide_clang_service_unit_completed_cb (GObject      *object,
     g_task_return_pointer (task, ret, g_object_unref);
 }
 
+/*
+ * The focused buffer is what the user is typing in, so it should never
+ * wait behind parses of other open files, nor those behind speculation.
+ */
+static IdeThreadPoolPriority
+ide_clang_service_get_priority (IdeClangService *self,
+                                IdeFile         *file)
+{
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_FILE (file));
+
+  if (self->pinned_file != NULL && ide_file_equal (self->pinned_file, file))
+    return IDE_THREAD_POOL_PRIORITY_INTERACTIVE;
+
+  return IDE_THREAD_POOL_PRIORITY_VISIBLE;
+}
+
 static void
 ide_clang_service_get_translation_unit_worker (EggTaskCache  *cache,
                                                gconstpointer  key,
@@ -479,6 +574,13 @@ ide_clang_service_get_translation_unit_worker (EggTaskCache  *cache,
    */
   request->options = (clang_defaultEditingTranslationUnitOptions () |
                       CXTranslationUnit_DetailedPreprocessingRecord);
+  request->speculative = (self->speculate_cancellable != NULL &&
+                          g_task_get_cancellable (task) == self->speculate_cancellable);
+
+  if (request->speculative)
+    request->priority = IDE_THREAD_POOL_PRIORITY_BACKGROUND;
+  else
+    request->priority = ide_clang_service_get_priority (self, request->file);
 
   real_task = g_task_new (self,
                           g_task_get_cancellable (task),
@@ -486,6 +588,9 @@ ide_clang_service_get_translation_unit_worker (EggTaskCache  *cache,
                           g_object_ref (task));
   g_task_set_task_data (real_task, request, parse_request_free);
 
+  if (request->speculative)
+    g_set_object (&self->speculate_task, real_task);
+
   /*
    * Request the build flags necessary to build this module from the build system.
    */
@@ -515,6 +620,52 @@ ide_clang_service_get_translation_unit_cb (GObject      *object,
     g_task_return_pointer (task, g_steal_pointer (&ret), g_object_unref);
 }
 
+static void
+ide_clang_service_cancel_speculation (IdeClangService *self,
+                                      IdeFile         *file)
+{
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_FILE (file));
+
+  if (self->speculating == NULL)
+    return;
+
+  /*
+   * If the real request is for the file we are already speculating on,
+   * it will simply join the in-flight parse. Detach that parse from our
+   * cancellable so that cancelling the next speculation cannot fail it.
+   * Otherwise, get out of the way of the real work.
+   */
+  if (!ide_file_equal (self->speculating, file))
+    {
+      IDE_TRACE_MSG ("Cancelling speculative parse for real work");
+      g_cancellable_cancel (self->speculate_cancellable);
+      EGG_COUNTER_INC (SpeculativeCancels);
+    }
+  else if (self->speculate_task != NULL)
+    {
+      ParseRequest *request = g_task_get_task_data (self->speculate_task);
+      IdeThreadPoolPriority priority = ide_clang_service_get_priority (self, file);
+
+      /*
+       * The user is now waiting on this parse, so it must not sit behind
+       * other background work. If it is still waiting on build flags, the
+       * new priority is used when it is pushed to the thread pool.
+       */
+      if (priority < request->priority)
+        {
+          IDE_TRACE_MSG ("Promoting speculative parse for real work");
+          request->priority = priority;
+          ide_thread_pool_raise_task_priority (IDE_THREAD_POOL_COMPILER,
+                                               self->speculate_task,
+                                               priority);
+        }
+    }
+
+  g_clear_object (&self->speculate_cancellable);
+  self->speculate_cancellable = g_cancellable_new ();
+}
+
 /**
  * ide_clang_service_get_translation_unit_async:
  *
@@ -556,6 +707,8 @@ ide_clang_service_get_translation_unit_async (IdeClangService     *self,
       return;
     }
 
+  ide_clang_service_cancel_speculation (self, file);
+
   if (min_serial == 0)
     {
       IdeContext *context;
@@ -604,15 +757,381 @@ ide_clang_service_get_translation_unit_finish (IdeClangService  *self,
   return g_task_propagate_pointer (task, error);
 }
 
+static gsize
+ide_clang_service_unit_cost (gconstpointer value,
+                             gpointer      user_data)
+{
+  IdeClangTranslationUnit *unit = (IdeClangTranslationUnit *)value;
+
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (unit));
+
+  return _ide_clang_translation_unit_get_memory_usage (unit);
+}
+
+static void
+ide_clang_service_unpin (IdeClangService *self)
+{
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+
+  if (self->pinned_file != NULL)
+    {
+      if (self->units_cache != NULL)
+        egg_task_cache_unpin (self->units_cache, self->pinned_file);
+      g_clear_object (&self->pinned_file);
+    }
+}
+
+static const gchar *source_suffixes[] = { "c", "cc", "cpp", "cxx", "m", NULL };
+static const gchar *header_suffixes[] = { "h", "hh", "hpp", "hxx", NULL };
+
+static void
+ide_clang_service_add_candidate (IdeClangService *self,
+                                 GFile           *file,
+                                 IdeFile         *focus)
+{
+  IdeContext *context;
+  GList *iter;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (G_IS_FILE (file));
+
+  if (self->speculate_queue.length >= SPECULATE_MAX_CANDIDATES)
+    return;
+
+  if (focus != NULL && g_file_equal (file, ide_file_get_file (focus)))
+    return;
+
+  for (iter = self->speculate_queue.head; iter; iter = iter->next)
+    {
+      if (g_file_equal (file, ide_file_get_file (iter->data)))
+        return;
+    }
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  g_queue_push_tail (&self->speculate_queue, ide_file_new (context, file));
+}
+
+/*
+ * Adds the source/header counterparts of @file, such as foo.h and
+ * foo-private.h for foo.c. Candidates that do not exist are skipped when
+ * the queue is drained so that we don't stat() them all up front.
+ */
+static void
+ide_clang_service_add_counterparts (IdeClangService *self,
+                                    IdeFile         *focus)
+{
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *stem = NULL;
+  const gchar *dot;
+  guint i;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_FILE (focus));
+
+  if (!(path = g_file_get_path (ide_file_get_file (focus))) ||
+      !(dot = strrchr (path, '.')) ||
+      strchr (dot, G_DIR_SEPARATOR) != NULL)
+    return;
+
+  stem = g_strndup (path, dot - path);
+
+  if (g_strv_contains (source_suffixes, dot + 1))
+    {
+      for (i = 0; header_suffixes [i]; i++)
+        {
+          g_autofree gchar *name = g_strdup_printf ("%s.%s", stem, header_suffixes [i]);
+          g_autoptr(GFile) file = g_file_new_for_path (name);
+
+          ide_clang_service_add_candidate (self, file, focus);
+        }
+
+      {
+        g_autofree gchar *name = g_strdup_printf ("%s-private.h", stem);
+        g_autoptr(GFile) file = g_file_new_for_path (name);
+
+        ide_clang_service_add_candidate (self, file, focus);
+      }
+    }
+  else if (g_strv_contains (header_suffixes, dot + 1))
+    {
+      if (g_str_has_suffix (stem, "-private"))
+        stem [strlen (stem) - strlen ("-private")] = '\0';
+
+      for (i = 0; source_suffixes [i]; i++)
+        {
+          g_autofree gchar *name = g_strdup_printf ("%s.%s", stem, source_suffixes [i]);
+          g_autoptr(GFile) file = g_file_new_for_path (name);
+
+          ide_clang_service_add_candidate (self, file, focus);
+        }
+    }
+}
+
+static gboolean
+ide_clang_service_has_headroom (IdeClangService *self)
+{
+  IdeClangTranslationUnit *focused = NULL;
+  gsize estimate = 0;
+  gsize max_cost;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+
+  if (0 == (max_cost = egg_task_cache_get_max_cost (self->units_cache)))
+    return TRUE;
+
+  /*
+   * We don't know how large the unit will be until it is parsed, but files
+   * near the focused one tend to pull in the same headers. Use its size as
+   * the estimate so that speculation never pushes out units in use.
+   */
+  if (self->pinned_file != NULL &&
+      NULL != (focused = egg_task_cache_peek (self->units_cache, self->pinned_file)))
+    estimate = _ide_clang_translation_unit_get_memory_usage (focused);
+
+  return egg_task_cache_get_cost (self->units_cache) + estimate <= max_cost;
+}
+
+static void ide_clang_service_queue_speculate (IdeClangService *self);
+
+static void
+ide_clang_service_speculate_cb (GObject      *object,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+  EggTaskCache *cache = (EggTaskCache *)object;
+  g_autoptr(IdeClangService) self = user_data;
+  g_autoptr(IdeClangTranslationUnit) unit = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (EGG_IS_TASK_CACHE (cache));
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+
+  if (!(unit = egg_task_cache_get_finish (cache, result, &error)))
+    g_debug ("Speculative parse failed: %s", error->message);
+
+  g_clear_object (&self->speculating);
+  g_clear_object (&self->speculate_task);
+
+  if (self->units_cache != NULL && self->speculate_queue.length > 0)
+    ide_clang_service_queue_speculate (self);
+}
+
+static gboolean
+ide_clang_service_speculate (gpointer user_data)
+{
+  IdeClangService *self = user_data;
+  IdeFile *file;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+
+  /* Wait until the compiler pool has drained before doing anything. */
+  if (!ide_thread_pool_is_idle (IDE_THREAD_POOL_COMPILER))
+    IDE_RETURN (G_SOURCE_CONTINUE);
+
+  self->speculate_source = 0;
+
+  if (self->speculating != NULL)
+    IDE_RETURN (G_SOURCE_REMOVE);
+
+  if (!ide_clang_service_has_headroom (self))
+    {
+      IDE_TRACE_MSG ("No room in the cache for speculative parses");
+      while (self->speculate_queue.length > 0)
+        g_object_unref (g_queue_pop_head (&self->speculate_queue));
+      IDE_RETURN (G_SOURCE_REMOVE);
+    }
+
+  while (NULL != (file = g_queue_pop_head (&self->speculate_queue)))
+    {
+      if (egg_task_cache_peek (self->units_cache, file) != NULL)
+        {
+          g_object_unref (file);
+          continue;
+        }
+
+      IDE_TRACE_MSG ("Speculatively parsing \"%s\"", ide_file_get_path (file));
+
+      EGG_COUNTER_INC (SpeculativeParses);
+
+      self->speculating = file;
+      egg_task_cache_get_async (self->units_cache,
+                                file,
+                                FALSE,
+                                self->speculate_cancellable,
+                                ide_clang_service_speculate_cb,
+                                g_object_ref (self));
+
+      break;
+    }
+
+  IDE_RETURN (G_SOURCE_REMOVE);
+}
+
+static void
+ide_clang_service_queue_speculate (IdeClangService *self)
+{
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+
+  if (self->speculate_source == 0)
+    self->speculate_source = g_timeout_add (SPECULATE_DELAY_MSEC,
+                                            ide_clang_service_speculate,
+                                            self);
+}
+
+static void
+ide_clang_service_clear_speculation (IdeClangService *self)
+{
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+
+  if (self->speculate_source != 0)
+    {
+      g_source_remove (self->speculate_source);
+      self->speculate_source = 0;
+    }
+
+  while (self->speculate_queue.length > 0)
+    g_object_unref (g_queue_pop_head (&self->speculate_queue));
+}
+
+/*
+ * Warm the translation units for the files the user is most likely to
+ * visit after @focus: its header or source counterpart, the files around
+ * it in the back/forward list, and the buffers they recently closed.
+ */
+static void
+ide_clang_service_speculate_from (IdeClangService *self,
+                                  IdeFile         *focus)
+{
+  g_autoptr(GPtrArray) nearby = NULL;
+  IdeBackForwardList *back_forward_list;
+  IdeContext *context;
+  GList *iter;
+  guint i;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_FILE (focus));
+
+  ide_clang_service_clear_speculation (self);
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  back_forward_list = ide_context_get_back_forward_list (context);
+
+  ide_clang_service_add_counterparts (self, focus);
+
+  nearby = _ide_back_forward_list_get_nearby_files (back_forward_list, SPECULATE_MAX_CANDIDATES);
+  for (i = 0; i < nearby->len; i++)
+    ide_clang_service_add_candidate (self, g_ptr_array_index (nearby, i), focus);
+
+  for (iter = self->recently_closed.head; iter; iter = iter->next)
+    ide_clang_service_add_candidate (self, ide_file_get_file (iter->data), focus);
+
+  if (self->speculate_queue.length > 0)
+    ide_clang_service_queue_speculate (self);
+}
+
+static void
+ide_clang_service_buffer_unloaded (IdeClangService  *self,
+                                   IdeBuffer        *buffer,
+                                   IdeBufferManager *buffer_manager)
+{
+  IdeFile *file;
+  GList *iter;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_BUFFER (buffer));
+  g_assert (IDE_IS_BUFFER_MANAGER (buffer_manager));
+
+  if (NULL == (file = ide_buffer_get_file (buffer)) || ide_file_get_is_temporary (file))
+    return;
+
+  for (iter = self->recently_closed.head; iter; iter = iter->next)
+    {
+      if (ide_file_equal (iter->data, file))
+        {
+          g_object_unref (iter->data);
+          g_queue_delete_link (&self->recently_closed, iter);
+          break;
+        }
+    }
+
+  g_queue_push_head (&self->recently_closed, g_object_ref (file));
+
+  while (self->recently_closed.length > RECENTLY_CLOSED_MAX)
+    g_object_unref (g_queue_pop_tail (&self->recently_closed));
+}
+
+static void
+ide_clang_service_buffer_focus_enter (IdeClangService  *self,
+                                      IdeBuffer        *buffer,
+                                      IdeBufferManager *buffer_manager)
+{
+  IdeFile *file;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_BUFFER (buffer));
+  g_assert (IDE_IS_BUFFER_MANAGER (buffer_manager));
+
+  ide_clang_service_unpin (self);
+
+  /*
+   * Keep the translation unit for the buffer the user is looking at around
+   * regardless of the memory budget, since it will be needed again as soon
+   * as they continue typing.
+   */
+  if (self->units_cache != NULL &&
+      NULL != (file = ide_buffer_get_file (buffer)) &&
+      !ide_file_get_is_temporary (file))
+    {
+      self->pinned_file = g_object_ref (file);
+      egg_task_cache_pin (self->units_cache, file);
+
+      ide_clang_service_speculate_from (self, file);
+    }
+}
+
+static void
+ide_clang_service_buffer_focus_leave (IdeClangService  *self,
+                                      IdeBuffer        *buffer,
+                                      IdeBufferManager *buffer_manager)
+{
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_BUFFER (buffer));
+  g_assert (IDE_IS_BUFFER_MANAGER (buffer_manager));
+
+  ide_clang_service_unpin (self);
+}
+
+static void
+ide_clang_service_buffer_trimmed (IdeClangService  *self,
+                                  IdeBuffer        *buffer,
+                                  IdeBufferManager *buffer_manager)
+{
+  IdeFile *file;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_BUFFER (buffer));
+  g_assert (IDE_IS_BUFFER_MANAGER (buffer_manager));
+
+  /* The unit will be parsed again when the buffer is focused */
+  if (NULL != (file = ide_buffer_get_file (buffer)))
+    egg_task_cache_evict (self->units_cache, file);
+}
+
 static void
 ide_clang_service_start (IdeService *service)
 {
   IdeClangService *self = (IdeClangService *)service;
+  IdeBufferManager *buffer_manager;
+  IdeBuffer *focus_buffer;
+  IdeContext *context;
 
   g_return_if_fail (IDE_IS_CLANG_SERVICE (self));
   g_return_if_fail (self->index == NULL);
 
   self->cancellable = g_cancellable_new ();
+  self->speculate_cancellable = g_cancellable_new ();
 
   self->units_cache = egg_task_cache_new ((GHashFunc)ide_file_hash,
                                           (GEqualFunc)ide_file_equal,
@@ -626,10 +1145,45 @@ ide_clang_service_start (IdeService *service)
                                           g_object_unref);
 
   egg_task_cache_set_name (self->units_cache, "clang translation-unit cache");
+  egg_task_cache_set_cost_func (self->units_cache, ide_clang_service_unit_cost, NULL, NULL);
+  egg_task_cache_set_max_cost (self->units_cache, DEFAULT_UNITS_MAX_COST);
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  buffer_manager = ide_context_get_buffer_manager (context);
+
+  g_signal_connect_object (buffer_manager,
+                           "buffer-focus-enter",
+                           G_CALLBACK (ide_clang_service_buffer_focus_enter),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (buffer_manager,
+                           "buffer-focus-leave",
+                           G_CALLBACK (ide_clang_service_buffer_focus_leave),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (buffer_manager,
+                           "buffer-unloaded",
+                           G_CALLBACK (ide_clang_service_buffer_unloaded),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (buffer_manager,
+                           "buffer-trimmed",
+                           G_CALLBACK (ide_clang_service_buffer_trimmed),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  if (NULL != (focus_buffer = ide_buffer_manager_get_focus_buffer (buffer_manager)))
+    ide_clang_service_buffer_focus_enter (self, focus_buffer, buffer_manager);
 
   self->index = clang_createIndex (0, 0);
   clang_CXIndex_setGlobalOptions (self->index,
                                   CXGlobalOpt_ThreadBackgroundPriorityForAll);
+
+  self->indexer = ide_clang_indexer_new (context);
+  ide_clang_indexer_start (self->indexer);
 }
 
 static void
@@ -641,7 +1195,16 @@ ide_clang_service_stop (IdeService *service)
   g_return_if_fail (self->index != NULL);
 
   g_cancellable_cancel (self->cancellable);
+  g_cancellable_cancel (self->speculate_cancellable);
+  ide_clang_service_clear_speculation (self);
+  ide_clang_service_unpin (self);
   g_clear_object (&self->units_cache);
+
+  if (self->indexer != NULL)
+    {
+      ide_clang_indexer_stop (self->indexer);
+      g_clear_object (&self->indexer);
+    }
 }
 
 static void
@@ -651,8 +1214,17 @@ ide_clang_service_dispose (GObject *object)
 
   IDE_ENTRY;
 
+  ide_clang_service_clear_speculation (self);
+  ide_clang_service_unpin (self);
   g_clear_object (&self->units_cache);
+  g_clear_object (&self->indexer);
   g_clear_object (&self->cancellable);
+  g_clear_object (&self->speculate_cancellable);
+  g_clear_object (&self->speculating);
+  g_clear_object (&self->speculate_task);
+
+  while (self->recently_closed.length > 0)
+    g_object_unref (g_queue_pop_head (&self->recently_closed));
   g_clear_pointer (&self->index, clang_disposeIndex);
 
   G_OBJECT_CLASS (ide_clang_service_parent_class)->dispose (object);
@@ -713,6 +1285,56 @@ ide_clang_service_get_cached_translation_unit (IdeClangService *self,
   return cached ? g_object_ref (cached) : NULL;
 }
 
+/**
+ * ide_clang_service_find_references:
+ * @self: A #IdeClangService.
+ * @usr: The USR of the entity, as returned from clang_getCursorUSR().
+ *
+ * Locates references to @usr throughout the project using the background
+ * index. Files do not need to be opened or parsed for their references to
+ * be found, but results will be missing until they have been indexed.
+ *
+ * Returns: (transfer container) (element-type Ide.SourceLocation): An array
+ *   of #IdeSourceLocation.
+ */
+GPtrArray *
+ide_clang_service_find_references (IdeClangService *self,
+                                   const gchar     *usr)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_SERVICE (self), NULL);
+  g_return_val_if_fail (usr != NULL, NULL);
+
+  if (self->indexer == NULL)
+    return g_ptr_array_new_with_free_func ((GDestroyNotify)ide_source_location_unref);
+
+  return ide_clang_indexer_lookup (self->indexer, usr, IDE_CLANG_INDEX_REFERENCE);
+}
+
+/**
+ * ide_clang_service_find_definitions:
+ * @self: A #IdeClangService.
+ * @usr: The USR of the entity, as returned from clang_getCursorUSR().
+ *
+ * Like ide_clang_service_find_references() but locates the definitions
+ * of @usr, which is useful when the definition lives in a file that is
+ * not part of the current translation unit.
+ *
+ * Returns: (transfer container) (element-type Ide.SourceLocation): An array
+ *   of #IdeSourceLocation.
+ */
+GPtrArray *
+ide_clang_service_find_definitions (IdeClangService *self,
+                                    const gchar     *usr)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_SERVICE (self), NULL);
+  g_return_val_if_fail (usr != NULL, NULL);
+
+  if (self->indexer == NULL)
+    return g_ptr_array_new_with_free_func ((GDestroyNotify)ide_source_location_unref);
+
+  return ide_clang_indexer_lookup (self->indexer, usr, IDE_CLANG_INDEX_DEFINITION);
+}
+
 void
 _ide_clang_dispose_string (CXString *str)
 {
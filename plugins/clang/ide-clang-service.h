@@ -38,6 +38,10 @@ IdeClangTranslationUnit *ide_clang_service_get_translation_unit_finish (IdeClang
                                                                         GError              **error);
 IdeClangTranslationUnit *ide_clang_service_get_cached_translation_unit (IdeClangService      *self,
                                                                         IdeFile              *file);
+GPtrArray               *ide_clang_service_find_references             (IdeClangService      *self,
+                                                                        const gchar          *usr);
+GPtrArray               *ide_clang_service_find_definitions            (IdeClangService      *self,
+                                                                        const gchar          *usr);
 
 G_END_DECLS
 
@@ -39,6 +39,7 @@ typedef struct
 {
   const gchar   *path;
   GArray        *children;
+  guint          recursive : 1;
 } TraversalState;
 
 static void symbol_tree_iface_init (IdeSymbolTreeInterface *iface);
@@ -123,6 +124,25 @@ cursor_is_recognized (TraversalState *state,
   return ret;
 }
 
+static void
+clear_symbol_entry (gpointer data)
+{
+  IdeClangSymbolEntry *entry = data;
+
+  g_clear_pointer (&entry->children, g_array_unref);
+}
+
+static GArray *
+new_children_array (void)
+{
+  GArray *ar;
+
+  ar = g_array_new (FALSE, FALSE, sizeof (IdeClangSymbolEntry));
+  g_array_set_clear_func (ar, clear_symbol_entry);
+
+  return ar;
+}
+
 static enum CXChildVisitResult
 count_recognizable_children (CXCursor     cursor,
                              CXCursor     parent,
@@ -131,11 +151,64 @@ count_recognizable_children (CXCursor     cursor,
   TraversalState *state = user_data;
 
   if (cursor_is_recognized (state, cursor))
-    g_array_append_val (state->children, cursor);
+    {
+      IdeClangSymbolEntry entry = { cursor, NULL };
+
+      if (state->recursive)
+        {
+          TraversalState child_state = *state;
+
+          entry.children = child_state.children = new_children_array ();
+          clang_visitChildren (cursor, count_recognizable_children, &child_state);
+        }
+
+      g_array_append_val (state->children, entry);
+    }
 
   return CXChildVisit_Continue;
 }
 
+/**
+ * _ide_clang_symbol_tree_build_children:
+ * @parent: the cursor to visit.
+ * @path: the path of the file to collect symbols from.
+ * @recursive: if all descendants should be collected.
+ *
+ * Collects the recognized children of @parent located in @path. If
+ * @recursive is set, the children of each child are collected as well
+ * so that the resulting tree never needs to visit the cursor tree again.
+ * This may be called from a worker thread, as long as no other thread is
+ * using the translation unit at the same time.
+ *
+ * Returns: (transfer full): A #GArray of #IdeClangSymbolEntry.
+ */
+GArray *
+_ide_clang_symbol_tree_build_children (CXCursor     parent,
+                                       const gchar *path,
+                                       gboolean     recursive)
+{
+  TraversalState state = { 0 };
+
+  state.path = path;
+  state.children = new_children_array ();
+  state.recursive = !!recursive;
+
+  clang_visitChildren (parent, count_recognizable_children, &state);
+
+  return state.children;
+}
+
+void
+_ide_clang_symbol_tree_set_children (IdeClangSymbolTree *self,
+                                     GArray             *children)
+{
+  g_return_if_fail (IDE_IS_CLANG_SYMBOL_TREE (self));
+  g_return_if_fail (self->children == NULL);
+  g_return_if_fail (children != NULL);
+
+  self->children = g_array_ref (children);
+}
+
 static guint
 ide_clang_symbol_tree_get_n_children (IdeSymbolTree *symbol_tree,
                                       IdeSymbolNode *parent)
@@ -143,7 +216,6 @@ ide_clang_symbol_tree_get_n_children (IdeSymbolTree *symbol_tree,
   IdeClangSymbolTree *self = (IdeClangSymbolTree *)symbol_tree;
   CXTranslationUnit tu;
   CXCursor cursor;
-  TraversalState state = { 0 };
   GArray *children = NULL;
   guint count;
 
@@ -169,14 +241,7 @@ ide_clang_symbol_tree_get_n_children (IdeSymbolTree *symbol_tree,
       cursor = _ide_clang_symbol_node_get_cursor (IDE_CLANG_SYMBOL_NODE (parent));
     }
 
-  children = g_array_new (FALSE, FALSE, sizeof (CXCursor));
-
-  state.path = self->path;
-  state.children = children;
-
-  clang_visitChildren (cursor,
-                       count_recognizable_children,
-                       &state);
+  children = _ide_clang_symbol_tree_build_children (cursor, self->path, FALSE);
 
   if (parent == NULL)
     self->children = g_array_ref (children);
@@ -213,10 +278,17 @@ ide_clang_symbol_tree_get_nth_child (IdeSymbolTree *symbol_tree,
 
   if (nth < children->len)
     {
-      CXCursor cursor;
+      const IdeClangSymbolEntry *entry;
+      IdeSymbolNode *node;
+
+      entry = &g_array_index (children, IdeClangSymbolEntry, nth);
+      node = _ide_clang_symbol_node_new (context, entry->cursor);
+
+      /* Precomputed trees already know the grandchildren. */
+      if (entry->children != NULL)
+        _ide_clang_symbol_node_set_children (IDE_CLANG_SYMBOL_NODE (node), entry->children);
 
-      cursor = g_array_index (children, CXCursor, nth);
-      return _ide_clang_symbol_node_new (context, cursor);
+      return node;
     }
 
   g_warning ("nth child %u is out of bounds", nth);
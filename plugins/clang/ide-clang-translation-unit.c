@@ -23,13 +23,15 @@
 #include <glib/gi18n.h>
 #include <ide.h>
 
-#include "ide-clang-completion-item.h"
-#include "ide-clang-completion-item-private.h"
+#include "ide-clang-completion-results.h"
 #include "ide-clang-private.h"
 #include "ide-clang-symbol-tree.h"
 #include "ide-clang-translation-unit.h"
 #include "ide-internal.h"
 
+/* Cursors of the main file are annotated lazily, this many lines at a time */
+#define CURSOR_BLOCK_LINES 100
+
 struct _IdeClangTranslationUnit
 {
   IdeObject          parent_instance;
@@ -39,6 +41,24 @@ struct _IdeClangTranslationUnit
   GFile             *file;
   IdeHighlightIndex *index;
   GHashTable        *diagnostics;
+  gsize              memory_usage;
+
+  /*
+   * The symbol tree and sorted symbols of the main file. These are computed
+   * by the parse worker with _ide_clang_translation_unit_prepare() before
+   * the translation unit is handed out, since libclang does not allow using
+   * a translation unit from multiple threads at once. A new translation
+   * unit is created for every parse, so they never need to be invalidated.
+   */
+  GArray            *symbol_tree;
+  GPtrArray         *symbols;
+
+  /*
+   * Location-sorted tables of the cursors in the main file, keyed by the
+   * block of CURSOR_BLOCK_LINES lines they cover. Blocks are only annotated
+   * once a lookup lands in them, so a reparse does not tokenize the file.
+   */
+  GHashTable        *cursor_blocks;
 };
 
 typedef struct
@@ -56,6 +76,15 @@ typedef struct
   gchar     *path;
 } GetSymbolsState;
 
+typedef struct
+{
+  guint      line;
+  guint      column;
+  guint      end_column;
+  CXCursor   cursor;
+  IdeSymbol *symbol;
+} CursorEntry;
+
 G_DEFINE_TYPE (IdeClangTranslationUnit, ide_clang_translation_unit, IDE_TYPE_OBJECT)
 EGG_DEFINE_COUNTER (instances, "Clang", "Translation Units", "Number of clang translation units")
 
@@ -467,6 +496,47 @@ ide_clang_translation_unit_get_serial (IdeClangTranslationUnit *self)
   return self->serial;
 }
 
+/**
+ * _ide_clang_translation_unit_get_memory_usage:
+ *
+ * Gets the number of bytes of memory used by the underlying translation unit
+ * as reported by clang_getCXTUResourceUsage(). The value is calculated upon
+ * the first call and cached afterwards, so it is best to call this from the
+ * worker that created the translation unit.
+ *
+ * Returns: The memory usage in bytes.
+ */
+gsize
+_ide_clang_translation_unit_get_memory_usage (IdeClangTranslationUnit *self)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), 0);
+
+  if (self->memory_usage == 0)
+    {
+      CXTranslationUnit tu = ide_ref_ptr_get (self->native);
+      CXTUResourceUsage usage;
+      gsize total = 0;
+      guint i;
+
+      usage = clang_getCXTUResourceUsage (tu);
+
+      for (i = 0; i < usage.numEntries; i++)
+        {
+          const CXTUResourceUsageEntry *entry = &usage.entries [i];
+
+          if (entry->kind >= CXTUResourceUsage_MEMORY_IN_BYTES_BEGIN &&
+              entry->kind <= CXTUResourceUsage_MEMORY_IN_BYTES_END)
+            total += entry->amount;
+        }
+
+      clang_disposeCXTUResourceUsage (usage);
+
+      self->memory_usage = MAX (total, 1);
+    }
+
+  return self->memory_usage;
+}
+
 static void
 ide_clang_translation_unit_set_native (IdeClangTranslationUnit *self,
                                        CXTranslationUnit        native)
@@ -488,6 +558,9 @@ ide_clang_translation_unit_finalize (GObject *object)
   g_clear_object (&self->file);
   g_clear_pointer (&self->index, ide_highlight_index_unref);
   g_clear_pointer (&self->diagnostics, g_hash_table_unref);
+  g_clear_pointer (&self->symbol_tree, g_array_unref);
+  g_clear_pointer (&self->symbols, g_ptr_array_unref);
+  g_clear_pointer (&self->cursor_blocks, g_hash_table_unref);
 
   G_OBJECT_CLASS (ide_clang_translation_unit_parent_class)->finalize (object);
 
@@ -616,9 +689,7 @@ ide_clang_translation_unit_code_complete_worker (GTask        *task,
   CodeCompleteState *state = task_data;
   CXCodeCompleteResults *results;
   CXTranslationUnit tu;
-  g_autoptr(IdeRefPtr) refptr = NULL;
   struct CXUnsavedFile *ufs;
-  GPtrArray *ar;
   gsize i;
   gsize j = 0;
 
@@ -679,22 +750,20 @@ ide_clang_translation_unit_code_complete_worker (GTask        *task,
                                   ufs, j,
                                   clang_defaultCodeCompleteOptions ());
 
-  /*
-   * encapsulate in refptr so we don't need to malloc lots of little strings.
-   * we will inflate result strings as necessary.
-   */
-  refptr = ide_ref_ptr_new (results, (GDestroyNotify)clang_disposeCodeCompleteResults);
-  ar = g_ptr_array_new_with_free_func (g_object_unref);
-
-  for (i = 0; i < results->NumResults; i++)
-    {
-      GtkSourceCompletionProposal *proposal;
-
-      proposal = GTK_SOURCE_COMPLETION_PROPOSAL (ide_clang_completion_item_new (refptr, i));
-      g_ptr_array_add (ar, proposal);
-    }
-
-  g_task_return_pointer (task, ar, (GDestroyNotify)g_ptr_array_unref);
+  if (results == NULL)
+    g_task_return_new_error (task,
+                             G_IO_ERROR,
+                             G_IO_ERROR_FAILED,
+                             "Failed to complete at %u:%u",
+                             state->line + 1, state->line_offset + 1);
+  else
+    /*
+     * Keep the raw results alive rather than inflating an object per
+     * result. Proposals are created lazily for the rows that are shown.
+     */
+    g_task_return_pointer (task,
+                           ide_clang_completion_results_new (results),
+                           (GDestroyNotify)ide_clang_completion_results_unref);
 
   /* cleanup malloc'd state */
   for (i = 0; i < j; i++)
@@ -741,9 +810,10 @@ ide_clang_translation_unit_code_complete_async (IdeClangTranslationUnit *self,
 
   g_task_set_task_data (task, state, code_complete_state_free);
 
-  ide_thread_pool_push_task (IDE_THREAD_POOL_COMPILER,
-                             task,
-                             ide_clang_translation_unit_code_complete_worker);
+  ide_thread_pool_push_task_with_priority (IDE_THREAD_POOL_COMPILER,
+                                           IDE_THREAD_POOL_PRIORITY_INTERACTIVE,
+                                           task,
+                                           ide_clang_translation_unit_code_complete_worker);
 
   IDE_EXIT;
 }
@@ -756,16 +826,16 @@ ide_clang_translation_unit_code_complete_async (IdeClangTranslationUnit *self,
  *
  * Completes a call to ide_clang_translation_unit_code_complete_async().
  *
- * Returns: (transfer container) (element-type GtkSourceCompletionProposal*): An array of
- *   #GtkSourceCompletionProposal. Upon failure, %NULL is returned.
+ * Returns: (transfer full): An #IdeClangCompletionResults containing the
+ *   unfiltered results. Upon failure, %NULL is returned.
  */
-GPtrArray *
+IdeClangCompletionResults *
 ide_clang_translation_unit_code_complete_finish (IdeClangTranslationUnit  *self,
                                                  GAsyncResult             *result,
                                                  GError                  **error)
 {
   GTask *task = (GTask *)result;
-  GPtrArray *ret;
+  IdeClangCompletionResults *ret;
 
   IDE_ENTRY;
 
@@ -871,40 +941,24 @@ get_symbol_kind (CXCursor        cursor,
   return kind;
 }
 
-IdeSymbol *
-ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
-                                          IdeSourceLocation        *location,
-                                          GError                  **error)
+static IdeSymbol *
+resolve_cursor_symbol (IdeClangTranslationUnit *self,
+                       CXCursor                 cursor)
 {
-  g_autofree gchar *filename = NULL;
   g_autofree gchar *workpath = NULL;
   g_auto(CXString) cxstr = { 0 };
   g_autoptr(IdeSourceLocation) declaration = NULL;
   g_autoptr(IdeSourceLocation) definition = NULL;
   g_autoptr(IdeSourceLocation) canonical = NULL;
-  CXTranslationUnit tu;
   IdeSymbolKind symkind = 0;
   IdeSymbolFlags symflags = 0;
   IdeProject *project;
   IdeContext *context;
   IdeVcs *vcs;
   GFile *workdir;
-  CXSourceLocation cxlocation;
   CXCursor tmpcursor;
-  CXCursor cursor;
-  CXFile cxfile;
-  IdeSymbol *ret = NULL;
-  IdeFile *file;
-  GFile *gfile;
-  guint line;
-  guint line_offset;
 
-  IDE_ENTRY;
-
-  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
-  g_return_val_if_fail (location != NULL, NULL);
-
-  tu = ide_ref_ptr_get (self->native);
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
 
   context = ide_object_get_context (IDE_OBJECT (self));
   project = ide_context_get_project (context);
@@ -912,20 +966,6 @@ ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
   workdir = ide_vcs_get_working_directory (vcs);
   workpath = g_file_get_path (workdir);
 
-  line = ide_source_location_get_line (location);
-  line_offset = ide_source_location_get_line_offset (location);
-
-  if (!(file = ide_source_location_get_file (location)) ||
-      !(gfile = ide_file_get_file (file)) ||
-      !(filename = g_file_get_path (gfile)) ||
-      !(cxfile = clang_getFile (tu, filename)))
-    IDE_RETURN (NULL);
-
-  cxlocation = clang_getLocation (tu, cxfile, line + 1, line_offset + 1);
-  cursor = clang_getCursor (tu, cxlocation);
-  if (clang_Cursor_isNull (cursor))
-    IDE_RETURN (NULL);
-
   tmpcursor = clang_getCursorReferenced (cursor);
   if (!clang_Cursor_isNull (tmpcursor))
     {
@@ -935,6 +975,36 @@ ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
       cxrange = clang_getCursorExtent (tmpcursor);
       tmploc = clang_getRangeStart (cxrange);
       definition = create_location (self, project, workpath, tmploc);
+
+      /*
+       * If the definition is not part of this translation unit, we only have
+       * the declaration (such as a prototype from a header). Try to locate
+       * the real definition from the project index instead.
+       */
+      if (!clang_isCursorDefinition (tmpcursor) &&
+          clang_Cursor_isNull (clang_getCursorDefinition (tmpcursor)))
+        {
+          g_auto(CXString) cxusr = { 0 };
+          IdeClangService *service;
+          const gchar *usr;
+
+          cxusr = clang_getCursorUSR (tmpcursor);
+          usr = clang_getCString (cxusr);
+          service = ide_context_get_service_typed (context, IDE_TYPE_CLANG_SERVICE);
+
+          if (usr != NULL && *usr != '\0' && service != NULL)
+            {
+              g_autoptr(GPtrArray) definitions = NULL;
+
+              definitions = ide_clang_service_find_definitions (service, usr);
+
+              if (definitions->len > 0)
+                {
+                  declaration = g_steal_pointer (&definition);
+                  definition = ide_source_location_ref (g_ptr_array_index (definitions, 0));
+                }
+            }
+        }
     }
 
   symkind = get_symbol_kind (cursor, &symflags);
@@ -951,6 +1021,9 @@ ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
 
       if (path != NULL)
         {
+          GFile *gfile;
+          IdeFile *file;
+
           gfile = g_file_new_for_path (path);
           file = g_object_new (IDE_TYPE_FILE,
                                "context", context,
@@ -958,7 +1031,7 @@ ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
                                "path", path,
                                NULL);
 
-          g_clear_pointer (&definition, ide_symbol_unref);
+          g_clear_pointer (&definition, ide_source_location_unref);
           definition = ide_source_location_new (file, 0, 0, 0);
 
           g_clear_object (&file);
@@ -967,14 +1040,201 @@ ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
     }
 
   cxstr = clang_getCursorDisplayName (cursor);
-  ret = ide_symbol_new (clang_getCString (cxstr), symkind, symflags,
-                        declaration, definition, canonical);
 
   /*
    * TODO: We should also get information about the defintion of the symbol.
    *       Possibly more.
    */
 
+  return ide_symbol_new (clang_getCString (cxstr), symkind, symflags,
+                         declaration, definition, canonical);
+}
+
+static void
+clear_cursor_entry (gpointer data)
+{
+  CursorEntry *entry = data;
+
+  g_clear_pointer (&entry->symbol, ide_symbol_unref);
+}
+
+/*
+ * Builds a table of the identifier tokens between @first_line and
+ * @last_line of @cxfile along with the cursor clang annotated them with.
+ * Tokens are returned in source order so the table is sorted by location
+ * and can be binary searched.
+ */
+static GArray *
+build_cursor_table (CXTranslationUnit tu,
+                    CXFile            cxfile,
+                    guint             first_line,
+                    guint             last_line)
+{
+  CXToken *tokens = NULL;
+  CXCursor *cursors;
+  CXSourceRange range;
+  unsigned n_tokens = 0;
+  GArray *ar;
+  guint i;
+
+  ar = g_array_new (FALSE, FALSE, sizeof (CursorEntry));
+  g_array_set_clear_func (ar, clear_cursor_entry);
+
+  range = clang_getRange (clang_getLocation (tu, cxfile, first_line, 1),
+                          clang_getLocation (tu, cxfile, last_line + 1, 1));
+  clang_tokenize (tu, range, &tokens, &n_tokens);
+
+  if (n_tokens == 0)
+    return ar;
+
+  cursors = g_new0 (CXCursor, n_tokens);
+  clang_annotateTokens (tu, tokens, n_tokens, cursors);
+
+  for (i = 0; i < n_tokens; i++)
+    {
+      CXSourceRange extent;
+      CursorEntry entry = { 0 };
+      enum CXCursorKind kind;
+      unsigned end_line;
+
+      kind = clang_getCursorKind (cursors [i]);
+
+      if (clang_isInvalid (kind))
+        continue;
+
+      if (clang_getTokenKind (tokens [i]) != CXToken_Identifier &&
+          kind != CXCursor_InclusionDirective)
+        continue;
+
+      extent = clang_getTokenExtent (tu, tokens [i]);
+      clang_getFileLocation (clang_getRangeStart (extent), NULL, &entry.line, &entry.column, NULL);
+      clang_getFileLocation (clang_getRangeEnd (extent), NULL, &end_line, &entry.end_column, NULL);
+
+      if (end_line != entry.line || entry.line < first_line || entry.line > last_line)
+        continue;
+
+      entry.cursor = cursors [i];
+
+      g_array_append_val (ar, entry);
+    }
+
+  g_free (cursors);
+  clang_disposeTokens (tu, tokens, n_tokens);
+
+  return ar;
+}
+
+static GArray *
+get_cursor_block (IdeClangTranslationUnit *self,
+                  CXTranslationUnit        tu,
+                  CXFile                   cxfile,
+                  guint                    line)
+{
+  guint block = (line - 1) / CURSOR_BLOCK_LINES;
+  GArray *ar;
+
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_assert (line > 0);
+
+  if (self->cursor_blocks == NULL)
+    self->cursor_blocks = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_array_unref);
+
+  if (NULL == (ar = g_hash_table_lookup (self->cursor_blocks, GUINT_TO_POINTER (block))))
+    {
+      ar = build_cursor_table (tu,
+                               cxfile,
+                               block * CURSOR_BLOCK_LINES + 1,
+                               (block + 1) * CURSOR_BLOCK_LINES);
+      g_hash_table_insert (self->cursor_blocks, GUINT_TO_POINTER (block), ar);
+    }
+
+  return ar;
+}
+
+static CursorEntry *
+find_cursor_entry (GArray *cursors,
+                   guint   line,
+                   guint   column)
+{
+  guint lo = 0;
+  guint hi = cursors->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      CursorEntry *entry = &g_array_index (cursors, CursorEntry, mid);
+
+      if (line < entry->line || (line == entry->line && column < entry->column))
+        hi = mid;
+      else if (line > entry->line || column >= entry->end_column)
+        lo = mid + 1;
+      else
+        return entry;
+    }
+
+  return NULL;
+}
+
+IdeSymbol *
+ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
+                                          IdeSourceLocation        *location,
+                                          GError                  **error)
+{
+  g_autofree gchar *filename = NULL;
+  CXTranslationUnit tu;
+  CXSourceLocation cxlocation;
+  CXCursor cursor;
+  CXFile cxfile;
+  IdeSymbol *ret = NULL;
+  IdeFile *file;
+  GFile *gfile;
+  guint line;
+  guint line_offset;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
+  g_return_val_if_fail (location != NULL, NULL);
+
+  tu = ide_ref_ptr_get (self->native);
+
+  line = ide_source_location_get_line (location);
+  line_offset = ide_source_location_get_line_offset (location);
+
+  if (!(file = ide_source_location_get_file (location)) ||
+      !(gfile = ide_file_get_file (file)))
+    IDE_RETURN (NULL);
+
+  if (!(filename = g_file_get_path (gfile)) ||
+      !(cxfile = clang_getFile (tu, filename)))
+    IDE_RETURN (NULL);
+
+  /*
+   * Lookups within the main file are answered from the cursor table of the
+   * surrounding lines, and the resolved symbol is saved so that repeated
+   * hovers over the same token are free. Locations between tokens fall
+   * through to clang.
+   */
+  if (self->file != NULL && g_file_equal (gfile, self->file))
+    {
+      GArray *cursors = get_cursor_block (self, tu, cxfile, line + 1);
+      CursorEntry *entry;
+
+      if (NULL != (entry = find_cursor_entry (cursors, line + 1, line_offset + 1)))
+        {
+          if (entry->symbol == NULL)
+            entry->symbol = resolve_cursor_symbol (self, entry->cursor);
+          IDE_RETURN (ide_symbol_ref (entry->symbol));
+        }
+    }
+
+  cxlocation = clang_getLocation (tu, cxfile, line + 1, line_offset + 1);
+  cursor = clang_getCursor (tu, cxlocation);
+  if (clang_Cursor_isNull (cursor))
+    IDE_RETURN (NULL);
+
+  ret = resolve_cursor_symbol (self, cursor);
+
   IDE_RETURN (ret);
 }
 
@@ -1056,6 +1316,28 @@ sort_symbols_by_name (gconstpointer a,
                     ide_symbol_get_name (*bsym));
 }
 
+static GPtrArray *
+collect_symbols (CXTranslationUnit  tu,
+                 IdeFile           *file,
+                 const gchar       *path)
+{
+  GetSymbolsState state = { 0 };
+  CXCursor cursor;
+
+  state.ar = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_symbol_unref);
+  state.file = file;
+  state.path = (gchar *)path;
+
+  cursor = clang_getTranslationUnitCursor (tu);
+  clang_visitChildren (cursor,
+                       ide_clang_translation_unit_get_symbols__visitor_cb,
+                       &state);
+
+  g_ptr_array_sort (state.ar, sort_symbols_by_name);
+
+  return state.ar;
+}
+
 /**
  * ide_clang_translation_unit_get_symbols:
  *
@@ -1065,26 +1347,88 @@ GPtrArray *
 ide_clang_translation_unit_get_symbols (IdeClangTranslationUnit *self,
                                         IdeFile                 *file)
 {
-  GetSymbolsState state = { 0 };
-  CXCursor cursor;
+  g_autofree gchar *path = NULL;
 
   g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
   g_return_val_if_fail (IDE_IS_FILE (file), NULL);
 
-  state.ar = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_symbol_unref);
-  state.file = file;
-  state.path = g_file_get_path (ide_file_get_file (file));
+  if (self->symbols != NULL && g_file_equal (ide_file_get_file (file), self->file))
+    {
+      GPtrArray *ret;
+      guint i;
 
-  cursor = clang_getTranslationUnitCursor (ide_ref_ptr_get (self->native));
-  clang_visitChildren (cursor,
-                       ide_clang_translation_unit_get_symbols__visitor_cb,
-                       &state);
+      ret = g_ptr_array_new_full (self->symbols->len, (GDestroyNotify)ide_symbol_unref);
+      for (i = 0; i < self->symbols->len; i++)
+        g_ptr_array_add (ret, ide_symbol_ref (g_ptr_array_index (self->symbols, i)));
 
-  g_ptr_array_sort (state.ar, sort_symbols_by_name);
+      return ret;
+    }
 
-  g_free (state.path);
+  path = g_file_get_path (ide_file_get_file (file));
 
-  return state.ar;
+  return collect_symbols (ide_ref_ptr_get (self->native), file, path);
+}
+
+/**
+ * _ide_clang_translation_unit_prepare:
+ * @self: An #IdeClangTranslationUnit
+ * @file: An #IdeFile for the main file of @self
+ *
+ * Computes the symbol tree and the sorted symbols for the main file of the
+ * translation unit.
+ *
+ * This must be called from the worker that created the translation unit,
+ * before it is handed out. Once the translation unit is published, it is
+ * used from the main thread and must not be touched by other threads.
+ */
+void
+_ide_clang_translation_unit_prepare (IdeClangTranslationUnit *self,
+                                     IdeFile                 *file)
+{
+  g_autofree gchar *path = NULL;
+  CXTranslationUnit tu;
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_return_if_fail (IDE_IS_FILE (file));
+  g_return_if_fail (self->symbols == NULL);
+
+  tu = ide_ref_ptr_get (self->native);
+  path = g_file_get_path (ide_file_get_file (file));
+
+  if (path != NULL)
+    {
+      self->symbol_tree = _ide_clang_symbol_tree_build_children (clang_getTranslationUnitCursor (tu),
+                                                                 path,
+                                                                 TRUE);
+      self->symbols = collect_symbols (tu, file, path);
+    }
+
+  IDE_EXIT;
+}
+
+static IdeSymbolTree *
+ide_clang_translation_unit_create_symbol_tree (IdeClangTranslationUnit *self,
+                                               GFile                   *file)
+{
+  IdeSymbolTree *symbol_tree;
+  IdeContext *context;
+
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_assert (G_IS_FILE (file));
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  symbol_tree = g_object_new (IDE_TYPE_CLANG_SYMBOL_TREE,
+                              "context", context,
+                              "native", self->native,
+                              "file", file,
+                              NULL);
+
+  if (self->symbol_tree != NULL && self->file != NULL && g_file_equal (file, self->file))
+    _ide_clang_symbol_tree_set_children (IDE_CLANG_SYMBOL_TREE (symbol_tree), self->symbol_tree);
+
+  return symbol_tree;
 }
 
 void
@@ -1095,8 +1439,6 @@ ide_clang_translation_unit_get_symbol_tree_async (IdeClangTranslationUnit *self,
                                                   gpointer                 user_data)
 {
   g_autoptr(GTask) task = NULL;
-  IdeSymbolTree *symbol_tree;
-  IdeContext *context;
 
   g_return_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self));
   g_return_if_fail (G_IS_FILE (file));
@@ -1104,13 +1446,14 @@ ide_clang_translation_unit_get_symbol_tree_async (IdeClangTranslationUnit *self,
 
   task = g_task_new (self, cancellable, callback, user_data);
 
-  context = ide_object_get_context (IDE_OBJECT (self));
-  symbol_tree = g_object_new (IDE_TYPE_CLANG_SYMBOL_TREE,
-                              "context", context,
-                              "native", self->native,
-                              "file", file,
-                              NULL);
-  g_task_return_pointer (task, symbol_tree, g_object_unref);
+  /*
+   * The tree for the main file was built by the parse worker, and is shared
+   * by every request until the next parse. Trees for other files (such as
+   * headers) are still visited lazily as they are expanded.
+   */
+  g_task_return_pointer (task,
+                         ide_clang_translation_unit_create_symbol_tree (self, file),
+                         g_object_unref);
 }
 
 IdeSymbolTree *
@@ -244,7 +244,10 @@ ide_ctags_builder_rebuild (IdeCtagsBuilder *self)
     return;
 
   task = g_task_new (self, NULL, ide_ctags_builder_build_cb, NULL);
-  ide_thread_pool_push_task (IDE_THREAD_POOL_INDEXER, task, ide_ctags_builder_build_worker);
+  ide_thread_pool_push_task_with_priority (IDE_THREAD_POOL_INDEXER,
+                                           IDE_THREAD_POOL_PRIORITY_BACKGROUND,
+                                           task,
+                                           ide_ctags_builder_build_worker);
 }
 
 static void
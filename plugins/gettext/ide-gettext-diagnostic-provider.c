@@ -24,6 +24,10 @@
 
 #include "ide-gettext-diagnostic-provider.h"
 
+/* Rough estimate of the size of an IdeDiagnostic and its message. */
+#define DIAGNOSTIC_COST        512
+#define DIAGNOSTICS_MAX_COST   (2 * 1024 * 1024)
+
 struct _IdeGettextDiagnostics
 {
   GObject         parent_instance;
@@ -486,6 +490,19 @@ populate_cache (EggTaskCache  *cache,
                            g_object_ref (task));
 }
 
+static gsize
+ide_gettext_diagnostics_cost (gconstpointer value,
+                              gpointer      user_data)
+{
+  const IdeGettextDiagnostics *diags = value;
+  gsize cost = sizeof *diags;
+
+  if (diags->diagnostics != NULL)
+    cost += ide_diagnostics_get_size (diags->diagnostics) * DIAGNOSTIC_COST;
+
+  return cost;
+}
+
 static void
 ide_gettext_diagnostic_provider_init (IdeGettextDiagnosticProvider *self)
 {
@@ -501,4 +518,6 @@ ide_gettext_diagnostic_provider_init (IdeGettextDiagnosticProvider *self)
                                                 NULL);
 
   egg_task_cache_set_name (self->diagnostics_cache, "gettext diagnostic cache");
+  egg_task_cache_set_cost_func (self->diagnostics_cache, ide_gettext_diagnostics_cost, NULL, NULL);
+  egg_task_cache_set_max_cost (self->diagnostics_cache, DIAGNOSTICS_MAX_COST);
 }
@@ -34,16 +34,23 @@
  * the git repository.
  *
  * To enable us to avoid blocking the main loop, the actual diff is performed in a background
- * thread. To avoid threading issues with the rest of LibIDE, this module creates a copy of the
- * loaded repository. A single thread will be dispatched for the context and all reload tasks
- * will be performed from that thread.
+ * thread. Diffs are run on a small pool of threads so that buffers do not wait on each other.
+ * A libgit2 repository may only be used by one thread at a time, so each worker opens its own
+ * copy of the repository the first time it needs it and keeps it for later diffs. The blob
+ * found in HEAD is cached per buffer (by id, as blobs belong to the repository they were
+ * looked up in) until the VCS is reloaded, when HEAD or the index changes.
  *
- * Upon completion of the diff, the results will be passed back to the primary thread and the
- * state updated for use by line change renderer in the source view.
+ * Each buffer has at most one diff in flight. If the buffer changes again before that diff has
+ * been picked up by a worker, the queued diff is updated with the newest contents rather than
+ * queuing another one.
  *
- * TODO: Move the thread work into ide_thread_pool?
+ * Upon completion of the diff, the results will be passed back to the primary thread and the
+ * state updated for use by line change renderer in the source view. The state is a byte per
+ * line containing the IdeBufferLineChange for that line.
  */
 
+#define MAX_DIFF_THREADS 4
+
 struct _IdeGitBufferChangeMonitor
 {
   IdeBufferChangeMonitor  parent_instance;
@@ -54,9 +61,12 @@ struct _IdeGitBufferChangeMonitor
   IdeBuffer              *buffer;
 
   GgitRepository         *repository;
-  GHashTable             *state;
+  GByteArray             *state;
 
-  GgitBlob               *cached_blob;
+  GgitOId                *cached_blob_oid;
+
+  /* The diff in flight, owned by its GTask. Only valid while in_calculation is set. */
+  struct _DiffTask       *queued_diff;
 
   guint                   changed_timeout;
 
@@ -64,16 +74,20 @@ struct _IdeGitBufferChangeMonitor
   guint                   in_calculation : 1;
   guint                   delete_range_requires_recalculation : 1;
   guint                   is_child_of_workdir : 1;
+  guint                   blob_missing : 1;
 };
 
-typedef struct
+typedef struct _DiffTask
 {
-  GgitRepository *repository;
-  GHashTable     *state;
+  GFile          *workdir;
+  GByteArray     *state;
   GFile          *file;
   GBytes         *content;
-  GgitBlob       *blob;
+  GgitOId        *blob_oid;
+  /* Protected by diff_mutex, @content may be replaced until this is set */
+  gboolean        started;
   guint           is_child_of_workdir : 1;
+  guint           blob_missing : 1;
 } DiffTask;
 
 G_DEFINE_TYPE (IdeGitBufferChangeMonitor,
@@ -82,6 +96,10 @@ G_DEFINE_TYPE (IdeGitBufferChangeMonitor,
 
 EGG_DEFINE_COUNTER (instances, "IdeGitBufferChangeMonitor", "Instances",
                     "The number of git buffer change monitor instances.");
+EGG_DEFINE_COUNTER (coalesced, "IdeGitBufferChangeMonitor", "Coalesced Diffs",
+                    "The number of diffs folded into an already queued diff.");
+EGG_DEFINE_COUNTER (blob_lookups, "IdeGitBufferChangeMonitor", "Blob Lookups",
+                    "The number of times a blob was resolved from HEAD.");
 
 enum {
   PROP_0,
@@ -90,8 +108,9 @@ enum {
 };
 
 static GParamSpec  *properties [LAST_PROP];
-static GAsyncQueue *work_queue;
-static GThread     *work_thread;
+static GThreadPool *work_pool;
+static GMutex       diff_mutex;
+static GPrivate     thread_repositories = G_PRIVATE_INIT ((GDestroyNotify)g_hash_table_unref);
 
 static void
 diff_task_free (gpointer data)
@@ -101,14 +120,15 @@ diff_task_free (gpointer data)
   if (diff)
     {
       g_clear_object (&diff->file);
-      g_clear_object (&diff->blob);
-      g_clear_object (&diff->repository);
-      g_clear_pointer (&diff->state, g_hash_table_unref);
+      g_clear_object (&diff->workdir);
+      g_clear_pointer (&diff->blob_oid, ggit_oid_free);
+      g_clear_pointer (&diff->state, g_byte_array_unref);
       g_clear_pointer (&diff->content, g_bytes_unref);
+      g_slice_free (DiffTask, diff);
     }
 }
 
-static GHashTable *
+static GByteArray *
 ide_git_buffer_change_monitor_calculate_finish (IdeGitBufferChangeMonitor  *self,
                                                 GAsyncResult               *result,
                                                 GError                    **error)
@@ -121,9 +141,14 @@ ide_git_buffer_change_monitor_calculate_finish (IdeGitBufferChangeMonitor  *self
 
   diff = g_task_get_task_data (task);
 
-  /* Keep the blob around for future use */
-  if (diff->blob != self->cached_blob)
-    g_set_object (&self->cached_blob, diff->blob);
+  /* Keep the blob (or the fact there isn't one) around for future use */
+  if (diff->blob_oid != NULL &&
+      (self->cached_blob_oid == NULL || !ggit_oid_equal (diff->blob_oid, self->cached_blob_oid)))
+    {
+      g_clear_pointer (&self->cached_blob_oid, ggit_oid_free);
+      self->cached_blob_oid = ggit_oid_copy (diff->blob_oid);
+    }
+  self->blob_missing = diff->blob_missing;
 
   /* If the file is a child of the working directory, we need to know */
   self->is_child_of_workdir = diff->is_child_of_workdir;
@@ -138,6 +163,7 @@ ide_git_buffer_change_monitor_calculate_async (IdeGitBufferChangeMonitor *self,
                                                gpointer                   user_data)
 {
   g_autoptr(GTask) task = NULL;
+  g_autoptr(GFile) workdir = NULL;
   DiffTask *diff;
   IdeFile *file;
   GFile *gfile;
@@ -163,18 +189,73 @@ ide_git_buffer_change_monitor_calculate_async (IdeGitBufferChangeMonitor *self,
       return;
     }
 
+  if (NULL == (workdir = ggit_repository_get_workdir (self->repository)))
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_FILENAME,
+                               _("Repository does not have a working directory."));
+      return;
+    }
+
   diff = g_slice_new0 (DiffTask);
   diff->file = g_object_ref (gfile);
-  diff->repository = g_object_ref (self->repository);
-  diff->state = g_hash_table_new (g_direct_hash, g_direct_equal);
+  diff->workdir = g_steal_pointer (&workdir);
+  diff->state = g_byte_array_new ();
   diff->content = ide_buffer_get_content (self->buffer);
-  diff->blob = self->cached_blob ? g_object_ref (self->cached_blob) : NULL;
+  diff->blob_oid = self->cached_blob_oid ? ggit_oid_copy (self->cached_blob_oid) : NULL;
+  diff->blob_missing = self->blob_missing;
 
   g_task_set_task_data (task, diff, diff_task_free);
 
   self->in_calculation = TRUE;
+  self->queued_diff = diff;
 
-  g_async_queue_push (work_queue, g_object_ref (task));
+  g_thread_pool_push (work_pool, g_object_ref (task), NULL);
+}
+
+/*
+ * If the diff in flight has not been picked up by a worker yet, give it the
+ * current contents of the buffer instead of queuing another diff after it.
+ *
+ * Returns: %TRUE if the queued diff will include the latest changes.
+ */
+static gboolean
+ide_git_buffer_change_monitor_coalesce (IdeGitBufferChangeMonitor *self)
+{
+  DiffTask *diff = self->queued_diff;
+  GBytes *content;
+  gboolean started;
+
+  g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
+  g_assert (self->in_calculation);
+
+  if (diff == NULL || self->buffer == NULL)
+    return FALSE;
+
+  g_mutex_lock (&diff_mutex);
+  started = diff->started;
+  g_mutex_unlock (&diff_mutex);
+
+  if (started)
+    return FALSE;
+
+  content = ide_buffer_get_content (self->buffer);
+
+  g_mutex_lock (&diff_mutex);
+  if (!(started = diff->started))
+    {
+      g_bytes_unref (diff->content);
+      diff->content = g_steal_pointer (&content);
+    }
+  g_mutex_unlock (&diff_mutex);
+
+  g_clear_pointer (&content, g_bytes_unref);
+
+  if (!started)
+    EGG_COUNTER_INC (coalesced);
+
+  return !started;
 }
 
 static IdeBufferLineChange
@@ -182,8 +263,7 @@ ide_git_buffer_change_monitor_get_change (IdeBufferChangeMonitor *monitor,
                                           const GtkTextIter      *iter)
 {
   IdeGitBufferChangeMonitor *self = (IdeGitBufferChangeMonitor *)monitor;
-  gpointer key;
-  gpointer value;
+  guint line;
 
   g_return_val_if_fail (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self), IDE_BUFFER_LINE_CHANGE_NONE);
   g_return_val_if_fail (iter, IDE_BUFFER_LINE_CHANGE_NONE);
@@ -198,10 +278,12 @@ ide_git_buffer_change_monitor_get_change (IdeBufferChangeMonitor *monitor,
       return IDE_BUFFER_LINE_CHANGE_NONE;
     }
 
-  key = GINT_TO_POINTER (gtk_text_iter_get_line (iter) + 1);
-  value = g_hash_table_lookup (self->state, key);
+  line = gtk_text_iter_get_line (iter);
 
-  return GPOINTER_TO_INT (value);
+  if (line >= self->state->len)
+    return IDE_BUFFER_LINE_CHANGE_NONE;
+
+  return self->state->data [line];
 }
 
 static void
@@ -220,24 +302,26 @@ ide_git_buffer_change_monitor__calculate_cb (GObject      *object,
                                              gpointer      user_data_unused)
 {
   IdeGitBufferChangeMonitor *self = (IdeGitBufferChangeMonitor *)object;
-  g_autoptr(GHashTable) ret = NULL;
+  g_autoptr(GByteArray) ret = NULL;
   g_autoptr(GError) error = NULL;
 
   g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
 
   self->in_calculation = FALSE;
+  self->queued_diff = NULL;
 
   ret = ide_git_buffer_change_monitor_calculate_finish (self, result, &error);
 
   if (!ret)
     {
-      if (!g_error_matches (error, GGIT_ERROR, GGIT_ERROR_NOTFOUND))
+      if (!g_error_matches (error, GGIT_ERROR, GGIT_ERROR_NOTFOUND) &&
+          !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
         g_message ("%s", error->message);
     }
   else
     {
-      g_clear_pointer (&self->state, g_hash_table_unref);
-      self->state = g_hash_table_ref (ret);
+      g_clear_pointer (&self->state, g_byte_array_unref);
+      self->state = g_steal_pointer (&ret);
     }
 
   ide_buffer_change_monitor_emit_changed (IDE_BUFFER_CHANGE_MONITOR (self));
@@ -260,7 +344,11 @@ ide_git_buffer_change_monitor_recalculate (IdeGitBufferChangeMonitor *self)
   self->state_dirty = TRUE;
 
   if (self->in_calculation)
-    return;
+    {
+      if (ide_git_buffer_change_monitor_coalesce (self))
+        self->state_dirty = FALSE;
+      return;
+    }
 
   ide_git_buffer_change_monitor_calculate_async (self,
                                                  NULL,
@@ -423,7 +511,9 @@ ide_git_buffer_change_monitor_reload (IdeBufferChangeMonitor *monitor)
 
   g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
 
-  g_clear_object (&self->cached_blob);
+  g_clear_pointer (&self->cached_blob_oid, ggit_oid_free);
+  self->blob_missing = FALSE;
+
   ide_git_buffer_change_monitor_recalculate (self);
 
   IDE_EXIT;
@@ -471,6 +561,38 @@ ide_git_buffer_change_monitor_set_buffer (IdeBufferChangeMonitor *monitor,
   IDE_EXIT;
 }
 
+/*
+ * Merges @change into the state for @lineno (which starts from 1), growing
+ * the array as necessary. A line that is both added and deleted is changed.
+ */
+static void
+state_set_change (GByteArray          *state,
+                  gint                 lineno,
+                  IdeBufferLineChange  change)
+{
+  guint index;
+
+  g_assert (state != NULL);
+
+  if (lineno < 1)
+    return;
+
+  index = lineno - 1;
+
+  if (index >= state->len)
+    {
+      guint old_len = state->len;
+
+      g_byte_array_set_size (state, index + 1);
+      memset (state->data + old_len, IDE_BUFFER_LINE_CHANGE_NONE, state->len - old_len);
+    }
+
+  if (state->data [index] != IDE_BUFFER_LINE_CHANGE_NONE)
+    change = IDE_BUFFER_LINE_CHANGE_CHANGED;
+
+  state->data [index] = change;
+}
+
 static gint
 diff_line_cb (GgitDiffDelta *delta,
               GgitDiffHunk  *hunk,
@@ -478,7 +600,7 @@ diff_line_cb (GgitDiffDelta *delta,
               gpointer       user_data)
 {
   GgitDiffLineType type;
-  GHashTable *hash = user_data;
+  GByteArray *state = user_data;
   gint new_lineno;
   gint old_lineno;
   gint adjust;
@@ -486,7 +608,7 @@ diff_line_cb (GgitDiffDelta *delta,
   g_return_val_if_fail (delta, GGIT_ERROR_GIT_ERROR);
   g_return_val_if_fail (hunk, GGIT_ERROR_GIT_ERROR);
   g_return_val_if_fail (line, GGIT_ERROR_GIT_ERROR);
-  g_return_val_if_fail (hash, GGIT_ERROR_GIT_ERROR);
+  g_return_val_if_fail (state, GGIT_ERROR_GIT_ERROR);
 
   type = ggit_diff_line_get_origin (line);
 
@@ -499,27 +621,13 @@ diff_line_cb (GgitDiffDelta *delta,
   switch (type)
     {
     case GGIT_DIFF_LINE_ADDITION:
-      if (g_hash_table_lookup (hash, GINT_TO_POINTER (new_lineno)))
-        g_hash_table_replace (hash,
-                              GINT_TO_POINTER (new_lineno),
-                              GINT_TO_POINTER (IDE_BUFFER_LINE_CHANGE_CHANGED));
-      else
-        g_hash_table_insert (hash,
-                             GINT_TO_POINTER (new_lineno),
-                             GINT_TO_POINTER (IDE_BUFFER_LINE_CHANGE_ADDED));
+      state_set_change (state, new_lineno, IDE_BUFFER_LINE_CHANGE_ADDED);
       break;
 
     case GGIT_DIFF_LINE_DELETION:
       adjust = (ggit_diff_hunk_get_new_start (hunk) - ggit_diff_hunk_get_old_start (hunk));
       old_lineno += adjust;
-      if (g_hash_table_lookup (hash, GINT_TO_POINTER (old_lineno)))
-        g_hash_table_replace (hash,
-                              GINT_TO_POINTER (old_lineno),
-                              GINT_TO_POINTER (IDE_BUFFER_LINE_CHANGE_CHANGED));
-      else
-        g_hash_table_insert (hash,
-                             GINT_TO_POINTER (old_lineno),
-                             GINT_TO_POINTER (IDE_BUFFER_LINE_CHANGE_DELETED));
+      state_set_change (state, old_lineno, IDE_BUFFER_LINE_CHANGE_DELETED);
       break;
 
     case GGIT_DIFF_LINE_CONTEXT:
@@ -538,38 +646,60 @@ diff_line_cb (GgitDiffDelta *delta,
   return 0;
 }
 
+/*
+ * Gets the repository for @workdir that belongs to the calling worker, opening
+ * it the first time. Nothing else uses it, so no locking is required.
+ */
+static GgitRepository *
+ide_git_buffer_change_monitor_get_thread_repository (GFile   *workdir,
+                                                     GError **error)
+{
+  GHashTable *repositories;
+  GgitRepository *repository;
+
+  g_assert (G_IS_FILE (workdir));
+
+  if (NULL == (repositories = g_private_get (&thread_repositories)))
+    {
+      repositories = g_hash_table_new_full (g_file_hash,
+                                            (GEqualFunc)g_file_equal,
+                                            g_object_unref,
+                                            g_object_unref);
+      g_private_set (&thread_repositories, repositories);
+    }
+
+  if (NULL == (repository = g_hash_table_lookup (repositories, workdir)))
+    {
+      if (NULL == (repository = ggit_repository_open (workdir, error)))
+        return NULL;
+
+      g_hash_table_insert (repositories, g_object_ref (workdir), repository);
+    }
+
+  return repository;
+}
+
 static gboolean
 ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *self,
                                                   DiffTask                   *diff,
                                                   GError                    **error)
 {
   g_autofree gchar *relative_path = NULL;
-  g_autoptr(GFile) workdir = NULL;
+  g_autoptr(GgitBlob) blob = NULL;
+  GgitRepository *repository;
   const guint8 *data;
   gsize data_len = 0;
 
   g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
   g_assert (diff);
   g_assert (G_IS_FILE (diff->file));
+  g_assert (G_IS_FILE (diff->workdir));
   g_assert (diff->state);
-  g_assert (GGIT_IS_REPOSITORY (diff->repository));
   g_assert (diff->content);
-  g_assert (!diff->blob || GGIT_IS_BLOB (diff->blob));
   g_assert (error);
   g_assert (!*error);
 
-  workdir = ggit_repository_get_workdir (diff->repository);
-
-  if (!workdir)
-    {
-      g_set_error (error,
-                   G_IO_ERROR,
-                   G_IO_ERROR_INVALID_FILENAME,
-                   _("Repository does not have a working directory."));
-      return FALSE;
-    }
-
-  relative_path = g_file_get_relative_path (workdir, diff->file);
+  relative_path = g_file_get_relative_path (diff->workdir, diff->file);
 
   if (!relative_path)
     {
@@ -582,21 +712,29 @@ ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *se
 
   diff->is_child_of_workdir = TRUE;
 
+  if (NULL == (repository = ide_git_buffer_change_monitor_get_thread_repository (diff->workdir, error)))
+    return FALSE;
+
   /*
-   * Find the blob if necessary. This will be cached by the main thread for us on the way out
-   * of the async operation.
+   * Find the blob if necessary. Its id will be cached by the main thread for us on the way out
+   * of the async operation, as will the fact that the file is not found in HEAD.
    */
-  if (!diff->blob)
+  if (diff->blob_oid != NULL)
+    {
+      blob = (GgitBlob *)ggit_repository_lookup (repository, diff->blob_oid, GGIT_TYPE_BLOB, error);
+    }
+  else if (!diff->blob_missing)
     {
       GgitOId *entry_oid = NULL;
       GgitOId *oid = NULL;
-      GgitObject *blob = NULL;
       GgitObject *commit = NULL;
       GgitRef *head = NULL;
       GgitTree *tree = NULL;
       GgitTreeEntry *entry = NULL;
 
-      head = ggit_repository_get_head (diff->repository, error);
+      EGG_COUNTER_INC (blob_lookups);
+
+      head = ggit_repository_get_head (repository, error);
       if (!head)
         goto cleanup;
 
@@ -604,7 +742,7 @@ ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *se
       if (!oid)
         goto cleanup;
 
-      commit = ggit_repository_lookup (diff->repository, oid, GGIT_TYPE_COMMIT, error);
+      commit = ggit_repository_lookup (repository, oid, GGIT_TYPE_COMMIT, error);
       if (!commit)
         goto cleanup;
 
@@ -614,20 +752,23 @@ ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *se
 
       entry = ggit_tree_get_by_path (tree, relative_path, error);
       if (!entry)
-        goto cleanup;
+        {
+          if (g_error_matches (*error, GGIT_ERROR, GGIT_ERROR_NOTFOUND))
+            diff->blob_missing = TRUE;
+          goto cleanup;
+        }
 
       entry_oid = ggit_tree_entry_get_id (entry);
       if (!entry_oid)
         goto cleanup;
 
-      blob = ggit_repository_lookup (diff->repository, entry_oid, GGIT_TYPE_BLOB, error);
+      blob = (GgitBlob *)ggit_repository_lookup (repository, entry_oid, GGIT_TYPE_BLOB, error);
       if (!blob)
         goto cleanup;
 
-      diff->blob = g_object_ref (blob);
+      diff->blob_oid = ggit_oid_copy (entry_oid);
 
     cleanup:
-      g_clear_object (&blob);
       g_clear_pointer (&entry_oid, ggit_oid_free);
       g_clear_pointer (&entry, ggit_tree_entry_unref);
       g_clear_object (&tree);
@@ -636,7 +777,7 @@ ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *se
       g_clear_object (&head);
     }
 
-  if (!diff->blob)
+  if (!blob)
     {
       if ((*error) == NULL)
         g_set_error (error,
@@ -648,39 +789,36 @@ ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *se
 
   data = g_bytes_get_data (diff->content, &data_len);
 
-  ggit_diff_blob_to_buffer (diff->blob, relative_path, data, data_len, relative_path,
+  ggit_diff_blob_to_buffer (blob, relative_path, data, data_len, relative_path,
                             NULL, NULL, NULL, NULL, diff_line_cb, (gpointer)diff->state, error);
 
   return ((*error) == NULL);
 }
 
-static gpointer
-ide_git_buffer_change_monitor_worker (gpointer data)
+static void
+ide_git_buffer_change_monitor_worker (gpointer data,
+                                      gpointer user_data)
 {
-  GAsyncQueue *queue = data;
-  GTask *task;
-
-  g_assert (queue);
-
-  while ((task = g_async_queue_pop (queue)))
-    {
-      IdeGitBufferChangeMonitor *self;
-      DiffTask *diff;
-      GError *error = NULL;
+  g_autoptr(GTask) task = data;
+  IdeGitBufferChangeMonitor *self;
+  DiffTask *diff;
+  GError *error = NULL;
 
-      self = g_task_get_source_object (task);
-      diff = g_task_get_task_data (task);
+  g_assert (G_IS_TASK (task));
 
-      if (!ide_git_buffer_change_monitor_calculate_threaded (self, diff, &error))
-        g_task_return_error (task, error);
-      else
-        g_task_return_pointer (task, g_hash_table_ref (diff->state),
-                               (GDestroyNotify)g_hash_table_unref);
+  self = g_task_get_source_object (task);
+  diff = g_task_get_task_data (task);
 
-      g_object_unref (task);
-    }
+  /* From here on, the main thread will queue a new diff instead of updating this one */
+  g_mutex_lock (&diff_mutex);
+  diff->started = TRUE;
+  g_mutex_unlock (&diff_mutex);
 
-  return NULL;
+  if (!ide_git_buffer_change_monitor_calculate_threaded (self, diff, &error))
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, g_byte_array_ref (diff->state),
+                           (GDestroyNotify)g_byte_array_unref);
 }
 
 static void
@@ -698,8 +836,9 @@ ide_git_buffer_change_monitor_dispose (GObject *object)
 
   g_clear_object (&self->signal_group);
   g_clear_object (&self->vcs_signal_group);
-  g_clear_object (&self->cached_blob);
+  g_clear_pointer (&self->cached_blob_oid, ggit_oid_free);
   g_clear_object (&self->repository);
+  g_clear_pointer (&self->state, g_byte_array_unref);
 
   G_OBJECT_CLASS (ide_git_buffer_change_monitor_parent_class)->dispose (object);
 }
@@ -754,10 +893,11 @@ ide_git_buffer_change_monitor_class_init (IdeGitBufferChangeMonitorClass *klass)
 
   g_object_class_install_properties (object_class, LAST_PROP, properties);
 
-  work_queue = g_async_queue_new ();
-  work_thread = g_thread_new ("IdeGitBufferChangeMonitorWorker",
-                              ide_git_buffer_change_monitor_worker,
-                              work_queue);
+  work_pool = g_thread_pool_new (ide_git_buffer_change_monitor_worker,
+                                 NULL,
+                                 MIN (MAX_DIFF_THREADS, g_get_num_processors ()),
+                                 FALSE,
+                                 NULL);
 }
 
 static void
@@ -340,6 +340,20 @@ symbol_tree_panel_buffer_saved (SymbolTreePanel  *self,
     }
 }
 
+static void
+symbol_tree_panel_buffer_trimmed (SymbolTreePanel  *self,
+                                  IdeBuffer        *buffer,
+                                  IdeBufferManager *buffer_manager)
+{
+  g_assert (SYMBOL_IS_TREE_PANEL (self));
+  g_assert (IDE_IS_BUFFER (buffer));
+  g_assert (IDE_IS_BUFFER_MANAGER (buffer_manager));
+
+  /* The tree is requested again when the buffer is focused */
+  if (buffer != self->last_document)
+    egg_task_cache_evict (self->symbols_cache, buffer);
+}
+
 static void
 symbol_tree_panel_context_set (GtkWidget  *widget,
                                IdeContext *context)
@@ -360,6 +374,12 @@ symbol_tree_panel_context_set (GtkWidget  *widget,
                            G_CALLBACK (symbol_tree_panel_buffer_saved),
                            self,
                            G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (buffer_manager,
+                           "buffer-trimmed",
+                           G_CALLBACK (symbol_tree_panel_buffer_trimmed),
+                           self,
+                           G_CONNECT_SWAPPED);
 }
 
 static void
@@ -0,0 +1,287 @@
+/* gbp-sysprof-marks.c
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "gbp-sysprof-marks"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+#include "gbp-sysprof-marks.h"
+
+typedef struct
+{
+  SpCaptureWriter *writer;
+  GPid             pid;
+} SaveState;
+
+static gchar *
+get_profiles_directory (void)
+{
+  return g_build_filename (g_get_user_cache_dir (),
+                           ide_get_program_name (),
+                           "profiles",
+                           NULL);
+}
+
+/**
+ * gbp_sysprof_marks_new_filename:
+ * @prefix: the prefix for the name of the file, such as "timeline"
+ *
+ * Gets a new filename within the user's cache directory to save the
+ * timeline marks of this process to. Names with the same @prefix sort in
+ * the order they were created.
+ *
+ * Returns: (transfer full): a newly allocated filename.
+ */
+gchar *
+gbp_sysprof_marks_new_filename (const gchar *prefix)
+{
+  g_autoptr(GDateTime) now = NULL;
+  g_autofree gchar *dirname = NULL;
+  g_autofree gchar *stamp = NULL;
+  g_autofree gchar *name = NULL;
+
+  g_return_val_if_fail (prefix != NULL, NULL);
+
+  now = g_date_time_new_now_local ();
+  stamp = g_date_time_format (now, "%Y%m%d-%H%M%S");
+  name = g_strdup_printf ("%s-%s.syscap", prefix, stamp);
+  dirname = get_profiles_directory ();
+
+  return g_build_filename (dirname, name, NULL);
+}
+
+static void
+save_mark_cb (const IdeMark *mark,
+              gpointer       user_data)
+{
+  SaveState *state = user_data;
+  gchar group [32];
+
+  /* On Linux, the main thread has the same id as the process */
+  if (mark->thread_id == state->pid)
+    g_strlcpy (group, "Main Thread", sizeof group);
+  else
+    g_snprintf (group, sizeof group, "Thread %d", mark->thread_id);
+
+  /* Marks are recorded with g_get_monotonic_time(), sysprof uses nsec */
+  sp_capture_writer_add_mark (state->writer,
+                              mark->begin_time * 1000L,
+                              -1,
+                              state->pid,
+                              mark->duration * 1000L,
+                              group,
+                              mark->name,
+                              "");
+}
+
+static void
+gbp_sysprof_marks_save_worker (GTask        *task,
+                               gpointer      source_object,
+                               gpointer      task_data,
+                               GCancellable *cancellable)
+{
+  const gchar *filename = task_data;
+  g_autofree gchar *dirname = NULL;
+  SpCaptureReader *reader;
+  GError *error = NULL;
+  SaveState state;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (filename != NULL);
+
+  dirname = g_path_get_dirname (filename);
+
+  if (g_mkdir_with_parents (dirname, 0750) != 0)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               g_io_error_from_errno (errno),
+                               "Failed to create directory %s",
+                               dirname);
+      return;
+    }
+
+  if (NULL == (state.writer = sp_capture_writer_new (filename, 0)))
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_FAILED,
+                               "Failed to create capture file %s",
+                               filename);
+      return;
+    }
+
+  state.pid = getpid ();
+
+  /*
+   * This only copies the rings of each thread, the threads recording
+   * marks are not blocked while we save.
+   */
+  ide_mark_foreach (save_mark_cb, &state);
+
+  reader = sp_capture_writer_create_reader (state.writer, &error);
+
+  sp_capture_writer_unref (state.writer);
+
+  if (reader == NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, reader, (GDestroyNotify)sp_capture_reader_unref);
+}
+
+/**
+ * gbp_sysprof_marks_save_async:
+ * @filename: the file to save the capture to
+ *
+ * Asynchronously saves the timeline marks recorded by this process with
+ * ide_mark_record() to @filename as a sysprof capture.
+ */
+void
+gbp_sysprof_marks_save_async (const gchar         *filename,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (filename != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gbp_sysprof_marks_save_async);
+  g_task_set_task_data (task, g_strdup (filename), g_free);
+  g_task_run_in_thread (task, gbp_sysprof_marks_save_worker);
+}
+
+/**
+ * gbp_sysprof_marks_save_finish:
+ *
+ * Completes an asynchronous request to gbp_sysprof_marks_save_async().
+ *
+ * Returns: (transfer full): an #SpCaptureReader for the saved capture,
+ *   or %NULL upon failure and @error is set.
+ */
+SpCaptureReader *
+gbp_sysprof_marks_save_finish (GAsyncResult  *result,
+                               GError       **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+typedef struct
+{
+  gchar *prefix;
+  guint  max_files;
+} PruneState;
+
+static void
+prune_state_free (gpointer data)
+{
+  PruneState *state = data;
+
+  g_free (state->prefix);
+  g_slice_free (PruneState, state);
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **)a, *(const gchar **)b);
+}
+
+static void
+gbp_sysprof_marks_prune_worker (GTask        *task,
+                                gpointer      source_object,
+                                gpointer      task_data,
+                                GCancellable *cancellable)
+{
+  PruneState *state = task_data;
+  g_autoptr(GPtrArray) names = NULL;
+  g_autofree gchar *dirname = NULL;
+  g_autofree gchar *prefix = NULL;
+  const gchar *name;
+  GDir *dir;
+  guint i;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (state != NULL);
+
+  dirname = get_profiles_directory ();
+  prefix = g_strconcat (state->prefix, "-", NULL);
+  names = g_ptr_array_new_with_free_func (g_free);
+
+  if (NULL != (dir = g_dir_open (dirname, 0, NULL)))
+    {
+      while (NULL != (name = g_dir_read_name (dir)))
+        {
+          if (g_str_has_prefix (name, prefix) && g_str_has_suffix (name, ".syscap"))
+            g_ptr_array_add (names, g_strdup (name));
+        }
+
+      g_dir_close (dir);
+    }
+
+  /* The names sort by the time they were created, oldest first */
+  g_ptr_array_sort (names, compare_names);
+
+  for (i = 0; i + state->max_files < names->len; i++)
+    {
+      g_autofree gchar *path = g_build_filename (dirname, g_ptr_array_index (names, i), NULL);
+
+      g_debug ("Removing old capture %s", path);
+      g_unlink (path);
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * gbp_sysprof_marks_prune_async:
+ * @prefix: the prefix given to gbp_sysprof_marks_new_filename()
+ * @max_files: the number of captures to keep
+ *
+ * Asynchronously removes the oldest captures saved with @prefix, so that at
+ * most @max_files of them are left.
+ */
+void
+gbp_sysprof_marks_prune_async (const gchar         *prefix,
+                               guint                max_files,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  PruneState *state;
+
+  g_return_if_fail (prefix != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  state = g_slice_new0 (PruneState);
+  state->prefix = g_strdup (prefix);
+  state->max_files = max_files;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gbp_sysprof_marks_prune_async);
+  g_task_set_task_data (task, state, prune_state_free);
+  g_task_run_in_thread (task, gbp_sysprof_marks_prune_worker);
+}
@@ -0,0 +1,42 @@
+/* gbp-sysprof-marks.h
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GBP_SYSPROF_MARKS_H
+#define GBP_SYSPROF_MARKS_H
+
+#include <ide.h>
+#include <sysprof.h>
+
+G_BEGIN_DECLS
+
+gchar           *gbp_sysprof_marks_new_filename (const gchar          *prefix);
+void             gbp_sysprof_marks_save_async   (const gchar          *filename,
+                                                 GCancellable         *cancellable,
+                                                 GAsyncReadyCallback   callback,
+                                                 gpointer              user_data);
+SpCaptureReader *gbp_sysprof_marks_save_finish  (GAsyncResult         *result,
+                                                 GError              **error);
+void             gbp_sysprof_marks_prune_async  (const gchar          *prefix,
+                                                 guint                 max_files,
+                                                 GCancellable         *cancellable,
+                                                 GAsyncReadyCallback   callback,
+                                                 gpointer              user_data);
+
+G_END_DECLS
+
+#endif /* GBP_SYSPROF_MARKS_H */
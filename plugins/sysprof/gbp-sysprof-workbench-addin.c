@@ -19,9 +19,14 @@
 #include <glib/gi18n.h>
 #include <sysprof.h>
 
+#include "gbp-sysprof-marks.h"
 #include "gbp-sysprof-perspective.h"
 #include "gbp-sysprof-workbench-addin.h"
 
+#define LONG_FRAME_CAPTURE_INTERVAL (G_USEC_PER_SEC * 30)
+#define LONG_FRAME_CAPTURE_MAX      5
+#define LONG_FRAME_CAPTURE_PREFIX   "long-frame"
+
 struct _GbpSysprofWorkbenchAddin
 {
   GObject                parent_instance;
@@ -33,6 +38,8 @@ struct _GbpSysprofWorkbenchAddin
   IdeWorkbench          *workbench;
 
   GtkBox                *zoom_controls;
+
+  guint                  long_frame_handler;
 };
 
 static void workbench_addin_iface_init (IdeWorkbenchAddinInterface *iface);
@@ -336,6 +343,99 @@ open_profile_action (GSimpleAction *action,
   gtk_native_dialog_destroy (GTK_NATIVE_DIALOG (native));
 }
 
+static void
+capture_timeline_cb (GObject      *object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  g_autoptr(GbpSysprofWorkbenchAddin) self = user_data;
+  g_autoptr(SpCaptureReader) reader = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (GBP_IS_SYSPROF_WORKBENCH_ADDIN (self));
+
+  if (NULL == (reader = gbp_sysprof_marks_save_finish (result, &error)))
+    {
+      g_warning ("Failed to save timeline: %s", error->message);
+      return;
+    }
+
+  if (self->workbench == NULL)
+    return;
+
+  gbp_sysprof_perspective_set_profiler (self->perspective, NULL);
+  gbp_sysprof_perspective_set_reader (self->perspective, reader);
+
+  ide_workbench_set_visible_perspective (self->workbench, IDE_PERSPECTIVE (self->perspective));
+
+  gbp_sysprof_workbench_addin_update_controls (self);
+}
+
+static void
+capture_timeline_action (GSimpleAction *action,
+                         GVariant      *variant,
+                         gpointer       user_data)
+{
+  GbpSysprofWorkbenchAddin *self = user_data;
+  g_autofree gchar *filename = NULL;
+
+  g_assert (GBP_IS_SYSPROF_WORKBENCH_ADDIN (self));
+
+  filename = gbp_sysprof_marks_new_filename ("timeline");
+
+  gbp_sysprof_marks_save_async (filename,
+                                NULL,
+                                capture_timeline_cb,
+                                g_object_ref (self));
+}
+
+static void
+long_frame_saved_cb (GObject      *object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  g_autoptr(SpCaptureReader) reader = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *filename = user_data;
+
+  if (NULL == (reader = gbp_sysprof_marks_save_finish (result, &error)))
+    {
+      g_warning ("Failed to save timeline: %s", error->message);
+      return;
+    }
+
+  g_debug ("Timeline leading up to a long frame saved to %s", filename);
+
+  /* Only keep the most recent captures, nobody asked for these */
+  gbp_sysprof_marks_prune_async (LONG_FRAME_CAPTURE_PREFIX, LONG_FRAME_CAPTURE_MAX, NULL, NULL, NULL);
+}
+
+static void
+long_frame_cb (gint64   begin_time,
+               gint64   duration,
+               gpointer user_data)
+{
+  static gint64 last_capture;
+  gint64 now = g_get_monotonic_time ();
+  gchar *filename;
+
+  /*
+   * Save the timeline without switching perspectives, the user did not
+   * ask for it. Stalls tend to come in bursts (such as while loading a
+   * project), so only save one every so often. This is shared by all
+   * workbenches since the marks are process wide.
+   */
+  if (last_capture != 0 && (now - last_capture) < LONG_FRAME_CAPTURE_INTERVAL)
+    return;
+
+  last_capture = now;
+
+  IDE_TRACE_MSG ("Main loop stalled for %"G_GINT64_FORMAT" usec, saving timeline", duration);
+
+  filename = gbp_sysprof_marks_new_filename (LONG_FRAME_CAPTURE_PREFIX);
+  gbp_sysprof_marks_save_async (filename, NULL, long_frame_saved_cb, filename);
+}
+
 static void
 gbp_sysprof_workbench_addin_finalize (GObject *object)
 {
@@ -359,6 +459,7 @@ gbp_sysprof_workbench_addin_init (GbpSysprofWorkbenchAddin *self)
 {
   static const GActionEntry entries[] = {
     { "open-profile", open_profile_action },
+    { "capture-timeline", capture_timeline_action },
   };
 
   self->actions = g_simple_action_group_new ();
@@ -486,6 +587,12 @@ gbp_sysprof_workbench_addin_load (IdeWorkbenchAddin *addin,
                                    "visible", TRUE,
                                    NULL));
   ide_workbench_header_bar_insert_left (header, GTK_WIDGET (self->zoom_controls), GTK_PACK_START, 100);
+
+  /*
+   * Save the timeline marks whenever the main loop stalls so that there
+   * is something to look at after the fact.
+   */
+  self->long_frame_handler = ide_mark_add_long_frame_func (long_frame_cb, NULL, NULL);
 }
 
 static void
@@ -508,6 +615,12 @@ gbp_sysprof_workbench_addin_unload (IdeWorkbenchAddin *addin,
 
   gtk_widget_destroy (GTK_WIDGET (self->zoom_controls));
 
+  if (self->long_frame_handler != 0)
+    {
+      ide_mark_remove_long_frame_func (self->long_frame_handler);
+      self->long_frame_handler = 0;
+    }
+
   self->zoom_controls = NULL;
   self->perspective = NULL;
   self->workbench = NULL;
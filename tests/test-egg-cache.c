@@ -1,3 +1,4 @@
+#include "egg-memory-pressure.h"
 #include "egg-task-cache.h"
 
 static GMainLoop *main_loop;
@@ -58,11 +59,126 @@ test_task_cache (void)
   g_assert (foo == NULL);
 }
 
+static void
+populate_cost_callback (EggTaskCache  *self,
+                        gconstpointer  key,
+                        GTask         *task,
+                        gpointer       user_data)
+{
+  g_task_return_pointer (task, g_object_new (G_TYPE_OBJECT, NULL), g_object_unref);
+}
+
+static gsize
+cost_callback (gconstpointer value,
+               gpointer      user_data)
+{
+  return 10;
+}
+
+static void
+get_cost_cb (GObject      *object,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+  GError *error = NULL;
+  GObject *ret;
+  guint *pending = user_data;
+
+  ret = egg_task_cache_get_finish (cache, result, &error);
+  g_assert_no_error (error);
+  g_assert (ret != NULL);
+  g_object_unref (ret);
+
+  if (--(*pending) == 0)
+    g_main_loop_quit (main_loop);
+}
+
+static void
+test_task_cache_cost (void)
+{
+  static const gchar *keys[] = { "a", "b", "c", "d" };
+  guint pending = G_N_ELEMENTS (keys);
+  guint i;
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  cache = egg_task_cache_new (g_str_hash,
+                              g_str_equal,
+                              (GBoxedCopyFunc)g_strdup,
+                              (GBoxedFreeFunc)g_free,
+                              g_object_ref,
+                              g_object_unref,
+                              0,
+                              populate_cost_callback, NULL, NULL);
+  egg_task_cache_set_cost_func (cache, cost_callback, NULL, NULL);
+  egg_task_cache_set_max_cost (cache, 25);
+  egg_task_cache_pin (cache, "a");
+
+  for (i = 0; i < G_N_ELEMENTS (keys); i++)
+    egg_task_cache_get_async (cache, keys [i], FALSE, NULL, get_cost_cb, &pending);
+
+  g_main_loop_run (main_loop);
+  g_main_loop_unref (main_loop);
+
+  g_assert_cmpint (egg_task_cache_get_cost (cache), <=, 25);
+  g_assert (egg_task_cache_peek (cache, "a") != NULL);
+  g_assert (egg_task_cache_peek (cache, "d") != NULL);
+
+  egg_task_cache_unpin (cache, "a");
+  egg_task_cache_set_max_cost (cache, 10);
+
+  g_assert_cmpint (egg_task_cache_get_cost (cache), ==, 10);
+
+  g_clear_object (&cache);
+}
+
+static void
+test_task_cache_pressure (void)
+{
+  static const gchar *keys[] = { "a", "b", "c", "d" };
+  guint pending = G_N_ELEMENTS (keys);
+  guint i;
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  cache = egg_task_cache_new (g_str_hash,
+                              g_str_equal,
+                              (GBoxedCopyFunc)g_strdup,
+                              (GBoxedFreeFunc)g_free,
+                              g_object_ref,
+                              g_object_unref,
+                              0,
+                              populate_cost_callback, NULL, NULL);
+  egg_task_cache_set_evict_policy (cache, EGG_TASK_CACHE_EVICT_LFU);
+
+  for (i = 0; i < G_N_ELEMENTS (keys); i++)
+    egg_task_cache_get_async (cache, keys [i], FALSE, NULL, get_cost_cb, &pending);
+
+  g_main_loop_run (main_loop);
+  g_main_loop_unref (main_loop);
+
+  /* "a" and "b" are used more frequently than "c" and "d". */
+  for (i = 0; i < 3; i++)
+    {
+      g_assert (egg_task_cache_peek (cache, "a") != NULL);
+      g_assert (egg_task_cache_peek (cache, "b") != NULL);
+    }
+
+  g_signal_emit_by_name (egg_memory_pressure_get_default (), "pressure");
+
+  g_assert (egg_task_cache_peek (cache, "a") != NULL);
+  g_assert (egg_task_cache_peek (cache, "b") != NULL);
+  g_assert (egg_task_cache_peek (cache, "c") == NULL);
+  g_assert (egg_task_cache_peek (cache, "d") == NULL);
+
+  g_clear_object (&cache);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/Egg/TaskCache/basic", test_task_cache);
+  g_test_add_func ("/Egg/TaskCache/cost", test_task_cache_cost);
+  g_test_add_func ("/Egg/TaskCache/pressure", test_task_cache_pressure);
   return g_test_run ();
 }
@@ -158,6 +158,191 @@ test_EggHeap_extract_int (void)
    egg_heap_unref (heap);
 }
 
+typedef struct
+{
+   guint handle;
+   gint64 size;
+   guint id;
+} RefEntry;
+
+static void
+ref_remove_id (GArray *ref,
+               guint   id)
+{
+   guint i;
+
+   for (i = 0; i < ref->len; i++) {
+      if (g_array_index (ref, RefEntry, i).id == id) {
+         g_array_remove_index_fast (ref, i);
+         return;
+      }
+   }
+
+   g_assert_not_reached ();
+}
+
+static gint64
+ref_min (GArray *ref)
+{
+   gint64 min = G_MAXINT64;
+   guint i;
+
+   for (i = 0; i < ref->len; i++)
+      min = MIN (min, g_array_index (ref, RefEntry, i).size);
+
+   return min;
+}
+
+/*
+ * Performs random operations on both the heap and a naive reference
+ * implementation (an unsorted array), making sure they always agree.
+ */
+static void
+test_EggHeap_handles_random (void)
+{
+   EggHeap *heap;
+   GArray *ref;
+   guint next_id = 1;
+   gint64 last;
+   Tuple t;
+   gint i;
+
+   heap = egg_heap_new (sizeof (Tuple), cmptuple_rev);
+   ref = g_array_new (FALSE, FALSE, sizeof (RefEntry));
+
+   for (i = 0; i < 20000; i++) {
+      RefEntry *entry = NULL;
+      gint op = g_test_rand_int_range (0, 6);
+
+      if (ref->len > 0)
+         entry = &g_array_index (ref, RefEntry, g_test_rand_int_range (0, ref->len));
+      else
+         op = 0;
+
+      switch (op) {
+      case 0:
+      case 1: {
+         RefEntry e;
+
+         e.id = next_id++;
+         e.size = g_test_rand_int_range (0, 1000);
+         t.size = e.size;
+         t.pointer = GUINT_TO_POINTER (e.id);
+         e.handle = egg_heap_insert_with_handle (heap, &t);
+         g_assert_cmpint (e.handle, !=, 0);
+         g_array_append_val (ref, e);
+         break;
+      }
+
+      case 2:
+         entry->size -= g_test_rand_int_range (0, 100);
+         t.size = entry->size;
+         t.pointer = GUINT_TO_POINTER (entry->id);
+         egg_heap_increase_key (heap, entry->handle, &t);
+         break;
+
+      case 3:
+         entry->size += g_test_rand_int_range (0, 100);
+         t.size = entry->size;
+         t.pointer = GUINT_TO_POINTER (entry->id);
+         egg_heap_decrease_key (heap, entry->handle, &t);
+         break;
+
+      case 4:
+         g_assert (egg_heap_remove (heap, entry->handle, &t));
+         g_assert_cmpint (t.size, ==, entry->size);
+         g_assert_cmpint (GPOINTER_TO_UINT (t.pointer), ==, entry->id);
+         ref_remove_id (ref, entry->id);
+         break;
+
+      case 5:
+         g_assert (egg_heap_extract (heap, &t));
+         g_assert_cmpint (t.size, ==, ref_min (ref));
+         ref_remove_id (ref, GPOINTER_TO_UINT (t.pointer));
+         break;
+
+      default:
+         g_assert_not_reached ();
+      }
+
+      g_assert_cmpint (heap->len, ==, ref->len);
+
+      if (ref->len > 0) {
+         RefEntry *check;
+         Tuple *found;
+
+         g_assert_cmpint (egg_heap_peek (heap, Tuple).size, ==, ref_min (ref));
+
+         check = &g_array_index (ref, RefEntry, g_test_rand_int_range (0, ref->len));
+         found = egg_heap_lookup (heap, check->handle);
+         g_assert (found != NULL);
+         g_assert_cmpint (found->size, ==, check->size);
+         g_assert_cmpint (GPOINTER_TO_UINT (found->pointer), ==, check->id);
+      }
+   }
+
+   last = G_MININT64;
+
+   while (heap->len > 0) {
+      g_assert (egg_heap_extract (heap, &t));
+      g_assert_cmpint (t.size, >=, last);
+      ref_remove_id (ref, GPOINTER_TO_UINT (t.pointer));
+      last = t.size;
+   }
+
+   g_assert_cmpint (ref->len, ==, 0);
+
+   g_array_unref (ref);
+   egg_heap_unref (heap);
+}
+
+static void
+test_EggHeap_benchmark (void)
+{
+   EggHeap *heap;
+   guint *handles;
+   gdouble elapsed;
+   gint n_items = 1000000;
+   Tuple t;
+   gint i;
+
+   heap = egg_heap_new (sizeof (Tuple), cmptuple_rev);
+   handles = g_new (guint, n_items);
+
+   g_test_timer_start ();
+
+   for (i = 0; i < n_items; i++) {
+      t.size = g_test_rand_int_range (0, G_MAXINT32 / 2);
+      t.pointer = GINT_TO_POINTER (i);
+      handles [i] = egg_heap_insert_with_handle (heap, &t);
+   }
+
+   elapsed = g_test_timer_elapsed ();
+   g_test_maximized_result (n_items / elapsed, "inserts/sec: %.0f", n_items / elapsed);
+
+   g_test_timer_start ();
+
+   for (i = 0; i < n_items; i++) {
+      Tuple *item = egg_heap_lookup (heap, handles [i]);
+
+      item->size += g_test_rand_int_range (0, 1000);
+      egg_heap_decrease_key (heap, handles [i], NULL);
+   }
+
+   elapsed = g_test_timer_elapsed ();
+   g_test_maximized_result (n_items / elapsed, "decrease_key/sec: %.0f", n_items / elapsed);
+
+   g_test_timer_start ();
+
+   while (egg_heap_extract (heap, NULL)) { }
+
+   elapsed = g_test_timer_elapsed ();
+   g_test_maximized_result (n_items / elapsed, "extracts/sec: %.0f", n_items / elapsed);
+
+   g_free (handles);
+   egg_heap_unref (heap);
+}
+
 int
 main (gint   argc,
       gchar *argv[])
@@ -168,6 +353,10 @@ main (gint   argc,
    g_test_add_func ("/EggHeap/insert_and_extract<gpointer>", test_EggHeap_insert_val_ptr);
    g_test_add_func ("/EggHeap/insert_and_extract<Tuple>", test_EggHeap_insert_val_tuple);
    g_test_add_func ("/EggHeap/extract_index<int>", test_EggHeap_extract_int);
+   g_test_add_func ("/EggHeap/handles<Tuple>", test_EggHeap_handles_random);
+
+   if (g_test_perf ())
+      g_test_add_func ("/EggHeap/benchmark<Tuple>", test_EggHeap_benchmark);
 
    return g_test_run ();
 }
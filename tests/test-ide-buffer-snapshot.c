@@ -0,0 +1,314 @@
+/* test-ide-buffer-snapshot.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+#include <string.h>
+
+#include "buffers/ide-buffer-snapshot.h"
+
+/* Must match CHUNK_SIZE in ide-buffer-snapshot.c */
+#define CHUNK_SIZE 4096
+#define N_STEPS    2000
+#define MAX_HELD   4
+
+/*
+ * A snapshot handed out to a consumer, along with what its contents must
+ * remain no matter what happens to the buffer afterwards.
+ */
+typedef struct
+{
+  IdeBufferSnapshot *snapshot;
+  gchar             *expected;
+  gsize              expected_len;
+} Held;
+
+static const gchar *pieces[] = {
+  "a", "b", "z", " ", "\n", "\t", "{", "}",
+  "\xc3\xa9",         /* é, 2 bytes */
+  "\xe2\x82\xac",     /* €, 3 bytes */
+  "\xf0\x9d\x84\x9e", /* 𝄞, 4 bytes */
+};
+
+static void
+assert_snapshot_equals (IdeBufferSnapshot *snapshot,
+                        const gchar       *expected,
+                        gsize              expected_len,
+                        gboolean           trailing_newline)
+{
+  const gchar *data;
+  GBytes *bytes;
+  gsize len;
+
+  g_assert_cmpint (_ide_buffer_snapshot_get_length (snapshot), ==, expected_len + !!trailing_newline);
+
+  bytes = _ide_buffer_snapshot_get_bytes (snapshot);
+  data = g_bytes_get_data (bytes, &len);
+
+  g_assert_cmpint (len, ==, expected_len + !!trailing_newline);
+  g_assert (memcmp (data, expected, expected_len) == 0);
+
+  if (trailing_newline)
+    g_assert_cmpint (data [expected_len], ==, '\n');
+
+  /* The contents are always followed by a \0 that is not part of them */
+  g_assert_cmpint (data [len], ==, '\0');
+
+  g_assert (_ide_buffer_snapshot_peek_bytes (snapshot) == bytes);
+}
+
+/*
+ * Creates random text mixing single and multi-byte characters. Long runs
+ * are occasionally generated so that chunks get split.
+ */
+static GString *
+random_text (void)
+{
+  GString *str = g_string_new (NULL);
+  guint n_chars;
+  guint i;
+
+  if (g_test_rand_int_range (0, 10) == 0)
+    n_chars = g_test_rand_int_range (CHUNK_SIZE, CHUNK_SIZE * 3);
+  else
+    n_chars = g_test_rand_int_range (1, 64);
+
+  for (i = 0; i < n_chars; i++)
+    g_string_append (str, pieces [g_test_rand_int_range (0, G_N_ELEMENTS (pieces))]);
+
+  return str;
+}
+
+/*
+ * Picks a character offset within @text. Half of the time it is near a
+ * multiple of the chunk size so that edits land on chunk boundaries,
+ * which is where the bookkeeping is most likely to go wrong.
+ */
+static gsize
+random_offset (GString *text)
+{
+  gsize n_chars = g_utf8_strlen (text->str, text->len);
+  gint64 offset;
+
+  if (n_chars == 0)
+    return 0;
+
+  switch (g_test_rand_int_range (0, 4))
+    {
+    case 0:
+      offset = g_test_rand_int_range (0, n_chars + 1);
+      break;
+
+    case 1:
+      offset = g_test_rand_bit () ? 0 : n_chars;
+      break;
+
+    default:
+      offset = (gint64)(g_test_rand_int_range (0, n_chars / (CHUNK_SIZE / 4) + 1) * (CHUNK_SIZE / 4))
+             + g_test_rand_int_range (-2, 3);
+      break;
+    }
+
+  return CLAMP (offset, 0, (gint64)n_chars);
+}
+
+static gsize
+byte_offset (GString *text,
+             gsize    char_offset)
+{
+  return g_utf8_offset_to_pointer (text->str, char_offset) - text->str;
+}
+
+static void
+held_free (Held *held)
+{
+  _ide_buffer_snapshot_unref (held->snapshot);
+  g_free (held->expected);
+  g_slice_free (Held, held);
+}
+
+static void
+assert_held (GPtrArray *held)
+{
+  guint i;
+
+  for (i = 0; i < held->len; i++)
+    {
+      Held *h = g_ptr_array_index (held, i);
+
+      assert_snapshot_equals (h->snapshot, h->expected, h->expected_len, FALSE);
+    }
+}
+
+/*
+ * Applies random inserts, deletes and copy-on-write snapshots, and checks
+ * the flattened contents against a GString after every step.
+ */
+static void
+run_random (IdeBufferSnapshot *snapshot,
+            GString           *text)
+{
+  g_autoptr(GPtrArray) held = NULL;
+  gboolean trailing_newline = FALSE;
+  guint i;
+
+  held = g_ptr_array_new_with_free_func ((GDestroyNotify)held_free);
+
+  for (i = 0; i < N_STEPS; i++)
+    {
+      switch (g_test_rand_int_range (0, 10))
+        {
+        case 0: case 1: case 2: case 3:
+          {
+            g_autoptr(GString) insert = random_text ();
+            gsize offset = random_offset (text);
+
+            snapshot = _ide_buffer_snapshot_insert (snapshot, offset, insert->str, insert->len);
+            g_string_insert_len (text, byte_offset (text, offset), insert->str, insert->len);
+          }
+          break;
+
+        case 4: case 5: case 6:
+          {
+            gsize begin = random_offset (text);
+            gsize end = random_offset (text);
+            gsize b;
+            gsize e;
+
+            if (begin > end)
+              {
+                gsize tmp = begin;
+                begin = end;
+                end = tmp;
+              }
+
+            /* Mostly small deletions, but sometimes across several chunks */
+            if (g_test_rand_int_range (0, 4) != 0)
+              end = MIN (end, begin + g_test_rand_int_range (1, 16));
+
+            snapshot = _ide_buffer_snapshot_delete (snapshot, begin, end);
+
+            b = byte_offset (text, begin);
+            e = byte_offset (text, end);
+            g_string_erase (text, b, e - b);
+          }
+          break;
+
+        case 7:
+          /* Hand out a reference, as the buffer does for IdeUnsavedFiles */
+          if (held->len < MAX_HELD && !trailing_newline)
+            {
+              Held *h = g_slice_new0 (Held);
+
+              h->snapshot = _ide_buffer_snapshot_ref (snapshot);
+              h->expected = g_memdup (text->str, text->len);
+              h->expected_len = text->len;
+
+              g_ptr_array_add (held, h);
+            }
+          else if (held->len > 0)
+            {
+              g_ptr_array_remove_index (held, g_test_rand_int_range (0, held->len));
+            }
+          break;
+
+        case 8:
+          trailing_newline = !trailing_newline;
+          snapshot = _ide_buffer_snapshot_set_trailing_newline (snapshot, trailing_newline);
+          break;
+
+        case 9:
+          /* Flatten, so that the cached contents must be dropped on the next edit */
+          _ide_buffer_snapshot_get_bytes (snapshot);
+          break;
+
+        default:
+          g_assert_not_reached ();
+        }
+
+      assert_snapshot_equals (snapshot, text->str, text->len, trailing_newline);
+      assert_held (held);
+    }
+
+  _ide_buffer_snapshot_unref (snapshot);
+}
+
+static void
+test_buffer_snapshot_random (void)
+{
+  g_autoptr(GString) text = g_string_new (NULL);
+
+  run_random (_ide_buffer_snapshot_new (), text);
+}
+
+static void
+test_buffer_snapshot_random_from_bytes (void)
+{
+  g_autoptr(GString) text = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  guint i;
+
+  /* Start out larger than a chunk so that the first edit has to split it */
+  text = g_string_new (NULL);
+  for (i = 0; text->len < CHUNK_SIZE * 3; i++)
+    g_string_append (text, pieces [i % G_N_ELEMENTS (pieces)]);
+
+  /* Like ide_buffer_get_content(), the data is followed by a \0 */
+  bytes = g_bytes_new_take (g_strndup (text->str, text->len), text->len);
+
+  run_random (_ide_buffer_snapshot_new_for_bytes (bytes), text);
+}
+
+static void
+test_buffer_snapshot_copy_on_write (void)
+{
+  IdeBufferSnapshot *snapshot;
+  IdeBufferSnapshot *copy;
+  IdeBufferSnapshot *edited;
+
+  snapshot = _ide_buffer_snapshot_insert (_ide_buffer_snapshot_new (), 0, "hello world", 11);
+  assert_snapshot_equals (snapshot, "hello world", 11, FALSE);
+
+  /* Edits are applied in place while there is a single reference */
+  edited = _ide_buffer_snapshot_insert (snapshot, 5, ",", 1);
+  g_assert (edited == snapshot);
+  snapshot = edited;
+
+  copy = _ide_buffer_snapshot_ref (snapshot);
+
+  /* Once shared, the next edit must leave the other reference alone */
+  edited = _ide_buffer_snapshot_delete (snapshot, 0, 7);
+  g_assert (edited != copy);
+  snapshot = edited;
+
+  assert_snapshot_equals (snapshot, "world", 5, FALSE);
+  assert_snapshot_equals (copy, "hello, world", 12, FALSE);
+
+  _ide_buffer_snapshot_unref (snapshot);
+  _ide_buffer_snapshot_unref (copy);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Ide/BufferSnapshot/copy-on-write", test_buffer_snapshot_copy_on_write);
+  g_test_add_func ("/Ide/BufferSnapshot/random", test_buffer_snapshot_random);
+  g_test_add_func ("/Ide/BufferSnapshot/random-from-bytes", test_buffer_snapshot_random_from_bytes);
+  return g_test_run ();
+}
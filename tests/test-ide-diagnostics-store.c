@@ -0,0 +1,207 @@
+/* test-ide-diagnostics-store.c
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+
+#include "diagnostics/ide-diagnostics-store.h"
+
+static GVariant *
+make_diagnostics (guint line,
+                  const gchar *text)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uuuusa(uuuu))"));
+  g_variant_builder_add_parsed (&builder, "(%u, %u, uint32 0, uint32 0, %s, @a(uuuu) [(%u, uint32 0, %u, uint32 4)])",
+                                IDE_DIAGNOSTIC_WARNING, line, text, line, line);
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+test_diagnostics_store_lookup (void)
+{
+  g_autoptr(IdeDiagnosticsStore) store = _ide_diagnostics_store_new ();
+  g_autoptr(IdeDiagnostics) diagnostics = NULL;
+  g_autoptr(IdeDiagnostics) other = NULL;
+  g_autoptr(GVariant) found = NULL;
+  gboolean needs_validate = FALSE;
+
+  g_assert (!_ide_diagnostics_store_get_dirty (store));
+
+  _ide_diagnostics_store_insert (store, "file:///a.c", "aaaa", 100, FALSE, make_diagnostics (1, "a"));
+  _ide_diagnostics_store_insert (store, "file:///b.c", "bbbb", 0, FALSE, make_diagnostics (2, "b"));
+
+  g_assert (_ide_diagnostics_store_get_dirty (store));
+  g_assert_cmpint (_ide_diagnostics_store_get_size (store), ==, 2);
+
+  /* The checksum must match the content */
+  found = _ide_diagnostics_store_lookup (store, "file:///a.c", "aaaa");
+  g_assert (found != NULL);
+  g_assert_cmpint (g_variant_n_children (found), ==, 1);
+  g_clear_pointer (&found, g_variant_unref);
+
+  g_assert (_ide_diagnostics_store_lookup (store, "file:///a.c", "cccc") == NULL);
+  g_assert (_ide_diagnostics_store_lookup (store, "file:///c.c", "aaaa") == NULL);
+
+  /* For the file on disk, entries must have been checked against it */
+  diagnostics = _ide_diagnostics_store_lookup_on_disk (store, "file:///a.c", NULL, &needs_validate);
+  g_assert (diagnostics != NULL);
+  g_assert (!needs_validate);
+  g_assert_cmpint (ide_diagnostics_get_size (diagnostics), ==, 1);
+
+  /* The decoded diagnostics are shared until the entry is validated again */
+  other = _ide_diagnostics_store_lookup_on_disk (store, "file:///a.c", NULL, &needs_validate);
+  g_assert (other == diagnostics);
+  g_clear_pointer (&other, ide_diagnostics_unref);
+
+  g_assert (_ide_diagnostics_store_lookup_on_disk (store, "file:///b.c", NULL, &needs_validate) == NULL);
+  g_assert (needs_validate);
+
+  found = _ide_diagnostics_store_lookup (store, "file:///b.c", "bbbb");
+  g_assert (found != NULL);
+  g_clear_pointer (&found, g_variant_unref);
+
+  _ide_diagnostics_store_validate (store, "file:///b.c", "bbbb", 100);
+  other = _ide_diagnostics_store_lookup_on_disk (store, "file:///b.c", NULL, &needs_validate);
+  g_assert (other != NULL);
+  g_assert (!needs_validate);
+  g_clear_pointer (&other, ide_diagnostics_unref);
+
+  /* A mismatch is remembered until the file is validated again */
+  _ide_diagnostics_store_validate (store, "file:///a.c", "changed", 200);
+  g_assert (_ide_diagnostics_store_lookup_on_disk (store, "file:///a.c", NULL, &needs_validate) == NULL);
+  g_assert (!needs_validate);
+
+  _ide_diagnostics_store_validate (store, "file:///a.c", "aaaa", 300);
+  other = _ide_diagnostics_store_lookup_on_disk (store, "file:///a.c", NULL, &needs_validate);
+  g_assert (other != NULL);
+  g_assert (other != diagnostics);
+  g_clear_pointer (&other, ide_diagnostics_unref);
+
+  /* Files that no longer exist are dropped */
+  _ide_diagnostics_store_validate (store, "file:///b.c", NULL, 0);
+  g_assert (_ide_diagnostics_store_lookup (store, "file:///b.c", "bbbb") == NULL);
+  g_assert_cmpint (_ide_diagnostics_store_get_size (store), ==, 1);
+}
+
+static void
+test_diagnostics_store_drop_build (void)
+{
+  g_autoptr(IdeDiagnosticsStore) store = _ide_diagnostics_store_new ();
+  g_auto(GStrv) uris = NULL;
+
+  _ide_diagnostics_store_insert (store, "file:///a.c", "aaaa", 100, TRUE, make_diagnostics (1, "a"));
+  _ide_diagnostics_store_insert (store, "file:///b.c", "bbbb", 100, TRUE, make_diagnostics (2, "b"));
+  _ide_diagnostics_store_insert (store, "file:///c.c", "cccc", 100, FALSE, make_diagnostics (3, "c"));
+
+  uris = _ide_diagnostics_store_get_build_uris (store);
+  g_assert_cmpint (g_strv_length (uris), ==, 2);
+
+  /* Unchanged files might not have been compiled, so they are kept */
+  _ide_diagnostics_store_drop_build (store, "file:///a.c", "aaaa");
+  g_assert_cmpint (_ide_diagnostics_store_get_size (store), ==, 3);
+
+  _ide_diagnostics_store_drop_build (store, "file:///a.c", "changed");
+  g_assert_cmpint (_ide_diagnostics_store_get_size (store), ==, 2);
+
+  _ide_diagnostics_store_drop_build (store, "file:///b.c", NULL);
+  g_assert_cmpint (_ide_diagnostics_store_get_size (store), ==, 1);
+
+  /* Entries from the providers are not the build's to drop */
+  _ide_diagnostics_store_drop_build (store, "file:///c.c", "changed");
+  g_assert_cmpint (_ide_diagnostics_store_get_size (store), ==, 1);
+}
+
+static void
+test_diagnostics_store_serialize (void)
+{
+  g_autoptr(IdeDiagnosticsStore) store = _ide_diagnostics_store_new ();
+  g_autoptr(IdeDiagnosticsStore) copy = _ide_diagnostics_store_new ();
+  g_autoptr(GVariant) found = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  g_auto(GStrv) uris = NULL;
+  const gchar *text = NULL;
+  guint line = 0;
+  gboolean r;
+
+  _ide_diagnostics_store_insert (store, "file:///a.c", "aaaa", 100, FALSE, make_diagnostics (10, "unused variable"));
+  _ide_diagnostics_store_insert (store, "file:///b.c", "bbbb", 100, TRUE, make_diagnostics (20, "implicit declaration"));
+
+  bytes = _ide_diagnostics_store_serialize (store);
+  g_assert (bytes != NULL);
+  g_assert (!_ide_diagnostics_store_get_dirty (store));
+
+  r = _ide_diagnostics_store_load (copy, bytes, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  g_assert_cmpint (_ide_diagnostics_store_get_size (copy), ==, 2);
+  g_assert (!_ide_diagnostics_store_get_dirty (copy));
+
+  uris = _ide_diagnostics_store_get_uris (copy);
+  g_assert_cmpint (g_strv_length (uris), ==, 2);
+  g_clear_pointer (&uris, g_strfreev);
+
+  /* Loaded entries are not trusted until they are validated */
+  g_assert (_ide_diagnostics_store_lookup_on_disk (copy, "file:///a.c", NULL, NULL) == NULL);
+
+  /* Only the entries from builds are dropped when a build reports nothing */
+  uris = _ide_diagnostics_store_get_build_uris (copy);
+  g_assert_cmpint (g_strv_length (uris), ==, 1);
+  g_assert_cmpstr (uris [0], ==, "file:///b.c");
+  g_clear_pointer (&uris, g_strfreev);
+
+  found = _ide_diagnostics_store_lookup (copy, "file:///a.c", "aaaa");
+  g_assert (found != NULL);
+  g_variant_get_child (found, 0, "(uuuu&s@a(uuuu))", NULL, &line, NULL, NULL, &text, NULL);
+  g_assert_cmpint (line, ==, 10);
+  g_assert_cmpstr (text, ==, "unused variable");
+}
+
+static void
+test_diagnostics_store_load_invalid (void)
+{
+  g_autoptr(IdeDiagnosticsStore) store = _ide_diagnostics_store_new ();
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean r;
+
+  _ide_diagnostics_store_insert (store, "file:///a.c", "aaaa", 100, FALSE, make_diagnostics (1, "a"));
+
+  bytes = g_bytes_new_static ("garbage", 7);
+  r = _ide_diagnostics_store_load (store, bytes, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_assert (!r);
+
+  /* A failed load leaves the store as it was */
+  g_assert_cmpint (_ide_diagnostics_store_get_size (store), ==, 1);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Ide/DiagnosticsStore/lookup", test_diagnostics_store_lookup);
+  g_test_add_func ("/Ide/DiagnosticsStore/drop-build", test_diagnostics_store_drop_build);
+  g_test_add_func ("/Ide/DiagnosticsStore/serialize", test_diagnostics_store_serialize);
+  g_test_add_func ("/Ide/DiagnosticsStore/load-invalid", test_diagnostics_store_load_invalid);
+  return g_test_run ();
+}
@@ -0,0 +1,117 @@
+/* test-ide-diagnostics.c
+ *
+ * Copyright (C) 2016 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+
+#include "ide-internal.h"
+
+static void
+add_diagnostic (GPtrArray *ar,
+                IdeFile   *file,
+                guint      line,
+                guint      line_offset)
+{
+  g_autoptr(IdeSourceLocation) location = NULL;
+
+  location = ide_source_location_new (file, line, line_offset, 0);
+  g_ptr_array_add (ar, ide_diagnostic_new (IDE_DIAGNOSTIC_WARNING, "warning", location));
+}
+
+static void
+test_diagnostics_lookup_line (void)
+{
+  g_autoptr(IdeContext) dummy = NULL;
+  g_autoptr(IdeDiagnostics) diagnostics = NULL;
+  g_autoptr(IdeFile) file = NULL;
+  g_autoptr(GFile) gfile = NULL;
+  GPtrArray *ar;
+  gsize begin = 0;
+  gsize end = 0;
+  guint prev_line = 0;
+  guint i;
+
+  dummy = g_object_new (IDE_TYPE_CONTEXT, NULL);
+  gfile = g_file_new_for_path ("test.c");
+  file = g_object_new (IDE_TYPE_FILE,
+                       "context", dummy,
+                       "file", gfile,
+                       "path", "test.c",
+                       NULL);
+
+  ar = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_diagnostic_unref);
+  add_diagnostic (ar, file, 30, 2);
+  add_diagnostic (ar, file, 4, 10);
+  add_diagnostic (ar, file, 30, 0);
+  add_diagnostic (ar, file, 12, 1);
+  add_diagnostic (ar, file, 4, 3);
+  g_ptr_array_add (ar, ide_diagnostic_new (IDE_DIAGNOSTIC_ERROR, "no location", NULL));
+  diagnostics = ide_diagnostics_new (ar);
+
+  /* Unsorted diagnostics must be scanned by the caller */
+  g_assert (!_ide_diagnostics_lookup_line (diagnostics, 4, &begin, &end));
+
+  _ide_diagnostics_sort (diagnostics);
+
+  for (i = 0; i < 5; i++)
+    {
+      IdeSourceLocation *location;
+
+      location = ide_diagnostic_get_location (ide_diagnostics_index (diagnostics, i));
+      g_assert (location != NULL);
+      g_assert_cmpint (ide_source_location_get_line (location), >=, prev_line);
+      prev_line = ide_source_location_get_line (location);
+    }
+
+  g_assert (ide_diagnostic_get_location (ide_diagnostics_index (diagnostics, 5)) == NULL);
+
+  g_assert (_ide_diagnostics_lookup_line (diagnostics, 4, &begin, &end));
+  g_assert_cmpint (begin, ==, 0);
+  g_assert_cmpint (end, ==, 2);
+  g_assert_cmpint (ide_source_location_get_line_offset (ide_diagnostic_get_location (ide_diagnostics_index (diagnostics, 0))), ==, 3);
+
+  g_assert (_ide_diagnostics_lookup_line (diagnostics, 12, &begin, &end));
+  g_assert_cmpint (begin, ==, 2);
+  g_assert_cmpint (end, ==, 3);
+
+  g_assert (_ide_diagnostics_lookup_line (diagnostics, 30, &begin, &end));
+  g_assert_cmpint (begin, ==, 3);
+  g_assert_cmpint (end, ==, 5);
+
+  /* Lines without diagnostics result in an empty range */
+  g_assert (_ide_diagnostics_lookup_line (diagnostics, 0, &begin, &end));
+  g_assert_cmpint (begin, ==, end);
+  g_assert (_ide_diagnostics_lookup_line (diagnostics, 20, &begin, &end));
+  g_assert_cmpint (begin, ==, end);
+  g_assert (_ide_diagnostics_lookup_line (diagnostics, 100, &begin, &end));
+  g_assert_cmpint (begin, ==, end);
+
+  /* Sorted diagnostics are shared snapshots and must not change */
+  g_test_expect_message ("ide-diagnostics", G_LOG_LEVEL_CRITICAL, "*!self->sorted*");
+  ide_diagnostics_add (diagnostics, ide_diagnostics_index (diagnostics, 0));
+  g_test_assert_expected_messages ();
+  g_assert_cmpint (ide_diagnostics_get_size (diagnostics), ==, 6);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Ide/Diagnostics/lookup-line", test_diagnostics_lookup_line);
+  return g_test_run ();
+}
@@ -0,0 +1,225 @@
+/* test-ide-line-intervals.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+
+#include "buffers/ide-line-intervals.h"
+
+#define N_LINES 200
+
+/*
+ * A line at a time model of what IdeLineIntervals should contain, which
+ * we compare against after every operation.
+ */
+static guint model [N_LINES * 2];
+
+static void
+model_add (guint begin,
+           guint end,
+           guint value)
+{
+  guint i;
+
+  for (i = begin; i <= end; i++)
+    model [i] = MAX (model [i], value);
+}
+
+static void
+model_insert_lines (guint line,
+                    guint n_lines)
+{
+  guint i;
+
+  for (i = G_N_ELEMENTS (model) - 1; i >= line + n_lines; i--)
+    model [i] = model [i - n_lines];
+
+  /*
+   * New lines inside of an interval extend it. This only holds while the
+   * intervals do not overlap, which is the case until lines are removed.
+   */
+  for (i = line; i < line + n_lines; i++)
+    model [i] = (line > 0 && model [line - 1] == model [line + n_lines]) ? model [line - 1] : 0;
+}
+
+static void
+model_remove_lines (guint line,
+                    guint n_lines)
+{
+  guint i;
+
+  for (i = line; i < line + n_lines; i++)
+    model [line - 1] = MAX (model [line - 1], model [i]);
+
+  for (i = line; i + n_lines < G_N_ELEMENTS (model); i++)
+    model [i] = model [i + n_lines];
+
+  for (; i < G_N_ELEMENTS (model); i++)
+    model [i] = 0;
+}
+
+static void
+assert_matches_model (IdeLineIntervals *intervals)
+{
+  guint i;
+
+  for (i = 0; i < N_LINES; i++)
+    g_assert_cmpint (_ide_line_intervals_lookup (intervals, i), ==, model [i]);
+}
+
+static void
+test_line_intervals_basic (void)
+{
+  g_autoptr(IdeLineIntervals) intervals = _ide_line_intervals_new ();
+
+  _ide_line_intervals_add (intervals, 1, 10, 1);
+  _ide_line_intervals_add (intervals, 3, 4, 3);
+  _ide_line_intervals_add (intervals, 4, 12, 2);
+  _ide_line_intervals_add (intervals, 20, 20, 3);
+
+  g_assert_cmpint (_ide_line_intervals_get_size (intervals), ==, 4);
+
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 0), ==, 0);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 2), ==, 1);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 3), ==, 3);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 4), ==, 3);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 5), ==, 2);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 12), ==, 2);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 13), ==, 0);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 20), ==, 3);
+
+  /* Inserting before line 5 moves everything at or after it */
+  _ide_line_intervals_insert_lines (intervals, 5, 2);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 4), ==, 3);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 5), ==, 0);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 7), ==, 2);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 14), ==, 2);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 15), ==, 0);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 20), ==, 0);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 22), ==, 3);
+
+  /* Joining lines 4 through 22 collapses them onto line 3 */
+  _ide_line_intervals_remove_lines (intervals, 4, 19);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 2), ==, 1);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 3), ==, 3);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 4), ==, 0);
+
+  _ide_line_intervals_clear (intervals);
+  g_assert_cmpint (_ide_line_intervals_get_size (intervals), ==, 0);
+  g_assert_cmpint (_ide_line_intervals_lookup (intervals, 3), ==, 0);
+}
+
+static void
+count_lines (guint    begin_line,
+             guint    end_line,
+             guint    value,
+             gpointer user_data)
+{
+  guint *count = user_data;
+
+  g_assert_cmpint (begin_line, <=, end_line);
+
+  *count += end_line - begin_line + 1;
+}
+
+static void
+test_line_intervals_foreach (void)
+{
+  g_autoptr(IdeLineIntervals) intervals = _ide_line_intervals_new ();
+  guint count = 0;
+
+  _ide_line_intervals_add (intervals, 0, 9, 1);
+  _ide_line_intervals_add (intervals, 20, 29, 2);
+  _ide_line_intervals_add (intervals, 100, 100, 3);
+
+  /* Only the overlapping part of each run is visited */
+  _ide_line_intervals_foreach (intervals, 5, 24, count_lines, &count);
+  g_assert_cmpint (count, ==, 10);
+
+  count = 0;
+  _ide_line_intervals_foreach (intervals, 30, 99, count_lines, &count);
+  g_assert_cmpint (count, ==, 0);
+}
+
+/*
+ * Applies random edits and compares the result against the model. Inserting
+ * and removing lines are exercised separately because removing lines can
+ * leave two runs sharing a line, which the model does not track.
+ */
+static void
+run_random (gboolean remove_lines)
+{
+  g_autoptr(IdeLineIntervals) intervals = _ide_line_intervals_new ();
+  guint i;
+
+  memset (model, 0, sizeof model);
+
+  for (i = 0; i < 2000; i++)
+    {
+      guint line = g_random_int_range (1, N_LINES / 2);
+      guint n = g_random_int_range (1, 10);
+
+      if (g_random_boolean ())
+        {
+          _ide_line_intervals_add (intervals, line, line + n, i % 5 + 1);
+          model_add (line, line + n, i % 5 + 1);
+        }
+      else if (remove_lines)
+        {
+          _ide_line_intervals_remove_lines (intervals, line, n);
+          model_remove_lines (line, n);
+        }
+      else
+        {
+          _ide_line_intervals_insert_lines (intervals, line, n);
+          model_insert_lines (line, n);
+        }
+
+      /* Keep the lines within the model */
+      if (i % 50 == 0)
+        {
+          _ide_line_intervals_clear (intervals);
+          memset (model, 0, sizeof model);
+        }
+
+      assert_matches_model (intervals);
+    }
+}
+
+static void
+test_line_intervals_insert (void)
+{
+  run_random (FALSE);
+}
+
+static void
+test_line_intervals_remove (void)
+{
+  run_random (TRUE);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Ide/LineIntervals/basic", test_line_intervals_basic);
+  g_test_add_func ("/Ide/LineIntervals/foreach", test_line_intervals_foreach);
+  g_test_add_func ("/Ide/LineIntervals/insert", test_line_intervals_insert);
+  g_test_add_func ("/Ide/LineIntervals/remove", test_line_intervals_remove);
+  return g_test_run ();
+}
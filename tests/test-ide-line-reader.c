@@ -0,0 +1,241 @@
+/* test-ide-line-reader.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+#include <string.h>
+
+/*
+ * This is the byte at a time implementation IdeLineReader used to have,
+ * with the addition of stripping the \r of \r\n line endings.
+ */
+typedef struct
+{
+  const gchar *contents;
+  gsize        length;
+  gsize        pos;
+} ReferenceReader;
+
+static const gchar *
+reference_next (ReferenceReader *reader,
+                gsize           *length)
+{
+  const gchar *ret;
+
+  if (reader->pos >= reader->length)
+    {
+      *length = 0;
+      return NULL;
+    }
+
+  ret = &reader->contents [reader->pos];
+
+  for (; reader->pos < reader->length; reader->pos++)
+    {
+      if (reader->contents [reader->pos] == '\n')
+        {
+          *length = &reader->contents [reader->pos] - ret;
+          if (*length > 0 && ret [*length - 1] == '\r')
+            (*length)--;
+          reader->pos++;
+          return ret;
+        }
+    }
+
+  *length = &reader->contents [reader->pos] - ret;
+
+  return ret;
+}
+
+static void
+test_line_reader_basic (void)
+{
+  static const struct {
+    const gchar *input;
+    const gchar *lines [5];
+  } cases [] = {
+    { "", { NULL } },
+    { "\n", { "", NULL } },
+    { "a", { "a", NULL } },
+    { "a\nb", { "a", "b", NULL } },
+    { "a\nb\n", { "a", "b", NULL } },
+    { "a\r\nb\r\n", { "a", "b", NULL } },
+    { "a\rb\n\r\n", { "a\rb", "", NULL } },
+    { "\r", { "\r", NULL } },
+    { "\n\n\n", { "", "", "", NULL } },
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (cases); i++)
+    {
+      IdeLineReader reader;
+      const gchar *line;
+      gsize len;
+      guint j = 0;
+
+      ide_line_reader_init (&reader, (gchar *)cases [i].input, -1);
+
+      while ((line = ide_line_reader_next (&reader, &len)))
+        {
+          g_assert_nonnull (cases [i].lines [j]);
+          g_assert_cmpint (len, ==, strlen (cases [i].lines [j]));
+          g_assert (strncmp (line, cases [i].lines [j], len) == 0);
+          j++;
+        }
+
+      g_assert_null (cases [i].lines [j]);
+    }
+}
+
+static gchar *
+random_buffer (gsize *length)
+{
+  static const gchar alphabet[] = "ab\r\n";
+  gchar *buf;
+  gsize i;
+
+  *length = g_test_rand_int_range (0, 512);
+  buf = g_malloc (*length + 1);
+
+  for (i = 0; i < *length; i++)
+    buf [i] = alphabet [g_test_rand_int_range (0, 4)];
+  buf [*length] = 0;
+
+  return buf;
+}
+
+static void
+test_line_reader_fuzz (void)
+{
+  guint i;
+
+  for (i = 0; i < 10000; i++)
+    {
+      g_autofree gchar *buf = NULL;
+      ReferenceReader ref = { 0 };
+      IdeLineReader reader;
+      IdeLineReader spans_reader;
+      IdeLineSpan spans [16];
+      guint n_spans = 0;
+      guint span = 0;
+      gsize length;
+
+      buf = random_buffer (&length);
+
+      ref.contents = buf;
+      ref.length = length;
+
+      ide_line_reader_init (&reader, buf, length);
+      ide_line_reader_init (&spans_reader, buf, length);
+
+      for (;;)
+        {
+          const gchar *expected;
+          const gchar *line;
+          gsize expected_len;
+          gsize len;
+
+          expected = reference_next (&ref, &expected_len);
+          line = ide_line_reader_next (&reader, &len);
+
+          g_assert (line == expected);
+          g_assert_cmpint (len, ==, expected_len);
+
+          if (span == n_spans)
+            {
+              n_spans = ide_line_reader_next_spans (&spans_reader,
+                                                    spans,
+                                                    g_test_rand_int_range (1, G_N_ELEMENTS (spans)));
+              span = 0;
+            }
+
+          if (expected == NULL)
+            {
+              g_assert_cmpint (n_spans, ==, 0);
+              break;
+            }
+
+          g_assert_cmpint (span, <, n_spans);
+          g_assert (spans [span].line == expected);
+          g_assert_cmpint (spans [span].length, ==, expected_len);
+          span++;
+        }
+    }
+}
+
+static void
+test_line_reader_benchmark (void)
+{
+  g_autoptr(GString) str = NULL;
+  IdeLineReader reader;
+  ReferenceReader ref = { 0 };
+  IdeLineSpan spans [64];
+  const gchar *line;
+  gdouble elapsed;
+  gsize total = 0;
+  gsize len;
+  guint n;
+  guint i;
+
+  /* Something shaped like a ctags file, about 200 MB */
+  str = g_string_sized_new (200 * 1024 * 1024 + 256);
+  for (i = 0; str->len < 200 * 1024 * 1024; i++)
+    g_string_append_printf (str,
+                            "symbol_%u\tsrc/module-%u/file-%u.c\t/^static void symbol_%u (void)$/;\"\tf\n",
+                            i, i % 97, i % 1013, i);
+
+  g_test_timer_start ();
+  ref.contents = str->str;
+  ref.length = str->len;
+  while ((line = reference_next (&ref, &len)))
+    total += len;
+  elapsed = g_test_timer_elapsed ();
+  g_test_message ("byte at a time: %lf seconds", elapsed);
+
+  g_test_timer_start ();
+  ide_line_reader_init (&reader, str->str, str->len);
+  while ((line = ide_line_reader_next (&reader, &len)))
+    total -= len;
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "ide_line_reader_next: %lf seconds", elapsed);
+
+  g_assert_cmpint (total, ==, 0);
+
+  g_test_timer_start ();
+  ide_line_reader_init (&reader, str->str, str->len);
+  while ((n = ide_line_reader_next_spans (&reader, spans, G_N_ELEMENTS (spans))))
+    {
+      for (i = 0; i < n; i++)
+        total += spans [i].length;
+    }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "ide_line_reader_next_spans: %lf seconds", elapsed);
+
+  g_assert_cmpint (total, >, 0);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Ide/LineReader/basic", test_line_reader_basic);
+  g_test_add_func ("/Ide/LineReader/fuzz", test_line_reader_fuzz);
+  if (g_test_perf ())
+    g_test_add_func ("/Ide/LineReader/benchmark", test_line_reader_benchmark);
+  return g_test_run ();
+}
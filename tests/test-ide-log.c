@@ -0,0 +1,101 @@
+/* test-ide-log.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gstdio.h>
+#include <ide.h>
+#include <string.h>
+#include <unistd.h>
+
+#define N_THREADS  4
+#define N_MESSAGES 2000
+
+static volatile gint n_logged;
+
+static gpointer
+log_criticals (gpointer data)
+{
+  guint i;
+
+  for (i = 0; i < N_MESSAGES; i++)
+    {
+      g_log ("test-ide-log", G_LOG_LEVEL_CRITICAL, "critical %u", i);
+      g_atomic_int_inc (&n_logged);
+    }
+
+  return NULL;
+}
+
+/*
+ * Logs criticals from several threads while the writer thread is being
+ * shut down. None of them may be lost, and shutting down must not leave a
+ * thread waiting for the writer forever.
+ */
+static void
+test_log_shutdown_while_logging (void)
+{
+  g_autofree gchar *filename = NULL;
+  g_autofree gchar *contents = NULL;
+  GThread *threads [N_THREADS];
+  GError *error = NULL;
+  const gchar *pos;
+  guint n_criticals = 0;
+  guint i;
+  gint fd;
+
+  fd = g_file_open_tmp ("test-ide-log-XXXXXX", &filename, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (fd, !=, -1);
+  close (fd);
+
+  ide_log_init (FALSE, filename);
+
+  for (i = 0; i < N_THREADS; i++)
+    threads [i] = g_thread_new ("test-ide-log", log_criticals, NULL);
+
+  /* Shut down once every thread is well underway */
+  while (g_atomic_int_get (&n_logged) < N_THREADS * N_MESSAGES / 4)
+    g_thread_yield ();
+
+  ide_log_shutdown ();
+
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads [i]);
+
+  g_file_get_contents (filename, &contents, NULL, &error);
+  g_assert_no_error (error);
+
+  for (pos = contents; NULL != (pos = strstr (pos, "CRITICAL")); pos++)
+    n_criticals++;
+
+  g_assert_cmpint (n_criticals, ==, N_THREADS * N_MESSAGES);
+
+  g_unlink (filename);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  /* g_test_init() makes criticals fatal, but we log them on purpose */
+  g_log_set_always_fatal (G_LOG_FATAL_MASK);
+
+  g_test_add_func ("/Ide/Log/shutdown-while-logging", test_log_shutdown_while_logging);
+  return g_test_run ();
+}
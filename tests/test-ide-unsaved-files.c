@@ -0,0 +1,854 @@
+/* test-ide-unsaved-files.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "test-ide-unsaved-files"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <ide.h>
+#include <string.h>
+
+#include "application/ide-application-tests.h"
+
+#define N_FILES   500
+#define N_LOOKUPS 100
+
+/* Must match JOURNAL_COMPACT_MIN_RECORDS and JOURNAL_COMPACT_RATIO */
+#define N_COMPACT_FILES  20
+#define N_COMPACT_ROUNDS 5
+
+static gchar *tmp_dir;
+
+typedef struct
+{
+  IdeContext *context;
+  GPtrArray  *files;
+  guint       round;
+} DraftsState;
+
+static void
+drafts_state_free (gpointer data)
+{
+  DraftsState *state = data;
+
+  g_clear_object (&state->context);
+  g_clear_pointer (&state->files, g_ptr_array_unref);
+  g_slice_free (DraftsState, state);
+}
+
+static void
+remove_recursive (const gchar *path)
+{
+  GDir *dir;
+
+  if (NULL != (dir = g_dir_open (path, 0, NULL)))
+    {
+      const gchar *name;
+
+      while (NULL != (name = g_dir_read_name (dir)))
+        {
+          g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+          remove_recursive (child);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_remove (path);
+}
+
+/* Removes the drafts left behind by previous tests */
+static void
+reset_drafts (void)
+{
+  g_autofree gchar *path = NULL;
+
+  path = g_build_filename (g_get_user_data_dir (), ide_get_program_name (), "drafts", NULL);
+  remove_recursive (path);
+}
+
+static gchar *
+get_drafts_path (IdeContext  *context,
+                 const gchar *name)
+{
+  return g_build_filename (g_get_user_data_dir (),
+                           ide_get_program_name (),
+                           "drafts",
+                           ide_project_get_id (ide_context_get_project (context)),
+                           name,
+                           NULL);
+}
+
+/* Drafts are only restored for files that exist */
+static GPtrArray *
+create_real_files (const gchar *prefix,
+                   guint        n_files)
+{
+  GPtrArray *files;
+  guint i;
+
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (i = 0; i < n_files; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("%s-%u.c", prefix, i);
+      g_autofree gchar *path = g_build_filename (tmp_dir, name, NULL);
+      GError *error = NULL;
+
+      g_file_set_contents (path, "on disk\n", -1, &error);
+      g_assert_no_error (error);
+
+      g_ptr_array_add (files, g_file_new_for_path (path));
+    }
+
+  return files;
+}
+
+static gchar *
+draft_text (guint index,
+            guint round)
+{
+  return g_strdup_printf ("draft %u of %u\n", round, index);
+}
+
+static void
+update_draft (IdeUnsavedFiles *unsaved_files,
+              GFile           *file,
+              guint            index,
+              guint            round)
+{
+  gchar *text = draft_text (index, round);
+  g_autoptr(GBytes) bytes = g_bytes_new_take (text, strlen (text));
+
+  ide_unsaved_files_update (unsaved_files, file, bytes);
+}
+
+static gchar *
+add_record (GFile       *file,
+            const gchar *text)
+{
+  g_autofree gchar *checksum = NULL;
+  g_autofree gchar *uri = g_file_get_uri (file);
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, text, -1);
+
+  return g_strdup_printf ("+ %s %s", checksum, uri);
+}
+
+static gchar **
+read_journal (IdeContext *context)
+{
+  g_autofree gchar *path = get_drafts_path (context, "journal");
+  g_autofree gchar *contents = NULL;
+  GError *error = NULL;
+
+  g_file_get_contents (path, &contents, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (g_str_has_suffix (contents, "\n"));
+
+  contents [strlen (contents) - 1] = '\0';
+
+  return g_strsplit (contents, "\n", 0);
+}
+
+static guint
+count_objects (IdeContext *context)
+{
+  g_autofree gchar *path = get_drafts_path (context, "objects");
+  const gchar *name;
+  guint count = 0;
+  GDir *dir;
+
+  dir = g_dir_open (path, 0, NULL);
+  g_assert (dir != NULL);
+
+  while (NULL != (name = g_dir_read_name (dir)))
+    {
+      g_assert (!g_str_has_suffix (name, ".tmp"));
+      count++;
+    }
+
+  g_dir_close (dir);
+
+  return count;
+}
+
+static void
+assert_draft (IdeUnsavedFiles *unsaved_files,
+              GFile           *file,
+              const gchar     *expected)
+{
+  g_autoptr(IdeUnsavedFile) uf = NULL;
+  GBytes *content;
+
+  uf = ide_unsaved_files_get_unsaved_file (unsaved_files, file);
+  g_assert (uf != NULL);
+
+  content = ide_unsaved_file_get_content (uf);
+  g_assert_cmpint (g_bytes_get_size (content), ==, strlen (expected));
+  g_assert (memcmp (g_bytes_get_data (content, NULL), expected, strlen (expected)) == 0);
+}
+
+static GPtrArray *
+create_files (IdeContext *context)
+{
+  GFile *workdir;
+  GPtrArray *files;
+  guint i;
+
+  workdir = ide_vcs_get_working_directory (ide_context_get_vcs (context));
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (i = 0; i < N_FILES; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("unsaved-%u.c", i);
+
+      g_ptr_array_add (files, g_file_get_child (workdir, name));
+    }
+
+  return files;
+}
+
+static void
+update_all (IdeUnsavedFiles *unsaved_files,
+            GPtrArray       *files,
+            guint            generation)
+{
+  guint i;
+
+  for (i = 0; i < files->len; i++)
+    {
+      gchar *text = g_strdup_printf ("int file_%u_%u;\n", i, generation);
+      g_autoptr(GBytes) bytes = g_bytes_new_take (text, strlen (text));
+
+      ide_unsaved_files_update (unsaved_files, g_ptr_array_index (files, i), bytes);
+    }
+}
+
+static void
+test_unsaved_files_basic_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(IdeContext) context = NULL;
+  g_autoptr(GPtrArray) files = NULL;
+  g_autoptr(GPtrArray) ar = NULL;
+  IdeUnsavedFiles *unsaved_files;
+  GError *error = NULL;
+  gint64 sequence;
+  guint i;
+
+  context = ide_context_new_finish (result, &error);
+  g_assert_no_error (error);
+  g_assert (IDE_IS_CONTEXT (context));
+
+  unsaved_files = ide_context_get_unsaved_files (context);
+  files = create_files (context);
+
+  update_all (unsaved_files, files, 0);
+
+  ar = ide_unsaved_files_to_array (unsaved_files);
+  g_assert_cmpint (ar->len, ==, N_FILES);
+
+  for (i = 0; i < files->len; i++)
+    {
+      g_autoptr(IdeUnsavedFile) uf = NULL;
+      g_autofree gchar *expected = g_strdup_printf ("int file_%u_0;\n", i);
+      GBytes *content;
+
+      g_assert (ide_unsaved_files_contains (unsaved_files, g_ptr_array_index (files, i)));
+
+      uf = ide_unsaved_files_get_unsaved_file (unsaved_files, g_ptr_array_index (files, i));
+      g_assert (uf != NULL);
+
+      content = ide_unsaved_file_get_content (uf);
+      g_assert_cmpint (g_bytes_get_size (content), ==, strlen (expected));
+      g_assert (memcmp (g_bytes_get_data (content, NULL), expected, strlen (expected)) == 0);
+    }
+
+  /* Temporary files are only created on request, and are readable by path */
+  {
+    g_autoptr(IdeUnsavedFile) uf = NULL;
+    g_autoptr(IdeUnsavedFile) uf2 = NULL;
+    g_autofree gchar *contents = NULL;
+    const gchar *path;
+    const gchar *path2;
+    gsize len;
+
+    uf = ide_unsaved_files_get_unsaved_file (unsaved_files, g_ptr_array_index (files, 7));
+    g_assert (ide_unsaved_file_persist (uf, NULL, &error));
+    g_assert_no_error (error);
+
+    path = ide_unsaved_file_get_temp_path (uf);
+    g_assert (path != NULL);
+    g_assert (g_file_get_contents (path, &contents, &len, &error));
+    g_assert_no_error (error);
+    g_assert_cmpstr (contents, ==, "int file_7_0;\n");
+
+    /* Every IdeUnsavedFile for the same file shares the temporary file */
+    update_all (unsaved_files, files, 1);
+    uf2 = ide_unsaved_files_get_unsaved_file (unsaved_files, g_ptr_array_index (files, 7));
+    path2 = ide_unsaved_file_get_temp_path (uf2);
+    g_assert_cmpstr (path, ==, path2);
+
+    g_assert (ide_unsaved_file_persist (uf2, NULL, &error));
+    g_assert_no_error (error);
+    g_clear_pointer (&contents, g_free);
+    g_assert (g_file_get_contents (path2, &contents, &len, &error));
+    g_assert_no_error (error);
+    g_assert_cmpstr (contents, ==, "int file_7_1;\n");
+  }
+
+  sequence = ide_unsaved_files_get_sequence (unsaved_files);
+
+  for (i = 0; i < files->len; i++)
+    ide_unsaved_files_remove (unsaved_files, g_ptr_array_index (files, i));
+
+  g_assert_cmpint (ide_unsaved_files_get_sequence (unsaved_files), ==, sequence);
+
+  g_clear_pointer (&ar, g_ptr_array_unref);
+  ar = ide_unsaved_files_to_array (unsaved_files);
+  g_assert_cmpint (ar->len, ==, 0);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+test_unsaved_files_basic (GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  g_autoptr(GFile) project_file = NULL;
+  g_autofree gchar *path = NULL;
+  GTask *task;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  path = g_build_filename (TEST_DATA_DIR, "project1", "configure.ac", NULL);
+  project_file = g_file_new_for_path (path);
+  ide_context_new_async (project_file, cancellable, test_unsaved_files_basic_cb, task);
+}
+
+static void
+test_unsaved_files_benchmark_cb (GObject      *object,
+                                 GAsyncResult *result,
+                                 gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(IdeContext) context = NULL;
+  g_autoptr(GPtrArray) files = NULL;
+  IdeUnsavedFiles *unsaved_files;
+  GError *error = NULL;
+  gdouble elapsed;
+  GTimer *timer;
+  guint i;
+  guint j;
+
+  context = ide_context_new_finish (result, &error);
+  g_assert_no_error (error);
+
+  unsaved_files = ide_context_get_unsaved_files (context);
+  files = create_files (context);
+
+  timer = g_timer_new ();
+
+  update_all (unsaved_files, files, 0);
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_test_message ("Added %u unsaved files in %lf msec", N_FILES, elapsed * 1000.0);
+
+  g_timer_reset (timer);
+  for (j = 0; j < N_LOOKUPS; j++)
+    update_all (unsaved_files, files, j + 1);
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_test_message ("Updated %u unsaved files %u times in %lf msec",
+                  N_FILES, N_LOOKUPS, elapsed * 1000.0);
+
+  g_timer_reset (timer);
+  for (j = 0; j < N_LOOKUPS; j++)
+    {
+      for (i = 0; i < files->len; i++)
+        {
+          g_autoptr(IdeUnsavedFile) uf = NULL;
+
+          uf = ide_unsaved_files_get_unsaved_file (unsaved_files, g_ptr_array_index (files, i));
+          g_assert (uf != NULL);
+        }
+    }
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_test_minimized_result (elapsed * 1000.0 * 1000.0 / (N_FILES * N_LOOKUPS),
+                           "Looked up unsaved file in %lf usec",
+                           elapsed * 1000.0 * 1000.0 / (N_FILES * N_LOOKUPS));
+
+  g_timer_destroy (timer);
+
+  ide_unsaved_files_clear (unsaved_files);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+test_unsaved_files_benchmark (GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  g_autoptr(GFile) project_file = NULL;
+  g_autofree gchar *path = NULL;
+  GTask *task;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  path = g_build_filename (TEST_DATA_DIR, "project1", "configure.ac", NULL);
+  project_file = g_file_new_for_path (path);
+  ide_context_new_async (project_file, cancellable, test_unsaved_files_benchmark_cb, task);
+}
+
+static void
+test_unsaved_files_journal_restore_cb (GObject      *object,
+                                       GAsyncResult *result,
+                                       gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(IdeContext) context = NULL;
+  g_autoptr(IdeUnsavedFile) uf0 = NULL;
+  g_autoptr(IdeUnsavedFile) uf1 = NULL;
+  g_autofree gchar *text0 = draft_text (0, 1);
+  g_autofree gchar *text1 = draft_text (1, 0);
+  IdeUnsavedFiles *unsaved_files;
+  DraftsState *state;
+  GError *error = NULL;
+
+  context = ide_context_new_finish (result, &error);
+  g_assert_no_error (error);
+
+  state = g_task_get_task_data (task);
+
+  /* A new context for the project restores the drafts from the journal */
+  unsaved_files = ide_context_get_unsaved_files (context);
+  assert_draft (unsaved_files, g_ptr_array_index (state->files, 0), text0);
+  assert_draft (unsaved_files, g_ptr_array_index (state->files, 1), text1);
+  g_assert (!ide_unsaved_files_contains (unsaved_files, g_ptr_array_index (state->files, 2)));
+
+  /* The draft that was modified last is restored with the highest sequence */
+  uf0 = ide_unsaved_files_get_unsaved_file (unsaved_files, g_ptr_array_index (state->files, 0));
+  uf1 = ide_unsaved_files_get_unsaved_file (unsaved_files, g_ptr_array_index (state->files, 1));
+  g_assert_cmpint (ide_unsaved_file_get_sequence (uf0), >, ide_unsaved_file_get_sequence (uf1));
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+test_unsaved_files_journal_save2_cb (GObject      *object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data)
+{
+  IdeUnsavedFiles *unsaved_files = (IdeUnsavedFiles *)object;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GFile) project_file = NULL;
+  g_auto(GStrv) lines = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *text = draft_text (0, 1);
+  g_autofree gchar *removed = NULL;
+  g_autofree gchar *added = NULL;
+  g_autofree gchar *uri = NULL;
+  DraftsState *state;
+  GError *error = NULL;
+
+  ide_unsaved_files_save_finish (unsaved_files, result, &error);
+  g_assert_no_error (error);
+
+  state = g_task_get_task_data (task);
+
+  /* Only the changes are appended, an unmodified draft is not written again */
+  lines = read_journal (state->context);
+  g_assert_cmpint (g_strv_length (lines), ==, 5);
+
+  uri = g_file_get_uri (g_ptr_array_index (state->files, 2));
+  removed = g_strdup_printf ("- %s", uri);
+  g_assert_cmpstr (lines [3], ==, removed);
+
+  added = add_record (g_ptr_array_index (state->files, 0), text);
+  g_assert_cmpstr (lines [4], ==, added);
+
+  g_assert_cmpint (count_objects (state->context), ==, 4);
+
+  path = g_build_filename (TEST_DATA_DIR, "project1", "configure.ac", NULL);
+  project_file = g_file_new_for_path (path);
+  ide_context_new_async (project_file,
+                         g_task_get_cancellable (task),
+                         test_unsaved_files_journal_restore_cb,
+                         g_object_ref (task));
+}
+
+static void
+test_unsaved_files_journal_save1_cb (GObject      *object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data)
+{
+  IdeUnsavedFiles *unsaved_files = (IdeUnsavedFiles *)object;
+  g_autoptr(GTask) task = user_data;
+  g_auto(GStrv) lines = NULL;
+  DraftsState *state;
+  GError *error = NULL;
+  guint i;
+
+  ide_unsaved_files_save_finish (unsaved_files, result, &error);
+  g_assert_no_error (error);
+
+  state = g_task_get_task_data (task);
+
+  lines = read_journal (state->context);
+  g_assert_cmpint (g_strv_length (lines), ==, state->files->len);
+
+  for (i = 0; i < state->files->len; i++)
+    {
+      g_autofree gchar *text = draft_text (i, 0);
+      g_autofree gchar *record = add_record (g_ptr_array_index (state->files, i), text);
+
+      g_assert (g_strv_contains ((const gchar * const *)lines, record));
+    }
+
+  g_assert_cmpint (count_objects (state->context), ==, state->files->len);
+
+  update_draft (unsaved_files, g_ptr_array_index (state->files, 0), 0, 1);
+  ide_unsaved_files_remove (unsaved_files, g_ptr_array_index (state->files, 2));
+
+  ide_unsaved_files_save_async (unsaved_files,
+                                g_task_get_cancellable (task),
+                                test_unsaved_files_journal_save2_cb,
+                                g_object_ref (task));
+}
+
+static void
+test_unsaved_files_journal_cb (GObject      *object,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  IdeUnsavedFiles *unsaved_files;
+  DraftsState *state;
+  GError *error = NULL;
+  guint i;
+
+  state = g_slice_new0 (DraftsState);
+  state->context = ide_context_new_finish (result, &error);
+  state->files = create_real_files ("journal", 3);
+  g_task_set_task_data (task, state, drafts_state_free);
+
+  g_assert_no_error (error);
+
+  unsaved_files = ide_context_get_unsaved_files (state->context);
+
+  for (i = 0; i < state->files->len; i++)
+    update_draft (unsaved_files, g_ptr_array_index (state->files, i), i, 0);
+
+  ide_unsaved_files_save_async (unsaved_files,
+                                g_task_get_cancellable (task),
+                                test_unsaved_files_journal_save1_cb,
+                                g_object_ref (task));
+}
+
+static void
+test_unsaved_files_journal (GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+  g_autoptr(GFile) project_file = NULL;
+  g_autofree gchar *path = NULL;
+  GTask *task;
+
+  reset_drafts ();
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  path = g_build_filename (TEST_DATA_DIR, "project1", "configure.ac", NULL);
+  project_file = g_file_new_for_path (path);
+  ide_context_new_async (project_file, cancellable, test_unsaved_files_journal_cb, task);
+}
+
+static void
+test_unsaved_files_compact_save_cb (GObject      *object,
+                                    GAsyncResult *result,
+                                    gpointer      user_data)
+{
+  IdeUnsavedFiles *unsaved_files = (IdeUnsavedFiles *)object;
+  g_autoptr(GTask) task = user_data;
+  g_auto(GStrv) lines = NULL;
+  DraftsState *state;
+  GError *error = NULL;
+  guint i;
+
+  ide_unsaved_files_save_finish (unsaved_files, result, &error);
+  g_assert_no_error (error);
+
+  state = g_task_get_task_data (task);
+  lines = read_journal (state->context);
+
+  if (++state->round < N_COMPACT_ROUNDS)
+    {
+      /* Not enough stale records yet to compact */
+      g_assert_cmpint (g_strv_length (lines), ==, state->round * N_COMPACT_FILES);
+
+      for (i = 0; i < state->files->len; i++)
+        update_draft (unsaved_files, g_ptr_array_index (state->files, i), i, state->round);
+
+      ide_unsaved_files_save_async (unsaved_files,
+                                    g_task_get_cancellable (task),
+                                    test_unsaved_files_compact_save_cb,
+                                    g_object_ref (task));
+      return;
+    }
+
+  /* The journal was rewritten with only the latest drafts, and old objects removed */
+  g_assert_cmpint (g_strv_length (lines), ==, N_COMPACT_FILES);
+  g_assert_cmpint (count_objects (state->context), ==, N_COMPACT_FILES);
+
+  for (i = 0; i < state->files->len; i++)
+    {
+      g_autofree gchar *text = draft_text (i, state->round - 1);
+      g_autofree gchar *record = add_record (g_ptr_array_index (state->files, i), text);
+
+      g_assert (g_strv_contains ((const gchar * const *)lines, record));
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+test_unsaved_files_compact_cb (GObject      *object,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  IdeUnsavedFiles *unsaved_files;
+  DraftsState *state;
+  GError *error = NULL;
+  guint i;
+
+  state = g_slice_new0 (DraftsState);
+  state->context = ide_context_new_finish (result, &error);
+  state->files = create_real_files ("compact", N_COMPACT_FILES);
+  g_task_set_task_data (task, state, drafts_state_free);
+
+  g_assert_no_error (error);
+
+  unsaved_files = ide_context_get_unsaved_files (state->context);
+
+  for (i = 0; i < state->files->len; i++)
+    update_draft (unsaved_files, g_ptr_array_index (state->files, i), i, 0);
+
+  ide_unsaved_files_save_async (unsaved_files,
+                                g_task_get_cancellable (task),
+                                test_unsaved_files_compact_save_cb,
+                                g_object_ref (task));
+}
+
+static void
+test_unsaved_files_compact (GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+  g_autoptr(GFile) project_file = NULL;
+  g_autofree gchar *path = NULL;
+  GTask *task;
+
+  reset_drafts ();
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  path = g_build_filename (TEST_DATA_DIR, "project1", "configure.ac", NULL);
+  project_file = g_file_new_for_path (path);
+  ide_context_new_async (project_file, cancellable, test_unsaved_files_compact_cb, task);
+}
+
+static void
+test_unsaved_files_legacy_save_cb (GObject      *object,
+                                   GAsyncResult *result,
+                                   gpointer      user_data)
+{
+  IdeUnsavedFiles *unsaved_files = (IdeUnsavedFiles *)object;
+  g_autoptr(GTask) task = user_data;
+  g_autofree gchar *manifest_path = NULL;
+  g_auto(GStrv) lines = NULL;
+  DraftsState *state;
+  GError *error = NULL;
+  guint i;
+
+  ide_unsaved_files_save_finish (unsaved_files, result, &error);
+  g_assert_no_error (error);
+
+  state = g_task_get_task_data (task);
+
+  /* The drafts were moved into the journal and the old layout removed */
+  lines = read_journal (state->context);
+  g_assert_cmpint (g_strv_length (lines), ==, state->files->len);
+  g_assert_cmpint (count_objects (state->context), ==, state->files->len);
+
+  manifest_path = get_drafts_path (state->context, "manifest");
+  g_assert (!g_file_test (manifest_path, G_FILE_TEST_EXISTS));
+
+  for (i = 0; i < state->files->len; i++)
+    {
+      GFile *file = g_ptr_array_index (state->files, i);
+      g_autofree gchar *text = draft_text (i, 0);
+      g_autofree gchar *record = add_record (file, text);
+      g_autofree gchar *uri = g_file_get_uri (file);
+      g_autofree gchar *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+      g_autofree gchar *legacy_path = get_drafts_path (state->context, hash);
+
+      g_assert (g_strv_contains ((const gchar * const *)lines, record));
+      g_assert (!g_file_test (legacy_path, G_FILE_TEST_EXISTS));
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+test_unsaved_files_legacy_restore_cb (GObject      *object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  IdeUnsavedFiles *unsaved_files;
+  DraftsState *state;
+  GError *error = NULL;
+  guint i;
+
+  state = g_task_get_task_data (task);
+
+  g_clear_object (&state->context);
+  state->context = ide_context_new_finish (result, &error);
+  g_assert_no_error (error);
+
+  unsaved_files = ide_context_get_unsaved_files (state->context);
+
+  for (i = 0; i < state->files->len; i++)
+    {
+      g_autofree gchar *text = draft_text (i, 0);
+
+      assert_draft (unsaved_files, g_ptr_array_index (state->files, i), text);
+    }
+
+  ide_unsaved_files_save_async (unsaved_files,
+                                g_task_get_cancellable (task),
+                                test_unsaved_files_legacy_save_cb,
+                                g_object_ref (task));
+}
+
+static void
+test_unsaved_files_legacy_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GString) manifest = NULL;
+  g_autoptr(GFile) project_file = NULL;
+  g_autofree gchar *manifest_path = NULL;
+  g_autofree gchar *drafts_dir = NULL;
+  g_autofree gchar *path = NULL;
+  DraftsState *state;
+  GError *error = NULL;
+  guint i;
+
+  state = g_slice_new0 (DraftsState);
+  state->context = ide_context_new_finish (result, &error);
+  state->files = create_real_files ("legacy", 3);
+  g_task_set_task_data (task, state, drafts_state_free);
+
+  g_assert_no_error (error);
+
+  /* Write drafts the way older versions did, named by the sha1 of the uri */
+  drafts_dir = get_drafts_path (state->context, NULL);
+  g_assert_cmpint (g_mkdir_with_parents (drafts_dir, 0700), ==, 0);
+
+  manifest = g_string_new (NULL);
+
+  for (i = 0; i < state->files->len; i++)
+    {
+      g_autofree gchar *uri = g_file_get_uri (g_ptr_array_index (state->files, i));
+      g_autofree gchar *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+      g_autofree gchar *legacy_path = get_drafts_path (state->context, hash);
+      g_autofree gchar *text = draft_text (i, 0);
+
+      g_file_set_contents (legacy_path, text, -1, &error);
+      g_assert_no_error (error);
+
+      g_string_append_printf (manifest, "%s\n", uri);
+    }
+
+  manifest_path = get_drafts_path (state->context, "manifest");
+  g_file_set_contents (manifest_path, manifest->str, manifest->len, &error);
+  g_assert_no_error (error);
+
+  path = g_build_filename (TEST_DATA_DIR, "project1", "configure.ac", NULL);
+  project_file = g_file_new_for_path (path);
+  ide_context_new_async (project_file,
+                         g_task_get_cancellable (task),
+                         test_unsaved_files_legacy_restore_cb,
+                         g_object_ref (task));
+}
+
+static void
+test_unsaved_files_legacy (GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+  g_autoptr(GFile) project_file = NULL;
+  g_autofree gchar *path = NULL;
+  GTask *task;
+
+  reset_drafts ();
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  path = g_build_filename (TEST_DATA_DIR, "project1", "configure.ac", NULL);
+  project_file = g_file_new_for_path (path);
+  ide_context_new_async (project_file, cancellable, test_unsaved_files_legacy_cb, task);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  IdeApplication *app;
+  g_autofree gchar *data_dir = NULL;
+  GError *error = NULL;
+  gint ret;
+
+  /* Keep the drafts written by the tests out of the user's data directory */
+  tmp_dir = g_dir_make_tmp ("test-ide-unsaved-files-XXXXXX", &error);
+  g_assert_no_error (error);
+  data_dir = g_build_filename (tmp_dir, "data", NULL);
+  g_setenv ("XDG_DATA_HOME", data_dir, TRUE);
+
+  g_test_init (&argc, &argv, NULL);
+
+  ide_log_init (TRUE, NULL);
+  ide_log_set_verbosity (4);
+
+  app = ide_application_new ();
+  ide_application_add_test (app, "/Ide/UnsavedFiles/basic", test_unsaved_files_basic, NULL);
+  ide_application_add_test (app, "/Ide/UnsavedFiles/journal", test_unsaved_files_journal, NULL);
+  ide_application_add_test (app, "/Ide/UnsavedFiles/compact", test_unsaved_files_compact, NULL);
+  ide_application_add_test (app, "/Ide/UnsavedFiles/legacy", test_unsaved_files_legacy, NULL);
+  if (g_test_perf ())
+    ide_application_add_test (app, "/Ide/UnsavedFiles/benchmark", test_unsaved_files_benchmark, NULL);
+  ret = g_application_run (G_APPLICATION (app), argc, argv);
+  g_object_unref (app);
+
+  remove_recursive (tmp_dir);
+  g_free (tmp_dir);
+
+  return ret;
+}
@@ -23,6 +23,230 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#define TASK_CACHE_PREFIX "TaskCache/"
+
+typedef struct
+{
+  gint64 hits;
+  gint64 misses;
+  gint64 coalesced;
+  gint64 populate_usec;
+  gint64 evictions;
+  gint64 bytes;
+} CacheStats;
+
+typedef struct
+{
+  gchar  *category;
+  gchar  *name;
+  gint64  value;
+  gdouble rate;
+  guint   has_rate : 1;
+} Sample;
+
+typedef struct
+{
+  GPtrArray  *samples;
+  GHashTable *previous;
+  GHashTable *current;
+  gdouble     elapsed;
+} SampleState;
+
+typedef struct
+{
+  GString *str;
+  guint    count;
+} JsonState;
+
+static GHashTable *caches;
+static gchar **categories;
+static gdouble watch_interval;
+static gboolean json;
+
+static GOptionEntry entries[] = {
+  { "watch", 'w', 0, G_OPTION_ARG_DOUBLE, &watch_interval,
+    "Refresh every INTERVAL seconds, showing the rate of change", "INTERVAL" },
+  { "json", 'j', 0, G_OPTION_ARG_NONE, &json,
+    "Print line-delimited JSON snapshots", NULL },
+  { "category", 'c', 0, G_OPTION_ARG_STRING_ARRAY, &categories,
+    "Only show counters whose category matches GLOB", "GLOB" },
+  { NULL }
+};
+
+static gboolean
+category_matches (const gchar *category)
+{
+  guint i;
+
+  if (categories == NULL)
+    return TRUE;
+
+  for (i = 0; categories [i]; i++)
+    {
+      if (g_pattern_match_simple (categories [i], category))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+sample_free (gpointer data)
+{
+  Sample *sample = data;
+
+  g_free (sample->category);
+  g_free (sample->name);
+  g_slice_free (Sample, sample);
+}
+
+static gint
+sample_compare_rate (gconstpointer a,
+                     gconstpointer b)
+{
+  const Sample *sa = *(const Sample * const *)a;
+  const Sample *sb = *(const Sample * const *)b;
+  gdouble ra = ABS (sa->rate);
+  gdouble rb = ABS (sb->rate);
+  gint ret;
+
+  if (ra > rb)
+    return -1;
+  else if (ra < rb)
+    return 1;
+
+  if ((ret = g_strcmp0 (sa->category, sb->category)))
+    return ret;
+
+  return g_strcmp0 (sa->name, sb->name);
+}
+
+/*
+ * EggTaskCache registers its counters with a category of the form
+ * "TaskCache/<Metric>" and the name of the cache as the counter name,
+ * so collect those and display them grouped per cache.
+ */
+static gboolean
+collect_cache_counter (EggCounter *counter)
+{
+  CacheStats *stats;
+  const gchar *metric;
+  gint64 value;
+
+  if (!g_str_has_prefix (counter->category, TASK_CACHE_PREFIX))
+    return FALSE;
+
+  if (!(stats = g_hash_table_lookup (caches, counter->name)))
+    {
+      stats = g_new0 (CacheStats, 1);
+      g_hash_table_insert (caches, g_strdup (counter->name), stats);
+    }
+
+  metric = counter->category + strlen (TASK_CACHE_PREFIX);
+  value = egg_counter_get (counter);
+
+  if (g_str_equal (metric, "Hits"))
+    stats->hits = value;
+  else if (g_str_equal (metric, "Misses"))
+    stats->misses = value;
+  else if (g_str_equal (metric, "Coalesced"))
+    stats->coalesced = value;
+  else if (g_str_equal (metric, "Populate"))
+    stats->populate_usec = value;
+  else if (g_str_equal (metric, "Evictions"))
+    stats->evictions = value;
+  else if (g_str_equal (metric, "Bytes"))
+    stats->bytes = value;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar * const *)a, *(const gchar * const *)b);
+}
+
+static void
+print_caches (void)
+{
+  g_autofree const gchar **names = NULL;
+  guint n_names = 0;
+  guint i;
+
+  if (g_hash_table_size (caches) == 0)
+    return;
+
+  names = (const gchar **)g_hash_table_get_keys_as_array (caches, &n_names);
+  qsort (names, n_names, sizeof (gchar *), compare_names);
+
+  g_print ("\n");
+  g_print ("%-32s : %12s : %12s : %6s : %10s : %14s : %10s : %14s\n",
+           "           Task Cache", "Hits", "Misses", "Hit %", "Coalesced",
+           "Populate (ms)", "Evictions", "Bytes");
+  g_print ("-------------------------------- : "
+           "------------ : ------------ : ------ : ---------- : "
+           "-------------- : ---------- : --------------\n");
+
+  for (i = 0; i < n_names; i++)
+    {
+      CacheStats *stats = g_hash_table_lookup (caches, names [i]);
+      gint64 lookups = stats->hits + stats->misses;
+      gdouble hit_rate = lookups ? (100.0 * stats->hits / lookups) : 0.0;
+
+      g_print ("%-32s : %12"G_GINT64_FORMAT" : %12"G_GINT64_FORMAT" : %6.1f : "
+               "%10"G_GINT64_FORMAT" : %14.1f : %10"G_GINT64_FORMAT" : %14"G_GINT64_FORMAT"\n",
+               names [i],
+               stats->hits,
+               stats->misses,
+               hit_rate,
+               stats->coalesced,
+               stats->populate_usec / 1000.0,
+               stats->evictions,
+               stats->bytes);
+    }
+}
+
+static void
+histogram_cb (const gchar  *category,
+              const gchar  *name,
+              const gint64 *buckets,
+              gint64        sum,
+              gpointer      user_data)
+{
+  guint *n_histograms = user_data;
+  gint64 count = 0;
+  guint i;
+
+  if (!category_matches (category))
+    return;
+
+  for (i = 0; i < EGG_HISTOGRAM_N_BUCKETS; i++)
+    count += buckets [i];
+
+  if ((*n_histograms)++ == 0)
+    {
+      g_print ("\n");
+      g_print ("%-20s : %-23s : %10s : %10s : %10s : %10s : %10s\n",
+               "      Category", "      Histogram", "Count", "Mean", "p50", "p90", "p99");
+      g_print ("-------------------- : ----------------------- : "
+               "---------- : ---------- : ---------- : ---------- : ----------\n");
+    }
+
+  g_print ("%-20s : %-23s : %10"G_GINT64_FORMAT" : %10"G_GINT64_FORMAT" : "
+           "%10"G_GINT64_FORMAT" : %10"G_GINT64_FORMAT" : %10"G_GINT64_FORMAT"\n",
+           category,
+           name,
+           count,
+           count ? sum / count : 0,
+           egg_histogram_percentile (buckets, 50),
+           egg_histogram_percentile (buckets, 90),
+           egg_histogram_percentile (buckets, 99));
+}
+
 static void
 foreach_cb (EggCounter *counter,
             gpointer    user_data)
@@ -31,6 +255,12 @@ foreach_cb (EggCounter *counter,
 
   (*n_counters)++;
 
+  if (!category_matches (counter->category))
+    return;
+
+  if (collect_cache_counter (counter) || egg_counter_is_histogram (counter))
+    return;
+
   g_print ("%-20s : %-32s : %20"G_GINT64_FORMAT" : %-s\n",
            counter->category,
            counter->name,
@@ -62,17 +292,283 @@ int_parse_with_range (gint        *value,
   return TRUE;
 }
 
+/*
+ * Samples are taken with egg_counter_get(), which only sums the per-cpu
+ * cells of the mapped (read-only) segment. No locks are taken and the
+ * observed process is never signalled, so watching it does not perturb
+ * the process being measured.
+ */
+static void
+sample_cb (EggCounter *counter,
+           gpointer    user_data)
+{
+  SampleState *state = user_data;
+  Sample *sample;
+  gint64 *value;
+  gchar *key;
+
+  if (!category_matches (counter->category) || egg_counter_is_histogram (counter))
+    return;
+
+  sample = g_slice_new0 (Sample);
+  sample->category = g_strdup (counter->category);
+  sample->name = g_strdup (counter->name);
+  sample->value = egg_counter_get (counter);
+
+  key = g_strdup_printf ("%s\x1f%s", counter->category, counter->name);
+
+  if (state->previous != NULL &&
+      state->elapsed > 0.0 &&
+      NULL != (value = g_hash_table_lookup (state->previous, key)))
+    {
+      sample->rate = (sample->value - *value) / state->elapsed;
+      sample->has_rate = TRUE;
+    }
+
+  value = g_new (gint64, 1);
+  *value = sample->value;
+  g_hash_table_insert (state->current, key, value);
+
+  g_ptr_array_add (state->samples, sample);
+}
+
+static GPtrArray *
+take_samples (EggCounterArena *arena,
+              GHashTable      *previous,
+              GHashTable      *current,
+              gdouble          elapsed)
+{
+  SampleState state;
+
+  state.samples = g_ptr_array_new_with_free_func (sample_free);
+  state.previous = previous;
+  state.current = current;
+  state.elapsed = elapsed;
+
+  egg_counter_arena_foreach (arena, sample_cb, &state);
+
+  g_ptr_array_sort (state.samples, sample_compare_rate);
+
+  return state.samples;
+}
+
+static void
+append_json_string (GString     *str,
+                    const gchar *value)
+{
+  const gchar *iter;
+
+  g_string_append_c (str, '"');
+
+  for (iter = value; *iter; iter++)
+    {
+      guchar ch = *iter;
+
+      if (ch == '"' || ch == '\\')
+        {
+          g_string_append_c (str, '\\');
+          g_string_append_c (str, ch);
+        }
+      else if (ch < 0x20)
+        g_string_append_printf (str, "\\u%04x", ch);
+      else
+        g_string_append_c (str, ch);
+    }
+
+  g_string_append_c (str, '"');
+}
+
+static void
+json_histogram_cb (const gchar  *category,
+                   const gchar  *name,
+                   const gint64 *buckets,
+                   gint64        sum,
+                   gpointer      user_data)
+{
+  JsonState *state = user_data;
+  gint64 count = 0;
+  guint i;
+
+  if (!category_matches (category))
+    return;
+
+  for (i = 0; i < EGG_HISTOGRAM_N_BUCKETS; i++)
+    count += buckets [i];
+
+  if (state->count++ > 0)
+    g_string_append_c (state->str, ',');
+
+  g_string_append (state->str, "{\"category\":");
+  append_json_string (state->str, category);
+  g_string_append (state->str, ",\"name\":");
+  append_json_string (state->str, name);
+  g_string_append_printf (state->str,
+                          ",\"count\":%"G_GINT64_FORMAT
+                          ",\"sum\":%"G_GINT64_FORMAT
+                          ",\"p50\":%"G_GINT64_FORMAT
+                          ",\"p90\":%"G_GINT64_FORMAT
+                          ",\"p99\":%"G_GINT64_FORMAT"}",
+                          count,
+                          sum,
+                          egg_histogram_percentile (buckets, 50),
+                          egg_histogram_percentile (buckets, 90),
+                          egg_histogram_percentile (buckets, 99));
+}
+
+/*
+ * Prints a single snapshot as one line of JSON so that the output can be
+ * piped into a monitoring agent. "rate" is per-second and null until a
+ * previous sample is available.
+ */
+static void
+print_json (gint             pid,
+            EggCounterArena *arena,
+            GPtrArray       *samples)
+{
+  g_autoptr(GString) str = NULL;
+  JsonState state;
+  guint i;
+
+  str = g_string_new (NULL);
+
+  g_string_append_printf (str, "{\"time\":%"G_GINT64_FORMAT",\"pid\":%d,\"counters\":[",
+                          g_get_real_time (), pid);
+
+  for (i = 0; i < samples->len; i++)
+    {
+      Sample *sample = g_ptr_array_index (samples, i);
+
+      if (i > 0)
+        g_string_append_c (str, ',');
+
+      g_string_append (str, "{\"category\":");
+      append_json_string (str, sample->category);
+      g_string_append (str, ",\"name\":");
+      append_json_string (str, sample->name);
+      g_string_append_printf (str, ",\"value\":%"G_GINT64_FORMAT",\"rate\":", sample->value);
+
+      if (sample->has_rate)
+        {
+          gchar buf [G_ASCII_DTOSTR_BUF_SIZE];
+
+          g_string_append (str, g_ascii_formatd (buf, sizeof buf, "%.3f", sample->rate));
+        }
+      else
+        g_string_append (str, "null");
+
+      g_string_append_c (str, '}');
+    }
+
+  g_string_append (str, "],\"histograms\":[");
+
+  state.str = str;
+  state.count = 0;
+  egg_counter_arena_foreach_histogram (arena, json_histogram_cb, &state);
+
+  g_string_append (str, "]}\n");
+
+  fwrite (str->str, 1, str->len, stdout);
+  fflush (stdout);
+}
+
+static void
+print_watch (gint       pid,
+             GPtrArray *samples)
+{
+  guint i;
+
+  /* Home the cursor and clear the screen, like top(1) */
+  g_print ("\033[H\033[2J");
+  g_print ("Counters for process %d, every %.1lf seconds. Press Ctrl+C to exit.\n\n",
+           pid, watch_interval);
+  g_print ("%-20s : %-32s : %20s : %14s\n",
+           "      Category", "             Name", "Value", "Rate (/sec)");
+  g_print ("-------------------- : "
+           "-------------------------------- : "
+           "-------------------- : "
+           "--------------\n");
+
+  for (i = 0; i < samples->len; i++)
+    {
+      Sample *sample = g_ptr_array_index (samples, i);
+
+      if (sample->has_rate)
+        g_print ("%-20s : %-32s : %20"G_GINT64_FORMAT" : %14.1lf\n",
+                 sample->category, sample->name, sample->value, sample->rate);
+      else
+        g_print ("%-20s : %-32s : %20"G_GINT64_FORMAT" : %14s\n",
+                 sample->category, sample->name, sample->value, "-");
+    }
+}
+
+static gint
+watch (gint             pid,
+       EggCounterArena *arena)
+{
+  g_autoptr(GHashTable) previous = NULL;
+  gint64 last_time = 0;
+
+  for (;;)
+    {
+      g_autoptr(GPtrArray) samples = NULL;
+      GHashTable *current;
+      gint64 now;
+
+      now = g_get_monotonic_time ();
+      current = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      samples = take_samples (arena, previous, current,
+                              (now - last_time) / (gdouble)G_USEC_PER_SEC);
+
+      g_clear_pointer (&previous, g_hash_table_unref);
+      previous = current;
+      last_time = now;
+
+      if (json)
+        print_json (pid, arena, samples);
+      else
+        print_watch (pid, samples);
+
+      egg_counter_arena_unref (arena);
+
+      g_usleep (watch_interval * G_USEC_PER_SEC);
+
+      /*
+       * Re-open the arena every tick so that counters registered since
+       * the last one (such as those of a newly created task cache) show up.
+       */
+      if (!(arena = egg_counter_arena_new_for_pid (pid)))
+        {
+          fprintf (stderr, "Process %d is no longer available.\n", pid);
+          return EXIT_SUCCESS;
+        }
+    }
+
+  g_assert_not_reached ();
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
 {
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
   EggCounterArena *arena;
   guint n_counters = 0;
+  guint n_histograms = 0;
   gint pid;
 
+  context = g_option_context_new ("PID - list the counters of a running process");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
   if (argc != 2)
     {
-      fprintf (stderr, "usage: %s <pid>\n", argv [0]);
+      fprintf (stderr, "usage: %s [OPTION...] <pid>\n", argv [0]);
       return EXIT_FAILURE;
     }
 
@@ -81,11 +577,18 @@ main (gint   argc,
 
   if (!int_parse_with_range (&pid, 1, G_MAXUSHORT, argv [1]))
     {
-      fprintf (stderr, "usage: %s <pid>\n", argv [0]);
+      fprintf (stderr, "usage: %s [OPTION...] <pid>\n", argv [0]);
+      return EXIT_FAILURE;
+    }
+
+  if (watch_interval < 0.0)
+    {
+      fprintf (stderr, "Watch interval must be a positive number of seconds.\n");
       return EXIT_FAILURE;
     }
 
   arena = egg_counter_arena_new_for_pid (pid);
+  caches = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
   if (!arena)
     {
@@ -93,6 +596,22 @@ main (gint   argc,
       return EXIT_FAILURE;
     }
 
+  if (watch_interval > 0.0)
+    return watch (pid, arena);
+
+  if (json)
+    {
+      g_autoptr(GHashTable) current = NULL;
+      g_autoptr(GPtrArray) samples = NULL;
+
+      current = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      samples = take_samples (arena, NULL, current, 0.0);
+      print_json (pid, arena, samples);
+      egg_counter_arena_unref (arena);
+
+      return EXIT_SUCCESS;
+    }
+
   g_print ("%-20s : %-32s : %20s : %-72s\n",
            "      Category",
            "             Name", "Value", "Description");
@@ -105,7 +624,11 @@ main (gint   argc,
            "-------------------------------- : "
            "-------------------- : "
            "------------------------------------------------------------------------\n");
+  print_caches ();
+  egg_counter_arena_foreach_histogram (arena, histogram_cb, &n_histograms);
   g_print ("Discovered %u counters\n", n_counters);
 
+  egg_counter_arena_unref (arena);
+
   return EXIT_SUCCESS;
 }